@@ -4,6 +4,23 @@ SOURCES += \
     $$PWD/src/qdropbox2file.cpp \
     $$PWD/src/qdropbox2folder.cpp \
     $$PWD/src/qdropbox2entityinfo.cpp \
+    $$PWD/src/qdropbox2json.cpp \
+    $$PWD/src/qdropbox2contentcache.cpp \
+    $$PWD/src/qdropbox2metadatacache.cpp \
+    $$PWD/src/qdropbox2linkcache.cpp \
+    $$PWD/src/qdropbox2engine.cpp \
+    $$PWD/src/qdropbox2metrics.cpp \
+    $$PWD/src/qdropbox2tracer.cpp \
+    $$PWD/src/qdropbox2chunkedbuffer.cpp \
+    $$PWD/src/qdropbox2upload.cpp \
+    $$PWD/src/qdropbox2chunkcontroller.cpp \
+    $$PWD/src/qdropbox2transfermanager.cpp \
+    $$PWD/src/qdropbox2sync.cpp \
+    $$PWD/src/qdropbox2mirror.cpp \
+    $$PWD/src/qdropbox2snapshot.cpp \
+    $$PWD/src/qdropbox2pathtable.cpp \
+    $$PWD/src/qdropbox2zipreader.cpp \
+    $$PWD/src/qdropbox2thumbnails.cpp \
 
 HEADERS += \
     $$PWD/src/qdropbox2global.h \
@@ -14,3 +31,21 @@ HEADERS += \
     $$PWD/src/qdropbox2folder.h \
     $$PWD/src/qdropbox2entity.h \
     $$PWD/src/qdropbox2entityinfo.h \
+    $$PWD/src/qdropbox2json.h \
+    $$PWD/src/qdropbox2contentcache.h \
+    $$PWD/src/qdropbox2entry.h \
+    $$PWD/src/qdropbox2metadatacache.h \
+    $$PWD/src/qdropbox2linkcache.h \
+    $$PWD/src/qdropbox2engine.h \
+    $$PWD/src/qdropbox2metrics.h \
+    $$PWD/src/qdropbox2tracer.h \
+    $$PWD/src/qdropbox2chunkedbuffer.h \
+    $$PWD/src/qdropbox2upload.h \
+    $$PWD/src/qdropbox2chunkcontroller.h \
+    $$PWD/src/qdropbox2transfermanager.h \
+    $$PWD/src/qdropbox2sync.h \
+    $$PWD/src/qdropbox2mirror.h \
+    $$PWD/src/qdropbox2snapshot.h \
+    $$PWD/src/qdropbox2pathtable.h \
+    $$PWD/src/qdropbox2zipreader.h \
+    $$PWD/src/qdropbox2thumbnails.h \
@@ -1,10 +1,22 @@
+#include <QDir>
+
 #include "qdropbox2.h"
+#include "qdropbox2contentcache.h"
+#include "qdropbox2metadatacache.h"
+#include "qdropbox2linkcache.h"
+#include "qdropbox2engine.h"
+#include "qdropbox2metrics.h"
+#include "qdropbox2tracer.h"
+#include "qdropbox2folder.h"
+#include "qdropbox2json.h"
 
 QDropbox2::QDropbox2(QObject *parent)
     : QObject(parent),
-      QNAM(this),
-      lastErrorCode(QDropbox2::NoError),
-      eventLoop(nullptr)
+      _contentCache(nullptr),
+      _metadataCache(new QDropbox2MetadataCache()),
+      _linkCache(new QDropbox2LinkCache()),
+      _engine(nullptr),
+      _tracer(nullptr)
 {
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "creating dropbox api" << endl;
@@ -15,11 +27,13 @@ QDropbox2::QDropbox2(QObject *parent)
 
 QDropbox2::QDropbox2(const QString& app_key, const QString& app_secret, QObject *parent, OAuthMethod method, QString url)
     : QObject(parent),
-      QNAM(this),
       appKey(app_key),
       appSecret(app_secret),
-      lastErrorCode(QDropbox2::NoError),
-      eventLoop(nullptr)
+      _contentCache(nullptr),
+      _metadataCache(new QDropbox2MetadataCache()),
+      _linkCache(new QDropbox2LinkCache()),
+      _engine(nullptr),
+      _tracer(nullptr)
 {
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "creating api with access token and method" << endl;
@@ -30,10 +44,13 @@ QDropbox2::QDropbox2(const QString& app_key, const QString& app_secret, QObject
 
 QDropbox2::QDropbox2(const QString& token, QObject *parent, OAuthMethod method, const QString& url)
     : QObject(parent),
-      QNAM(this),
       accessToken_(token),
-      lastErrorCode(QDropbox2::NoError),
-      eventLoop(nullptr)
+      bearerHeader(QString("Bearer %1").arg(token).toUtf8()),
+      _contentCache(nullptr),
+      _metadataCache(new QDropbox2MetadataCache()),
+      _linkCache(new QDropbox2LinkCache()),
+      _engine(nullptr),
+      _tracer(nullptr)
 {
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "creating api with access token and method" << endl;
@@ -42,34 +59,138 @@ QDropbox2::QDropbox2(const QString& token, QObject *parent, OAuthMethod method,
     init(url, method);
 }
 
+QThreadStorage<QDropbox2::ThreadTransports*> QDropbox2::threadTransports;
+QAtomicInt QDropbox2::nextTransportKey;
+QMutex QDropbox2::transportsMutex;
+
+QDropbox2::~QDropbox2()
+{
+    qDeleteAll(watchers);
+    delete _contentCache;
+    delete _metadataCache;
+    delete _linkCache;
+    delete _engine;
+    delete _tracer;
+
+    // the transports of other threads, and the objects they own, belong to
+    // those threads: they are orphaned here, and released there when the
+    // thread exits or next creates a transport (see transport())
+    QMutexLocker lock(&transportsMutex);
+    foreach(Transport* t, allTransports)
+        t->owner = nullptr;
+    allTransports.clear();
+    lock.unlock();
+
+    if(threadTransports.hasLocalData())
+        delete threadTransports.localData()->byOwner.take(transportKey);
+}
+
+QDropbox2::Transport::Transport(QDropbox2* owner)
+    : owner(owner),
+      QNAM(nullptr),
+      eventLoop(nullptr),
+      lastErrorCode(QDropbox2::NoError),
+      pendingLinks(0),
+      prefetchedLinks(0)
+{
+}
+
+QDropbox2::Transport::~Transport()
+{
+    QMutexLocker lock(&transportsMutex);
+    if(owner)
+        owner->allTransports.removeOne(this);
+    lock.unlock();
+
+    delete eventLoop;
+    delete QNAM;
+}
+
+QDropbox2::ThreadTransports::~ThreadTransports()
+{
+    qDeleteAll(byOwner);
+}
+
+QDropbox2::Transport& QDropbox2::transport()
+{
+    if(!threadTransports.hasLocalData())
+        threadTransports.setLocalData(new ThreadTransports());
+    QHash<int, Transport*>& byOwner = threadTransports.localData()->byOwner;
+
+    Transport* t = byOwner.value(transportKey);
+    if(!t)
+    {
+        // first time on this thread; also release what objects destroyed since
+        // then have left behind here
+        QList<Transport*> orphans;
+        QMutexLocker lock(&transportsMutex);
+        for(QHash<int, Transport*>::iterator i = byOwner.begin(); i != byOwner.end();)
+        {
+            if(i.value()->owner)
+                ++i;
+            else
+            {
+                orphans.append(i.value());
+                i = byOwner.erase(i);
+            }
+        }
+
+        t = new Transport(this);
+        allTransports.append(t);
+        lock.unlock();
+
+        qDeleteAll(orphans);
+        byOwner.insert(transportKey, t);
+    }
+    return *t;
+}
+
+QNetworkAccessManager* QDropbox2::networkAccessManager()
+{
+    Transport& t = transport();
+    if(!t.QNAM)
+    {
+        // created on, and owned by, the calling thread; the direct connection
+        // runs the completion handling on that thread too, where its transport
+        // state lives, instead of on the thread that owns this object
+        t.QNAM = new QNetworkAccessManager();
+        connect(t.QNAM, &QNetworkAccessManager::finished,
+                this, &QDropbox2::slot_networkRequestFinished,
+                Qt::DirectConnection);
+    }
+    return t.QNAM;
+}
+
 void QDropbox2::init(const QString& api_url, QDropbox2::OAuthMethod oauth_method)
 {
+    transportKey = nextTransportKey.fetchAndAddRelaxed(1);
+
     setApiUrl(api_url);
     setAuthMethod(oauth_method);
 
-    connect(&QNAM, &QNetworkAccessManager::finished, this, &QDropbox2::slot_networkRequestFinished);
-
-    if(accessToken_.isEmpty() && !appKey.isEmpty() && !appSecret.isEmpty())
+    if(accessToken().isEmpty() && !appKey.isEmpty() && !appSecret.isEmpty())
     {
         // we need to request a temporary access token
-        tokenFromKeyAndSecret();  // this will set lastErrorCode on error
+        tokenFromKeyAndSecret();  // this will set the error state on error
     }
 }
 
 QDropbox2::Error QDropbox2::error()
 {
-    return (QDropbox2::Error)lastErrorCode;
+    return (QDropbox2::Error)transport().lastErrorCode;
 }
 
 QString QDropbox2::errorString()
 {
-    return lastErrorMessage;
+    return transport().lastErrorMessage;
 }
 
 void QDropbox2::clearError()
 {
-    lastErrorCode = (int)QDropbox2::NoError;
-    lastErrorMessage.clear();
+    Transport& t = transport();
+
+    t.lastErrorCode = (int)QDropbox2::NoError;
+    t.lastErrorMessage.clear();
 }
 
 void QDropbox2::setApiUrl(const QString& url)
@@ -83,6 +204,12 @@ QString QDropbox2::apiUrl()
     return apiurl.toString();
 }
 
+void QDropbox2::setServerOverride(const QUrl& server)
+{
+    QWriteLocker locker(&tokenLock);
+    serverOverride = server;
+}
+
 void QDropbox2::setAuthMethod(OAuthMethod method)
 {
     oauthMethod = method;
@@ -97,54 +224,54 @@ QDropbox2::OAuthMethod QDropbox2::authMethod()
 
 void QDropbox2::slot_networkRequestFinished(QNetworkReply *reply)
 {
+    Transport& t = transport();
+
     reply->deleteLater();
 
-    QByteArray buff = reply->readAll();
-    lastResponse = QString(buff);
+    t.lastResponse = reply->readAll();
 
 #ifdef QTDROPBOX_DEBUG
     //qDebug() << "request " << nr << "finished." << endl;
     qDebug() << "request was: " << reply->url().toString() << endl;
     qDebug() << "response: " << reply->bytesAvailable() << "bytes" << endl;
     qDebug() << "status code: " << reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toString() << endl;
-    qDebug() << "== begin response ==" << endl << lastResponse << endl << "== end response ==" << endl;
+    qDebug() << "== begin response ==" << endl << t.lastResponse << endl << "== end response ==" << endl;
     qDebug() << "req#" << nr << " is of type " << requestMap[nr].type << endl;
 #endif
 
-    lastErrorCode = reply->error();
-    if(replyMap.contains(reply))
+    t.lastErrorCode = reply->error();
+    if(t.replyMap.contains(reply))
     {
-        CallbackPtr async_data(replyMap[reply]);
+        CallbackPtr async_data(t.replyMap[reply]);
         if(async_data->callback)
             (this->*async_data->callback)(reply, async_data);
-        replyMap.remove(reply);
+        t.replyMap.remove(reply);
     }
     else
     {
-        if(lastErrorCode != QNetworkReply::NoError)
+        if(t.lastErrorCode != QNetworkReply::NoError)
         {
 #ifdef QTDROPBOX_DEBUG
             // debug information only - this should not happen, but if it does we 
             // ignore replies when not waiting for anything
 #endif
-            lastErrorMessage = reply->errorString();
+            t.lastErrorMessage = reply->errorString();
 
-            if(lastErrorCode == QDROPBOX_V2_ERROR)
+            if(t.lastErrorCode == QDROPBOX_V2_ERROR)
             {
                 QJsonParseError jsonError;
-                QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+                QJsonDocument json = QJsonDocument::fromJson(t.lastResponse, &jsonError);
                 if(jsonError.error == QJsonParseError::NoError)
                 {
-                    cachedJson = json;
                     QJsonObject object = json.object();
                     if(object.contains("user_message"))
-                        lastErrorMessage = object.value("user_message").toString();
+                        t.lastErrorMessage = object.value("user_message").toString();
                     else if(object.contains("error_summary"))
-                        lastErrorMessage = object.value("error_summary").toString();
+                        t.lastErrorMessage = object.value("error_summary").toString();
                 }
             }
 
-            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
         }
 
         stopEventLoop();
@@ -161,41 +288,283 @@ void QDropbox2::prepareApiUrl()
 
 bool QDropbox2::createAPIv2Reqeust(QUrl request, QNetworkRequest& req, bool include_bearer)
 {
+    Transport& t = transport();
+
     bool result = false;
+
+    QReadLocker locker(&tokenLock);
     if(accessToken_.isEmpty() && include_bearer)
     {
-        lastErrorCode = (int)QDropbox2::APIError;
-        lastErrorMessage = "The authorizing access token has not been set.";
+        locker.unlock();
+
+        t.lastErrorCode = (int)QDropbox2::APIError;
+        t.lastErrorMessage = "The authorizing access token has not been set.";
 #ifdef QTDROPBOX_DEBUG
-        qDebug() << "error " << lastErrorCode << "(" << lastErrorMessage << ") in createAPIv2Reqeust()" << endl;
+        qDebug() << "error " << t.lastErrorCode << "(" << t.lastErrorMessage << ") in createAPIv2Reqeust()" << endl;
 #endif
-        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
     }
     else
     {
         QString req_str = request.toString(QUrl::RemoveAuthority|QUrl::RemoveScheme);
         Q_ASSERT(req_str.startsWith("/"));
 
-        req.setUrl(request);
-        if(include_bearer)
+        if(serverOverride.isValid())
         {
-            QString bearer = QString("Bearer %1").arg(accessToken_);
-            req.setRawHeader("Authorization", bearer.toUtf8());
+            request.setScheme(serverOverride.scheme());
+            request.setHost(serverOverride.host());
+            request.setPort(serverOverride.port());
         }
 
+        req.setUrl(request);
+        if(include_bearer)
+            req.setRawHeader("Authorization", bearerHeader);
+
         result = true;
     }
 
     return result;
 }
 
+bool QDropbox2::enableContentCache(const QString& directory, qint64 max_bytes, int ttl)
+{
+    Transport& t = transport();
+
+    disableContentCache();
+
+    if(!QDir().mkpath(directory))
+    {
+        t.lastErrorCode = (int)QDropbox2::APIError;
+        t.lastErrorMessage = QString("The content cache directory \"%1\" could not be created.").arg(directory);
+        emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
+        return false;
+    }
+
+    _contentCache = new QDropbox2ContentCache(directory, max_bytes, ttl);
+    return true;
+}
+
+void QDropbox2::disableContentCache()
+{
+    delete _contentCache;
+    _contentCache = nullptr;
+}
+
+void QDropbox2::setMetadataCacheLimits(int max_entries, qint64 max_bytes)
+{
+    _metadataCache->setLimits(max_entries, max_bytes);
+}
+
+bool QDropbox2::watchMetadata(const QString& folder)
+{
+    Transport& t = transport();
+
+    QString key = folder.toLower();
+    if(watchers.contains(key))
+        return true;
+
+    // the watcher establishes its cursor on construction; entries may only
+    // be cached once the cursor exists, or changes made in between would
+    // never be reported
+    QDropbox2Folder* watcher = new QDropbox2Folder(folder, this);
+    if(watcher->error() != 0)
+    {
+        t.lastErrorCode = watcher->error();
+        t.lastErrorMessage = watcher->errorString();
+        emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
+        delete watcher;
+        return false;
+    }
+
+    _metadataCache->addRoot(folder);
+    watchers[key] = watcher;
+    return watcher->watch();
+}
+
+void QDropbox2::unwatchMetadata(const QString& folder)
+{
+    QString key = folder.toLower();
+    if(!watchers.contains(key))
+        return;
+
+    QDropbox2Folder* watcher = watchers.take(key);
+    watcher->unwatch();
+    watcher->deleteLater();
+
+    _metadataCache->removeRoot(folder);
+}
+
+bool QDropbox2::prefetchTemporaryLinks(const QStringList& paths)     // asynchronous
+{
+    Transport& t = transport();
+
+    clearError();
+
+    foreach(const QString& path, paths)
+    {
+        QUrl link;
+        if(_linkCache->lookup(path, QString(), link))
+            continue;
+
+        QNetworkReply* reply;
+        if(!requestTemporaryLink(reply, path))
+            return false;
+
+        CallbackPtr reply_data(new LinkData());
+        LinkData* link_data = reinterpret_cast<LinkData*>(reply_data.data());
+        link_data->callback = &QDropbox2::temporaryLinkCallback;
+        link_data->path = path;
+        t.replyMap[reply] = reply_data;
+
+        ++t.pendingLinks;
+    }
+
+    // nothing needed fetching
+    if(!t.pendingLinks)
+        emit signal_temporaryLinksPrefetched(0);
+
+    return true;
+}
+
+bool QDropbox2::requestTemporaryLink(QNetworkReply*& reply, const QString& path)
+{
+    QUrl url;
+    url.setUrl(QDROPBOX2_API_URL);
+    url.setPath("/2/files/get_temporary_link");
+
+    QNetworkRequest req;
+    if(!createAPIv2Reqeust(url, req))
+        return false;
+
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    QDropbox2JsonWriter json(path.size());
+    json.beginObject()
+            .value("path", path)
+        .endObject();
+
+    reply = sendPOST(req, json.data());
+    return reply != nullptr;
+}
+
+void QDropbox2::temporaryLinkCallback(QNetworkReply* reply, CallbackPtr reply_data)
+{
+    Transport& t = transport();
+
+    LinkData* link_data = reinterpret_cast<LinkData*>(reply_data.data());
+
+    if(t.lastErrorCode != 0)
+    {
+        t.lastErrorMessage = reply->errorString();
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2::temporaryLinkCallback error: " << link_data->path << t.lastErrorCode << t.lastErrorMessage << endl;
+#endif
+        emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
+    }
+    else
+    {
+        QJsonParseError jsonError;
+        QJsonDocument json = QJsonDocument::fromJson(t.lastResponse, &jsonError);
+        if(jsonError.error == QJsonParseError::NoError)
+        {
+            QJsonObject object = json.object();
+            if(object.contains("link"))
+            {
+                QString rev = object.value("metadata").toObject().value("rev").toString();
+                _linkCache->insert(link_data->path, rev, QUrl(object.value("link").toString()));
+                ++t.prefetchedLinks;
+            }
+        }
+        else
+        {
+            t.lastErrorCode = (int)QDropbox2::APIError;
+            t.lastErrorMessage = "Dropbox API did not send correct answer for temporary link data.";
+            emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
+        }
+    }
+
+    if(--t.pendingLinks == 0)
+    {
+        int count = t.prefetchedLinks;
+        t.prefetchedLinks = 0;
+        emit signal_temporaryLinksPrefetched(count);
+    }
+}
+
+void QDropbox2::enableEngine(int io_threads)
+{
+    disableEngine();
+    _engine = new QDropbox2Engine(io_threads);
+    if(_metrics)
+        _engine->setMetrics(_metrics);
+}
+
+void QDropbox2::disableEngine()
+{
+    delete _engine;
+    _engine = nullptr;
+}
+
+void QDropbox2::enableMetrics()
+{
+    if(_metrics)
+        return;
+
+    _metrics = QSharedPointer<QDropbox2Metrics>::create();
+    if(_engine)
+        _engine->setMetrics(_metrics);
+}
+
+void QDropbox2::disableMetrics()
+{
+    if(_engine)
+        _engine->setMetrics(QSharedPointer<QDropbox2Metrics>());
+    _metrics.clear();
+}
+
+void QDropbox2::trackRequest(QNetworkReply* reply)
+{
+    if(_metrics && reply)
+        _metrics->track(reply);
+}
+
+void QDropbox2::enableTracing(int max_events)
+{
+    disableTracing();
+    _tracer = new QDropbox2Tracer(max_events);
+}
+
+void QDropbox2::disableTracing()
+{
+    delete _tracer;
+    _tracer = nullptr;
+}
+
+quint64 QDropbox2::traceBegin(const char* name, const QVariantMap& args)
+{
+    return _tracer ? _tracer->begin(name, args) : 0;
+}
+
+void QDropbox2::traceStep(quint64 id, const char* name, const QVariantMap& args)
+{
+    if(_tracer && id)
+        _tracer->step(id, name, args);
+}
+
+void QDropbox2::traceEnd(quint64 id, const char* name, const QVariantMap& args)
+{
+    if(_tracer && id)
+        _tracer->end(id, name, args);
+}
+
 QNetworkReply* QDropbox2::sendPOST(QNetworkRequest& rq, QByteArray postdata)
 {
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "sendPOST() host = " << host << endl;
 #endif
 
-    return QNAM.post(rq, postdata);
+    QNetworkReply* reply = networkAccessManager()->post(rq, postdata);
+    trackRequest(reply);
+    return reply;
 }
 
 QNetworkReply*  QDropbox2::sendGET(QNetworkRequest& rq)
@@ -204,11 +573,15 @@ QNetworkReply*  QDropbox2::sendGET(QNetworkRequest& rq)
     qDebug() << "sendGET() host = " << host << endl;
 #endif
 
-    return QNAM.get(rq);
+    QNetworkReply* reply = networkAccessManager()->get(rq);
+    trackRequest(reply);
+    return reply;
 }
 
 QString QDropbox2::signatureMethodString()
 {
+    Transport& t = transport();
+
     QString sigmeth;
     switch(oauthMethod)
     {
@@ -219,9 +592,9 @@ QString QDropbox2::signatureMethodString()
             sigmeth = "HMAC-SHA1";
             break;
         default:
-            lastErrorCode = (int)QDropbox2::UnknownAuthMethod;
-            lastErrorMessage = QString("Authentication method %1 is unknown").arg(oauthMethod);
-            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            t.lastErrorCode = (int)QDropbox2::UnknownAuthMethod;
+            t.lastErrorMessage = QString("Authentication method %1 is unknown").arg(oauthMethod);
+            emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
             break;
     }
 
@@ -230,11 +603,14 @@ QString QDropbox2::signatureMethodString()
 
 void QDropbox2::setAccessToken(const QString& token)
 {
+    QWriteLocker locker(&tokenLock);
     accessToken_ = token;
+    bearerHeader = QString("Bearer %1").arg(token).toUtf8();
 }
 
 QString QDropbox2::accessToken()
 {
+    QReadLocker locker(&tokenLock);
     return accessToken_;
 }
 
@@ -265,10 +641,12 @@ QUrl QDropbox2::authorizeLink(const QString& appKey, const QString& redirect_uri
 
 bool QDropbox2::tokenFromKeyAndSecret()     // synchronous
 {
+    Transport& t = transport();
+
     bool result = false;
 
     clearError();
-    accessToken_.clear();
+    setAccessToken(QString());
 
     QNetworkReply* reply;
     result = requestTokenViaOAuth1(reply);
@@ -278,36 +656,34 @@ bool QDropbox2::tokenFromKeyAndSecret()     // synchronous
         startEventLoop();
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
-        result = (lastErrorCode == 0 && lastResponse.length());
+        QJsonDocument json = QJsonDocument::fromJson(t.lastResponse, &jsonError);
+        result = (t.lastErrorCode == 0 && t.lastResponse.length());
         if(result)
         {
             if(jsonError.error == QJsonParseError::NoError)
             {
-                cachedJson = json;
                 QJsonObject object = json.object();
                 if(object.contains("oauth2_token"))
-                    accessToken_ = object.value("oauth2_token").toString();
+                    setAccessToken(object.value("oauth2_token").toString());
             }
         }
-        else if(lastErrorCode != 0)
+        else if(t.lastErrorCode != 0)
         {
-            lastErrorMessage.clear();
-            lastErrorCode = (int)QDropbox2::UnknownAuthMethod;
+            t.lastErrorMessage.clear();
+            t.lastErrorCode = (int)QDropbox2::UnknownAuthMethod;
             if(jsonError.error == QJsonParseError::NoError)
             {
-                cachedJson = json;
                 QJsonObject object = json.object();
                 if(object.contains("error_summary"))
-                    lastErrorMessage = object.value("error_summary").toString();
+                    t.lastErrorMessage = object.value("error_summary").toString();
             }
-            if(lastErrorMessage.isEmpty())
-                lastErrorMessage = "An error occurred using the OAuth v1 interface.";
-            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            if(t.lastErrorMessage.isEmpty())
+                t.lastErrorMessage = "An error occurred using the OAuth v1 interface.";
+            emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
         }
     }
 
-    return !accessToken_.isEmpty();
+    return !accessToken().isEmpty();
 }
 
 bool QDropbox2::requestTokenViaOAuth1(QNetworkReply*& reply)
@@ -323,16 +699,20 @@ bool QDropbox2::requestTokenViaOAuth1(QNetworkReply*& reply)
         return false;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"oauth1_token\": \"%1\", \"oauth1_secret\": \"%2\"}")
-                                .arg(appKey)
-                                .arg(appSecret);
+    QDropbox2JsonWriter json(appKey.size() + appSecret.size());
+    json.beginObject()
+            .value("oauth1_token", appKey)
+            .value("oauth1_secret", appSecret)
+        .endObject();
 
-    reply = sendPOST(req);
+    reply = sendPOST(req, json.data());
     return reply != nullptr;
 }
 
 bool QDropbox2::revokeAccessToken()     // synchronous
 {
+    Transport& t = transport();
+
     bool result = false;
 
     clearError();
@@ -349,9 +729,9 @@ bool QDropbox2::revokeAccessToken()     // synchronous
     }
     else
     {
-        lastErrorCode = (int)QDropbox2::APIError;
-        lastErrorMessage = "An error occurred creating the network request.";
-        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        t.lastErrorCode = (int)QDropbox2::APIError;
+        t.lastErrorMessage = "An error occurred creating the network request.";
+        emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
     }
 
     return result;
@@ -375,6 +755,8 @@ bool QDropbox2::requestTokenRevocation(QNetworkReply*& reply)
 
 bool QDropbox2::userInfo(QDropbox2User& info)   // synchronous
 {
+    Transport& t = transport();
+
     bool result = false;
 
     clearError();
@@ -386,23 +768,22 @@ bool QDropbox2::userInfo(QDropbox2User& info)   // synchronous
     {
         startEventLoop();
 
-        result = (lastErrorCode == 0 && lastResponse.length());
+        result = (t.lastErrorCode == 0 && t.lastResponse.length());
         if(result)
         {
             QJsonParseError jsonError;
-            QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+            QJsonDocument json = QJsonDocument::fromJson(t.lastResponse, &jsonError);
             if(jsonError.error == QJsonParseError::NoError)
             {
-                cachedJson = json;
                 QJsonObject object = json.object();
-                QDropbox2User a(object, this);
+                QDropbox2User a(object, nullptr);
                 info = a;
             }
             else
             {
-                lastErrorCode = (int)QDropbox2::APIError;
-                lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
-                emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+                t.lastErrorCode = (int)QDropbox2::APIError;
+                t.lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
+                emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
 
                 result = false;
             }
@@ -414,6 +795,8 @@ bool QDropbox2::userInfo(QDropbox2User& info)   // synchronous
 
 bool QDropbox2::userInfo()      // asynchronous
 {
+    Transport& t = transport();
+
     bool result = false;
 
     clearError();
@@ -425,7 +808,7 @@ bool QDropbox2::userInfo()      // asynchronous
     {
         CallbackPtr reply_data(new CallbackData());
         reply_data->callback = &QDropbox2::userInfoCallback;
-        replyMap[reply] = reply_data;
+        t.replyMap[reply] = reply_data;
     }
 
     return result;
@@ -449,31 +832,33 @@ bool QDropbox2::requestUserInfo(QNetworkReply*& reply)
 
 void QDropbox2::userInfoCallback(QNetworkReply* /*reply*/, CallbackPtr /*data*/)
 {
+    Transport& t = transport();
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "== user info ==" << lastResponse << "== user info end ==";
+    qDebug() << "== user info ==" << t.lastResponse << "== user info end ==";
 #endif
 
     QJsonParseError jsonError;
-    QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+    QJsonDocument json = QJsonDocument::fromJson(t.lastResponse, &jsonError);
     if(jsonError.error != QJsonParseError::NoError)
     {
-        lastErrorCode = (int)QDropbox2::APIError;
-        lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
+        t.lastErrorCode = (int)QDropbox2::APIError;
+        t.lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
 #ifdef QTDROPBOX_DEBUG
-        qDebug() << "error: " << lastErrorMessage << endl;
+        qDebug() << "error: " << t.lastErrorMessage << endl;
 #endif
-        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
     }
     else
     {
-        cachedJson = json;
-        QDropbox2User info(json.object(), this);
+        QDropbox2User info(json.object(), nullptr);
         emit signal_userInfoReceived(info);
     }
 }
 
 bool QDropbox2::usageInfo(QDropbox2Usage& info)     // synchronous
 {
+    Transport& t = transport();
+
     bool result = false;
 
     clearError();
@@ -485,23 +870,22 @@ bool QDropbox2::usageInfo(QDropbox2Usage& info)     // synchronous
     {
         startEventLoop();
 
-        result = (lastErrorCode == 0 && lastResponse.length());
+        result = (t.lastErrorCode == 0 && t.lastResponse.length());
         if(result)
         {
             QJsonParseError jsonError;
-            QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+            QJsonDocument json = QJsonDocument::fromJson(t.lastResponse, &jsonError);
             if(jsonError.error == QJsonParseError::NoError)
             {
-                cachedJson = json;
                 QJsonObject object = json.object();
-                QDropbox2Usage a(object, this);
+                QDropbox2Usage a(object, nullptr);
                 info = a;
             }
             else
             {
-                lastErrorCode = (int)QDropbox2::APIError;
-                lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
-                emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+                t.lastErrorCode = (int)QDropbox2::APIError;
+                t.lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
+                emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
 
                 result = false;
             }
@@ -513,6 +897,8 @@ bool QDropbox2::usageInfo(QDropbox2Usage& info)     // synchronous
 
 bool QDropbox2::usageInfo()     // asynchronous
 {
+    Transport& t = transport();
+
     bool result = false;
 
     clearError();
@@ -524,7 +910,7 @@ bool QDropbox2::usageInfo()     // asynchronous
     {
         CallbackPtr reply_data(new CallbackData());
         reply_data->callback = &QDropbox2::usageInfoCallback;
-        replyMap[reply] = reply_data;
+        t.replyMap[reply] = reply_data;
     }
 
     return result;
@@ -548,60 +934,52 @@ bool QDropbox2::requestUsageInfo(QNetworkReply*& reply)
 
 void QDropbox2::usageInfoCallback(QNetworkReply* /*reply*/, CallbackPtr /*data*/)
 {
+    Transport& t = transport();
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "== usage info ==" << lastResponse << "== usage info end ==";
+    qDebug() << "== usage info ==" << t.lastResponse << "== usage info end ==";
 #endif
 
     QJsonParseError jsonError;
-    QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+    QJsonDocument json = QJsonDocument::fromJson(t.lastResponse, &jsonError);
     if(jsonError.error != QJsonParseError::NoError)
     {
-        lastErrorCode = (int)QDropbox2::APIError;
-        lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
+        t.lastErrorCode = (int)QDropbox2::APIError;
+        t.lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
 #ifdef QTDROPBOX_DEBUG
-        qDebug() << "error: " << lastErrorMessage << endl;
+        qDebug() << "error: " << t.lastErrorMessage << endl;
 #endif
-        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        emit signal_errorOccurred(t.lastErrorCode, t.lastErrorMessage);
     }
     else
     {
-        QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
-        if(jsonError.error == QJsonParseError::NoError)
-        {
-            cachedJson = json;
-            QJsonObject object = json.object();
-            QDropbox2Usage usage(object, this);
-            emit signal_usageInfoReceived(usage);
-        }
-        else
-        {
-            lastErrorCode = (int)QDropbox2::APIError;
-            lastErrorMessage  = "Dropbox API did not send correct answer for account information.";
-            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
-        }
+        QDropbox2Usage usage(json.object(), nullptr);
+        emit signal_usageInfoReceived(usage);
     }
 }
 
 void QDropbox2::startEventLoop()
 {
+    Transport& t = transport();
+
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "QDropbox::startEventLoop()" << endl;
 #endif
-    if(eventLoop == nullptr)
-        eventLoop = new QEventLoop(this);
-    eventLoop->exec();
+    if(t.eventLoop == nullptr)
+        t.eventLoop = new QEventLoop();
+    t.eventLoop->exec();
 }
 
 void QDropbox2::stopEventLoop()
 {
+    Transport& t = transport();
+
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "QDropbox::stopEventLoop()" << endl;
 #endif
-    if(eventLoop == nullptr)
+    if(t.eventLoop == nullptr)
         return;
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "loop ended" << endl;
 #endif
-    eventLoop->exit();
+    t.eventLoop->exit();
 }
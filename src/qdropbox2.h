@@ -3,6 +3,14 @@
 //#include <QCryptographicHash>
 //#include <QDateTime>
 
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QThreadStorage>
+#include <QVariantMap>
+
 #ifdef QTDROPBOX_DEBUG
 #include <QDebug>
 #endif
@@ -12,6 +20,14 @@
 #include "qdropbox2account.h"
 #include "qdropbox2entityinfo.h"
 
+class QDropbox2ContentCache;
+class QDropbox2MetadataCache;
+class QDropbox2LinkCache;
+class QDropbox2Folder;
+class QDropbox2Engine;
+class QDropbox2Metrics;
+class QDropbox2Tracer;
+
 /*! The main entry point of QDropbox2, a heavily re-factored version of Daniel Eder's QtDropbox
     to support the new Dropbox APIv2 interface.
 */
@@ -46,6 +62,19 @@
   function the function error() will return QDropbox2::NoError if no error occurred or the error that
   occurred when processing the blocking request.
 
+  <h3>Using QDropbox2 from multiple threads</h3>
+  A single, authenticated QDropbox2 instance may be shared by any number of threads.  Each thread
+  that issues requests gets its own network transport (QNetworkAccessManager, event loop and error
+  state), created on first use and released when the thread exits, while the access token and the
+  caches are shared.  error() and errorString() report the last error of the calling thread.
+  QDropbox2File and QDropbox2Folder instances are not shared; create them on the thread that uses
+  them (e.g., inside a QRunnable), passing the shared QDropbox2.
+
+  Configuration (setApiUrl(), setAuthMethod(), enableContentCache(), ...) and folder watching
+  (watchMetadata()) should be done from the thread that created the instance, before it is shared.
+  Asynchronous requests deliver their results on the thread that issued them, so that thread needs a
+  running event loop; signals reach receivers on other threads as queued connections.
+
   \bug HMAC-SHA1 authentication is not working (does not have to be in 1.0)
 
  */
@@ -125,6 +154,11 @@ public:
                        OAuthMethod method = QDropbox2::Plaintext,
                        const QString& url = "api.dropboxapi.com");
 
+    /*!
+      Releases the resources held by the instance.
+     */
+    ~QDropbox2();
+
     /*!
       If an error occurred you can access the last error code by using this function.
      */
@@ -150,6 +184,15 @@ public:
      */
     QString apiUrl();
 
+    /*!
+      Sends every request to the given server instead of the Dropbox API and
+      content servers; only the scheme, host and port are replaced.  This is
+      meant for gateways and for local stand-in servers in tests.
+
+      \param server URL of the server, or an empty URL for the Dropbox servers.
+     */
+    void setServerOverride(const QUrl& server);
+
     /*!
       This function is used to changed the used authentication method. You can use it
       even if you want to change the authentication method during an already existing
@@ -269,6 +312,178 @@ public:
     */
     bool createAPIv2Reqeust(QUrl url, QNetworkRequest& netreq, bool include_bearer = true);
 
+    /*!
+      Enables an on-disk cache of downloaded file content that is shared by all
+      QDropbox2File instances using this QDropbox2.  Cached content is keyed by
+      file id and revision, so it is only ever served for an unchanged file.
+
+      When a file is opened for reading, its current revision is confirmed with a
+      (cheap) metadata request, and the content is then read from the cache if
+      present.  If a time-to-live is given, a revision confirmed within that many
+      seconds is trusted without asking the server again.
+
+      Replaces any previously enabled content cache.
+
+      \param directory Local directory to hold the cached content.
+      \param max_bytes Upper bound on the total size of the cached content.
+      \param ttl Number of seconds a confirmed revision is trusted.  Zero means always confirm.
+      \returns <i>true</i> if the cache directory is usable or <i>false</i> if it is not.
+     */
+    bool enableContentCache(const QString& directory, qint64 max_bytes = 256*1024*1024, int ttl = 0);
+
+    /*!
+      Disables the content cache.  Content already cached is left on disk.
+     */
+    void disableContentCache();
+
+    /*!
+      Returns the content cache, or <i>nullptr</i> if none is enabled.
+     */
+    QDropbox2ContentCache* contentCache() const { return _contentCache; }
+
+    /*!
+      Returns the in-memory metadata cache shared by all QDropbox2File and
+      QDropbox2Folder instances using this QDropbox2.  The cache only holds
+      entries for the direct children of watched folders (see watchMetadata()).
+     */
+    QDropbox2MetadataCache* metadataCache() const { return _metadataCache; }
+
+    /*!
+      Changes the bounds of the metadata cache.
+
+      \param max_entries Upper bound on the number of cached entries.
+      \param max_bytes Upper bound on the approximate memory used by the entries.
+     */
+    void setMetadataCacheLimits(int max_entries, qint64 max_bytes);
+
+    /*!
+      Starts watching a Dropbox folder so that metadata requests for its direct
+      children can be answered from memory.  The folder is long-polled in the
+      background, and every change reported by the server is applied to the
+      metadata cache, so cached entries never go stale.
+
+      \remark Watching requires a running Qt event loop.
+
+      \param folder Dropbox path of the folder to watch ("/" for the root).
+      \returns <i>true</i> if the folder is being watched or <i>false</i> if there was an error.
+     */
+    bool watchMetadata(const QString& folder);
+
+    /*!
+      Stops watching a Dropbox folder, and drops its entries from the metadata cache.
+     */
+    void unwatchMetadata(const QString& folder);
+
+    /*!
+      Returns the cache of temporary streaming links shared by all QDropbox2File
+      instances using this QDropbox2 (see QDropbox2File::temporaryLink()).
+     */
+    QDropbox2LinkCache* linkCache() const { return _linkCache; }
+
+    /*!
+      Obtains temporary streaming links for a set of files, and places them in
+      the link cache, so that subsequent calls to QDropbox2File::temporaryLink()
+      for those files are answered without a request to the server.  Files that
+      already have a usable cached link are skipped.
+
+      \remark This is an asynchronous call.  Emits signal_temporaryLinksPrefetched()
+      when all of the links have been retrieved.
+
+      \param paths Dropbox paths of the files.
+      \returns <i>true</i> if the requests were submitted successfully or <i>false</i> if they were not.
+     */
+    bool prefetchTemporaryLinks(const QStringList& paths);
+
+    /*!
+      Moves network I/O for supported asynchronous operations (currently
+      QDropbox2Folder::contents()) onto dedicated threads, and response parsing
+      onto the global thread pool.  See QDropbox2Engine.
+
+      Replaces any previously enabled engine; requests still in flight on it are
+      abandoned.
+
+      \param io_threads Number of I/O threads.
+     */
+    void enableEngine(int io_threads = 1);
+
+    /*!
+      Returns all network I/O to the calling threads.
+     */
+    void disableEngine();
+
+    /*!
+      Returns the network engine, or <i>nullptr</i> if none is enabled.
+     */
+    QDropbox2Engine* engine() const { return _engine; }
+
+    /*!
+      Starts collecting per-endpoint request counts, byte counts, errors and
+      latency histograms for every request sent through this QDropbox2 (see
+      QDropbox2Metrics).  Does nothing if metrics are already enabled.
+
+      Like enableEngine(), this should not be called while other threads are
+      sending requests.
+     */
+    void enableMetrics();
+
+    /*!
+      Stops collecting request metrics and discards the statistics.  Requests
+      already in flight finish recording into the discarded instance.
+     */
+    void disableMetrics();
+
+    /*!
+      Returns the request metrics, or <i>nullptr</i> if they are not enabled.
+     */
+    QDropbox2Metrics* metrics() const { return _metrics.data(); }
+
+    /*!
+      Measures a request that was just sent, if metrics are enabled.  Called by
+      the library for every request; only needed by code that sends its own
+      requests with createAPIv2Reqeust().
+     */
+    void trackRequest(QNetworkReply* reply);
+
+    /*!
+      Starts recording the lifecycle of file uploads (and their session chunks),
+      folder listings (and their pages) and longpolls as trace events that can
+      be exported for a trace viewer (see QDropbox2Tracer).  Replaces any
+      previously enabled tracer.
+
+      Like enableEngine(), this should not be called while other threads are
+      sending requests.
+
+      \param max_events Number of events kept.
+     */
+    void enableTracing(int max_events = 1000000);
+
+    /*!
+      Stops recording trace events and discards them.
+     */
+    void disableTracing();
+
+    /*!
+      Returns the tracer, or <i>nullptr</i> if tracing is not enabled.
+     */
+    QDropbox2Tracer* tracer() const { return _tracer; }
+
+    /*!
+      Begins a traced operation if tracing is enabled.
+
+      \returns The correlation id of the operation, or zero if tracing is not enabled.
+     */
+    quint64 traceBegin(const char* name, const QVariantMap& args = QVariantMap());
+
+    /*!
+      Begins a step of a traced operation.  Does nothing if <i>id</i> is zero.
+     */
+    void traceStep(quint64 id, const char* name, const QVariantMap& args = QVariantMap());
+
+    /*!
+      Ends a traced operation or step.  Does nothing if <i>id</i> is zero.
+     */
+    void traceEnd(quint64 id, const char* name, const QVariantMap& args = QVariantMap());
+
 signals:
     /*!
       This signal is emitted whenever an error occurs. The error is passed
@@ -295,6 +510,14 @@ signals:
      */
     void signal_usageInfoReceived(const QDropbox2Usage& usage);
 
+    /*!
+      Emitted when all links requested by prefetchTemporaryLinks() have been
+      retrieved (or have failed).
+
+      \param count The number of links that were added to the link cache.
+     */
+    void signal_temporaryLinksPrefetched(int count);
+
 private slots:
     void slot_networkRequestFinished(QNetworkReply* reply);
 
@@ -321,9 +544,51 @@ private:        // classes
     {
         AsyncCallback callback;
     };
+    struct LinkData : public CallbackData
+    {
+        QString path;
+    };
+
+    // the state of a request in flight is per-thread; see transport()
+    struct Transport
+    {
+        explicit Transport(QDropbox2* owner);
+        ~Transport();
+
+        // cleared, under transportsMutex, when the owner is destroyed before
+        // this thread exits
+        QDropbox2*      owner;
+
+        QNetworkAccessManager* QNAM;
+
+        // for synchronous functions
+        QEventLoop*     eventLoop;
+
+        int             lastErrorCode;
+        QString         lastErrorMessage;
+        QByteArray      lastResponse;
+
+        // for asynchronous operations
+        ReplyMap        replyMap;
+
+        int             pendingLinks;
+        int             prefetchedLinks;
+    };
+
+    // the transports of one thread, keyed by the transportKey of the object
+    // they belong to; released when that thread exits
+    struct ThreadTransports
+    {
+        ~ThreadTransports();
+
+        QHash<int, Transport*> byOwner;
+    };
 
 private:        // methods
     void    init(const QString& api_url = "api.dropbox.com", OAuthMethod oauth_method = Plaintext);
+
+    Transport&  transport();
+    QNetworkAccessManager* networkAccessManager();
     //QString hmacsha1(QString key, QString baseString);
     void    prepareApiUrl();
 
@@ -336,6 +601,7 @@ private:        // methods
     bool    requestUsageInfo(QNetworkReply*& reply);
     bool    requestTokenViaOAuth1(QNetworkReply*& reply);
     bool    requestTokenRevocation(QNetworkReply*& reply);
+    bool    requestTemporaryLink(QNetworkReply*& reply, const QString& path);
 
     // functions for synchronous actions
     void    startEventLoop();
@@ -344,31 +610,45 @@ private:        // methods
     // QNetworkReply post-processing callbacks (synchronous and asynchronous)
     void    userInfoCallback(QNetworkReply* reply, CallbackPtr data);
     void    usageInfoCallback(QNetworkReply* reply, CallbackPtr data);
+    void    temporaryLinkCallback(QNetworkReply* reply, CallbackPtr data);
 
 private:        // data members
-    QNetworkAccessManager QNAM;
-
     QString         appKey;
     QString         appSecret;
+
+    // guards the token, which may be replaced while other threads use it
+    mutable QReadWriteLock tokenLock;
     QString         accessToken_;
+    QByteArray      bearerHeader;
+    QUrl            serverOverride;
 
     QUrl            apiurl;
     OAuthMethod     oauthMethod;
 
-    int             lastErrorCode;
-    QString         lastErrorMessage;
-    QString         lastResponse;
+    // a thread's transports outlive the objects they belong to: those of
+    // other threads may still be in use when this object is destroyed, so it
+    // only orphans them, and each thread releases its own
+    static QThreadStorage<ThreadTransports*> threadTransports;
+    static QAtomicInt nextTransportKey;
+    static QMutex   transportsMutex;
+
+    int             transportKey;
+    QList<Transport*> allTransports;   // every thread's, under transportsMutex
 
-    // for asynchronous operations
-    ReplyMap        replyMap;
+    QDropbox2User   account;
 
-    // for synchronous functions
-    QEventLoop      *eventLoop;
+    QDropbox2ContentCache* _contentCache;
 
-    // cached JSON results
-    QJsonDocument   cachedJson;
+    QDropbox2MetadataCache* _metadataCache;
+    QMap<QString, QDropbox2Folder*> watchers;   // lower-cased folder -> watcher
 
-    QDropbox2User   account;
+    QDropbox2LinkCache* _linkCache;
+
+    QDropbox2Engine* _engine;
+
+    QSharedPointer<QDropbox2Metrics> _metrics;
+
+    QDropbox2Tracer* _tracer;
 };
 
 Q_DECLARE_METATYPE(QDropbox2::Error);
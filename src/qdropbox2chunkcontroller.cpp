@@ -0,0 +1,152 @@
+#include <cmath>
+
+#include "qdropbox2chunkcontroller.h"
+
+namespace
+{
+    // weight kept by older measurements each time a chunk is recorded
+    const double Decay = 0.9;
+
+    // sizes whose goodput is this close to the best are considered equal
+    const double Tolerance = 0.05;
+
+    qint64 roundToUnit(qint64 bytes, qint64 maximum)
+    {
+        const qint64 unit = QDropbox2ChunkController::Unit;
+        return qBound(unit, (bytes / unit) * unit, maximum);
+    }
+}
+
+QDropbox2ChunkController::QDropbox2ChunkController(qint64 initial, qint64 maximum)
+    : maximum(roundToUnit(maximum, maximumChunkSize()))
+{
+    this->initial = roundToUnit(initial, this->maximum);
+    reset();
+}
+
+void QDropbox2ChunkController::reset()
+{
+    QMutexLocker locker(&mutex);
+
+    size = initial;
+    sw = sx = sy = sxx = sxy = 0.0;
+    failures = attempted = 0.0;
+}
+
+qint64 QDropbox2ChunkController::chunkSize() const
+{
+    QMutexLocker locker(&mutex);
+    return size;
+}
+
+void QDropbox2ChunkController::recordSuccess(qint64 bytes, qint64 msecs)
+{
+    QMutexLocker locker(&mutex);
+
+    const double x = double(bytes);
+    const double y = double(msecs);
+
+    sw  = sw  * Decay + 1.0;
+    sx  = sx  * Decay + x;
+    sy  = sy  * Decay + y;
+    sxx = sxx * Decay + x * x;
+    sxy = sxy * Decay + x * y;
+
+    failures  *= Decay;
+    attempted  = attempted * Decay + x;
+
+    update();
+}
+
+void QDropbox2ChunkController::recordFailure(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+
+    failures  = failures * Decay + 1.0;
+    attempted = attempted * Decay + double(bytes);
+
+    update();
+}
+
+bool QDropbox2ChunkController::fitted(double& a, double& b) const
+{
+    // the fit needs measurements of at least two different sizes
+    const double det = sw * sxx - sx * sx;
+    if(sw < 1.0 || det <= 1e-6 * sxx * sw)
+        return false;
+
+    b = (sw * sxy - sx * sy) / det;
+    a = (sy - b * sx) / sw;
+
+    // noise can produce a negative overhead or slope; neither is physical
+    if(b <= 0.0)
+        b = 1e-9;
+    if(a < 0.0)
+        a = 0.0;
+    return true;
+}
+
+double QDropbox2ChunkController::expectedGoodput(qint64 bytes, double a, double b) const
+{
+    // failures are assumed to strike each byte independently
+    const double loss = attempted > 0.0 ? failures / attempted : 0.0;
+    const double x = double(bytes);
+    return x * std::exp(-loss * x) / (a + b * x) * 1000.0;
+}
+
+void QDropbox2ChunkController::update()
+{
+    double a, b;
+    if(!fitted(a, b))
+    {
+        // probe another size, so that overhead and throughput can be told apart
+        if(sw >= 1.0)
+            size = (size * 2 <= maximum) ? size * 2 : roundToUnit(size / 2, maximum);
+        else if(failures > 0.0)
+            size = roundToUnit(size / 2, maximum);
+        return;
+    }
+
+    double best = 0.0;
+    for(qint64 s = Unit;s <= maximum;s += Unit)
+        best = qMax(best, expectedGoodput(s, a, b));
+
+    for(qint64 s = Unit;s <= maximum;s += Unit)
+    {
+        if(expectedGoodput(s, a, b) >= best * (1.0 - Tolerance))
+        {
+            size = s;
+            break;
+        }
+    }
+}
+
+double QDropbox2ChunkController::overhead() const
+{
+    QMutexLocker locker(&mutex);
+    double a, b;
+    return fitted(a, b) ? a : 0.0;
+}
+
+double QDropbox2ChunkController::throughput() const
+{
+    QMutexLocker locker(&mutex);
+    double a, b;
+    if(fitted(a, b))
+        return 1000.0 / b;
+    return sy > 0.0 ? sx / sy * 1000.0 : 0.0;
+}
+
+double QDropbox2ChunkController::failureRate() const
+{
+    QMutexLocker locker(&mutex);
+    const double loss = attempted > 0.0 ? failures / attempted : 0.0;
+    return 1.0 - std::exp(-loss * double(size));
+}
+
+double QDropbox2ChunkController::goodput() const
+{
+    QMutexLocker locker(&mutex);
+    double a, b;
+    return fitted(a, b) ? expectedGoodput(size, a, b) : 0.0;
+}
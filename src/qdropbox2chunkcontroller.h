@@ -0,0 +1,120 @@
+#pragma once
+
+#include <QtCore/QMutex>
+
+#include "qdropbox2global.h"
+
+//! Chooses the size of upload session chunks from measured performance
+/*!
+  Every chunk of an upload session costs a fixed overhead (the round trip,
+  and the request itself) on top of the time its bytes take on the wire, and
+  a chunk that fails has to be sent again in full.  Large chunks amortise the
+  overhead, small chunks waste less when a request fails; which size gives
+  the best goodput depends on the link.
+
+  QDropbox2ChunkController learns this from the chunks actually sent.  It
+  fits the time taken per chunk to <i>overhead + size / throughput</i>, and
+  estimates the chance of a failure per byte sent; both estimates decay, so
+  they follow a link whose character changes.  It then picks the size, a
+  multiple of 4 MB as upload sessions require, with the best expected goodput,
+
+  \code
+  goodput(size) = size * P(success | size) / (overhead + size / throughput)
+  \endcode
+
+  preferring the smaller of two sizes whose goodput is within a few percent,
+  since a smaller chunk holds less memory and is cheaper to resend.  Until
+  chunks of two different sizes have been measured, the controller probes by
+  doubling (or halving) the current size.
+
+  All methods are thread-safe.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2ChunkController
+{
+public:
+    enum
+    {
+        //! Chunks other than the last must be multiples of 4 MB
+        Unit = 4*1024*1024
+    };
+
+    /*!
+      Creates a controller.
+
+      \param initial Size of the first chunk.
+      \param maximum Largest chunk size chosen; at most maximumChunkSize().
+     */
+    explicit QDropbox2ChunkController(qint64 initial = 2 * Unit, qint64 maximum = maximumChunkSize());
+
+    /*!
+      Returns the largest multiple of 4 MB that Dropbox accepts in one request.
+     */
+    static qint64 maximumChunkSize() { return (qint64(MaxSingleUpload) / Unit) * Unit; }
+
+    /*!
+      Returns the size to use for the next chunk.
+     */
+    qint64  chunkSize() const;
+
+    /*!
+      Records a chunk that was accepted by the server.
+
+      \param bytes Size of the chunk.
+      \param msecs Time from sending the request to receiving the response.
+     */
+    void    recordSuccess(qint64 bytes, qint64 msecs);
+
+    /*!
+      Records a chunk that failed, and will have to be sent again.
+
+      \param bytes Size of the chunk.
+     */
+    void    recordFailure(qint64 bytes);
+
+    /*!
+      Returns the estimated per-chunk overhead, in milliseconds.
+     */
+    double  overhead() const;
+
+    /*!
+      Returns the estimated throughput, in bytes per second.
+     */
+    double  throughput() const;
+
+    /*!
+      Returns the estimated probability that a chunk of the current size fails.
+     */
+    double  failureRate() const;
+
+    /*!
+      Returns the expected goodput, in bytes per second, at the current size.
+     */
+    double  goodput() const;
+
+    /*!
+      Forgets all measurements, and returns to the initial size.
+     */
+    void    reset();
+
+private:
+    void    update();
+    bool    fitted(double& a, double& b) const;
+    double  expectedGoodput(qint64 size, double a, double b) const;
+
+    mutable QMutex mutex;
+
+    qint64  initial;
+    qint64  maximum;
+    qint64  size;
+
+    // decayed sums for the least-squares fit of msecs against bytes
+    double  sw;
+    double  sx;
+    double  sy;
+    double  sxx;
+    double  sxy;
+
+    // decayed failure count, and bytes attempted
+    double  failures;
+    double  attempted;
+};
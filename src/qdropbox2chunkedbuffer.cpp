@@ -0,0 +1,323 @@
+#include <algorithm>
+
+#include "qdropbox2chunkedbuffer.h"
+
+//--------------------------------------
+// QDropbox2ChunkedBuffer
+
+QDropbox2ChunkedBuffer::QDropbox2ChunkedBuffer(int block_size)
+    : _blockSize(qMax(1, block_size)),
+      total(0),
+      inMemory(0),
+      budget(0),
+      spilledBytes(0),
+      discardedTo(0),
+      nextSpill(0),
+      hint(0)
+{
+}
+
+void QDropbox2ChunkedBuffer::setMemoryBudget(qint64 bytes)
+{
+    budget = bytes;
+    spillExcess();
+}
+
+void QDropbox2ChunkedBuffer::clear()
+{
+    blocks.clear();
+    total = 0;
+    inMemory = 0;
+    spilledBytes = 0;
+    discardedTo = 0;
+    nextSpill = 0;
+    hint = 0;
+
+    // snapshots that still read from the old file keep it alive
+    spill.clear();
+}
+
+void QDropbox2ChunkedBuffer::setContent(const QByteArray& data)
+{
+    clear();
+    if(data.isEmpty())
+        return;
+
+    Block block;
+    block.state   = Block::InMemory;
+    block.start   = 0;
+    block.length  = data.size();
+    block.data    = data;
+    block.spillAt = -1;
+    blocks.append(block);
+
+    total = inMemory = data.size();
+}
+
+int QDropbox2ChunkedBuffer::blockAt(qint64 pos) const
+{
+    Q_ASSERT(pos >= 0 && pos < total);
+
+    if(hint < blocks.count() && pos >= blocks[hint].start && pos < blocks[hint].start + blocks[hint].length)
+        return hint;
+
+    // last block starting at or before pos
+    QVector<Block>::const_iterator iter = std::upper_bound(blocks.constBegin(), blocks.constEnd(), pos,
+                                                           [](qint64 p, const Block& b) { return p < b.start; });
+    hint = int(iter - blocks.constBegin()) - 1;
+    return hint;
+}
+
+void QDropbox2ChunkedBuffer::copyOut(const Block& block, qint64 offset, char* data, qint64 len) const
+{
+    if(block.state == Block::InMemory)
+        memcpy(data, block.data.constData() + offset, len);
+    else if(block.state == Block::Spilled)
+    {
+        spill->seek(block.spillAt + offset);
+        spill->read(data, len);
+    }
+}
+
+void QDropbox2ChunkedBuffer::copyIn(Block& block, qint64 offset, const char* data, qint64 len)
+{
+    if(block.state == Block::InMemory)
+        memcpy(block.data.data() + offset, data, len);      // detaches a shared block
+    else if(block.state == Block::Spilled)
+    {
+        spill->seek(block.spillAt + offset);
+        spill->write(data, len);
+    }
+}
+
+qint64 QDropbox2ChunkedBuffer::write(qint64 pos, const char* data, qint64 len)
+{
+    if(pos < discardedTo || pos > total)
+        return -1;
+    if(len <= 0)
+        return 0;
+
+    qint64 done = 0;
+
+    // overwrite what is already there
+    if(pos < total)
+    {
+        for(int i = blockAt(pos);done < len && i < blocks.count();++i)
+        {
+            Block& block = blocks[i];
+            const qint64 offset = pos + done - block.start;
+            const qint64 n = qMin(len - done, block.length - offset);
+            copyIn(block, offset, data + done, n);
+            done += n;
+        }
+    }
+
+    // then extend; a block is never grown past the block size, so existing
+    // content does not move
+    while(done < len)
+    {
+        if(blocks.isEmpty() || blocks.last().length >= _blockSize || blocks.last().state != Block::InMemory)
+        {
+            Block block;
+            block.state   = Block::InMemory;
+            block.start   = total;
+            block.length  = 0;
+            block.spillAt = -1;
+            blocks.append(block);
+        }
+
+        Block& last = blocks.last();
+        const qint64 n = qMin(len - done, qint64(_blockSize) - last.length);
+        last.data.append(data + done, int(n));
+        last.length += n;
+        total += n;
+        inMemory += n;
+        done += n;
+    }
+
+    spillExcess();
+
+    return len;
+}
+
+void QDropbox2ChunkedBuffer::spillExcess()
+{
+    if(budget <= 0)
+        return;
+
+    // the last block is still being filled, and stays in memory
+    while(inMemory > budget && nextSpill < blocks.count() - 1)
+    {
+        Block& block = blocks[nextSpill++];
+        if(block.state != Block::InMemory)
+            continue;
+
+        if(!spill)
+        {
+            spill = QSharedPointer<QTemporaryFile>::create();
+            if(!spill->open())
+            {
+                // nowhere to spill to; keep everything in memory
+                spill.clear();
+                budget = 0;
+                return;
+            }
+        }
+
+        const qint64 at = spill->size();
+        spill->seek(at);
+        if(spill->write(block.data.constData(), block.length) != block.length)
+        {
+            budget = 0;
+            return;
+        }
+
+        block.state   = Block::Spilled;
+        block.spillAt = at;
+        block.data    = QByteArray();
+
+        inMemory -= block.length;
+        spilledBytes += block.length;
+    }
+}
+
+void QDropbox2ChunkedBuffer::discard(qint64 pos)
+{
+    for(int i = 0;i < blocks.count() && blocks[i].start + blocks[i].length <= pos;++i)
+    {
+        Block& block = blocks[i];
+        if(block.state == Block::InMemory)
+            inMemory -= block.length;
+        else if(block.state == Block::Spilled)
+            spilledBytes -= block.length;
+
+        block.state = Block::Discarded;
+        block.data  = QByteArray();
+
+        discardedTo = block.start + block.length;
+    }
+
+    nextSpill = qMax(nextSpill, int(std::upper_bound(blocks.constBegin(), blocks.constEnd(), discardedTo,
+                                                     [](qint64 p, const Block& b) { return p < b.start + b.length; })
+                                    - blocks.constBegin()));
+}
+
+qint64 QDropbox2ChunkedBuffer::read(qint64 pos, char* data, qint64 maxlen) const
+{
+    if(pos < discardedTo || pos >= total || maxlen <= 0)
+        return 0;
+
+    const qint64 len = qMin(maxlen, total - pos);
+    qint64 done = 0;
+    for(int i = blockAt(pos);done < len;++i)
+    {
+        const Block& block = blocks[i];
+        const qint64 offset = pos + done - block.start;
+        const qint64 n = qMin(len - done, block.length - offset);
+        copyOut(block, offset, data + done, n);
+        done += n;
+        hint = i;
+    }
+
+    return len;
+}
+
+qint64 QDropbox2ChunkedBuffer::readLine(qint64 pos, char* data, qint64 maxlen) const
+{
+    if(pos < discardedTo || pos >= total || maxlen <= 0)
+        return 0;
+
+    const qint64 len = qMin(maxlen, total - pos);
+    qint64 done = 0;
+    for(int i = blockAt(pos);done < len;++i)
+    {
+        const Block& block = blocks[i];
+        const qint64 offset = pos + done - block.start;
+        qint64 n = qMin(len - done, block.length - offset);
+
+        // copy first, then look for the newline in the copy; this works the
+        // same whether the block is in memory or spilled
+        copyOut(block, offset, data + done, n);
+        const char* newline = static_cast<const char*>(memchr(data + done, '\n', n));
+        hint = i;
+
+        if(newline)
+        {
+            done = newline - data + 1;
+            break;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+QByteArray QDropbox2ChunkedBuffer::mid(qint64 pos, qint64 len) const
+{
+    if(pos < discardedTo || pos >= total)
+        return QByteArray();
+    if(len < 0 || len > total - pos)
+        len = total - pos;
+    if(len > MaxArraySize)
+        return QByteArray();
+
+    const Block& block = blocks[blockAt(pos)];
+    if(block.state == Block::InMemory)
+    {
+        const qint64 offset = pos - block.start;
+        if(offset == 0 && len == block.length)
+            return block.data;
+        if(offset + len <= block.length)
+            return block.data.mid(int(offset), int(len));
+    }
+
+    QByteArray result(int(len), Qt::Uninitialized);
+    read(pos, result.data(), len);
+    return result;
+}
+
+QByteArray QDropbox2ChunkedBuffer::toByteArray() const
+{
+    return mid(0);
+}
+
+QIODevice* QDropbox2ChunkedBuffer::createReader(qint64 pos, qint64 len, QObject* parent) const
+{
+    QDropbox2ChunkedBufferReader* reader = new QDropbox2ChunkedBufferReader(*this, pos, len, parent);
+    reader->open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    return reader;
+}
+
+//--------------------------------------
+// QDropbox2ChunkedBufferReader
+
+QDropbox2ChunkedBufferReader::QDropbox2ChunkedBufferReader(const QDropbox2ChunkedBuffer& buffer, qint64 pos, qint64 len, QObject* parent)
+    : QIODevice(parent),
+      snapshot(buffer),
+      base(qBound(qint64(0), pos, buffer.size())),
+      length(qBound(qint64(0), len, buffer.size() - base)),
+      cursor(0)
+{
+}
+
+bool QDropbox2ChunkedBufferReader::seek(qint64 pos)
+{
+    if(pos < 0 || pos > length)
+        return false;
+
+    QIODevice::seek(pos);
+    cursor = pos;
+    return true;
+}
+
+qint64 QDropbox2ChunkedBufferReader::readData(char* data, qint64 maxlen)
+{
+    const qint64 n = snapshot.read(base + cursor, data, qMin(maxlen, length - cursor));
+    cursor += n;
+    return n;
+}
+
+qint64 QDropbox2ChunkedBufferReader::writeData(const char* /*data*/, qint64 /*len*/)
+{
+    return -1;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <climits>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QIODevice>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QVector>
+
+#include "qdropbox2global.h"
+
+//! A byte buffer stored as a list of fixed-size blocks
+/*!
+  QDropbox2File keeps the content of an open file in a QDropbox2ChunkedBuffer
+  rather than in a single QByteArray.  Appending never moves existing content.
+  Each block is filled to the block size and then a new block is started, so
+  many small writes cost no more than one large one.  Writing inside the
+  content overwrites bytes in place, as a regular file does.
+
+  The blocks are implicitly shared QByteArrays.  Copying a buffer, or taking
+  a reader() over part of it, therefore shares the data and copies nothing.
+  A later write detaches only the block it touches.  Content adopted with
+  setContent() (e.g., a download or a cache mapping) becomes a single block,
+  and is not copied until it is written to.
+
+  With a memory budget set (see setMemoryBudget()), the oldest full blocks
+  are moved to a temporary file whenever the content held in memory exceeds
+  the budget.  Content that has been consumed elsewhere (e.g., uploaded) can
+  be released from the front of the buffer with discard().
+
+  The buffer is not thread-safe.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2ChunkedBuffer
+{
+public:
+    enum
+    {
+        //! Upload session chunks are multiples of 4 MB
+        DefaultBlockSize = 4*1024*1024,
+
+        //! Largest range returned as a QByteArray, whose size is an int
+        MaxArraySize = INT_MAX
+    };
+
+    /*!
+      Creates an empty buffer.
+
+      \param block_size Size at which a block is closed and a new one begun.
+     */
+    explicit QDropbox2ChunkedBuffer(int block_size = DefaultBlockSize);
+
+    /*!
+      Returns the number of bytes in the buffer, including any that have been
+      spilled to disk or discarded.
+     */
+    qint64  size() const        { return total; }
+    bool    isEmpty() const     { return total == 0; }
+
+    int     blockSize() const   { return _blockSize; }
+    int     blockCount() const  { return blocks.count(); }
+
+    /*!
+      Returns the number of bytes held in memory.
+     */
+    qint64  memoryUsage() const { return inMemory; }
+
+    /*!
+      Returns the number of bytes held in the spill file.
+     */
+    qint64  spilled() const     { return spilledBytes; }
+
+    /*!
+      Limits the content held in memory.  Beyond the budget, the oldest full
+      blocks are written to a temporary file; the block being filled always
+      stays in memory.  Zero or less means no limit (the default).
+     */
+    void    setMemoryBudget(qint64 bytes);
+    qint64  memoryBudget() const { return budget; }
+
+    /*!
+      Discards the content.
+     */
+    void    clear();
+
+    /*!
+      Replaces the content with <i>data</i>, which is shared rather than copied.
+     */
+    void    setContent(const QByteArray& data);
+
+    /*!
+      Writes <i>len</i> bytes at <i>pos</i>, overwriting existing content and
+      extending the buffer as needed.
+
+      \returns The number of bytes written, or -1 if <i>pos</i> is beyond the
+               end or within the discarded part of the buffer.
+     */
+    qint64  write(qint64 pos, const char* data, qint64 len);
+
+    /*!
+      Copies up to <i>maxlen</i> bytes starting at <i>pos</i> into <i>data</i>.
+
+      \returns The number of bytes copied.
+     */
+    qint64  read(qint64 pos, char* data, qint64 maxlen) const;
+
+    /*!
+      Like read(), but stops after the first newline character.
+     */
+    qint64  readLine(qint64 pos, char* data, qint64 maxlen) const;
+
+    /*!
+      Returns up to <i>len</i> bytes starting at <i>pos</i> (or all remaining
+      bytes if <i>len</i> is negative).  A range that is exactly one block held
+      in memory is returned shared; any other range is copied.  A range longer
+      than MaxArraySize does not fit in a QByteArray, and an empty array is
+      returned; use read() or createReader() instead.
+     */
+    QByteArray mid(qint64 pos, qint64 len = -1) const;
+
+    /*!
+      Returns the whole content as one QByteArray.  This is a copy unless the
+      content is held in a single block.  Content longer than MaxArraySize
+      is not returned; see mid().
+     */
+    QByteArray toByteArray() const;
+
+    /*!
+      Releases every block that lies entirely before <i>pos</i>.  Released
+      content can no longer be read or written; size() is unaffected.
+     */
+    void    discard(qint64 pos);
+
+    /*!
+      Returns the offset below which content has been released by discard().
+     */
+    qint64  discarded() const   { return discardedTo; }
+
+    /*!
+      Returns a read-only, random-access device over a range of the buffer,
+      suitable for QNetworkAccessManager::post().  The device shares a snapshot
+      of the blocks, and is not affected by later writes to blocks held in
+      memory.  Spilled blocks are read from the shared spill file, so the range
+      should not be overwritten while the device is in use.
+
+      \param pos Start of the range.
+      \param len Length of the range.
+      \param parent Parent of the device.
+     */
+    QIODevice* createReader(qint64 pos, qint64 len, QObject* parent = 0) const;
+
+private:
+    struct Block
+    {
+        enum State { InMemory, Spilled, Discarded };
+
+        State       state;
+        qint64      start;      // offset of the block in the content
+        qint64      length;
+        QByteArray  data;       // InMemory only
+        qint64      spillAt;    // Spilled only; offset in the spill file
+    };
+
+    int     blockAt(qint64 pos) const;
+    void    copyOut(const Block& block, qint64 offset, char* data, qint64 len) const;
+    void    copyIn(Block& block, qint64 offset, const char* data, qint64 len);
+    void    spillExcess();
+
+    int                 _blockSize;
+    qint64              total;
+    qint64              inMemory;
+    qint64              budget;
+    qint64              spilledBytes;
+    qint64              discardedTo;
+
+    QVector<Block>      blocks;
+    int                 nextSpill;  // first block that may still be spilled
+
+    QSharedPointer<QTemporaryFile> spill;
+
+    mutable int         hint;       // block of the last lookup; reads are mostly sequential
+};
+
+//! \internal A device reading a range of a QDropbox2ChunkedBuffer snapshot
+class QDropbox2ChunkedBufferReader : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    QDropbox2ChunkedBufferReader(const QDropbox2ChunkedBuffer& buffer, qint64 pos, qint64 len, QObject* parent = 0);
+
+    bool    isSequential() const override   { return false; }
+    qint64  size() const override           { return length; }
+    qint64  bytesAvailable() const override { return (length - cursor) + QIODevice::bytesAvailable(); }
+    bool    seek(qint64 pos) override;
+
+protected:
+    qint64  readData(char* data, qint64 maxlen) override;
+    qint64  writeData(const char* data, qint64 len) override;
+
+private:
+    QDropbox2ChunkedBuffer  snapshot;
+    qint64                  base;
+    qint64                  length;
+    qint64                  cursor;
+};
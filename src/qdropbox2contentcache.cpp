@@ -0,0 +1,311 @@
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#ifdef QTDROPBOX_DEBUG
+#include <QDebug>
+#endif
+
+#include "qdropbox2contentcache.h"
+
+static const char* CacheSuffix = ".cache";
+
+QDropbox2ContentCache::QDropbox2ContentCache(const QString& directory, qint64 max_bytes, int ttl)
+    : _directory(directory),
+      _maxBytes(max_bytes),
+      _ttl(ttl),
+      totalBytes(0),
+      clock(0),
+      pruneAt(64)
+{
+    QDir dir(_directory);
+    if(!dir.exists())
+        dir.mkpath(".");
+
+    // adopt what a previous instance left behind, oldest first, so
+    // recency survives (approximately) across runs
+    QFileInfoList files = dir.entryInfoList(QStringList() << QString("*%1").arg(CacheSuffix),
+                                            QDir::Files,
+                                            QDir::Time|QDir::Reversed);
+    foreach(const QFileInfo& info, files)
+    {
+        QString key = info.fileName();
+        key.chop(qstrlen(CacheSuffix));
+
+        Entry entry;
+        entry.size = info.size();
+        entry.stamp = ++clock;
+        entries[key] = entry;
+        recency[entry.stamp] = key;
+        totalBytes += entry.size;
+    }
+
+    evict();
+}
+
+qint64 QDropbox2ContentCache::maxBytes() const
+{
+    QMutexLocker locker(&mutex);
+    return _maxBytes;
+}
+
+void QDropbox2ContentCache::setMaxBytes(qint64 max_bytes)
+{
+    QMutexLocker locker(&mutex);
+    _maxBytes = max_bytes;
+    evict();
+}
+
+int QDropbox2ContentCache::ttl() const
+{
+    QMutexLocker locker(&mutex);
+    return _ttl;
+}
+
+void QDropbox2ContentCache::setTtl(int seconds)
+{
+    QMutexLocker locker(&mutex);
+    _ttl = seconds;
+}
+
+qint64 QDropbox2ContentCache::size() const
+{
+    QMutexLocker locker(&mutex);
+    return totalBytes;
+}
+
+QString QDropbox2ContentCache::key(const QString& id, const QString& rev)
+{
+    // "id:a4ayc_80_OEAAAAAAAAAXw" + "a1c10ce0dd78" -> "a4ayc_80_OEAAAAAAAAAXw.a1c10ce0dd78",
+    // with anything that isn't filename-safe on every platform replaced
+    QString result = QString("%1.%2").arg(id.mid(id.indexOf(':') + 1)).arg(rev);
+    for(int i = 0;i < result.size();++i)
+    {
+        const QChar c = result.at(i);
+        if(!(c.isLetterOrNumber() && c.unicode() < 0x80) && c != '_' && c != '-' && c != '.')
+            result[i] = '_';
+    }
+    return result;
+}
+
+QString QDropbox2ContentCache::filePath(const QString& key) const
+{
+    return QString("%1/%2%3").arg(_directory).arg(key).arg(CacheSuffix);
+}
+
+void QDropbox2ContentCache::touch(const QString& key, Entry& entry)
+{
+    recency.remove(entry.stamp);
+    entry.stamp = ++clock;
+    recency[entry.stamp] = key;
+}
+
+void QDropbox2ContentCache::evict(const QString& keep)
+{
+    QMap<quint64, QString>::iterator iter = recency.begin();
+    while(totalBytes > _maxBytes && iter != recency.end())
+    {
+        const QString key = iter.value();
+        if(key == keep || !QFile::remove(filePath(key)))
+        {
+            // either the entry we are protecting, or a file that is still
+            // in use (on some platforms mapped files cannot be removed)
+            if(!QFile::exists(filePath(key)))
+            {
+                totalBytes -= entries[key].size;
+                entries.remove(key);
+                iter = recency.erase(iter);
+            }
+            else
+                ++iter;
+            continue;
+        }
+
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2ContentCache: evicting" << key << endl;
+#endif
+        totalBytes -= entries[key].size;
+        entries.remove(key);
+        iter = recency.erase(iter);
+    }
+}
+
+bool QDropbox2ContentCache::contains(const QString& key) const
+{
+    QMutexLocker locker(&mutex);
+    return entries.contains(key);
+}
+
+bool QDropbox2ContentCache::insert(const QString& key, const QByteArray& data)
+{
+    if(data.size() > maxBytes())
+        return false;
+
+    // the content is written without holding the lock, which only guards the
+    // bookkeeping; QSaveFile writes to a temporary name and renames on
+    // commit, so a concurrent reader never sees a partially written entry
+    QSaveFile file(filePath(key));
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    if(file.write(data) != data.size() || !file.commit())
+        return false;
+
+    QMutexLocker locker(&mutex);
+    stored(key, data.size());
+    return true;
+}
+
+bool QDropbox2ContentCache::insert(const QString& key, QIODevice* data)
+{
+    const qint64 size = data->size() - data->pos();
+    if(size > maxBytes())
+        return false;
+
+    // as above, the lock is only taken once the content is in place
+    QSaveFile file(filePath(key));
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QByteArray piece(1024*1024, Qt::Uninitialized);
+    qint64 written = 0;
+    while(written < size)
+    {
+        const qint64 n = data->read(piece.data(), qMin(qint64(piece.size()), size - written));
+        if(n <= 0 || file.write(piece.constData(), n) != n)
+            return false;
+        written += n;
+    }
+    if(!file.commit())
+        return false;
+
+    QMutexLocker locker(&mutex);
+    stored(key, size);
+    return true;
+}
+
+void QDropbox2ContentCache::stored(const QString& key, qint64 size)
+{
+    if(entries.contains(key))
+    {
+        Entry& entry = entries[key];
+        totalBytes -= entry.size;
+        entry.size = size;
+        totalBytes += entry.size;
+        touch(key, entry);
+    }
+    else
+    {
+        Entry entry;
+        entry.size = size;
+        entry.stamp = ++clock;
+        entries[key] = entry;
+        recency[entry.stamp] = key;
+        totalBytes += entry.size;
+    }
+
+    evict(key);
+}
+
+QFile* QDropbox2ContentCache::open(const QString& key)
+{
+    QMutexLocker locker(&mutex);
+
+    if(!entries.contains(key))
+        return nullptr;
+
+    QFile* file = new QFile(filePath(key));
+    if(!file->open(QIODevice::ReadOnly))
+    {
+        // removed behind our back
+        delete file;
+        totalBytes -= entries[key].size;
+        recency.remove(entries[key].stamp);
+        entries.remove(key);
+        return nullptr;
+    }
+
+    touch(key, entries[key]);
+    return file;
+}
+
+void QDropbox2ContentCache::remove(const QString& key)
+{
+    QMutexLocker locker(&mutex);
+
+    if(!entries.contains(key))
+        return;
+
+    QFile::remove(filePath(key));
+    totalBytes -= entries[key].size;
+    recency.remove(entries[key].stamp);
+    entries.remove(key);
+}
+
+void QDropbox2ContentCache::clear()
+{
+    QMutexLocker locker(&mutex);
+
+    foreach(const QString& key, entries.keys())
+        QFile::remove(filePath(key));
+
+    entries.clear();
+    recency.clear();
+    freshness.clear();
+    totalBytes = 0;
+}
+
+bool QDropbox2ContentCache::freshKey(const QString& path, QString& key) const
+{
+    QMutexLocker locker(&mutex);
+
+    if(_ttl <= 0)
+        return false;
+
+    QHash<QString, Freshness>::const_iterator iter = freshness.constFind(path.toLower());
+    if(iter == freshness.constEnd())
+        return false;
+    if((QDateTime::currentMSecsSinceEpoch() - iter->confirmed) > (_ttl * qint64(1000)))
+        return false;
+
+    key = iter->key;
+    return true;
+}
+
+void QDropbox2ContentCache::setFresh(const QString& path, const QString& key)
+{
+    QMutexLocker locker(&mutex);
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    // paths are remembered long after their content is evicted, so the
+    // associations are pruned whenever their number has doubled
+    if(freshness.count() >= pruneAt)
+    {
+        pruneFreshness(now);
+        pruneAt = qMax(64, freshness.count() * 2);
+    }
+
+    Freshness& entry = freshness[path.toLower()];
+    entry.key = key;
+    entry.confirmed = now;
+}
+
+void QDropbox2ContentCache::pruneFreshness(qint64 now)
+{
+    // expired, or pointing at content that is no longer cached
+    QHash<QString, Freshness>::iterator iter = freshness.begin();
+    while(iter != freshness.end())
+    {
+        if((now - iter->confirmed) > (_ttl * qint64(1000)) || !entries.contains(iter->key))
+            iter = freshness.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+void QDropbox2ContentCache::invalidate(const QString& path)
+{
+    QMutexLocker locker(&mutex);
+    freshness.remove(path.toLower());
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include "qdropbox2global.h"
+
+//! A size-bounded, least-recently-used cache of file content on local disk
+/*!
+  QDropbox2ContentCache keeps downloaded Dropbox file content in a local
+  directory so that repeated reads of an unchanged file do not have to cross
+  the network again.  Entries are keyed by the Dropbox file id and revision
+  (see key()), so a cached entry can never be served for a different version
+  of the file.  When the total size of the cached content exceeds the limit,
+  the least recently used entries are removed.
+
+  The cache additionally remembers which key was current for a Dropbox path,
+  and when that was last confirmed with the server.  Within the configured
+  time-to-live, a QDropbox2File can be opened from the cache without any
+  network traffic at all.
+
+  Instances are created and owned by QDropbox2 (see QDropbox2::enableContentCache()).
+  All methods are thread-safe.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2ContentCache
+{
+public:
+    /*!
+      Creates a cache in the given directory, adopting any entries a previous
+      instance left behind.  The directory is created if it does not exist.
+
+      \param directory Local directory that holds the cached content.
+      \param max_bytes Upper bound on the total size of the cached content.
+      \param ttl Number of seconds a path-to-revision association is trusted
+                 without asking the server.  Zero means always ask.
+     */
+    QDropbox2ContentCache(const QString& directory, qint64 max_bytes, int ttl = 0);
+
+    /*!
+      Returns the directory that holds the cached content.
+     */
+    QString directory() const { return _directory; }
+
+    /*!
+      Returns the upper bound on the total size of cached content.
+     */
+    qint64 maxBytes() const;
+
+    /*!
+      Changes the upper bound on the total size of cached content, removing
+      entries if the cache is now over budget.
+     */
+    void setMaxBytes(qint64 max_bytes);
+
+    /*!
+      Returns the number of seconds a path-to-revision association is trusted.
+     */
+    int ttl() const;
+
+    /*!
+      Sets the number of seconds a path-to-revision association is trusted
+      without asking the server.  Zero means always ask.
+     */
+    void setTtl(int seconds);
+
+    /*!
+      Returns the total size of the cached content.
+     */
+    qint64 size() const;
+
+    /*!
+      Builds the cache key for a specific revision of a Dropbox file.
+     */
+    static QString key(const QString& id, const QString& rev);
+
+    /*!
+      Indicates whether content for the key is cached.
+     */
+    bool contains(const QString& key) const;
+
+    /*!
+      Stores content under the key, removing least recently used entries if
+      required.  Content larger than the whole cache is not stored.
+
+      \returns <i>true</i> if the content was stored.
+     */
+    bool insert(const QString& key, const QByteArray& data);
+
+    /*!
+      Stores content read from a device, from its current position to its
+      end, a piece at a time; for content too large to be held in one
+      QByteArray.
+
+      \returns <i>true</i> if the content was stored.
+     */
+    bool insert(const QString& key, QIODevice* data);
+
+    /*!
+      Opens the cached content for the key for reading, and marks the entry as
+      most recently used.  The caller takes ownership of the returned QFile.
+
+      \returns An open QFile, or <i>nullptr</i> if the key is not cached.
+     */
+    QFile* open(const QString& key);
+
+    /*!
+      Removes the cached content for the key.
+     */
+    void remove(const QString& key);
+
+    /*!
+      Removes all cached content.
+     */
+    void clear();
+
+    /*!
+      Retrieves the key last confirmed for a Dropbox path, if it was confirmed
+      within the time-to-live.
+
+      \returns <i>true</i> if a fresh key was found.
+     */
+    bool freshKey(const QString& path, QString& key) const;
+
+    /*!
+      Records that the server just confirmed the key as current for the path.
+     */
+    void setFresh(const QString& path, const QString& key);
+
+    /*!
+      Forgets the key recorded for the path (e.g., because the file was
+      modified, moved or removed through this library).
+     */
+    void invalidate(const QString& path);
+
+private:
+    struct Entry
+    {
+        qint64  size;
+        quint64 stamp;
+    };
+
+    struct Freshness
+    {
+        QString key;
+        qint64  confirmed;
+    };
+
+    QString filePath(const QString& key) const;
+    void    touch(const QString& key, Entry& entry);
+    void    stored(const QString& key, qint64 size);
+    void    evict(const QString& keep = QString());
+    void    pruneFreshness(qint64 now);
+
+    mutable QMutex  mutex;
+
+    QString         _directory;
+    qint64          _maxBytes;
+    int             _ttl;
+
+    qint64          totalBytes;
+    quint64         clock;
+
+    QHash<QString, Entry>       entries;
+    QMap<quint64, QString>      recency;    // access stamp -> key, oldest first
+
+    QHash<QString, Freshness>   freshness;  // lower-cased Dropbox path -> key
+    int                         pruneAt;    // freshness count that triggers pruning
+};
@@ -0,0 +1,301 @@
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QRunnable>
+
+#ifdef QTDROPBOX_DEBUG
+#include <QDebug>
+#endif
+
+#include "qdropbox2engine.h"
+
+namespace
+{
+    // turns a finished response into a result on the parser pool, then
+    // hands it to the reply on the submitting thread
+    class ParseTask : public QRunnable
+    {
+    public:
+        ParseTask(QDropbox2EngineReply* reply, QDropbox2Engine::Parser parser,
+                  int error, const QString& error_string, int http_status, const QByteArray& data)
+            : reply(reply),
+              parser(parser),
+              error(error),
+              errorString(error_string),
+              httpStatus(http_status),
+              data(data)
+        {}
+
+        void run() override
+        {
+            QVariant result;
+            if(error == QNetworkReply::NoError)
+            {
+                if(parser)
+                    result = parser(data);
+            }
+            else
+            {
+                QJsonParseError jsonError;
+                QJsonDocument json = QJsonDocument::fromJson(data, &jsonError);
+                if(jsonError.error == QJsonParseError::NoError)
+                {
+                    QJsonObject object = json.object();
+                    if(object.contains("user_message"))
+                        errorString = object.value("user_message").toString();
+                    else if(object.contains("error_summary"))
+                        errorString = object.value("error_summary").toString();
+                }
+            }
+
+            QMetaObject::invokeMethod(reply, "complete", Qt::QueuedConnection,
+                                      Q_ARG(int, error),
+                                      Q_ARG(QString, errorString),
+                                      Q_ARG(int, httpStatus),
+                                      Q_ARG(QByteArray, data),
+                                      Q_ARG(QVariant, result));
+        }
+
+    private:
+        QDropbox2EngineReply*   reply;
+        QDropbox2Engine::Parser parser;
+        int                     error;
+        QString                 errorString;
+        int                     httpStatus;
+        QByteArray              data;
+    };
+}
+
+//--------------------------------------
+// QDropbox2EngineReply
+
+QDropbox2EngineReply::QDropbox2EngineReply(QObject* parent)
+    : QObject(parent),
+      finished(false),
+      _error(0),
+      _httpStatus(0)
+{
+}
+
+void QDropbox2EngineReply::complete(int error, const QString& error_string, int http_status,
+                                    const QByteArray& data, const QVariant& result)
+{
+    finished     = true;
+    _error       = error;
+    _errorString = error_string;
+    _httpStatus  = http_status;
+    _data        = data;
+    _result      = result;
+
+    emit signal_finished();
+}
+
+//--------------------------------------
+// QDropbox2Engine
+
+QDropbox2Engine::QDropbox2Engine(int io_threads, QObject* parent)
+    : QObject(parent),
+      parserPool(QThreadPool::globalInstance())
+{
+    for(int i = 0;i < qMax(1, io_threads);++i)
+    {
+        QThread* thread = new QThread(this);
+        thread->setObjectName(QString("QDropbox2Engine I/O %1").arg(i));
+
+        QDropbox2EngineWorker* worker = new QDropbox2EngineWorker(parserPool);
+        worker->moveToThread(thread);
+        thread->start();
+
+        threads.append(thread);
+        workers.append(worker);
+    }
+}
+
+QDropbox2Engine::~QDropbox2Engine()
+{
+    for(int i = 0;i < workers.count();++i)
+    {
+        QMetaObject::invokeMethod(workers[i], "slot_shutdown", Qt::BlockingQueuedConnection);
+        threads[i]->quit();
+        threads[i]->wait();
+        delete workers[i];
+    }
+}
+
+void QDropbox2Engine::setParserPool(QThreadPool* pool)
+{
+    parserPool = pool ? pool : QThreadPool::globalInstance();
+    foreach(QDropbox2EngineWorker* worker, workers)
+        worker->setParserPool(parserPool);
+}
+
+void QDropbox2Engine::setMetrics(QSharedPointer<QDropbox2Metrics> metrics)
+{
+    foreach(QDropbox2EngineWorker* worker, workers)
+        worker->setMetrics(metrics);
+}
+
+QDropbox2EngineReply* QDropbox2Engine::post(const QNetworkRequest& request, const QByteArray& body, Parser parser)
+{
+    QDropbox2EngineReply* reply = new QDropbox2EngineReply();
+
+    QDropbox2EngineWorker::Job* job = new QDropbox2EngineWorker::Job;
+    job->request = request;
+    job->body = body;
+    job->parser = parser;
+    job->reply = reply;
+
+    int index = (next.fetchAndAddRelaxed(1) & 0x7fffffff) % workers.count();
+    workers[index]->submit(job);
+
+    return reply;
+}
+
+//--------------------------------------
+// QDropbox2EngineWorker
+
+QDropbox2EngineWorker::QDropbox2EngineWorker(QThreadPool* pool)
+    : QObject(),
+      head(&stub),
+      tail(&stub),
+      wakePending(0),
+      parserPool(pool),
+      QNAM(nullptr)
+{
+    stub.next.store(nullptr);
+}
+
+QDropbox2EngineWorker::~QDropbox2EngineWorker()
+{
+    // anything submitted after shutdown
+    while(Job* job = pop())
+        delete job;
+}
+
+void QDropbox2EngineWorker::push(Job* job)
+{
+    job->next.store(nullptr);
+    Job* prev = head.fetchAndStoreOrdered(job);
+    prev->next.storeRelease(job);
+}
+
+QDropbox2EngineWorker::Job* QDropbox2EngineWorker::pop()
+{
+    Job* t = tail;
+    Job* n = t->next.loadAcquire();
+
+    if(t == &stub)
+    {
+        if(!n)
+            return nullptr;
+        tail = n;
+        t = n;
+        n = n->next.loadAcquire();
+    }
+
+    if(n)
+    {
+        tail = n;
+        return t;
+    }
+
+    // a producer has swung 'head' but not yet linked its node; it will
+    // post another wakeup once it has
+    if(t != head.loadAcquire())
+        return nullptr;
+
+    push(&stub);
+
+    n = t->next.loadAcquire();
+    if(n)
+    {
+        tail = n;
+        return t;
+    }
+
+    return nullptr;
+}
+
+void QDropbox2EngineWorker::setMetrics(QSharedPointer<QDropbox2Metrics> metrics)
+{
+    QMutexLocker locker(&metricsMutex);
+    this->metrics = metrics;
+}
+
+void QDropbox2EngineWorker::submit(Job* job)
+{
+    push(job);
+
+    if(wakePending.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "slot_drain", Qt::QueuedConnection);
+}
+
+void QDropbox2EngineWorker::slot_drain()
+{
+    wakePending.storeRelease(0);
+
+    if(!QNAM)
+    {
+        QNAM = new QNetworkAccessManager(this);
+        connect(QNAM, &QNetworkAccessManager::finished, this, &QDropbox2EngineWorker::slot_finished);
+    }
+
+    QSharedPointer<QDropbox2Metrics> tracker;
+    {
+        QMutexLocker locker(&metricsMutex);
+        tracker = metrics;
+    }
+
+    while(Job* job = pop())
+    {
+        QNetworkReply* reply = QNAM->post(job->request, job->body);
+        if(tracker)
+            tracker->track(reply);
+        inflight.insert(reply, job);
+        // the body is no longer needed once handed to the reply
+        job->body.clear();
+    }
+}
+
+void QDropbox2EngineWorker::slot_finished(QNetworkReply* reply)
+{
+    reply->deleteLater();
+
+    Job* job = inflight.take(reply);
+    if(!job)
+        return;
+
+    int error = reply->error();
+    QString error_string = (error == QNetworkReply::NoError) ? QString() : reply->errorString();
+    int http_status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray data = reply->readAll();
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2EngineWorker: " << reply->url().toString() << http_status << data.size() << "bytes" << endl;
+#endif
+
+    if(error == QNetworkReply::NoError && !job->parser)
+    {
+        // nothing to parse; deliver straight from the I/O thread
+        QMetaObject::invokeMethod(job->reply, "complete", Qt::QueuedConnection,
+                                  Q_ARG(int, error),
+                                  Q_ARG(QString, error_string),
+                                  Q_ARG(int, http_status),
+                                  Q_ARG(QByteArray, data),
+                                  Q_ARG(QVariant, QVariant()));
+    }
+    else
+        parserPool.loadAcquire()->start(new ParseTask(job->reply, job->parser, error, error_string, http_status, data));
+
+    delete job;
+}
+
+void QDropbox2EngineWorker::slot_shutdown()
+{
+    qDeleteAll(inflight);
+    inflight.clear();
+
+    // replies are children of the QNAM, and are aborted with it
+    delete QNAM;
+    QNAM = nullptr;
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <functional>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVariant>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
+
+#include "qdropbox2global.h"
+#include "qdropbox2metrics.h"
+
+class QDropbox2EngineWorker;
+
+//! The result of a request submitted to QDropbox2Engine
+/*!
+  A QDropbox2EngineReply is returned by QDropbox2Engine::post().  It lives on
+  the thread that submitted the request, and signal_finished() is delivered
+  there (as a queued call) once the response has been received and parsed.
+
+  The submitter owns the reply, and may delete it (e.g., with deleteLater())
+  once signal_finished() has been emitted.  It must not be deleted before then.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2EngineReply : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QDropbox2EngineReply(QObject* parent = 0);
+
+    /*!
+      Indicates whether the request has completed.
+     */
+    bool        isFinished() const  { return finished; }
+
+    /*!
+      The QNetworkReply::NetworkError of the request, or zero on success.
+     */
+    int         error() const       { return _error; }
+
+    /*!
+      A description of the error, taken from the Dropbox error response when
+      one was sent.
+     */
+    QString     errorString() const { return _errorString; }
+
+    /*!
+      The HTTP status code of the response.
+     */
+    int         httpStatus() const  { return _httpStatus; }
+
+    /*!
+      The raw response body.
+     */
+    QByteArray  data() const        { return _data; }
+
+    /*!
+      The value produced from the response body by the parser passed to
+      QDropbox2Engine::post(), if any.
+     */
+    QVariant    result() const      { return _result; }
+
+signals:
+    void        signal_finished();
+
+private:
+    friend class QDropbox2Engine;
+    friend class QDropbox2EngineWorker;
+
+    Q_INVOKABLE void complete(int error, const QString& error_string, int http_status,
+                              const QByteArray& data, const QVariant& result);
+
+    bool        finished;
+    int         _error;
+    QString     _errorString;
+    int         _httpStatus;
+    QByteArray  _data;
+    QVariant    _result;
+};
+
+//! Runs network I/O on dedicated threads
+/*!
+  By default, every QDropbox2 request is sent and processed on the calling
+  thread, inside a nested event loop; a slow response parse therefore delays
+  every other reply on that thread.
+
+  QDropbox2Engine moves the network I/O onto one or more dedicated threads,
+  each owning its own QNetworkAccessManager.  Requests are handed to an I/O
+  thread through a lock-free multiple-producer, single-consumer queue, so any
+  number of threads may submit concurrently without contending on a lock.
+  Response bodies are parsed on a worker pool rather than on the I/O thread,
+  which never blocks on CPU work, and the result is delivered back to the
+  submitting thread through QDropbox2EngineReply::signal_finished().
+
+  Enable the engine with QDropbox2::enableEngine().
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2Engine : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+      Converts a response body into a result value.  Called on a worker pool
+      thread, so it must not touch thread-affine objects.
+     */
+    typedef std::function<QVariant(const QByteArray&)> Parser;
+
+    /*!
+      Starts the I/O threads.
+
+      \param io_threads Number of I/O threads.  Requests are spread across them
+                        round-robin.
+      \param parent Parent QObject
+     */
+    explicit QDropbox2Engine(int io_threads = 1, QObject* parent = 0);
+
+    /*!
+      Stops the I/O threads.  Requests still in flight are abandoned, and their
+      replies never finish.
+     */
+    ~QDropbox2Engine();
+
+    /*!
+      Returns the number of I/O threads.
+     */
+    int     ioThreadCount() const   { return workers.count(); }
+
+    /*!
+      Sets the pool used to parse responses.  Defaults to QThreadPool::globalInstance().
+     */
+    void    setParserPool(QThreadPool* pool);
+
+    /*!
+      Sets the metrics that requests sent by the I/O threads are recorded in,
+      or stops recording if null.  Called by QDropbox2::enableMetrics().
+     */
+    void    setMetrics(QSharedPointer<QDropbox2Metrics> metrics);
+
+    /*!
+      Submits a POST request.  May be called from any thread.
+
+      \param request The fully prepared request (see QDropbox2::createAPIv2Reqeust()).
+      \param body The request body.
+      \param parser Optional conversion of the response body, run on the parser pool.
+      \returns A reply, owned by the caller, that finishes on the calling thread.
+     */
+    QDropbox2EngineReply* post(const QNetworkRequest& request, const QByteArray& body, Parser parser = Parser());
+
+private:
+    QList<QThread*>                 threads;
+    QList<QDropbox2EngineWorker*>   workers;
+    QAtomicInt                      next;
+    QThreadPool*                    parserPool;
+};
+
+//! \internal An I/O thread of QDropbox2Engine
+class QDropbox2EngineWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    // intrusive node of the submission queue
+    struct Job
+    {
+        QAtomicPointer<Job>     next;
+        QNetworkRequest         request;
+        QByteArray              body;
+        QDropbox2Engine::Parser parser;
+        QDropbox2EngineReply*   reply;
+    };
+
+    explicit QDropbox2EngineWorker(QThreadPool* pool);
+    ~QDropbox2EngineWorker();
+
+    void    setParserPool(QThreadPool* pool) { parserPool.storeRelease(pool); }
+    void    setMetrics(QSharedPointer<QDropbox2Metrics> metrics);
+
+    // producer side; any thread
+    void    submit(Job* job);
+
+public slots:
+    void    slot_drain();
+    void    slot_shutdown();
+
+private slots:
+    void    slot_finished(QNetworkReply* reply);
+
+private:
+    // Vyukov's intrusive MPSC queue: producers swing 'head' with a single
+    // atomic exchange; only the I/O thread touches 'tail'
+    void    push(Job* job);
+    Job*    pop();
+
+    QAtomicPointer<Job>     head;
+    Job*                    tail;
+    Job                     stub;
+
+    // set while a drain is scheduled, so producers post at most one wakeup
+    QAtomicInt              wakePending;
+
+    QAtomicPointer<QThreadPool> parserPool;
+
+    // replaced from the owning thread, read once per drain
+    QMutex                  metricsMutex;
+    QSharedPointer<QDropbox2Metrics> metrics;
+
+    QNetworkAccessManager*  QNAM;
+    QHash<QNetworkReply*, Job*> inflight;
+};
@@ -1,4 +1,3 @@
-#include <QFileInfo>
 #include <QLocale>
 
 #include "qdropbox2entityinfo.h"
@@ -22,6 +21,23 @@ QDropbox2EntityInfo::QDropbox2EntityInfo(const QDropbox2EntityInfo &other)
     copyFrom(other);
 }
 
+QDropbox2EntityInfo::QDropbox2EntityInfo(const QDropbox2Entry& entry, QObject *parent)
+    : QObject(parent)
+{
+    init();
+
+    _id             = entry.id;
+    _bytes          = entry.bytes;
+    _serverModified = entry.serverModified;
+    _clientModified = entry.clientModified;
+    _path           = entry.path;
+    _revisionHash   = entry.rev;
+    _contentHash    = entry.contentHash;
+    _isDir          = entry.type == QDropbox2Entry::Folder;
+    _isDeleted      = entry.type == QDropbox2Entry::Deleted;
+    _isShared       = entry.isShared;
+}
+
 QDropbox2EntityInfo::~QDropbox2EntityInfo()
 {
 }
@@ -31,13 +47,12 @@ void QDropbox2EntityInfo::copyFrom(const QDropbox2EntityInfo &other)
     setParent(other.parent());
 
     _id             = other._id;
-    _size           = other._size;
     _bytes          = other._bytes;
     _serverModified = other._serverModified;
     _clientModified = other._clientModified;
     _path           = other._path;
-    _filename       = other._filename;
     _revisionHash   = other._revisionHash;
+    _contentHash    = other._contentHash;
     _isDir          = other._isDir;
     _isShared       = other._isShared;
     _isDeleted      = other._isDeleted;
@@ -54,44 +69,133 @@ void QDropbox2EntityInfo::init(const QJsonObject& jsonData)
     if(!jsonData.isEmpty())
     {
         _id             = jsonData.value("id").toString();
-        _clientModified = getTimestamp("client_modified");
-        _serverModified = getTimestamp("server_modified");
+        _clientModified = timestamp(jsonData.value("client_modified"));
+        _serverModified = timestamp(jsonData.value("server_modified"));
         _revisionHash   = jsonData.value("rev").toString();
-        _bytes          = jsonData.value("size").toInt();
-        _size           = QString::number(_bytes);
+        _contentHash    = jsonData.value("content_hash").toString();
+        _bytes          = quint64(jsonData.value("size").toDouble());  // exact up to 2^53
         _path           = jsonData.value("path_display").toString();
         _isShared       = jsonData.contains("sharing_info");
         _isDir          = jsonData.value(".tag").toString().compare("folder") == 0;
         _isDeleted      = jsonData.value(".tag").toString().compare("deleted") == 0;
-
-        QFileInfo info(_path);
-        _filename = info.fileName();
     }
     else
     {
         _id             = "";
-        _size           = "";
         _bytes          = 0;
-        _serverModified = QDateTime::currentDateTime();
-        _clientModified = QDateTime::currentDateTime();
+        _serverModified = QDateTime::currentMSecsSinceEpoch();
+        _clientModified = _serverModified;
         _path           = "";
-        _filename       = "";
         _revisionHash   = "";
+        _contentHash    = "";
         _isDir          = false;
         _isShared       = false;
         _isDeleted      = false;
     }
 }
 
-QDateTime QDropbox2EntityInfo::getTimestamp(QString value)
+qint64 QDropbox2EntityInfo::timestamp(const QJsonValue& value)
+{
+    qint64 msecs;
+    return parseTimestamp(value.toString(), msecs) ? msecs : NoTimestamp;
+}
+
+bool QDropbox2EntityInfo::parseTimestamp(const QString& text, qint64& msecs)
 {
     // APIv2: 2015-05-12T15:50:38Z
-    const QString dtFormat = "\"yyyy-MM-ddTHH:mm:ssZ\"";
+    if(text.size() != 20)
+        return false;
+
+    const QChar* c = text.constData();
+    if(c[4] != '-' || c[7] != '-' || c[10] != 'T' || c[13] != ':' || c[16] != ':' || c[19] != 'Z')
+        return false;
+
+    auto number = [c](int begin, int length, int& result)
+    {
+        result = 0;
+        for(int i = begin;i < begin + length;++i)
+        {
+            const ushort digit = c[i].unicode() - '0';
+            if(digit > 9)
+                return false;
+            result = result * 10 + digit;
+        }
+        return true;
+    };
+
+    int year, month, day, hour, minute, second;
+    if(!number(0, 4, year) || !number(5, 2, month) || !number(8, 2, day) ||
+       !number(11, 2, hour) || !number(14, 2, minute) || !number(17, 2, second))
+        return false;
 
-    QDateTime res = QLocale(QLocale::English).toDateTime(value, dtFormat);
-    res.setTimeSpec(Qt::UTC);
+    static const int daysInMonth[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    const bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if(year < 1 || month < 1 || month > 12 || day < 1 ||
+       day > daysInMonth[month - 1] + (month == 2 && leap ? 1 : 0) ||
+       hour > 23 || minute > 59 || second > 59)
+        return false;
 
-    return res;
+    // days since 1970-01-01 in the proleptic Gregorian calendar, counting
+    // years from March so that the leap day comes last
+    const int y = month <= 2 ? year - 1 : year;
+    const int era = y / 400;
+    const int yearOfEra = y - era * 400;
+    const int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    const qint64 days = qint64(era) * 146097 + dayOfEra - 719468;
+
+    msecs = (days * 86400 + hour * 3600 + minute * 60 + second) * 1000;
+    return true;
+}
+
+QDateTime QDropbox2EntityInfo::serverModified() const
+{
+    return _serverModified == NoTimestamp ? QDateTime() : QDateTime::fromMSecsSinceEpoch(_serverModified, Qt::UTC);
+}
+
+QDateTime QDropbox2EntityInfo::clientModified() const
+{
+    return _clientModified == NoTimestamp ? QDateTime() : QDateTime::fromMSecsSinceEpoch(_clientModified, Qt::UTC);
+}
+
+QDropbox2Entry QDropbox2EntityInfo::toEntry() const
+{
+    QDropbox2Entry entry;
+    entry.type           = _isDeleted ? QDropbox2Entry::Deleted :
+                                        (_isDir ? QDropbox2Entry::Folder : QDropbox2Entry::File);
+    entry.id             = _id;
+    entry.path           = _path;
+    entry.rev            = _revisionHash;
+    entry.contentHash    = _contentHash;
+    entry.bytes          = _bytes;
+    entry.clientModified = _clientModified;
+    entry.serverModified = _serverModified;
+    entry.isShared       = _isShared;
+    return entry;
+}
+
+QDropbox2Entry QDropbox2EntityInfo::parseEntry(const QJsonObject& jsonData)
+{
+    const QString tag = jsonData.value(".tag").toString();
+
+    QDropbox2Entry entry;
+    entry.type           = (tag == "deleted") ? QDropbox2Entry::Deleted :
+                                                ((tag == "folder") ? QDropbox2Entry::Folder : QDropbox2Entry::File);
+    entry.id             = jsonData.value("id").toString();
+    entry.path           = jsonData.value("path_display").toString();
+    entry.rev            = jsonData.value("rev").toString();
+    entry.contentHash    = jsonData.value("content_hash").toString();
+    entry.bytes          = quint64(jsonData.value("size").toDouble());
+    entry.clientModified = timestamp(jsonData.value("client_modified"));
+    entry.serverModified = timestamp(jsonData.value("server_modified"));
+    entry.isShared       = jsonData.contains("sharing_info");
+    return entry;
+}
+
+QString QDropbox2EntityInfo::filename() const
+{
+    // derived rather than stored: a listing holds one of these per entry
+    return _path.mid(_path.lastIndexOf('/') + 1);
 }
 
 QString QDropbox2EntityInfo::size() const
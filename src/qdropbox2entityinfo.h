@@ -10,6 +10,7 @@
 #endif
 
 #include "qdropbox2common.h"
+#include "qdropbox2entry.h"
 
 //! Provides information and metadata about an entry in the Dropbox account
 /*!
@@ -50,6 +51,15 @@ public:
      */
     QDropbox2EntityInfo(const QDropbox2EntityInfo &other);
 
+    /*!
+      Creates an instance of QDropbox2EntityInfo from a compact QDropbox2Entry
+      (e.g., one held by the metadata cache).
+
+      \param entry compact metadata
+      \param parent pointer to the parent QObject
+    */
+    QDropbox2EntityInfo(const QDropbox2Entry& entry, QObject *parent = 0);
+
     /*!
       Default destructor. Takes care of cleaning up when the object is destroyed.
     */
@@ -88,12 +98,19 @@ public:
     /*!
       Timestamp of last modification on the server.
      */
-    QDateTime serverModified()  const   { return _serverModified; }
+    QDateTime serverModified()  const;
 
     /*!
       Timestamp of desktop client upload.
      */
-    QDateTime clientModified()  const   { return _clientModified; }
+    QDateTime clientModified()  const;
+
+    /*!
+      The same timestamps, in msecs since the epoch (UTC); NoTimestamp if the
+      entry has none.  Unlike the QDateTime accessors, these do not allocate.
+     */
+    qint64    serverModifiedMSecs() const { return _serverModified; }
+    qint64    clientModifiedMSecs() const { return _clientModified; }
 
     /*!
       Full canonical path of the file.
@@ -103,7 +120,7 @@ public:
     /*!
       Filename component.
     */
-    QString   filename()        const   { return _filename; }
+    QString   filename()        const;
 
     /*!
       Indicates whether the selected item is currently shared with others.
@@ -125,18 +142,44 @@ public:
     */
     QString   revisionHash()    const   { return _revisionHash; }
 
+    /*!
+      Dropbox content hash of a file (see QDropbox2ContentHasher); empty for
+      folders.  Unlike the revision, it only changes with the content.
+    */
+    QString   contentHash()     const   { return _contentHash; }
+
+    /*!
+      Returns the metadata as a compact QDropbox2Entry value.
+    */
+    QDropbox2Entry toEntry()    const;
+
+    /*!
+      Decodes APIv2 metadata straight into a QDropbox2Entry, without creating
+      a QDropbox2EntityInfo; for decoding many entries at once.
+    */
+    static QDropbox2Entry parseEntry(const QJsonObject& jsonData);
+
+    /*!
+      Parses an APIv2 timestamp, which always has the form
+      "yyyy-MM-ddTHH:mm:ssZ", without going through QLocale or allocating.
+
+      \param text The timestamp.
+      \param msecs Receives the time in msecs since the epoch, UTC.
+      \returns <i>false</i> if the text is not a valid timestamp of that form.
+     */
+    static bool parseTimestamp(const QString& text, qint64& msecs);
+
 private:
     void        init(const QJsonObject& jsonData = QJsonObject());
-    QDateTime   getTimestamp(QString value);
+    static qint64 timestamp(const QJsonValue& value);
 
     QString     _id;
-    QDateTime   _clientModified;
-    QDateTime   _serverModified;
+    qint64      _clientModified;    // msecs since the epoch, or NoTimestamp
+    qint64      _serverModified;
     QString     _revisionHash;
+    QString     _contentHash;
     quint64     _bytes;
-    QString     _size;
     QString     _path;
-    QString     _filename;
     bool        _isShared;
     bool        _isDir;
     bool        _isDeleted;
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <limits>
+
+#include <QtCore/QMetaType>
+#include <QtCore/QString>
+
+#include "qdropbox2global.h"
+
+// the timestamp of an entry that has none; any other value, negative ones
+// (before 1970) included, is a valid time
+const qint64 NoTimestamp = std::numeric_limits<qint64>::min();
+
+//! Compact, value-type metadata for an entry in the Dropbox account
+/*!
+  QDropbox2Entry carries the same information as QDropbox2EntityInfo, but as a
+  plain value type: it is not a QObject, and it can be copied and stored in
+  large numbers cheaply.  The library uses it for in-memory indexes such as
+  the metadata cache (see QDropbox2MetadataCache).
+
+  A QDropbox2EntityInfo can be constructed from a QDropbox2Entry and converted
+  back with QDropbox2EntityInfo::toEntry().
+ */
+struct QDROPBOXSHARED_EXPORT QDropbox2Entry
+{
+    //! Kind of entry, from the APIv2 ".tag" value
+    enum Type
+    {
+        File,
+        Folder,
+        Deleted
+    };
+
+    Type        type;
+    QString     id;
+    QString     path;           // "path_display"
+    QString     rev;
+    QString     contentHash;    // files only
+    quint64     bytes;
+    qint64      clientModified; // msecs since the epoch, UTC; NoTimestamp if unknown
+    qint64      serverModified;
+    bool        isShared;
+
+    QDropbox2Entry()
+        : type(File),
+          bytes(0),
+          clientModified(NoTimestamp),
+          serverModified(NoTimestamp),
+          isShared(false)
+    {}
+
+    /*!
+      Approximate heap footprint of the entry, in bytes, for use by memory-bounded
+      containers.
+     */
+    qint64 memoryUsage() const
+    {
+        // QString payloads are UTF-16; each string also carries a header
+        return qint64(sizeof(QDropbox2Entry)) +
+               (id.size() + path.size() + rev.size() + contentHash.size()) * qint64(sizeof(QChar)) +
+               4 * 24;
+    }
+};
+
+Q_DECLARE_METATYPE(QDropbox2Entry)
@@ -1,4 +1,13 @@
+#include <limits>
+
+#include <QScopedPointer>
+#include <QTimer>
+
 #include "qdropbox2file.h"
+#include "qdropbox2contentcache.h"
+#include "qdropbox2json.h"
+#include "qdropbox2metadatacache.h"
+#include "qdropbox2linkcache.h"
 
 QDropbox2File::QDropbox2File(QObject *parent)
     : QIODevice(parent),
@@ -33,6 +42,7 @@ QDropbox2File::QDropbox2File(const QDropbox2File& source)
 
 QDropbox2File::~QDropbox2File()
 {
+    releaseCacheFile();
     if(_buffer)
         delete _buffer;
     if(eventLoop)
@@ -43,6 +53,19 @@ void QDropbox2File::init(QDropbox2 *api, const QString& filename, qint64 thresho
 {
     if(filename.compare("/") == 0 || filename.isEmpty())
     {
+        // the destructor still has to be able to clean up
+        _buffer           = nullptr;
+        eventLoop         = nullptr;
+        _metadata         = nullptr;
+        cacheFile         = nullptr;
+        putTrace          = 0;
+        putStep           = nullptr;
+        _memoryBudget     = 0;
+        streamReply       = nullptr;
+        streamFailed      = false;
+        streamLost        = false;
+        streamWaiting     = false;
+
         lastErrorCode = QDropbox2::APIError;
         lastErrorMessage = "Filename cannot be root ('/')";
     }
@@ -55,12 +78,22 @@ void QDropbox2File::init(QDropbox2 *api, const QString& filename, qint64 thresho
         bufferThreshold   = threshold;
         overwrite_        = true;
         rename            = false;
+        jobPollFirst      = FirstJobPoll;
+        jobPollLast       = LastJobPoll;
         _metadata         = nullptr;
+        cacheFile         = nullptr;
         lastErrorCode     = 0;
         lastErrorMessage  = "";
         position          = 0;
         currentThreshold  = 0;
         fileExists        = false;
+        putTrace          = 0;
+        putStep           = nullptr;
+        _memoryBudget     = 0;
+        streamReply       = nullptr;
+        streamFailed      = false;
+        streamLost        = false;
+        streamWaiting     = false;
 
         if(api)
             accessToken = api->accessToken();
@@ -91,14 +124,21 @@ bool QDropbox2File::open(QIODevice::OpenMode mode)
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "QDropbox2File::open(...)" << endl;
 #endif
-    if(!QIODevice::open(mode))
+    // the content is already in memory; QIODevice's read buffer would only
+    // add a second copy (and read ahead of 'position')
+    if(!QIODevice::open(mode | QIODevice::Unbuffered))
         return result;
 
   /*  if(isMode(QIODevice::NotOpen))
         return true; */
 
     if(!_buffer)
-        _buffer = new QByteArray();
+        _buffer = new QDropbox2ChunkedBuffer();
+    _buffer->setMemoryBudget(_memoryBudget);
+    releaseCacheFile();
+
+    // the content is replaced, so a write lost to a failed stream is over
+    streamLost = false;
 
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "QDropbox2File: opening file" << endl;
@@ -113,8 +153,15 @@ bool QDropbox2File::open(QIODevice::OpenMode mode)
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "QDropbox2File: _buffer cleared." << endl;
 #endif
+        // anything left of an earlier background upload is abandoned
+        resetStream();
+        if(putTrace)
+            _api->traceEnd(putTrace, "putFile", {{"abandoned", true}});
+        putTrace = 0;
+
         _buffer->clear();
         position = 0;
+        currentThreshold = 0;
         result = true;
     }
     else
@@ -122,7 +169,10 @@ bool QDropbox2File::open(QIODevice::OpenMode mode)
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "QDropbox2File: reading file content" << endl;
 #endif
-        if(getFile(_filename))  // this will return true if the file doesn't already exist
+        bool have_metadata = false;
+        if(!isMode(QIODevice::WriteOnly) && openFromCache(have_metadata))
+            result = true;
+        else if(getFile(_filename))  // this will return true if the file doesn't already exist
         {
             if(isMode(QIODevice::WriteOnly)) // write mode here means append
                 position = _buffer->size();
@@ -130,8 +180,17 @@ bool QDropbox2File::open(QIODevice::OpenMode mode)
                 position = 0;
 
             result = (lastErrorCode == 0 || lastErrorCode == 200 || fileExists);
-            if(fileExists)
+            if(fileExists && !have_metadata)
                 obtainMetadata();
+
+            QDropbox2ContentCache* cache = _api->contentCache();
+            if(cache && fileExists && result && !downloadKey.isEmpty())
+            {
+                // streamed, as the content may be too large for one QByteArray
+                QScopedPointer<QIODevice> content(_buffer->createReader(0, _buffer->size()));
+                cache->insert(downloadKey, content.data());
+                cache->setFresh(_filename, downloadKey);
+            }
         }
     }
 
@@ -140,11 +199,87 @@ bool QDropbox2File::open(QIODevice::OpenMode mode)
 
 void QDropbox2File::close()
 {
-    if(isMode(QIODevice::WriteOnly) && _buffer->length())
+    if(isMode(QIODevice::WriteOnly) && !_buffer->isEmpty())
         flush();
+    releaseCacheFile();
     QIODevice::close();
 }
 
+bool QDropbox2File::openFromCache(bool& have_metadata)
+{
+    QDropbox2ContentCache* cache = _api ? _api->contentCache() : nullptr;
+    if(!cache)
+        return false;
+
+    QString key;
+    if(!cache->freshKey(_filename, key))
+    {
+        // confirm the current revision with the server; this is far
+        // cheaper than downloading the content
+        obtainMetadata();
+        have_metadata = true;
+        if(!_metadata || _metadata->id().isEmpty() || _metadata->isDeleted() || _metadata->isDirectory())
+            return false;
+
+        key = QDropbox2ContentCache::key(_metadata->id(), _metadata->revisionHash());
+        cache->setFresh(_filename, key);
+    }
+
+    cacheFile = cache->open(key);
+    if(!cacheFile)
+        return false;
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2File: serving" << _filename << "from cache entry" << key << endl;
+#endif
+
+    const qint64 size = cacheFile->size();
+    if(size > std::numeric_limits<int>::max())
+    {
+        // a QByteArray cannot refer to a mapping that large; download instead
+        releaseCacheFile();
+        return false;
+    }
+
+    if(size)
+    {
+        uchar* mapped = cacheFile->map(0, size);
+        if(!mapped)
+        {
+            releaseCacheFile();
+            return false;
+        }
+
+        // the buffer refers to the mapping directly; it is never written to
+        // in read-only mode, and would detach (copy) if it were
+        _buffer->setContent(QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), size));
+    }
+    else
+        _buffer->clear();
+
+    fileExists = true;
+    position = 0;
+    lastErrorCode = 0;
+    lastErrorMessage.clear();
+
+    emit readyRead();
+    return true;
+}
+
+void QDropbox2File::releaseCacheFile()
+{
+    if(!cacheFile)
+        return;
+
+    // drop the buffer's reference to the mapping before it goes away
+    if(_buffer)
+        _buffer->clear();
+
+    cacheFile->close();     // also unmaps
+    delete cacheFile;
+    cacheFile = nullptr;
+}
+
 void QDropbox2File::setApi(QDropbox2 *dropbox)
 {
     _api = dropbox;
@@ -172,12 +307,17 @@ bool QDropbox2File::event(QEvent *event)
     return QIODevice::event(event);
 }
 
-//void QDropbox2File::setFlushThreshold(qint64 num)
-//{
-//    if(num < 0)
-//        num = MaxSingleUpload;
-//    bufferThreshold = num;
-//}
+void QDropbox2File::setFlushThreshold(qint64 num)
+{
+    bufferThreshold = qMax(qint64(0), num);
+}
+
+void QDropbox2File::setMemoryBudget(qint64 bytes)
+{
+    _memoryBudget = bytes;
+    if(_buffer)
+        _buffer->setMemoryBudget(bytes);
+}
 
 void QDropbox2File::setOverwrite(bool overwrite)
 {
@@ -195,51 +335,82 @@ qint64 QDropbox2File::readData(char *data, qint64 maxlen)
         return maxlen;      // we do no "post-reading operations"
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "QDropbox2File::readData(...), maxlen = " << maxlen << endl;
-    QString buff_str = QString(*_buffer);
-    //qDebug() << "old bytes = " << _buffer->toHex() << ", str: " << buff_str <<  endl;
-    qDebug() << "old size = " << _buffer->size() << endl;
+    qDebug() << "QDropbox2File::readData(...), maxlen = " << maxlen << ", position = " << position << ", size = " << _buffer->size() << endl;
 #endif
 
-    if(_buffer->size() == 0 || position >= _buffer->size())
-        return 0;
+    // straight from the backing store (which may be a cache mapping)
+    const qint64 read = _buffer->read(position, data, maxlen);
 
-    if(_buffer->size() < maxlen)
-        maxlen = _buffer->size();
+    position += read;
 
-    QByteArray tmp = _buffer->mid(position, maxlen);
-    const qint64 read = tmp.size();
-    memcpy(data, tmp.data(), read);
+    return read;
+}
 
-#ifdef QTDROPBOX_DEBUG
-    qDebug() << "new size = " << _buffer->size() << endl;
-    //qDebug() << "new bytes = " << _buffer->toHex() << endl;
-#endif
+qint64 QDropbox2File::readLineData(char *data, qint64 maxlen)
+{
+    // QIODevice would otherwise read a line one byte at a time
+    const qint64 read = _buffer->readLine(position, data, maxlen);
 
     position += read;
 
     return read;
 }
 
-qint64 QDropbox2File::writeData(const char *data, qint64 len)
+QByteArray QDropbox2File::slice(qint64 maxlen) const
 {
-    int written_bytes = 0;
+    if(!_buffer || position >= _buffer->size())
+        return QByteArray();
+
+    const qint64 available = _buffer->size() - position;
+    if(maxlen < 0 || maxlen > available)
+        maxlen = available;
+
+    // a QByteArray holds no more than this
+    if(maxlen > QDropbox2ChunkedBuffer::MaxArraySize)
+        return QByteArray();
 
-    qint64 oldlen = _buffer->size();
-    _buffer->insert(position, data, len);
+    // heap blocks can be shared outright; a cache mapping goes away on
+    // close(), so its content has to be copied out
+    if(!cacheFile)
+        return _buffer->mid(position, maxlen);
 
-    //// flush if the threshold is reached
-    //if(currentThreshold > bufferThreshold)
-    //    flush();
+    QByteArray copy(int(maxlen), Qt::Uninitialized);
+    _buffer->read(position, copy.data(), maxlen);
+    return copy;
+}
+
+QByteArray QDropbox2File::peekShared(qint64 maxlen) const
+{
+    return slice(maxlen);
+}
+
+QByteArray QDropbox2File::readAllShared()
+{
+    QByteArray result = slice(-1);
+    position += result.size();
+    return result;
+}
 
-    currentThreshold += len;
-    written_bytes = len;
+qint64 QDropbox2File::writeData(const char *data, qint64 len)
+{
+    if(streamFailed || streamLost || position < streamedTo())
+    {
+        setErrorString((streamFailed || streamLost) ? lastErrorMessage : "Content before this position has already been uploaded");
+        return -1;
+    }
 
-    if(_buffer->size() != oldlen+len)
-        written_bytes = (oldlen-_buffer->size());
+    // overwrites at the position, and extends the content past its end
+    qint64 written_bytes = _buffer->write(position, data, len);
+    if(written_bytes < 0)
+        return written_bytes;
 
+    currentThreshold += written_bytes;
     position += written_bytes;
 
+    // upload full chunks in the background once the threshold is reached
+    if(bufferThreshold > 0 && currentThreshold >= bufferThreshold)
+        streamChunks();
+
     return written_bytes;
 }
 
@@ -259,8 +430,7 @@ void QDropbox2File::slot_networkRequestFinished(QNetworkReply *reply)
     {
         if(lastErrorCode == QNetworkReply::NoError)
         {
-            QByteArray buff = reply->readAll();
-            lastResponse = QString(buff);
+            lastResponse = reply->readAll();
     #ifdef QTDROPBOX_DEBUG
             qDebug() << "QDropbox2Folder::slot_networkRequestFinished(...)" << endl;
             qDebug() << "request was: " << reply->url().toString() << endl;
@@ -284,14 +454,36 @@ bool QDropbox2File::isMode(QIODevice::OpenMode mode)
 QNetworkReply* QDropbox2File::sendPOST(QNetworkRequest& rq, QByteArray& postdata)
 {
     QNetworkReply *reply = QNAM.post(rq, postdata);
+    _api->trackRequest(reply);
     connect(this, &QDropbox2File::signal_operationAborted, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::uploadProgress, this, &QDropbox2File::slot_uploadProgress);
     return reply;
 }
 
+QNetworkReply* QDropbox2File::sendPOST(QNetworkRequest& rq, QIODevice* device)
+{
+    // the content is streamed from the device rather than copied into the
+    // request; the reply takes ownership of it
+    rq.setHeader(QNetworkRequest::ContentLengthHeader, device->size());
+
+    QNetworkReply *reply = QNAM.post(rq, device);
+    device->setParent(reply);
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2File::signal_operationAborted, reply, &QNetworkReply::abort);
+    connect(reply, &QNetworkReply::uploadProgress, this, &QDropbox2File::slot_uploadProgress);
+    return reply;
+}
+
+void QDropbox2File::appendContent(const QByteArray& data)
+{
+    if(!data.isEmpty())
+        _buffer->write(_buffer->size(), data.constData(), data.size());
+}
+
 QNetworkReply* QDropbox2File::sendGET(QNetworkRequest& rq)
 {
     QNetworkReply *reply = QNAM.get(rq);
+    _api->trackRequest(reply);
     connect(this, &QDropbox2File::signal_operationAborted, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::downloadProgress, this, &QDropbox2File::signal_downloadProgress);
     return reply;
@@ -312,15 +504,27 @@ bool QDropbox2File::getFile(const QString& filename)
     if(!_api->createAPIv2Reqeust(url, req))
         return result;
 
-    req.setRawHeader("Dropbox-API-arg", QString("{ \"path\": \"%1\" }")
-                                                .arg((filename.compare("/") == 0) ? "" : filename).toUtf8());
+    QDropbox2JsonWriter json(filename.size(), QDropbox2JsonWriter::AsciiSafe);
+    json.beginObject()
+            .value("path", (filename.compare("/") == 0) ? QString() : filename)
+        .endObject();
+    req.setRawHeader("Dropbox-API-arg", json.data());
 
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "QDropbox2File::getFileContent " << url.toString() << endl;
 #endif
 
+    downloadKey.clear();
+    _buffer->clear();
     QNetworkReply* reply = sendGET(req);
 
+    // the content goes into the buffer as it arrives, rather than being
+    // collected by the reply: a QByteArray cannot hold more than 2 GB
+    connect(reply, &QNetworkReply::readyRead, this, [=]() {
+        if(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() / 100 == 2)
+            appendContent(reply->readAll());
+    });
+
     CallbackPtr reply_data(new CallbackData);
     reply_data->callback = &QDropbox2File::resultGetFile;
     replyMap[reply] = reply_data;
@@ -345,21 +549,17 @@ void QDropbox2File::resultGetFile(QNetworkReply *reply, CallbackPtr /*reply_data
     lastErrorCode = 0;
 
     QByteArray response = reply->readAll();
-    QString resp_str;
 
 //#ifdef QTDROPBOX_DEBUG
-//    resp_str = QString(response.toHex());
-//    qDebug() << "QDropbox2File::replyFileContent response = " << resp_str << endl;
-//
+//    qDebug() << "QDropbox2File::replyFileContent response = " << response.toHex() << endl;
 //#endif
 
     if(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == QDROPBOX_V2_ERROR)
     {
-        resp_str = QString(response);
         lastErrorMessage = "";
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(resp_str.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -378,8 +578,18 @@ void QDropbox2File::resultGetFile(QNetworkReply *reply, CallbackPtr /*reply_data
     }
     else
     {
-        _buffer->clear();
-        _buffer->append(response);
+        appendContent(response);
+
+        // the metadata of the revision actually downloaded is returned
+        // in a header; that identifies the content for the cache
+        if(_api->contentCache())
+        {
+            QJsonDocument json = QJsonDocument::fromJson(reply->rawHeader("Dropbox-API-Result"));
+            QJsonObject object = json.object();
+            if(object.contains("id") && object.contains("rev"))
+                downloadKey = QDropbox2ContentCache::key(object.value("id").toString(), object.value("rev").toString());
+        }
+
         emit readyRead();
     }
 
@@ -394,9 +604,17 @@ bool QDropbox2File::putFile()
     qDebug() << "QDropbox2File::putFile()" << endl;
 #endif
 
+    if(streamLost)
+    {
+        lastErrorCode = QDropbox2::APIError;
+        lastErrorMessage = "Part of the content was lost with a failed upload session; open the file again to rewrite it.";
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        return result;
+    }
+
     QUrl url;
     url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
-    if(_buffer->length() <= MaxSingleUpload)
+    if(_buffer->size() <= MaxSingleUpload)
         url.setPath("/2/files/upload");
     else
         url.setPath("/2/files/upload_session/start");
@@ -408,40 +626,95 @@ bool QDropbox2File::putFile()
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
-    QString json = QString("{ \"path\": \"%1\", \"mode\": \"%2\", \"autorename\": %3, \"mute\": true }")
-                                        .arg(_filename)
-                                        .arg(overwrite_ ? "overwrite" : "add")
-                                        .arg(rename ? "true" : "false");
+    QDropbox2JsonWriter json(_filename.size(), QDropbox2JsonWriter::AsciiSafe);
+    json.beginObject()
+            .value("path", _filename)
+            .value("mode", overwrite_ ? "overwrite" : "add")
+            .value("autorename", rename)
+            .value("mute", true)
+        .endObject();
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "QDropbox2File::Dropbox-API-arg " << json << endl;
+    qDebug() << "QDropbox2File::Dropbox-API-arg " << json.data() << endl;
     qDebug() << "QDropbox2File::putFile " << url.toString() << endl;
 #endif
     QNetworkReply* reply = nullptr;
 
-    if(_buffer->length() <= MaxSingleUpload)
+    if(!putTrace)
+        putTrace = _api->traceBegin("putFile", {{"path", _filename}, {"bytes", _buffer->size()}});
+
+    if(streamSession)
+    {
+        // full chunks have been going up while the file was written; wait
+        // for the last of them, then finish the session with the rest
+        while(streamReply)
+        {
+            streamWaiting = true;
+            startEventLoop();
+            streamWaiting = false;
+        }
+
+        if(!streamFailed)
+        {
+            streamSession->session_parameters = json.data();
+            if(!continueSession(streamSession))
+            {
+                lastErrorCode = QDropbox2::APIError;
+                lastErrorMessage = "Could not create the request for the next upload session chunk.";
+            }
+            else
+                startEventLoop();
+        }
+        else if(_buffer->discarded() > 0)
+        {
+            // what the lost session had was released from the buffer, so
+            // the file cannot be uploaded again from the start; fail for
+            // good rather than upload it truncated
+            _buffer->clear();
+            position = 0;
+            currentThreshold = 0;
+            streamLost = true;
+        }
+
+        resetStream();
+    }
+    else if(_buffer->size() <= MaxSingleUpload)
     {
-        req.setRawHeader("Dropbox-API-arg", json.toUtf8());
-        reply = sendPOST(req, *_buffer);
+        req.setRawHeader("Dropbox-API-arg", json.data());
+
+        putStep = "upload";
+        _api->traceStep(putTrace, putStep, {{"bytes", _buffer->size()}});
+        reply = sendPOST(req, _buffer->createReader(0, _buffer->size()));
     }
     else
     {
-        QString session_json = QString("{ \"close\": false }");
-        req.setRawHeader("Dropbox-API-arg", session_json.toUtf8());
+        QDropbox2JsonWriter session_json;
+        session_json.beginObject()
+                        .value("close", false)
+                    .endObject();
+        req.setRawHeader("Dropbox-API-arg", session_json.data());
 
         QByteArray dummy_data;
+        putStep = "upload_session/start";
+        _api->traceStep(putTrace, putStep);
         reply = sendPOST(req, dummy_data);
 
-        session_starts[reply] = json;
+        session_starts[reply] = json.data();
     }
 
     // "{ \"path\": \"%1\", \"mode\": \"overwrite\", \"autorename\": %2, \"mute\": true }"
     // "{ \"path\": \"%1\", \"mode\": \"update\", \"autorename\": %2, \"mute\": true }"
 
-    CallbackPtr reply_data(new CallbackData);
-    reply_data->callback = &QDropbox2File::resultPutFile;
-    replyMap[reply] = reply_data;
+    if(reply)
+    {
+        CallbackPtr reply_data(new CallbackData);
+        reply_data->callback = &QDropbox2File::resultPutFile;
+        replyMap[reply] = reply_data;
 
-    startEventLoop();
+        startEventLoop();
+    }
+
+    _api->traceEnd(putTrace, "putFile", {{"error", lastErrorCode}});
+    putTrace = 0;
 
     result = (lastErrorCode == 0);
     if(!result)
@@ -453,6 +726,8 @@ bool QDropbox2File::putFile()
     }
     else
     {
+        invalidateCaches(_filename);
+
         // we wrote the whole file, so reset
         _buffer->clear();
         position = 0;
@@ -471,20 +746,19 @@ void QDropbox2File::resultPutFile(QNetworkReply *reply, CallbackPtr /*reply_data
     lastErrorCode = 0;
 
     QByteArray response = reply->readAll();
-    QString resp_str;
 
 #ifdef QTDROPBOX_DEBUG
-    resp_str = response;
-    qDebug() << "QDropbox2File::resultPutFile response = " << resp_str << endl;
+    qDebug() << "QDropbox2File::resultPutFile response = " << response << endl;
 #endif
 
+    _api->traceEnd(putTrace, putStep, {{"status", reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt()}});
+
     if(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == QDROPBOX_V2_ERROR)
     {
-        resp_str = QString(response);
         lastErrorMessage = "";
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(resp_str.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -499,6 +773,13 @@ void QDropbox2File::resultPutFile(QNetworkReply *reply, CallbackPtr /*reply_data
         qDebug() << "QDropbox2File::resultPutFile jason.valid = " << json.isValid() << endl;
 #endif
 
+        if(upload_sessions.contains(reply))
+        {
+            chunkController.recordFailure(upload_sessions[reply]->session_payload);
+            upload_sessions.remove(reply);
+        }
+        session_starts.remove(reply);
+
         emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
     }
     else
@@ -535,6 +816,8 @@ void QDropbox2File::resultPutFile(QNetworkReply *reply, CallbackPtr /*reply_data
         {
             // continue an active session
             sd = upload_sessions[reply];
+            chunkController.recordSuccess(sd->session_payload, sd->payload_timer.elapsed());
+
             // set this here so upload progress uses correct values
             sd->session_offset += sd->session_payload;
 
@@ -544,47 +827,17 @@ void QDropbox2File::resultPutFile(QNetworkReply *reply, CallbackPtr /*reply_data
         // do we have an active upload session?
         if(!sd.isNull())
         {
-            int remaining = _buffer->length() - sd->session_offset;
+            qint64 remaining = _buffer->size() - sd->session_offset;
 
             if(remaining)
             {
-                QUrl url;
-                url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
-
-                // have we reached the end of the buffer?
-                if(remaining <= MaxSingleUpload)
-                    url.setPath("/2/files/upload_session/finish");      // upload the final chunk
-                else
-                    url.setPath("/2/files/upload_session/append_v2");   // upload the next chunk
-
-                Q_ASSERT(url.isValid());
-
-                QNetworkRequest req;
-                if(!_api->createAPIv2Reqeust(url, req))
-                    return;
-
-                req.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
-                QString json = QString("{ \"cursor\": { \"session_id\": \"%1\", \"offset\": %2 }, ")
-                                        .arg(sd->session_id)
-                                        .arg(sd->session_offset);
-
-                if(remaining <= MaxSingleUpload)
-                    json += QString("\"commit\": %3 }").arg(sd->session_parameters);
-                else
-                    json += QStringLiteral("\"close\": false }");
-
-                req.setRawHeader("Dropbox-API-arg", json.toUtf8());
-
-                sd->session_payload = (remaining < MaxSingleUpload) ? remaining : MaxSingleUpload;
-
-                QByteArray session_data = _buffer->mid(sd->session_offset, sd->session_payload);
-                QNetworkReply* new_reply = sendPOST(req, session_data);
-
-                upload_sessions[new_reply] = sd;
-
-                CallbackPtr reply_data(new CallbackData);
-                reply_data->callback = &QDropbox2File::resultPutFile;
-                replyMap[new_reply] = reply_data;
+                if(!continueSession(sd))
+                {
+                    lastErrorCode = QDropbox2::APIError;
+                    lastErrorMessage = "Could not create the request for the next upload session chunk.";
+                    emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+                    stopEventLoop();
+                }
 
                 // not very structured, but we need to keep the event loop
                 // going, so we bail here...
@@ -605,6 +858,220 @@ void QDropbox2File::resultPutFile(QNetworkReply *reply, CallbackPtr /*reply_data
     stopEventLoop();
 }
 
+QNetworkReply* QDropbox2File::continueSession(SessionPtr sd)
+{
+    qint64 remaining = _buffer->size() - sd->session_offset;
+
+    // the chunk size adapts to the link, rather than always being the
+    // largest a request may carry
+    const qint64 chunk = chunkController.chunkSize();
+    const bool last = (remaining <= chunk);
+
+    QUrl url;
+    url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
+
+    // have we reached the end of the buffer?
+    if(last)
+        url.setPath("/2/files/upload_session/finish");      // upload the final chunk
+    else
+        url.setPath("/2/files/upload_session/append_v2");   // upload the next chunk
+
+    Q_ASSERT(url.isValid());
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+        return nullptr;
+
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
+    QDropbox2JsonWriter json(sd->session_id.size() + sd->session_parameters.size(), QDropbox2JsonWriter::AsciiSafe);
+    json.beginObject()
+            .beginObject("cursor")
+                .value("session_id", sd->session_id)
+                .value("offset", sd->session_offset)
+            .endObject();
+
+    if(last)
+        json.raw("commit", sd->session_parameters);
+    else
+        json.value("close", false);
+
+    json.endObject();
+
+    req.setRawHeader("Dropbox-API-arg", json.data());
+
+    sd->session_payload = last ? remaining : chunk;
+    sd->payload_timer.start();
+
+    putStep = last ? "upload_session/finish" : "upload_session/append_v2";
+    _api->traceStep(putTrace, putStep, {{"offset", sd->session_offset}, {"bytes", sd->session_payload}});
+    QNetworkReply* reply = sendPOST(req, _buffer->createReader(sd->session_offset, sd->session_payload));
+
+    upload_sessions[reply] = sd;
+
+    CallbackPtr reply_data(new CallbackData);
+    reply_data->callback = &QDropbox2File::resultPutFile;
+    replyMap[reply] = reply_data;
+
+    return reply;
+}
+
+//--------------------------------------
+// Background upload while writing
+
+qint64 QDropbox2File::streamChunkSize() const
+{
+    // multiples of 4 MB below the request size limit, sized to the link as
+    // measured from the chunks already sent
+    return chunkController.chunkSize();
+}
+
+qint64 QDropbox2File::streamedTo() const
+{
+    if(!streamSession)
+        return 0;
+    return streamSession->session_offset + (streamReply ? streamSession->session_payload : 0);
+}
+
+void QDropbox2File::streamChunks()
+{
+    if(!_api || streamReply || streamFailed)
+        return;
+
+    const qint64 chunk = streamChunkSize();
+    const qint64 offset = streamSession ? streamSession->session_offset : 0;
+    if(_buffer->size() - offset < chunk)
+        return;
+
+    QUrl url;
+    url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
+
+    QDropbox2JsonWriter json(streamSession ? streamSession->session_id.size() : 0, QDropbox2JsonWriter::AsciiSafe);
+    if(!streamSession)
+    {
+        // the first chunk opens the session
+        url.setPath("/2/files/upload_session/start");
+        json.beginObject()
+                .value("close", false)
+            .endObject();
+    }
+    else
+    {
+        url.setPath("/2/files/upload_session/append_v2");
+        json.beginObject()
+                .beginObject("cursor")
+                    .value("session_id", streamSession->session_id)
+                    .value("offset", offset)
+                .endObject()
+                .value("close", false)
+            .endObject();
+    }
+
+    Q_ASSERT(url.isValid());
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+        return;
+
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
+    req.setRawHeader("Dropbox-API-arg", json.data());
+
+    if(!streamSession)
+    {
+        streamSession = SessionPtr(new SessionData());
+        putTrace = _api->traceBegin("putFile", {{"path", _filename}, {"streaming", true}});
+        putStep = "upload_session/start";
+    }
+    else
+        putStep = "upload_session/append_v2";
+
+    streamSession->session_payload = chunk;
+    streamSession->payload_timer.start();
+    _api->traceStep(putTrace, putStep, {{"offset", offset}, {"bytes", chunk}});
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2File::streamChunks " << url.toString() << offset << chunk << endl;
+#endif
+
+    streamReply = sendPOST(req, _buffer->createReader(offset, chunk));
+
+    CallbackPtr reply_data(new CallbackData);
+    reply_data->callback = &QDropbox2File::streamCallback;
+    replyMap[streamReply] = reply_data;
+}
+
+void QDropbox2File::streamCallback(QNetworkReply* reply, CallbackPtr /*reply_data*/)
+{
+    streamReply = nullptr;
+
+    QByteArray response = reply->readAll();
+    _api->traceEnd(putTrace, putStep, {{"status", reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt()}});
+
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    QJsonObject object = (jsonError.error == QJsonParseError::NoError) ? json.object() : QJsonObject();
+
+    if(lastErrorCode == QNetworkReply::NoError && streamSession->session_id.isEmpty())
+    {
+        streamSession->session_id = object.value("session_id").toString();
+        if(streamSession->session_id.isEmpty())
+            lastErrorCode = QDropbox2::APIError;
+    }
+
+    if(lastErrorCode == QNetworkReply::NoError)
+    {
+        chunkController.recordSuccess(streamSession->session_payload, streamSession->payload_timer.elapsed());
+
+        streamSession->session_offset += streamSession->session_payload;
+        streamSession->session_payload = 0;
+
+        // the server has it; release it from memory (or the spill file)
+        _buffer->discard(streamSession->session_offset);
+    }
+    else
+    {
+        chunkController.recordFailure(streamSession->session_payload);
+        streamFailed = true;
+
+        if(object.contains("user_message"))
+            lastErrorMessage = object.value("user_message").toString();
+        else if(object.contains("error_summary"))
+            lastErrorMessage = object.value("error_summary").toString();
+        else
+            lastErrorMessage = reply->errorString();
+
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2File::streamCallback error: " << lastErrorCode << lastErrorMessage << endl;
+#endif
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+    }
+
+    if(streamWaiting)
+        stopEventLoop();
+    else
+        streamChunks();
+}
+
+void QDropbox2File::resetStream()
+{
+    if(streamReply)
+    {
+        // abandon the chunk in flight without it being reported as an error
+        QNetworkReply* reply = streamReply;
+        streamReply = nullptr;
+        if(replyMap.contains(reply))
+            replyMap[reply]->callback = nullptr;
+
+        const int error_code = lastErrorCode;
+        const QString error_message = lastErrorMessage;
+        reply->abort();
+        lastErrorCode = error_code;
+        lastErrorMessage = error_message;
+    }
+
+    streamSession.clear();
+    streamFailed = false;
+}
+
 void QDropbox2File::startEventLoop()
 {
 #ifdef QTDROPBOX_DEBUG
@@ -653,6 +1120,18 @@ void QDropbox2File::obtainMetadata()
     }
     else
     {
+        QDropbox2MetadataCache* cache = _api->metadataCache();
+
+        QDropbox2Entry entry;
+        if(cache->lookup(_filename, entry))
+        {
+            lastErrorCode = 0;
+            _metadata = new QDropbox2EntityInfo(entry);
+            return;
+        }
+
+        const quint64 generation = cache->generation();
+
         QUrl url;
         url.setUrl(QDROPBOX2_API_URL);
         url.setPath(QString("/2/files/get_metadata"));
@@ -665,12 +1144,17 @@ void QDropbox2File::obtainMetadata()
         if(!_api->createAPIv2Reqeust(url, req))
             return;
         req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-        QString json = QString("{\"path\": \"%1\", \"include_media_info\": true, \"include_deleted\": true, \"include_has_explicit_shared_members\": true}")
-                                    .arg(_filename);
+        QDropbox2JsonWriter json(_filename.size());
+        json.beginObject()
+                .value("path", _filename)
+                .value("include_media_info", true)
+                .value("include_deleted", true)
+                .value("include_has_explicit_shared_members", true)
+            .endObject();
 #ifdef QTDROPBOX_DEBUG
-        qDebug() << "postdata = \"" << json << "\"" << endl;;
+        qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-        QByteArray postdata = json.toUtf8();
+        QByteArray postdata = json.data();
         (void)sendPOST(req, postdata);
 
         startEventLoop();
@@ -685,11 +1169,12 @@ void QDropbox2File::obtainMetadata()
         else
         {
             QJsonParseError jsonError;
-            QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+            QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
             if(jsonError.error == QJsonParseError::NoError)
             {
                 QJsonObject object = json.object();
                 _metadata = new QDropbox2EntityInfo(object);
+                cache->insert(_metadata->toEntry(), generation);
             }
             else
             {
@@ -704,6 +1189,16 @@ void QDropbox2File::obtainMetadata()
     }
 }
 
+void QDropbox2File::invalidateCaches(const QString& path)
+{
+    // changes we make ourselves will also arrive as deltas for watched
+    // folders, but not before the caller may look at the result
+    _api->metadataCache()->invalidate(path);
+    _api->linkCache()->invalidate(path);
+    if(_api->contentCache())
+        _api->contentCache()->invalidate(path);
+}
+
 bool QDropbox2File::hasChanged()
 {
     if(lastHash.isEmpty())
@@ -766,7 +1261,7 @@ bool QDropbox2File::revisions(QDropbox2File::RevisionsList& revisions, quint64 m
         result = true;
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -829,7 +1324,7 @@ void QDropbox2File::revisionsCallback(QNetworkReply* /*reply*/, CallbackPtr /*re
         RevisionsList revisions_results;
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -876,14 +1371,16 @@ bool QDropbox2File::getRevisions(QNetworkReply*& reply, quint64 max_results, boo
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"path\": \"%1\", \"limit\": %2}")
-                            .arg(_filename)
-                            .arg(max_results);
+    QDropbox2JsonWriter json(_filename.size());
+    json.beginObject()
+            .value("path", _filename)
+            .value("limit", max_results)
+        .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     reply = sendPOST(req, postdata);
 
     if(async)
@@ -920,7 +1417,9 @@ void QDropbox2File::slot_abort()
 void QDropbox2File::slot_uploadProgress(qint64 bytesSent, qint64 bytesTotal)
 {
     QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    if(!session_starts.contains(reply) && !upload_sessions.contains(reply))
+    if(reply && reply == streamReply)
+        emit signal_uploadProgress(streamSession->session_offset + bytesSent, _buffer->size());
+    else if(!session_starts.contains(reply) && !upload_sessions.contains(reply))
         emit signal_uploadProgress(bytesSent, bytesTotal);
     else if(bytesTotal && !session_starts.contains(reply))    // no progress with a start
     {
@@ -932,13 +1431,15 @@ void QDropbox2File::slot_uploadProgress(qint64 bytesSent, qint64 bytesTotal)
 
         // 'sd->session_payload' should be equal to 'bytesTotal'
 
-        emit signal_uploadProgress(sd->session_offset + bytesSent, _buffer->length());
+        emit signal_uploadProgress(sd->session_offset + bytesSent, _buffer->size());
     }
 }
 
 qint64 QDropbox2File::bytesAvailable() const
 {
-    return _buffer->size();
+    if(!_buffer || position >= _buffer->size())
+        return QIODevice::bytesAvailable();
+    return (_buffer->size() - position) + QIODevice::bytesAvailable();
 }
 
 bool QDropbox2File::remove(bool permanently)
@@ -968,12 +1469,14 @@ bool QDropbox2File::requestRemoval(bool permanently)
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"path\": \"%1\"}")
-                                .arg((_filename.compare("/") == 0) ? "" : _filename);
+    QDropbox2JsonWriter json(_filename.size());
+    json.beginObject()
+            .value("path", (_filename.compare("/") == 0) ? QString() : _filename)
+        .endObject();
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -986,6 +1489,8 @@ bool QDropbox2File::requestRemoval(bool permanently)
 #endif
         emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
     }
+    else
+        invalidateCaches(_filename);
 
     return result;
 }
@@ -1014,15 +1519,18 @@ bool QDropbox2File::requestMove(const QString& to_path)
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"from_path\": \"%1\", \"to_path\": \"%2\", \"autorename\": %3, \"allow_shared_folder\": false}")
-                                    .arg(_filename)
-                                    .arg(to_path)
-                                    .arg(rename ? "true" : "false");
+    QDropbox2JsonWriter json(_filename.size() + to_path.size());
+    json.beginObject()
+            .value("from_path", _filename)
+            .value("to_path", to_path)
+            .value("autorename", rename)
+            .value("allow_shared_folder", false)
+        .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -1035,6 +1543,11 @@ bool QDropbox2File::requestMove(const QString& to_path)
 #endif
         emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
     }
+    else
+    {
+        invalidateCaches(_filename);
+        invalidateCaches(to_path);
+    }
 
     return result;
 }
@@ -1064,15 +1577,18 @@ bool QDropbox2File::requestCopy(const QString& to_path)
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"from_path\": \"%1\", \"to_path\": \"%2\", \"autorename\": %3, \"allow_shared_folder\": false}")
-                                    .arg(_filename)
-                                    .arg(to_path)
-                                    .arg(rename ? "true" : "false");
+    QDropbox2JsonWriter json(_filename.size() + to_path.size());
+    json.beginObject()
+            .value("from_path", _filename)
+            .value("to_path", to_path)
+            .value("autorename", rename)
+            .value("allow_shared_folder", false)
+        .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -1085,12 +1601,204 @@ bool QDropbox2File::requestCopy(const QString& to_path)
 #endif
         emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
     }
+    else
+        invalidateCaches(to_path);
 
     return result;
 }
 
+bool QDropbox2File::requestObject(const QString& path, const QByteArray& postdata, QJsonObject& object)
+{
+    QUrl url;
+    url.setUrl(QDROPBOX2_API_URL, QUrl::StrictMode);
+    url.setPath(path);
+
+    Q_ASSERT(url.isValid());
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+        return false;
+
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "postdata = \"" << postdata << "\"" << endl;;
+#endif
+    QByteArray data = postdata;
+    (void)sendPOST(req, data);
+
+    startEventLoop();
+
+    if(lastErrorCode == 0)
+    {
+        QJsonParseError jsonError;
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
+        if(jsonError.error == QJsonParseError::NoError)
+            object = json.object();
+        else
+        {
+            lastErrorCode = QDropbox2::APIError;
+            lastErrorMessage = QString("Dropbox API did not send correct answer for %1.").arg(path);
+        }
+    }
+
+    if(lastErrorCode != 0)
+    {
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2File::requestObject error: " << path << lastErrorCode << lastErrorMessage << endl;
+#endif
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        return false;
+    }
+
+    return true;
+}
+
+bool QDropbox2File::saveUrl(const QUrl& url)
+{
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2File::saveUrl()" << endl;
+#endif
+
+    const QString source = url.toString(QUrl::FullyEncoded);
+    QDropbox2JsonWriter json(_filename.size() + source.size());
+    json.beginObject()
+            .value("path", _filename)
+            .value("url", source)
+        .endObject();
+
+    QJsonObject object;
+    if(!requestObject("/2/files/save_url", json.data(), object))
+        return false;
+
+    const QString job = object.value("async_job_id").toString();
+    int interval = jobPollFirst;
+    QString tag = object.value(".tag").toString();
+    while(tag != "complete")
+    {
+        if(tag == "failed")
+        {
+            lastErrorCode = QDROPBOX_V2_ERROR;
+            lastErrorMessage = QString("The URL could not be saved: %1").arg(object.value("failed").toObject().value(".tag").toString());
+            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            return false;
+        }
+
+        if((tag != "async_job_id" && tag != "in_progress") || job.isEmpty())
+        {
+            lastErrorCode = QDropbox2::APIError;
+            lastErrorMessage = "Dropbox API did not send correct answer for save_url job.";
+            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            return false;
+        }
+
+        // the content is being fetched by the server; nothing to do but wait
+        bool aborted = false;
+        QEventLoop wait;
+        QTimer::singleShot(interval, &wait, SLOT(quit()));
+        connect(this, &QDropbox2File::signal_operationAborted, &wait, [&]() { aborted = true; wait.quit(); });
+        wait.exec();
+        if(aborted)
+        {
+            lastErrorCode = QNetworkReply::OperationCanceledError;
+            lastErrorMessage = "Stopped waiting for the save_url job.";
+            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            return false;
+        }
+        interval = qMin(interval * 2, jobPollLast);
+
+        QDropbox2JsonWriter check(job.size());
+        check.beginObject()
+                .value("async_job_id", job)
+            .endObject();
+        if(!requestObject("/2/files/save_url/check_job_status", check.data(), object))
+            return false;
+        tag = object.value(".tag").toString();
+    }
+
+    invalidateCaches(_filename);
+    return true;
+}
+
+void QDropbox2File::setJobPolling(int first, int last)
+{
+    jobPollFirst = qMax(1, first);
+    jobPollLast = qMax(jobPollFirst, last);
+}
+
+QString QDropbox2File::copyReference(QDateTime* expires)
+{
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2File::copyReference()" << endl;
+#endif
+
+    QDropbox2JsonWriter json(_filename.size());
+    json.beginObject()
+            .value("path", _filename)
+        .endObject();
+
+    QJsonObject object;
+    if(!requestObject("/2/files/copy_reference/get", json.data(), object))
+        return QString();
+
+    if(expires)
+    {
+        qint64 msecs;
+        if(QDropbox2EntityInfo::parseTimestamp(object.value("expires").toString(), msecs))
+            *expires = QDateTime::fromMSecsSinceEpoch(msecs, Qt::UTC);
+        else
+            *expires = QDateTime();
+    }
+
+    const QString reference = object.value("copy_reference").toString();
+    if(reference.isEmpty())
+    {
+        lastErrorCode = QDropbox2::APIError;
+        lastErrorMessage = "Dropbox API did not send correct answer for copy reference data.";
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+    }
+
+    return reference;
+}
+
+bool QDropbox2File::saveCopyReference(const QString& reference)
+{
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2File::saveCopyReference()" << endl;
+#endif
+
+    QDropbox2JsonWriter json(_filename.size() + reference.size());
+    json.beginObject()
+            .value("copy_reference", reference)
+            .value("path", _filename)
+        .endObject();
+
+    QJsonObject object;
+    if(!requestObject("/2/files/copy_reference/save", json.data(), object))
+        return false;
+
+    invalidateCaches(_filename);
+    return true;
+}
+
 QUrl QDropbox2File::temporaryLink()
 {
+    // if the file is in a watched folder, its current revision is known
+    // locally and a link issued for an older revision will not be served
+    QString rev;
+    QDropbox2Entry entry;
+    if(_api->metadataCache()->lookup(_filename, entry))
+    {
+        if(entry.type == QDropbox2Entry::Deleted)
+            _api->linkCache()->invalidate(_filename);
+        else
+            rev = entry.rev;
+    }
+
+    QUrl link;
+    if(_api->linkCache()->lookup(_filename, rev, link))
+        return link;
+
     return requestStreamingLink();
 }
 
@@ -1113,12 +1821,15 @@ QUrl QDropbox2File::requestStreamingLink()
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"path\": \"%1\"}").arg(_filename);
+    QDropbox2JsonWriter json(_filename.size());
+    json.beginObject()
+            .value("path", _filename)
+        .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -1133,12 +1844,17 @@ QUrl QDropbox2File::requestStreamingLink()
     else
     {
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
             if(object.contains("link"))
+            {
                 result.setUrl(object.value("link").toString());
+                _api->linkCache()->insert(_filename,
+                                          object.value("metadata").toObject().value("rev").toString(),
+                                          result);
+            }
         }
         else
         {
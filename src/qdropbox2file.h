@@ -1,5 +1,6 @@
 #pragma once
 
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
 
 #include "qdropbox2common.h"
@@ -7,6 +8,8 @@
 #include "qdropbox2.h"
 #include "qdropbox2entity.h"
 #include "qdropbox2entityinfo.h"
+#include "qdropbox2chunkedbuffer.h"
+#include "qdropbox2chunkcontroller.h"
 
 //! Allows access to files stored on Dropbox
 /*!
@@ -18,6 +21,10 @@
   locally when using open(). This means that the file content is not automatically
   updated if it changed on the Dropbox server which, in return, means that you may
   not always have the most current version of the file content.
+
+  If a content cache has been enabled on the QDropbox2 instance (see
+  QDropbox2::enableContentCache()), opening a file read-only serves an unchanged
+  file from the local cache, memory-mapped, instead of downloading it again.
 */
 class QDROPBOXSHARED_EXPORT QDropbox2File : public QIODevice, public IQDropbox2Entity
 {
@@ -26,6 +33,15 @@ class QDROPBOXSHARED_EXPORT QDropbox2File : public QIODevice, public IQDropbox2E
 public:     // typedefs and enums
     typedef QList<QDropbox2EntityInfo> RevisionsList;
 
+    enum
+    {
+        //! Msecs before a save_url job is first polled; see setJobPolling()
+        FirstJobPoll = 500,
+
+        //! Msecs the polling interval grows to, at most
+        LastJobPoll = 5000
+    };
+
 public:
     /*!
       Default constructor. Use setApi() and setFilename() to access Dropbox.
@@ -134,20 +150,43 @@ public:
     bool event(QEvent* event);
 
     /*!
-      Usually the file content is automatically flushed whenever the internal buffer
-      has more than 1024 new byte or on using close(). If you want QDropbox2File to
-      automatically flush earlier than those 1024 byte use this function to reduce
-      this threshold.
+      By default the file content is held until flush() or close(), and then uploaded.
+      With a flush threshold set, once that many bytes have been written the content
+      is uploaded in the background, one full chunk at a time through an upload
+      session, while the application keeps writing.  flush() or close() then waits
+      for the chunk in flight, and finishes the session with whatever remains.
+
+      Content that has been uploaded can no longer be read or overwritten; writes
+      before that point fail.  Should a chunk fail after earlier chunks were
+      uploaded, the file cannot be completed: flush() fails, the content is
+      dropped, and writes and flushes fail until the file is opened again.
+      Combine with setMemoryBudget() to keep memory use bounded when the
+      application writes faster than the upload proceeds.
 
-      \param num QDropbox2File will automatically flush the file buffer when there are
-                 more than num new byte of data.
+      \param num Number of bytes written before background uploading begins.  Chunk
+                 sizes are multiples of 4 MB, chosen by a QDropbox2ChunkController
+                 from the chunks already sent.  Zero (the default) disables
+                 background uploading.
      */
-    //void setFlushThreshold(qint64 num);
+    void setFlushThreshold(qint64 num);
 
     /*!
       Returns the current flush threshold setting.
      */
-    //qint64 flushThreshold() const { return bufferThreshold; }
+    qint64 flushThreshold() const { return bufferThreshold; }
+
+    /*!
+      Limits the amount of written content held in memory.  Beyond the budget, the
+      oldest content is moved to a temporary file until it is uploaded.
+
+      \param bytes Memory budget in bytes.  Zero (the default) means no limit.
+     */
+    void setMemoryBudget(qint64 bytes);
+
+    /*!
+      Returns the current memory budget setting.
+     */
+    qint64 memoryBudget() const { return _memoryBudget; }
 
     /*!
       By default an already existing file will be overwritten. If you don't want to
@@ -187,9 +226,12 @@ public:
       Retrieves a (temporary) URL link to the file for streaming.  The file
       type must support streaming (e.g., MP4) for the link to work properly.
 
-      \remark The link is only valid for 4 hours.
+      \remark The link is only valid for 4 hours.  Links are kept in the link
+      cache of the QDropbox2 instance (see QDropbox2::linkCache()), and served
+      from there until shortly before they expire, or until the file is
+      known to have changed.
 
-      \remark This is a blocking call.
+      \remark This is a blocking call if no cached link is available.
 
       \returns A <i>valid</i> QUrl suitable for use with QDesktopServices::openUrl(), or an <i>invalid</i> QUrl on failure.
     */
@@ -226,6 +268,48 @@ public:
     */
     bool copy(const QString& to_path);
 
+    /*!
+      Saves the content found at a URL to the location of this file.  Dropbox
+      fetches the URL itself, so none of the content passes through this host.
+      The server does so in a background job, which is polled until it ends.
+
+      \remark This is a blocking call, for as long as the server takes to fetch
+      the URL.  slot_abort() stops waiting, but not the job on the server.
+
+      \param url The URL to fetch.
+      \returns <i>true</i> if the file was saved or <i>false</i> if there was an error.
+    */
+    bool saveUrl(const QUrl& url);
+
+    /*!
+      Sets the intervals at which saveUrl() polls its job: <i>first</i> msecs
+      after it was started, and from then on at intervals that double up to
+      <i>last</i> msecs.  The defaults are FirstJobPoll and LastJobPoll.
+    */
+    void setJobPolling(int first, int last);
+
+    /*!
+      Obtains a copy reference to the file.  Passed to saveCopyReference() on
+      a QDropbox2File of any account, it copies the file on the server, so that
+      none of the content passes through this host.
+
+      \remark This is a blocking call.
+
+      \param expires Receives the time the reference expires, if given.
+      \returns The copy reference, or an empty string if there was an error.
+    */
+    QString copyReference(QDateTime* expires = nullptr);
+
+    /*!
+      Saves the file behind a copy reference (see copyReference()), which may
+      have been obtained from another account, to the location of this file.
+
+      \remark This is a blocking call.
+
+      \returns <i>true</i> if the file was saved or <i>false</i> if there was an error.
+    */
+    bool saveCopyReference(const QString& reference);
+
     /*!
       Check if the file has changed on the dropbox while it was opened locally.
       This function will return false if the file was not previously opened and an error
@@ -282,10 +366,36 @@ public:
 
     /*!
       Reimplemented from QIODevice::bytesAvailable().
-      Reports the current size of the data buffer.
+      Reports the number of bytes between the current position and the end of the data buffer.
     */
     virtual qint64 bytesAvailable() const;
 
+    /*!
+      Returns up to <i>maxlen</i> bytes from the current position without consuming them,
+      leaving the position untouched.  The file's buffer is kept in blocks of
+      QDropbox2ChunkedBuffer::DefaultBlockSize bytes, and the result shares it (no copy
+      is made) only when the bytes returned are exactly one of those blocks, as is the
+      whole content of a file of up to 4 MB peeked at from the start.  Any other range,
+      and any content read from the content cache, is copied, just as by QIODevice::peek().
+
+      \param maxlen Maximum number of bytes to return, or -1 for all remaining bytes.
+                    More than QDropbox2ChunkedBuffer::MaxArraySize bytes do not fit
+                    in a QByteArray; an empty array is returned instead.
+    */
+    QByteArray peekShared(qint64 maxlen = -1) const;
+
+    /*!
+      Returns all bytes from the current position to the end of the content, and
+      moves the position to the end.  The rest is copied into a single array of
+      the right size, where QIODevice::readAll() grows its result in fixed-size
+      chunks; it is shared with the file's buffer instead only under the
+      conditions given for peekShared(), e.g. for a file of up to 4 MB read from
+      the start.  Returns an empty array, and leaves the position, if the rest
+      is longer than QDropbox2ChunkedBuffer::MaxArraySize; read it in parts
+      instead.
+    */
+    QByteArray readAllShared();
+
     /*!
       Reimplemented from IQDropbox2Entity.
     */
@@ -336,6 +446,7 @@ signals:
 protected:
     // QIODevice reimplemented methods
     qint64  readData(char *data, qint64 maxlen);
+    qint64  readLineData(char *data, qint64 maxlen);
     qint64  writeData(const char *data, qint64 len);
 
 private slots:
@@ -350,7 +461,7 @@ private:        // typedefs and enums
     struct SessionData;
     typedef QSharedPointer<SessionData> SessionPtr;
     typedef QMap<QNetworkReply*, SessionPtr> SessionMap;
-    typedef QMap<QNetworkReply*, QString> SessionStartMap;
+    typedef QMap<QNetworkReply*, QByteArray> SessionStartMap;
 
     typedef void(QDropbox2File::*AsyncCallback)(QNetworkReply*, CallbackPtr);
 
@@ -373,10 +484,11 @@ private:        // classes
     // will register.
     struct SessionData
     {
-        QString     session_parameters;
+        QByteArray  session_parameters;     // "commit" argument, pre-encoded for the header
         QString     session_id;
-        int         session_offset;
-        int         session_payload;
+        qint64      session_offset;
+        qint64      session_payload;
+        QElapsedTimer payload_timer;        // since the payload was sent
 
         SessionData()
             : session_offset(0),
@@ -385,20 +497,34 @@ private:        // classes
     };
 
 private:        // methods
-    void    init(QDropbox2 *api, const QString& filename, qint64 threshold = MaxSingleUpload);
+    void    init(QDropbox2 *api, const QString& filename, qint64 threshold = 0);
 
     QNetworkReply* sendPOST(QNetworkRequest& rq, QByteArray& postdata);
+    QNetworkReply* sendPOST(QNetworkRequest& rq, QIODevice* device);
     QNetworkReply* sendGET(QNetworkRequest& rq);
+    void        appendContent(const QByteArray& data);
 
     bool    isMode(QIODevice::OpenMode mode);
     bool    getFile(const QString& filename);
+    bool    openFromCache(bool& have_metadata);
+    void    releaseCacheFile();
     bool    putFile();
     void    obtainMetadata();
+    void    invalidateCaches(const QString& path);
 
     bool    requestRemoval(bool permanently);
     bool    requestMove(const QString& to_path);
     bool    requestCopy(const QString& to_path);
+    bool    requestObject(const QString& path, const QByteArray& postdata, QJsonObject& object);
     QUrl    requestStreamingLink();
+    QByteArray slice(qint64 maxlen) const;
+    QNetworkReply* continueSession(SessionPtr sd);
+
+    // background upload while writing
+    qint64  streamChunkSize() const;
+    qint64  streamedTo() const;
+    void    streamChunks();
+    void    resetStream();
 
     // Note that the QNetworkReply pointer is returned in case the
     // function needs to set data into the AsyncMap for later access
@@ -412,12 +538,13 @@ private:        // methods
     // QNetworkReply post-processing callbacks (synchronous and asynchronous)
     void    resultGetFile(QNetworkReply* reply, CallbackPtr reply_data);
     void    resultPutFile(QNetworkReply* reply, CallbackPtr reply_data);
+    void    streamCallback(QNetworkReply* reply, CallbackPtr reply_data);
     void    revisionsCallback(QNetworkReply* reply, CallbackPtr reply_data);
 
 private:        // data members
     QNetworkAccessManager QNAM;
 
-    QByteArray  *_buffer;
+    QDropbox2ChunkedBuffer *_buffer;
 
     QString     accessToken;
     QString     _filename;
@@ -432,7 +559,7 @@ private:        // data members
 
     int         lastErrorCode;
     QString     lastErrorMessage;
-    QString     lastResponse;
+    QByteArray  lastResponse;
 
     QString     lastHash;
 
@@ -444,13 +571,36 @@ private:        // data members
     bool        overwrite_;
     bool        rename;
 
-    int         position;
+    int         jobPollFirst;
+    int         jobPollLast;
+
+    qint64      position;
 
-    // for upload_session
+    // for upload_session; chunks are sized by the controller, which keeps
+    // learning across the uploads of this instance
     SessionStartMap session_starts;
     SessionMap  upload_sessions;
+    QDropbox2ChunkController chunkController;
+
+    // background upload while writing (see setFlushThreshold()); the session
+    // offset is what the server has confirmed, the payload what is in flight
+    SessionPtr      streamSession;
+    QNetworkReply*  streamReply;
+    bool            streamFailed;
+    bool            streamLost;         // content went with a failed session
+    bool            streamWaiting;      // flush() is waiting for streamReply
+    qint64          _memoryBudget;
+
+    // tracing of the upload in progress (see QDropbox2::enableTracing())
+    quint64     putTrace;
+    const char* putStep;
 
     QDropbox2EntityInfo *_metadata;
+
+    // content cache support: the mapped cache entry backing _buffer (if
+    // any), and the cache key of the most recent download
+    QFile       *cacheFile;
+    QString     downloadKey;
 };
 
 Q_DECLARE_METATYPE(QDropbox2File);
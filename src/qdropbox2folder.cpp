@@ -1,6 +1,14 @@
 #include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTimer>
 
 #include "qdropbox2folder.h"
+#include "qdropbox2json.h"
+#include "qdropbox2metadatacache.h"
+#include "qdropbox2linkcache.h"
+#include "qdropbox2engine.h"
+#include "qdropbox2zipreader.h"
 
 QDropbox2Folder::QDropbox2Folder(QObject *parent)
     : QObject(parent),
@@ -46,6 +54,9 @@ void QDropbox2Folder::init(QDropbox2 *api, const QString& foldername)
     eventLoop         = nullptr;
     rename            = false;
     _metadata         = nullptr;
+    watching          = false;
+    watchTimeout      = 30;
+    longpollTrace     = 0;
     lastErrorCode     = 0;
     lastErrorMessage  = "";
 
@@ -86,8 +97,7 @@ void QDropbox2Folder::slot_networkRequestFinished(QNetworkReply *reply)
 {
     reply->deleteLater();
 
-    QByteArray buff = reply->readAll();
-    lastResponse = QString(buff);
+    lastResponse = reply->readAll();
 
 #ifdef QTDROPBOX_DEBUG
     qDebug() << "QDropbox2Folder::slot_networkRequestFinished(...)" << endl;
@@ -124,6 +134,7 @@ void QDropbox2Folder::slot_networkRequestFinished(QNetworkReply *reply)
 QNetworkReply* QDropbox2Folder::sendPOST(QNetworkRequest& rq, QByteArray& postdata)
 {
     QNetworkReply *reply = QNAM.post(rq, postdata);
+    _api->trackRequest(reply);
     connect(this, &QDropbox2Folder::signal_operationAborted, reply, &QNetworkReply::abort);
     //connect(reply, &QNetworkReply::uploadProgress, this, &QDropbox2Folder::signal_uploadProgress);
     return reply;
@@ -174,17 +185,21 @@ bool QDropbox2Folder::getLatestCursor(QString& cursor, bool include_deleted)
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json;
     // TODO: the APIv2 /list_folder/longpoll call does not currently support cursors generated with the "include_media_info" value set to true.
     // https://www.dropboxforum.com/t5/API-support/Getting-400-HTTP-error-for-list-folder-longpoll/td-p/164086/page/2
-    json = QString("{\"path\": \"%1\", \"recursive\": false, \"include_media_info\": false, \"include_deleted\": %2, \"include_has_explicit_shared_members\": true}")
-                                .arg((_foldername.compare("/") == 0) ? "" : _foldername)
-                                .arg(include_deleted ? "true" : "false");
+    QDropbox2JsonWriter json(_foldername.size());
+    json.beginObject()
+            .value("path", (_foldername.compare("/") == 0) ? QString() : _foldername)
+            .value("recursive", false)
+            .value("include_media_info", false)
+            .value("include_deleted", include_deleted)
+            .value("include_has_explicit_shared_members", true)
+        .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -193,7 +208,7 @@ bool QDropbox2Folder::getLatestCursor(QString& cursor, bool include_deleted)
     if(result)
     {
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -223,7 +238,7 @@ bool QDropbox2Folder::hasChanged(ContentsList& changes)
         return false;
 
     QJsonParseError jsonError;
-    QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+    QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
     if(jsonError.error == QJsonParseError::NoError)
     {
         QJsonObject object = json.object();
@@ -235,8 +250,12 @@ bool QDropbox2Folder::hasChanged(ContentsList& changes)
         if(!data.count())
             return false;
 
+        ContentsList page;
         foreach(const QJsonValue& entry, data)
-            changes.append(QDropbox2EntityInfo(entry.toObject()));
+            page.append(QDropbox2EntityInfo(entry.toObject()));
+
+        updateCaches(page);
+        changes.append(page);
     }
 
     return true;
@@ -259,35 +278,56 @@ bool QDropbox2Folder::hasChanged()
     return result;
 }
 
-void QDropbox2Folder::hasChangedCallback(QNetworkReply* /*reply*/, CallbackPtr /*reply_data*/)
+void QDropbox2Folder::hasChangedCallback(QNetworkReply* reply, CallbackPtr /*reply_data*/)
 {
-    QJsonParseError jsonError;
-    QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
-    if(jsonError.error == QJsonParseError::NoError)
+    bool has_more = false;
+
+    if(lastErrorCode)
     {
-        QJsonObject object = json.object();
-        latestCursor = object.value("cursor").toString();
-        if(!object.contains("entries"))
-        {
+        lastErrorMessage = reply->errorString();
 #ifdef QTDROPBOX_DEBUG
-            qDebug() << "QDropbox2Folder::hasChangedCallback error: " << lastErrorCode << lastErrorMessage << endl;
+        qDebug() << "QDropbox2Folder::hasChangedCallback error: " << lastErrorCode << lastErrorMessage << endl;
 #endif
-            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
-        }
-        else
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+    }
+    else
+    {
+        QJsonParseError jsonError;
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
+        if(jsonError.error == QJsonParseError::NoError)
         {
-            QDropbox2Folder::ContentsList changes;
-
-            QJsonArray data = object.value("entries").toArray();
-            if(data.count())
+            QJsonObject object = json.object();
+            latestCursor = object.value("cursor").toString();
+            if(!object.contains("entries"))
             {
-                foreach(const QJsonValue& entry, data)
-                    changes.append(QDropbox2EntityInfo(entry.toObject()));
+#ifdef QTDROPBOX_DEBUG
+                qDebug() << "QDropbox2Folder::hasChangedCallback error: " << lastErrorCode << lastErrorMessage << endl;
+#endif
+                emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
             }
+            else
+            {
+                QDropbox2Folder::ContentsList changes;
+
+                QJsonArray data = object.value("entries").toArray();
+                if(data.count())
+                {
+                    foreach(const QJsonValue& entry, data)
+                        changes.append(QDropbox2EntityInfo(entry.toObject()));
+                }
+
+                updateCaches(changes);
+                has_more = object.value("has_more").toBool();
 
-            emit signal_hasChangedResults(changes);
+                emit signal_hasChangedResults(changes);
+            }
         }
     }
+
+    if(has_more)
+        hasChanged();
+    else if(watching)
+        slot_poll();
 }
 
 bool QDropbox2Folder::waitForChanged(int timeout)
@@ -299,10 +339,11 @@ bool QDropbox2Folder::waitForChanged(int timeout)
 
     while(true)
     {
-        if(requestLongpoll(timeout))
+        QNetworkReply* reply;
+        if(requestLongpoll(reply, timeout))
         {
             QJsonParseError jsonError;
-            QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+            QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
             if(jsonError.error == QJsonParseError::NoError)
             {
                 QJsonObject object = json.object();
@@ -321,7 +362,108 @@ bool QDropbox2Folder::waitForChanged(int timeout)
     return result;
 }
 
-bool QDropbox2Folder::requestLongpoll(int timeout)
+bool QDropbox2Folder::watch(int timeout)
+{
+    if(watching)
+        return true;
+
+    if(latestCursor.isEmpty() && !getLatestCursor(latestCursor, true))
+        return false;
+
+    watching = true;
+    watchTimeout = timeout;
+    slot_poll();
+    return true;
+}
+
+void QDropbox2Folder::unwatch()
+{
+    watching = false;
+}
+
+void QDropbox2Folder::slot_poll()
+{
+    if(!watching)
+        return;
+
+    QNetworkReply* reply;
+    if(requestLongpoll(reply, watchTimeout, true))
+    {
+        CallbackPtr reply_data(new CallbackData);
+        reply_data->callback = &QDropbox2Folder::longpollCallback;
+        replyMap[reply] = reply_data;
+    }
+}
+
+void QDropbox2Folder::longpollCallback(QNetworkReply* reply, CallbackPtr /*reply_data*/)
+{
+    _api->traceEnd(longpollTrace, "longpoll", {{"error", lastErrorCode}});
+    longpollTrace = 0;
+
+    if(!watching)
+        return;
+
+    if(lastErrorCode != 0 && lastErrorCode != 206)
+    {
+        lastErrorMessage = reply->errorString();
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2Folder::longpollCallback error: " << lastErrorCode << lastErrorMessage << endl;
+#endif
+        if(lastResponse.contains("reset"))
+        {
+            // the cursor has been invalidated by the server, so changes may
+            // have been missed; anything cached beneath us is suspect
+            _api->metadataCache()->invalidate(_foldername);
+            getLatestCursor(latestCursor, true);
+            slot_poll();
+        }
+        else
+        {
+            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            QTimer::singleShot(watchTimeout * 1000, this, SLOT(slot_poll()));
+        }
+        return;
+    }
+
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
+    if(jsonError.error != QJsonParseError::NoError)
+    {
+        QTimer::singleShot(watchTimeout * 1000, this, SLOT(slot_poll()));
+        return;
+    }
+
+    QJsonObject object = json.object();
+    if(object.value("changes").toBool())
+        hasChanged();
+    else
+    {
+        // the server may ask us to wait before polling again
+        int backoff = object.value("backoff").toInt();
+        if(backoff > 0)
+            QTimer::singleShot(backoff * 1000, this, SLOT(slot_poll()));
+        else
+            slot_poll();
+    }
+}
+
+void QDropbox2Folder::updateCaches(const ContentsList& changes)
+{
+    if(!_api || changes.isEmpty())
+        return;
+
+    QList<QDropbox2Entry> entries;
+    entries.reserve(changes.count());
+    foreach(const QDropbox2EntityInfo& info, changes)
+    {
+        entries.append(info.toEntry());
+        _api->linkCache()->invalidate(info.path());
+    }
+
+    _api->metadataCache()->apply(entries);
+}
+
+bool QDropbox2Folder::requestLongpoll(QNetworkReply*& reply, int timeout, bool async)
 {
     bool result = false;
 
@@ -342,17 +484,27 @@ bool QDropbox2Folder::requestLongpoll(int timeout)
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"cursor\": \"%1\", \"timeout\": %2}")
-                                .arg(latestCursor)
-                                .arg(timeout);
+    QDropbox2JsonWriter json(latestCursor.size());
+    json.beginObject()
+            .value("cursor", latestCursor)
+            .value("timeout", timeout)
+        .endObject();
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
-    (void)sendPOST(req, postdata);
+    QByteArray postdata = json.data();
+
+    longpollTrace = _api->traceBegin("longpoll", {{"path", _foldername}, {"timeout", timeout}});
+    reply = sendPOST(req, postdata);
+
+    if(async)
+        return true;
 
     startEventLoop();
 
+    _api->traceEnd(longpollTrace, "longpoll", {{"error", lastErrorCode}});
+    longpollTrace = 0;
+
     result = (lastErrorCode == 0 || lastErrorCode == 206);
     if(!result)
     {
@@ -383,6 +535,18 @@ void QDropbox2Folder::obtainMetadata()
     }
     else
     {
+        QDropbox2MetadataCache* cache = _api->metadataCache();
+
+        QDropbox2Entry entry;
+        if(cache->lookup(_foldername, entry))
+        {
+            lastErrorCode = 0;
+            _metadata = new QDropbox2EntityInfo(entry);
+            return;
+        }
+
+        const quint64 generation = cache->generation();
+
         QUrl url;
         url.setUrl(QDROPBOX2_API_URL);
         url.setPath(QString("/2/files/get_metadata"));
@@ -395,12 +559,17 @@ void QDropbox2Folder::obtainMetadata()
         if(!_api->createAPIv2Reqeust(url, req))
             return;
         req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-        QString json = QString("{\"path\": \"%1\", \"include_media_info\": true, \"include_deleted\": true, \"include_has_explicit_shared_members\": true}")
-                                    .arg(_foldername);
+        QDropbox2JsonWriter json(_foldername.size());
+        json.beginObject()
+                .value("path", _foldername)
+                .value("include_media_info", true)
+                .value("include_deleted", true)
+                .value("include_has_explicit_shared_members", true)
+            .endObject();
 #ifdef QTDROPBOX_DEBUG
-        qDebug() << "postdata = \"" << json << "\"" << endl;;
+        qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-        QByteArray postdata = json.toUtf8();
+        QByteArray postdata = json.data();
         (void)sendPOST(req, postdata);
     
         startEventLoop();
@@ -415,11 +584,12 @@ void QDropbox2Folder::obtainMetadata()
         else
         {
             QJsonParseError jsonError;
-            QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+            QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
             if(jsonError.error == QJsonParseError::NoError)
             {
                 QJsonObject object = json.object();
                 _metadata = new QDropbox2EntityInfo(object);
+                cache->insert(_metadata->toEntry(), generation);
             }
             else
             {
@@ -463,13 +633,15 @@ bool QDropbox2Folder::requestCreation()
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"path\": \"%1\", \"autorename\": %2}")
-                                .arg((_foldername.compare("/") == 0) ? "" : _foldername)
-                                .arg(rename ? "true" : "false");
+    QDropbox2JsonWriter json(_foldername.size());
+    json.beginObject()
+            .value("path", (_foldername.compare("/") == 0) ? QString() : _foldername)
+            .value("autorename", rename)
+        .endObject();
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -482,6 +654,8 @@ bool QDropbox2Folder::requestCreation()
 #endif
         emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
     }
+    else
+        _api->metadataCache()->invalidate(_foldername);
 
     return result;
 }
@@ -513,12 +687,14 @@ bool QDropbox2Folder::requestRemoval(bool permanently)
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"path\": \"%1\"}")
-                                .arg((_foldername.compare("/") == 0) ? "" : _foldername);
+    QDropbox2JsonWriter json(_foldername.size());
+    json.beginObject()
+            .value("path", (_foldername.compare("/") == 0) ? QString() : _foldername)
+        .endObject();
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -531,6 +707,8 @@ bool QDropbox2Folder::requestRemoval(bool permanently)
 #endif
         emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
     }
+    else
+        _api->metadataCache()->invalidate(_foldername);
 
     return result;
 }
@@ -559,15 +737,18 @@ bool QDropbox2Folder::requestMove(const QString& to_path)
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"from_path\": \"%1\", \"to_path\": \"%2\", \"autorename\": %3, \"allow_shared_folder\": false}")
-                                    .arg(_foldername)
-                                    .arg(to_path)
-                                    .arg(rename ? "true" : "false");
+    QDropbox2JsonWriter json(_foldername.size() + to_path.size());
+    json.beginObject()
+            .value("from_path", _foldername)
+            .value("to_path", to_path)
+            .value("autorename", rename)
+            .value("allow_shared_folder", false)
+        .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -580,6 +761,11 @@ bool QDropbox2Folder::requestMove(const QString& to_path)
 #endif
         emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
     }
+    else
+    {
+        _api->metadataCache()->invalidate(_foldername);
+        _api->metadataCache()->invalidate(to_path);
+    }
 
     return result;
 }
@@ -609,15 +795,18 @@ bool QDropbox2Folder::requestCopy(const QString& to_path)
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json = QString("{\"from_path\": \"%1\", \"to_path\": \"%2\", \"autorename\": %3, \"allow_shared_folder\": false}")
-                                    .arg(_foldername)
-                                    .arg(to_path)
-                                    .arg(rename ? "true" : "false");
+    QDropbox2JsonWriter json(_foldername.size() + to_path.size());
+    json.beginObject()
+            .value("from_path", _foldername)
+            .value("to_path", to_path)
+            .value("autorename", rename)
+            .value("allow_shared_folder", false)
+        .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     (void)sendPOST(req, postdata);
 
     startEventLoop();
@@ -630,6 +819,8 @@ bool QDropbox2Folder::requestCopy(const QString& to_path)
 #endif
         emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
     }
+    else
+        _api->metadataCache()->invalidate(to_path);
 
     return result;
 }
@@ -637,6 +828,223 @@ bool QDropbox2Folder::requestCopy(const QString& to_path)
 //--------------------------------------
 // List Folder
 
+bool QDropbox2Folder::download(const QString& local_dir)
+{
+    return requestDownload(local_dir);
+}
+
+bool QDropbox2Folder::requestDownload(const QString& local_dir)
+{
+    bool result = false;
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Folder::requestDownload()" << endl;
+#endif
+
+    lastErrorCode = 0;
+    lastErrorMessage.clear();
+
+    if(!local_dir.isEmpty() && !QDir().mkpath(local_dir))
+    {
+        lastErrorCode = QDropbox2::APIError;
+        lastErrorMessage = QString("Could not create %1").arg(local_dir);
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        return result;
+    }
+
+    QUrl url;
+    url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
+    url.setPath("/2/files/download_zip");
+
+    Q_ASSERT(url.isValid());
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+        return result;
+
+    QDropbox2JsonWriter json(_foldername.size(), QDropbox2JsonWriter::AsciiSafe);
+    json.beginObject()
+            .value("path", _foldername)
+        .endObject();
+    req.setRawHeader("Dropbox-API-arg", json.data());
+
+    // the entries are extracted as the zip reader decodes them
+    QDropbox2ZipReader zip;
+    QSaveFile* file = nullptr;
+    QDropbox2ZipEntry* device = nullptr;
+    QNetworkReply* reply = nullptr;
+    QString extractError;
+
+    auto extractFailed = [&](const QString& message)
+    {
+        if(extractError.isEmpty())
+            extractError = message;
+        reply->abort();
+    };
+
+    connect(&zip, &QDropbox2ZipReader::signal_entryStarted, this, [&](const QString& name, bool is_dir) {
+        if(!extractError.isEmpty())
+            return;
+
+        // names begin with the folder's own name
+        const QString path = QDir::cleanPath(name.section('/', 1));
+        if(path.isEmpty() || path == ".")
+            return;
+        if(QDir::isAbsolutePath(path) || path == ".." || path.startsWith("../"))
+        {
+            extractFailed(QString("Unsafe path in zip archive: %1").arg(name));
+            return;
+        }
+
+        if(local_dir.isEmpty())
+        {
+            if(!is_dir)
+            {
+                device = new QDropbox2ZipEntry(path, this);
+                emit signal_downloadEntry(path, device);
+            }
+            return;
+        }
+
+        const QString target = local_dir + "/" + path;
+        if(is_dir)
+        {
+            if(!QDir().mkpath(target))
+                extractFailed(QString("Could not create %1").arg(target));
+            return;
+        }
+
+        file = new QSaveFile(target);
+        if(!QDir().mkpath(QFileInfo(target).absolutePath()) || !file->open(QIODevice::WriteOnly))
+        {
+            extractFailed(QString("Could not write %1: %2").arg(target).arg(file->errorString()));
+            delete file;
+            file = nullptr;
+        }
+    });
+
+    connect(&zip, &QDropbox2ZipReader::signal_entryData, this, [&](const QByteArray& data) {
+        if(device)
+            device->appendData(data);
+        else if(file && file->write(data) != data.size())
+            extractFailed(QString("Could not write %1: %2").arg(file->fileName()).arg(file->errorString()));
+    });
+
+    connect(&zip, &QDropbox2ZipReader::signal_entryFinished, this, [&]() {
+        if(device)
+        {
+            device->setComplete();
+            device->deleteLater();
+            device = nullptr;
+        }
+        if(file)
+        {
+            if(!file->commit())
+                extractFailed(QString("Could not write %1: %2").arg(file->fileName()).arg(file->errorString()));
+            delete file;
+            file = nullptr;
+        }
+    });
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Folder::requestDownload " << url.toString() << endl;
+#endif
+
+    reply = QNAM.get(req);
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2Folder::signal_operationAborted, reply, &QNetworkReply::abort);
+    connect(reply, &QNetworkReply::downloadProgress, this, &QDropbox2Folder::signal_downloadProgress);
+
+    // the archive is decoded as it arrives, and never held as a whole
+    connect(reply, &QNetworkReply::readyRead, this, [&zip, reply]() {
+        if(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() / 100 == 2 && !zip.addData(reply->readAll()))
+            reply->abort();
+    });
+
+    CallbackPtr reply_data(new DownloadData());
+    DownloadData* download_data = reinterpret_cast<DownloadData*>(reply_data.data());
+    download_data->callback = &QDropbox2Folder::downloadCallback;
+    download_data->zip = &zip;
+    replyMap[reply] = reply_data;
+
+    startEventLoop();
+
+    if(replyMap.contains(reply))
+    {
+        // the loop was ended from elsewhere; the reply must not outlive the reader
+        replyMap.remove(reply);
+        disconnect(reply, nullptr, this, nullptr);
+        reply->abort();
+        extractError = "The download was interrupted";
+    }
+
+    // an entry cut short is never committed
+    if(file)
+    {
+        file->cancelWriting();
+        delete file;
+    }
+    if(device)
+    {
+        device->setComplete();
+        device->deleteLater();
+    }
+
+    if(!extractError.isEmpty())
+    {
+        lastErrorCode = QDropbox2::APIError;
+        lastErrorMessage = extractError;
+    }
+
+    result = (lastErrorCode == 0);
+    if(!result)
+    {
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2Folder::requestDownload error: " << lastErrorCode << lastErrorMessage << endl;
+#endif
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+    }
+
+    return result;
+}
+
+void QDropbox2Folder::downloadCallback(QNetworkReply* reply, CallbackPtr reply_data)
+{
+    QDropbox2ZipReader* zip = reinterpret_cast<DownloadData*>(reply_data.data())->zip;
+
+    if(zip->hasError())
+    {
+        lastErrorCode = QDropbox2::APIError;
+        lastErrorMessage = zip->errorString();
+    }
+    else if(lastErrorCode == QNetworkReply::NoError)
+    {
+        // the tail of the archive that arrived with the end of the reply
+        if(!zip->addData(lastResponse) || !zip->finish())
+        {
+            lastErrorCode = QDropbox2::APIError;
+            lastErrorMessage = zip->errorString();
+        }
+    }
+    else
+    {
+        lastErrorMessage = reply->errorString();
+
+        QJsonParseError jsonError;
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
+        if(jsonError.error == QJsonParseError::NoError)
+        {
+            QJsonObject object = json.object();
+            if(object.contains("user_message"))
+                lastErrorMessage = object.value("user_message").toString();
+            else if(object.contains("error_summary"))
+                lastErrorMessage = object.value("error_summary").toString();
+        }
+    }
+
+    stopEventLoop();
+}
+
 bool QDropbox2Folder::contents(QDropbox2Folder::ContentsList& contents, bool include_folders, bool include_deleted)
 {
     bool result = false;
@@ -647,11 +1055,18 @@ bool QDropbox2Folder::contents(QDropbox2Folder::ContentsList& contents, bool inc
     qDebug() << "QDropbox2Folder::contents()" << endl;
 #endif
 
+    quint64 trace = _api->traceBegin("contents", {{"path", _foldername}});
+
     bool has_more = true;
     do
     {
+        const char* page_step = latestCursor.isEmpty() ? "list_folder" : "list_folder/continue";
+        _api->traceStep(trace, page_step);
+
         QNetworkReply* reply;
-        if(!(result = getContents(reply, latestCursor, include_deleted)))
+        result = getContents(reply, latestCursor, include_deleted);
+        _api->traceEnd(trace, page_step, {{"error", lastErrorCode}});
+        if(!result)
         {
 #ifdef QTDROPBOX_DEBUG
             qDebug() << "QDropbox2Folder::contents error: " << lastErrorCode << lastErrorMessage << endl;
@@ -661,7 +1076,7 @@ bool QDropbox2Folder::contents(QDropbox2Folder::ContentsList& contents, bool inc
         }
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -694,6 +1109,8 @@ bool QDropbox2Folder::contents(QDropbox2Folder::ContentsList& contents, bool inc
         }
     } while(has_more);
 
+    _api->traceEnd(trace, "contents", {{"entries", contents.count()}});
+
     return result;
 }
 
@@ -702,6 +1119,18 @@ bool QDropbox2Folder::contents(bool include_folders, bool include_deleted)
     lastErrorCode = 0;
     latestCursor.clear();       // make sure we get a "current" listing, not a differential
 
+    quint64 trace = _api->traceBegin("contents", {{"path", _foldername}});
+
+    if(_api->engine())
+    {
+        if(engineContents(include_folders, include_deleted, ContentsList(), trace))
+            return true;
+        _api->traceEnd(trace, "contents", {{"error", lastErrorCode}});
+        return false;
+    }
+
+    _api->traceStep(trace, "list_folder");
+
     QNetworkReply* reply;
     bool result = getContents(reply, latestCursor, include_deleted, true);
     if(result)
@@ -710,14 +1139,24 @@ bool QDropbox2Folder::contents(bool include_folders, bool include_deleted)
         ContentsData* content_data = reinterpret_cast<ContentsData*>(reply_data.data());
         content_data->callback = &QDropbox2Folder::contentsCallback;
         content_data->include_folders = include_folders;
+        content_data->trace = trace;
         replyMap[reply] = reply_data;
     }
+    else
+    {
+        _api->traceEnd(trace, "list_folder");
+        _api->traceEnd(trace, "contents", {{"error", lastErrorCode}});
+    }
 
     return result;
 }
 
 void QDropbox2Folder::contentsCallback(QNetworkReply* /*reply*/, CallbackPtr reply_data)
 {
+    quint64 trace = reinterpret_cast<ContentsData*>(reply_data.data())->trace;
+    _api->traceEnd(trace, "list_folder", {{"error", lastErrorCode}});
+    _api->traceEnd(trace, "contents");
+
     if(lastErrorCode)
     {
 #ifdef QTDROPBOX_DEBUG
@@ -731,7 +1170,7 @@ void QDropbox2Folder::contentsCallback(QNetworkReply* /*reply*/, CallbackPtr rep
         ContentsData* contents_data = reinterpret_cast<ContentsData*>(reply_data.data());
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -768,6 +1207,24 @@ bool QDropbox2Folder::getContents(QNetworkReply*& reply, const QString& cursor,
     qDebug() << "QDropbox2Folder::getContents()" << endl;
 #endif
 
+    QNetworkRequest req;
+    QByteArray postdata;
+    if(!prepareContents(req, postdata, cursor, include_deleted))
+        return result;
+
+    reply = sendPOST(req, postdata);
+
+    if(async)
+        return true;
+
+    startEventLoop();
+
+    result = (lastErrorCode == 0);
+    return result;
+}
+
+bool QDropbox2Folder::prepareContents(QNetworkRequest& req, QByteArray& postdata, const QString& cursor, bool include_deleted)
+{
     QUrl url;
     url.setUrl(QDROPBOX2_API_URL, QUrl::StrictMode);
     if(cursor.isEmpty())
@@ -777,34 +1234,114 @@ bool QDropbox2Folder::getContents(QNetworkReply*& reply, const QString& cursor,
 
     Q_ASSERT(url.isValid());
 
-    QNetworkRequest req;
     if(!_api->createAPIv2Reqeust(url, req))
-        return result;
+        return false;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json;
+    QDropbox2JsonWriter json(cursor.isEmpty() ? _foldername.size() : cursor.size());
     if(cursor.isEmpty())
         // TODO: the APIv2 /list_folder/longpoll call does not currently support cursors generated with the "include_media_info" value set to true.
         // https://www.dropboxforum.com/t5/API-support/Getting-400-HTTP-error-for-list-folder-longpoll/td-p/164086/page/2
-        json = QString("{\"path\": \"%1\", \"recursive\": false, \"include_media_info\": false, \"include_deleted\": %2, \"include_has_explicit_shared_members\": true}")
-                                    .arg((_foldername.compare("/") == 0) ? "" : _foldername)
-                                    .arg(include_deleted ? "true" : "false");
+        json.beginObject()
+                .value("path", (_foldername.compare("/") == 0) ? QString() : _foldername)
+                .value("recursive", false)
+                .value("include_media_info", false)
+                .value("include_deleted", include_deleted)
+                .value("include_has_explicit_shared_members", true)
+            .endObject();
     else
-        json = QString("{\"cursor\": \"%1\"}").arg(cursor);
+        json.beginObject()
+                .value("cursor", cursor)
+            .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
-    reply = sendPOST(req, postdata);
+    postdata = json.data();
+    return true;
+}
 
-    if(async)
-        return true;
+QVariant QDropbox2Folder::parseContents(const QByteArray& response)
+{
+    // runs on the engine's parser pool
+    QVariantMap page;
 
-    startEventLoop();
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    if(jsonError.error != QJsonParseError::NoError)
+        return page;
+
+    QJsonObject object = json.object();
+
+    QList<QDropbox2Entry> entries;
+    QJsonArray data = object.value("entries").toArray();
+    entries.reserve(data.count());
+    foreach(const QJsonValue& entry, data)
+        entries.append(QDropbox2EntityInfo::parseEntry(entry.toObject()));
+
+    page["entries"]  = QVariant::fromValue(entries);
+    page["cursor"]   = object.value("cursor").toString();
+    page["has_more"] = object.value("has_more").toBool();
+    return page;
+}
 
-    result = (lastErrorCode == 0);
-    return result;
+bool QDropbox2Folder::engineContents(bool include_folders, bool include_deleted, ContentsList accumulated, quint64 trace)
+{
+    QNetworkRequest req;
+    QByteArray postdata;
+    if(!prepareContents(req, postdata, latestCursor, include_deleted))
+        return false;
+
+    const char* page_step = latestCursor.isEmpty() ? "list_folder" : "list_folder/continue";
+    _api->traceStep(trace, page_step);
+
+    QDropbox2EngineReply* reply = _api->engine()->post(req, postdata, &QDropbox2Folder::parseContents);
+    connect(reply, &QDropbox2EngineReply::signal_finished, this, [=]() {
+        reply->deleteLater();
+
+        _api->traceEnd(trace, page_step, {{"error", reply->error()}});
+
+        lastErrorCode = reply->error();
+        if(lastErrorCode)
+        {
+            lastErrorMessage = reply->errorString();
+#ifdef QTDROPBOX_DEBUG
+            qDebug() << "QDropbox2Folder::contents error: " << lastErrorCode << lastErrorMessage << endl;
+#endif
+            _api->traceEnd(trace, "contents", {{"error", lastErrorCode}});
+            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            return;
+        }
+
+        QVariantMap page = reply->result().toMap();
+        if(page.isEmpty())
+        {
+            lastErrorCode = QDropbox2::APIError;
+            lastErrorMessage = "Dropbox API did not send correct answer for file/directory metadata.";
+            _api->traceEnd(trace, "contents", {{"error", lastErrorCode}});
+            emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+            return;
+        }
+
+        ContentsList contents_results = accumulated;
+        foreach(const QDropbox2Entry& entry, page["entries"].value<QList<QDropbox2Entry>>())
+        {
+            if(!include_folders && entry.type == QDropbox2Entry::Folder)
+                continue;
+            contents_results.append(QDropbox2EntityInfo(entry));
+        }
+
+        latestCursor = page["cursor"].toString();
+        if(page["has_more"].toBool())
+            engineContents(include_folders, include_deleted, contents_results, trace);
+        else
+        {
+            _api->traceEnd(trace, "contents", {{"entries", contents_results.count()}});
+            emit signal_contentsResults(contents_results);
+        }
+    });
+
+    return true;
 }
 
 //--------------------------------------
@@ -834,7 +1371,7 @@ bool QDropbox2Folder::search(QDropbox2Folder::ContentsList& contents, const QStr
         }
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -894,7 +1431,7 @@ void QDropbox2Folder::searchCallback(QNetworkReply* /*reply*/, CallbackPtr /*rep
         ContentsList search_results;
 
         QJsonParseError jsonError;
-        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
         if(jsonError.error == QJsonParseError::NoError)
         {
             QJsonObject object = json.object();
@@ -937,18 +1474,19 @@ bool QDropbox2Folder::getSearch(QNetworkReply*& reply, const QString& query, qui
         return result;
 
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-    QString json;
-    json = QString("{\"path\": \"%1\", \"query\": \"%2\", \"start\": %3, \"max_results\": %4, \"mode\": \"%5\"}")
-                                .arg((_foldername.compare("/") == 0) ? "" : _foldername)
-                                .arg(query)
-                                .arg(start)
-                                .arg(max_results)
-                                .arg(mode);
+    QDropbox2JsonWriter json(_foldername.size() + query.size() + mode.size());
+    json.beginObject()
+            .value("path", (_foldername.compare("/") == 0) ? QString() : _foldername)
+            .value("query", query)
+            .value("start", start)
+            .value("max_results", max_results)
+            .value("mode", mode)
+        .endObject();
 
 #ifdef QTDROPBOX_DEBUG
-    qDebug() << "postdata = \"" << json << "\"" << endl;;
+    qDebug() << "postdata = \"" << json.data() << "\"" << endl;;
 #endif
-    QByteArray postdata = json.toUtf8();
+    QByteArray postdata = json.data();
     reply = sendPOST(req, postdata);
 
     if(async)
@@ -959,3 +1497,157 @@ bool QDropbox2Folder::getSearch(QNetworkReply*& reply, const QString& query, qui
     result = (lastErrorCode == 0);
     return result;
 }
+
+bool QDropbox2Folder::searchPages(const QString& query, const SearchFilter& filter, int page_size)
+{
+    lastErrorCode = 0;
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Folder::searchPages()" << endl;
+#endif
+
+    QDropbox2JsonWriter json(_foldername.size() + query.size() + 16 * (filter.extensions.count() + filter.categories.count()));
+    json.beginObject()
+            .value("query", query)
+            .beginObject("options");
+    if(_foldername.compare("/") != 0)
+        json.value("path", _foldername);
+    json.value("max_results", qBound(1, page_size, 1000))
+        .value("file_status", filter.deleted ? "deleted" : "active")
+        .value("filename_only", filter.filenameOnly);
+    if(!filter.extensions.isEmpty())
+    {
+        json.beginArray("file_extensions");
+        foreach(const QString& extension, filter.extensions)
+            json.element(extension);
+        json.endArray();
+    }
+    if(!filter.categories.isEmpty())
+    {
+        json.beginArray("file_categories");
+        foreach(const QString& category, filter.categories)
+            json.element(category);
+        json.endArray();
+    }
+    json.endObject()
+        .endObject();
+
+    return requestSearchPage("/2/files/search_v2", json.data());
+}
+
+bool QDropbox2Folder::requestSearchPage(const QString& path, const QByteArray& postdata)
+{
+    QUrl url;
+    url.setUrl(QDROPBOX2_API_URL, QUrl::StrictMode);
+    url.setPath(path);
+
+    Q_ASSERT(url.isValid());
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+        return false;
+
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "postdata = \"" << postdata << "\"" << endl;;
+#endif
+
+    if(_api->engine())
+    {
+        QDropbox2EngineReply* reply = _api->engine()->post(req, postdata, &QDropbox2Folder::parseSearch);
+        connect(reply, &QDropbox2EngineReply::signal_finished, this, [=]() {
+            reply->deleteLater();
+
+            lastErrorCode = reply->error();
+            if(lastErrorCode)
+                lastErrorMessage = reply->errorString();
+            searchPageResult(reply->result().toMap());
+        });
+        return true;
+    }
+
+    QByteArray data = postdata;
+    QNetworkReply* reply = sendPOST(req, data);
+
+    CallbackPtr reply_data(new CallbackData);
+    reply_data->callback = &QDropbox2Folder::searchPageCallback;
+    replyMap[reply] = reply_data;
+    return true;
+}
+
+void QDropbox2Folder::searchPageCallback(QNetworkReply* reply, CallbackPtr /*reply_data*/)
+{
+    if(lastErrorCode)
+    {
+        lastErrorMessage = reply->errorString();
+        searchPageResult(QVariantMap());
+    }
+    else
+        searchPageResult(parseSearch(lastResponse).toMap());
+}
+
+void QDropbox2Folder::searchPageResult(const QVariantMap& page)
+{
+    if(!lastErrorCode && page.isEmpty())
+    {
+        lastErrorCode = QDropbox2::APIError;
+        lastErrorMessage = "Dropbox API did not send correct answer for search results.";
+    }
+
+    if(lastErrorCode)
+    {
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2Folder::searchPages error: " << lastErrorCode << lastErrorMessage << endl;
+#endif
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        return;
+    }
+
+    const bool has_more = page["has_more"].toBool();
+    emit signal_searchPage(page["entries"].value<EntryList>(), has_more);
+    if(!has_more)
+        return;
+
+    const QString cursor = page["cursor"].toString();
+    QDropbox2JsonWriter json(cursor.size());
+    json.beginObject()
+            .value("cursor", cursor)
+        .endObject();
+
+    if(!requestSearchPage("/2/files/search/continue_v2", json.data()))
+    {
+        lastErrorCode = QDropbox2::APIError;
+        lastErrorMessage = "Could not create the search request.";
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+    }
+}
+
+QVariant QDropbox2Folder::parseSearch(const QByteArray& response)
+{
+    // runs on the engine's parser pool, if there is one
+    QVariantMap page;
+
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    if(jsonError.error != QJsonParseError::NoError)
+        return page;
+
+    QJsonObject object = json.object();
+
+    // {"match_type": {...}, "metadata": {".tag": "metadata", "metadata": {...}}}
+    EntryList entries;
+    QJsonArray matches = object.value("matches").toArray();
+    entries.reserve(matches.count());
+    foreach(const QJsonValue& match, matches)
+    {
+        QJsonObject metadata = match.toObject().value("metadata").toObject().value("metadata").toObject();
+        if(!metadata.isEmpty())
+            entries.append(QDropbox2EntityInfo::parseEntry(metadata));
+    }
+
+    page["entries"]  = QVariant::fromValue(entries);
+    page["cursor"]   = object.value("cursor").toString();
+    page["has_more"] = object.value("has_more").toBool();
+    return page;
+}
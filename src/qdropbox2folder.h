@@ -6,6 +6,8 @@
 #include "qdropbox2entity.h"
 #include "qdropbox2entityinfo.h"
 
+class QDropbox2ZipReader;
+
 //! Allows access to folders stored on Dropbox
 
 class QDROPBOXSHARED_EXPORT QDropbox2Folder : public QObject, public IQDropbox2Entity
@@ -14,6 +16,21 @@ class QDROPBOXSHARED_EXPORT QDropbox2Folder : public QObject, public IQDropbox2E
 
 public:     // typedefs and enums
     typedef QList<QDropbox2EntityInfo> ContentsList;
+    typedef QList<QDropbox2Entry> EntryList;
+
+    //! Conditions applied on the server by searchPages()
+    struct SearchFilter
+    {
+        QStringList extensions;     // file extensions, without the dot (e.g., "jpg")
+        QStringList categories;     // e.g., "image", "document", "pdf", "audio", "video", "folder"
+        bool        filenameOnly;   // match file names, not content
+        bool        deleted;        // match deleted files instead of active ones
+
+        SearchFilter()
+            : filenameOnly(false),
+              deleted(false)
+        {}
+    };
 
 public:
     /*!
@@ -187,6 +204,30 @@ public:
     */
     bool waitForChanged(int timeout = 30);
 
+    /*!
+      Continuously watch the folder for changes.  The folder is long-polled in
+      the background; whenever the server reports changes they are retrieved
+      (as with hasChanged()), applied to the metadata cache of the QDropbox2
+      instance, and emitted with signal_hasChangedResults().
+
+      \remark This is an asynchronous call.  Watching continues until unwatch()
+      is called.
+
+      \param timeout The number of seconds each long-poll request may wait.
+      \returns <i>true</i> if watching was started or <i>false</i> if it was not.
+    */
+    bool watch(int timeout = 30);
+
+    /*!
+      Stop watching the folder for changes.
+    */
+    void unwatch();
+
+    /*!
+      Indicates whether the folder is being watched for changes.
+    */
+    bool isWatching() const { return watching; }
+
     /*!
       Gets and returns all the contents of the folder.
 
@@ -209,7 +250,9 @@ public:
       the returned contents, and then issuing a contents() call on each.
 
       \remark This is an asynchronous call. Emits a signal when contents have
-      been retrieved.
+      been retrieved.  If a QDropbox2Engine is enabled, the request is sent from
+      its I/O threads, the response is parsed on its worker pool, and all
+      pages of a large listing are retrieved before the signal is emitted.
 
       \param include_folders Include folders in the result.
       \param include_deleted Include deleted files in the result.
@@ -247,6 +290,45 @@ public:
     */
     bool search(const QString& query, quint64 max_results = 100, const QString& mode = "filename");
 
+    /*!
+      Search beneath this folder for files and folders that match the query
+      ("search_v2"), with the filter applied by the server.  Results are not
+      collected: each page is emitted with signal_searchPage() as soon as it
+      has been decoded, and the next page is then requested with its cursor
+      ("search/continue_v2"), so any number of results can be retrieved in
+      bounded memory.
+
+      \remark This is an asynchronous call.  If an engine is enabled (see
+      QDropbox2::enableEngine()), pages are decoded on its parser pool.
+
+      \param query The query string to match against entries.
+      \param filter Extensions, categories and status of the entries to match.
+      \param page_size The number of results per page, up to 1000.
+      \returns <i>true</i> if the search was submitted or <i>false</i> if there was an error.
+    */
+    bool searchPages(const QString& query, const SearchFilter& filter = SearchFilter(), int page_size = 100);
+
+    /*!
+      Download the folder, with everything beneath it, as a single zip archive
+      ("download_zip"), rather than with one request per file.
+
+      The archive is decoded while it downloads, and is never held as a
+      whole: each entry is written to <i>local_dir</i> as soon as it has been
+      decoded or, if <i>local_dir</i> is empty, handed out as a QIODevice with
+      signal_downloadEntry().  Entries are named relative to the folder.
+      Files are written through QSaveFile, so an entry that fails its checksum
+      never replaces an existing file.
+
+      \remark The server only zips folders of up to 20 GB and 10,000 entries;
+      larger folders fail with "too_large" or "too_many_files".
+
+      \remark This is a blocking call.
+
+      \param local_dir Directory to extract the folder into; created if needed.
+      \returns <i>true</i> if the whole folder was downloaded or <i>false</i> if there was an error.
+    */
+    bool download(const QString& local_dir = QString());
+
     /*!
       Reimplemented from IQDropbox2Entity.
     */
@@ -272,8 +354,40 @@ signals:
     void    signal_searchResults(const ContentsList& search_results);
     void    signal_hasChangedResults(const ContentsList& change_results);
 
+    /*!
+      Emitted by searchPages() for each page of results.
+
+      \param entries The matches of the page, in the order ranked by the server.
+      \param has_more Whether another page follows.
+     */
+    void    signal_searchPage(const EntryList& entries, bool has_more);
+
+    /*!
+      Emitted by download(), when no local directory was given, as each file
+      in the archive starts to arrive.  The device is filled while the
+      archive downloads, and emits readChannelFinished() once the file is
+      complete; it is deleted after that, once control returns to the event
+      loop, so read from it as data arrives.
+
+      \param path Path of the file, relative to the folder.
+      \param device Sequential device holding the content.
+     */
+    void    signal_downloadEntry(const QString& path, QIODevice* device);
+
+    /*!
+      Emitted by download() as the archive arrives.
+
+      \param bytesReceived Bytes of the archive received so far.
+      \param bytesTotal Size of the archive, or -1 if it is not known.  The
+                        zip is built while it is sent, so download_zip usually
+                        sends no Content-Length, and the total stays -1 until
+                        the download completes.
+     */
+    void    signal_downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+
 private slots:
     void    slot_networkRequestFinished(QNetworkReply* rply);
+    void    slot_poll();
 
 private:        // typedefs and enums
     struct CallbackData;
@@ -293,6 +407,11 @@ private:        // classes
     struct ContentsData : public CallbackData
     {
         bool include_folders;
+        quint64 trace;
+    };
+    struct DownloadData : public CallbackData
+    {
+        QDropbox2ZipReader* zip;
     };
 
 private:        // methods
@@ -306,7 +425,8 @@ private:        // methods
     bool    requestRemoval(bool permanently);
     bool    requestMove(const QString& to_path);
     bool    requestCopy(const QString& to_path);
-    bool    requestLongpoll(int timeout = 30);
+    bool    requestLongpoll(QNetworkReply*& reply, int timeout = 30, bool async = false);
+    bool    requestDownload(const QString& local_dir);
 
     bool    getLatestCursor(QString& cursor, bool include_deleted = true);
 
@@ -314,7 +434,13 @@ private:        // methods
     // function needs to set data into the AsyncMap for later access
     // by the callback function.
     bool    getContents(QNetworkReply*& reply, const QString& cursor, bool include_deleted = false, bool async = false);
+    bool    prepareContents(QNetworkRequest& req, QByteArray& postdata, const QString& cursor, bool include_deleted);
+    bool    engineContents(bool include_folders, bool include_deleted, ContentsList accumulated, quint64 trace);
+    static QVariant parseContents(const QByteArray& response);
     bool    getSearch(QNetworkReply*& reply, const QString& query, quint64 start, quint64 max_results, const QString& mode, bool async);
+    bool    requestSearchPage(const QString& path, const QByteArray& postdata);
+    void    searchPageResult(const QVariantMap& page);
+    static QVariant parseSearch(const QByteArray& response);
 
     // functions for synchronous actions
     void    startEventLoop();
@@ -323,7 +449,12 @@ private:        // methods
     // QNetworkReply post-processing callbacks (synchronous and asynchronous)
     void    contentsCallback(QNetworkReply* reply, CallbackPtr data);
     void    searchCallback(QNetworkReply* reply, CallbackPtr data);
+    void    searchPageCallback(QNetworkReply* reply, CallbackPtr data);
     void    hasChangedCallback(QNetworkReply* reply, CallbackPtr data);
+    void    longpollCallback(QNetworkReply* reply, CallbackPtr data);
+    void    downloadCallback(QNetworkReply* reply, CallbackPtr data);
+
+    void    updateCaches(const ContentsList& changes);
 
 private:        // data members
     QNetworkAccessManager QNAM;
@@ -341,13 +472,17 @@ private:        // data members
 
     int         lastErrorCode;
     QString     lastErrorMessage;
-    QString     lastResponse;
+    QByteArray  lastResponse;
 
     bool        overwrite_;
     bool        rename;
 
     QString     latestCursor;
 
+    bool        watching;
+    int         watchTimeout;
+    quint64     longpollTrace;      // see QDropbox2::enableTracing()
+
     QDropbox2EntityInfo *_metadata;
 };
 
@@ -0,0 +1,231 @@
+#include "qdropbox2json.h"
+
+// room for the member names, punctuation and scalars of the largest request
+// the library builds; string values are accounted for separately
+static const int FixedReserve = 256;
+
+// the worst case encoding of a single UTF-16 unit is a six byte "\uXXXX"
+static const int MaxEscapedUnit = 6;
+
+static const char HexDigits[] = "0123456789abcdef";
+
+QDropbox2JsonWriter::QDropbox2JsonWriter(int string_chars, Encoding encoding)
+    : encoding(encoding),
+      populated(0),
+      depth(0)
+{
+    buffer.reserve(FixedReserve + string_chars * MaxEscapedUnit);
+}
+
+void QDropbox2JsonWriter::separator()
+{
+    if(depth == 0)
+        return;
+
+    const quint64 bit = quint64(1) << (depth - 1);
+    if(populated & bit)
+        buffer.append(", ");
+    else
+        populated |= bit;
+}
+
+void QDropbox2JsonWriter::key(const char* key)
+{
+    separator();
+    buffer.append('"');
+    buffer.append(key);
+    buffer.append("\": ");
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::beginObject()
+{
+    Q_ASSERT(depth < 64);
+
+    separator();
+    buffer.append('{');
+    ++depth;
+    populated &= ~(quint64(1) << (depth - 1));
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::beginObject(const char* name)
+{
+    Q_ASSERT(depth > 0 && depth < 64);
+
+    key(name);
+    buffer.append('{');
+    ++depth;
+    populated &= ~(quint64(1) << (depth - 1));
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::endObject()
+{
+    Q_ASSERT(depth > 0);
+
+    buffer.append('}');
+    --depth;
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::beginArray(const char* name)
+{
+    Q_ASSERT(depth > 0 && depth < 64);
+
+    key(name);
+    buffer.append('[');
+    ++depth;
+    populated &= ~(quint64(1) << (depth - 1));
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::endArray()
+{
+    Q_ASSERT(depth > 0);
+
+    buffer.append(']');
+    --depth;
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::value(const char* name, const QString& value)
+{
+    key(name);
+    appendString(buffer, value, encoding);
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::value(const char* name, const char* value)
+{
+    key(name);
+    buffer.append('"');
+    buffer.append(value);
+    buffer.append('"');
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::value(const char* name, bool value)
+{
+    key(name);
+    buffer.append(value ? "true" : "false");
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::value(const char* name, int value)
+{
+    return this->value(name, static_cast<qint64>(value));
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::value(const char* name, qint64 value)
+{
+    key(name);
+
+    // format into a local array; QByteArray::number() would allocate
+    char digits[24];
+    int n = 0;
+    quint64 magnitude = (value < 0) ? (0 - static_cast<quint64>(value)) : static_cast<quint64>(value);
+    do
+    {
+        digits[n++] = char('0' + (magnitude % 10));
+        magnitude /= 10;
+    } while(magnitude);
+
+    if(value < 0)
+        buffer.append('-');
+    while(n)
+        buffer.append(digits[--n]);
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::value(const char* name, quint64 value)
+{
+    key(name);
+
+    char digits[24];
+    int n = 0;
+    do
+    {
+        digits[n++] = char('0' + (value % 10));
+        value /= 10;
+    } while(value);
+
+    while(n)
+        buffer.append(digits[--n]);
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::element(const QString& value)
+{
+    separator();
+    appendString(buffer, value, encoding);
+    return *this;
+}
+
+QDropbox2JsonWriter& QDropbox2JsonWriter::raw(const char* name, const QByteArray& json)
+{
+    key(name);
+    buffer.append(json);
+    return *this;
+}
+
+void QDropbox2JsonWriter::appendString(QByteArray& out, const QString& value, Encoding encoding)
+{
+    out.append('"');
+
+    const ushort* units = value.utf16();
+    const int length = value.size();
+    for(int i = 0;i < length;++i)
+    {
+        uint c = units[i];
+
+        switch(c)
+        {
+            case '"':   out.append("\\\"");  continue;
+            case '\\':  out.append("\\\\");  continue;
+            case '\b':  out.append("\\b");   continue;
+            case '\f':  out.append("\\f");   continue;
+            case '\n':  out.append("\\n");   continue;
+            case '\r':  out.append("\\r");   continue;
+            case '\t':  out.append("\\t");   continue;
+            default:    break;
+        }
+
+        if(c < 0x20 || (encoding == AsciiSafe && c >= 0x7f))
+        {
+            // surrogate pairs are escaped unit by unit, which is what JSON expects
+            out.append("\\u");
+            out.append(HexDigits[(c >> 12) & 0xf]);
+            out.append(HexDigits[(c >> 8) & 0xf]);
+            out.append(HexDigits[(c >> 4) & 0xf]);
+            out.append(HexDigits[c & 0xf]);
+        }
+        else if(c < 0x80)
+            out.append(char(c));
+        else if(c < 0x800)
+        {
+            out.append(char(0xc0 | (c >> 6)));
+            out.append(char(0x80 | (c & 0x3f)));
+        }
+        else
+        {
+            if(QChar::isHighSurrogate(c) && (i + 1) < length && QChar::isLowSurrogate(units[i + 1]))
+            {
+                uint code = QChar::surrogateToUcs4(ushort(c), units[++i]);
+                out.append(char(0xf0 | (code >> 18)));
+                out.append(char(0x80 | ((code >> 12) & 0x3f)));
+                out.append(char(0x80 | ((code >> 6) & 0x3f)));
+                out.append(char(0x80 | (code & 0x3f)));
+                continue;
+            }
+
+            if(QChar::isSurrogate(c))
+                c = QChar::ReplacementCharacter;    // unpaired surrogate
+
+            out.append(char(0xe0 | (c >> 12)));
+            out.append(char(0x80 | ((c >> 6) & 0x3f)));
+            out.append(char(0x80 | (c & 0x3f)));
+        }
+    }
+
+    out.append('"');
+}
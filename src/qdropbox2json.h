@@ -0,0 +1,123 @@
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+#include "qdropbox2global.h"
+
+//! Builds the small JSON documents sent to the Dropbox APIv2
+/*!
+  QDropbox2JsonWriter produces the JSON request bodies and "Dropbox-API-arg"
+  header values used by the library.  The output buffer is allocated once, up
+  front, and values are appended in place with correct JSON string escaping.
+
+  When the output is destined for an HTTP header, use the AsciiSafe encoding.
+  Dropbox requires that the character 0x7F and all non-ASCII characters in the
+  "Dropbox-API-arg" header be escaped (e.g., as "\\u00e9"); the writer will do this
+  for every string value.
+
+  Example:
+
+      QDropbox2JsonWriter json(_filename.size(), QDropbox2JsonWriter::AsciiSafe);
+      json.beginObject()
+              .value("path", _filename)
+              .value("mute", true)
+          .endObject();
+      req.setRawHeader("Dropbox-API-arg", json.data());
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2JsonWriter
+{
+public:
+    //! Output encoding for string values
+    enum Encoding
+    {
+        Utf8,       /*!< Strings are written as UTF-8 (request bodies) */
+        AsciiSafe   /*!< Non-ASCII characters are written as \\uXXXX escapes (HTTP headers) */
+    };
+
+    /*!
+      Creates a writer and reserves its output buffer.
+
+      \param string_chars Total length of the string values that will be written.
+                          Used to size the single up-front allocation for the worst
+                          case escaping of those strings.
+      \param encoding How string values are to be encoded.
+     */
+    explicit QDropbox2JsonWriter(int string_chars = 0, Encoding encoding = Utf8);
+
+    /*!
+      Opens an anonymous object (the document root, or an array element).
+     */
+    QDropbox2JsonWriter& beginObject();
+
+    /*!
+      Opens an object as the value of the named member.
+     */
+    QDropbox2JsonWriter& beginObject(const char* key);
+
+    /*!
+      Closes the innermost object.
+     */
+    QDropbox2JsonWriter& endObject();
+
+    /*!
+      Opens an array as the value of the named member.
+     */
+    QDropbox2JsonWriter& beginArray(const char* key);
+
+    /*!
+      Closes the innermost array.
+     */
+    QDropbox2JsonWriter& endArray();
+
+    /*!
+      Writes a string member, escaping it for the selected encoding.
+     */
+    QDropbox2JsonWriter& value(const char* key, const QString& value);
+
+    /*!
+      Writes a string member from a plain ASCII literal (e.g., an enumerated
+      API value such as "overwrite").  The literal is not escaped.
+     */
+    QDropbox2JsonWriter& value(const char* key, const char* value);
+
+    QDropbox2JsonWriter& value(const char* key, bool value);
+    QDropbox2JsonWriter& value(const char* key, int value);
+    QDropbox2JsonWriter& value(const char* key, qint64 value);
+    QDropbox2JsonWriter& value(const char* key, quint64 value);
+
+    /*!
+      Writes a string as an array element.
+     */
+    QDropbox2JsonWriter& element(const QString& value);
+
+    /*!
+      Writes a member whose value is an already-encoded JSON fragment (e.g., the
+      output of another QDropbox2JsonWriter).
+     */
+    QDropbox2JsonWriter& raw(const char* key, const QByteArray& json);
+
+    /*!
+      Returns the encoded document.  The returned array shares the writer's
+      buffer, so taking a copy of it does not allocate.
+     */
+    const QByteArray& data() const { return buffer; }
+
+    /*!
+      Appends the JSON encoding of a string, including the surrounding quotes, to
+      an arbitrary buffer.
+     */
+    static void appendString(QByteArray& out, const QString& value, Encoding encoding = Utf8);
+
+private:
+    void    separator();
+    void    key(const char* key);
+
+    QByteArray  buffer;
+    Encoding    encoding;
+
+    // one bit per nesting level; set when the level already holds a member,
+    // so no container stack has to be allocated
+    quint64     populated;
+    int         depth;
+};
@@ -0,0 +1,121 @@
+#include <QDateTime>
+
+#include "qdropbox2linkcache.h"
+
+QDropbox2LinkCache::QDropbox2LinkCache(int lifetime)
+    : _lifetime(lifetime),
+      purgeAt(64)
+{
+}
+
+int QDropbox2LinkCache::lifetime() const
+{
+    QMutexLocker locker(&mutex);
+    return _lifetime;
+}
+
+void QDropbox2LinkCache::setLifetime(int seconds)
+{
+    QMutexLocker locker(&mutex);
+    _lifetime = seconds;
+}
+
+void QDropbox2LinkCache::setClock(Clock clock)
+{
+    QMutexLocker locker(&mutex);
+    this->clock = clock;
+}
+
+qint64 QDropbox2LinkCache::now() const
+{
+    return clock ? clock() : QDateTime::currentMSecsSinceEpoch();
+}
+
+int QDropbox2LinkCache::count() const
+{
+    QMutexLocker locker(&mutex);
+    return links.count();
+}
+
+bool QDropbox2LinkCache::lookup(const QString& path, const QString& rev, QUrl& link)
+{
+    QMutexLocker locker(&mutex);
+
+    QHash<QString, Link>::iterator iter = links.find(path.toLower());
+    if(iter == links.end())
+        return false;
+
+    if(iter->expires <= now() ||
+       (!rev.isEmpty() && iter->rev != rev))
+    {
+        links.erase(iter);
+        return false;
+    }
+
+    link = iter->url;
+    return true;
+}
+
+void QDropbox2LinkCache::insert(const QString& path, const QString& rev, const QUrl& link)
+{
+    QMutexLocker locker(&mutex);
+
+    const qint64 inserted = now();
+
+    Link& entry = links[path.toLower()];
+    entry.rev = rev;
+    entry.url = link;
+    entry.expires = inserted + _lifetime * qint64(1000);
+
+    // expired links are otherwise only dropped when looked up again, so
+    // sweep whenever the table has doubled since the last sweep
+    if(links.count() >= purgeAt)
+    {
+        purgeExpired(inserted);
+        purgeAt = qMax(64, links.count() * 2);
+    }
+}
+
+void QDropbox2LinkCache::invalidate(const QString& path)
+{
+    QMutexLocker locker(&mutex);
+
+    const QString key = path.toLower();
+    if(links.remove(key) || links.isEmpty())
+        return;
+
+    // not a cached file; it may be a folder that was moved or removed
+    const QString prefix = key + "/";
+    QHash<QString, Link>::iterator iter = links.begin();
+    while(iter != links.end())
+    {
+        if(iter.key().startsWith(prefix))
+            iter = links.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+void QDropbox2LinkCache::purge()
+{
+    QMutexLocker locker(&mutex);
+    purgeExpired(now());
+}
+
+void QDropbox2LinkCache::purgeExpired(qint64 now)
+{
+    QHash<QString, Link>::iterator iter = links.begin();
+    while(iter != links.end())
+    {
+        if(iter->expires <= now)
+            iter = links.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+void QDropbox2LinkCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    links.clear();
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <functional>
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QUrl>
+
+#include "qdropbox2global.h"
+
+//! A cache of temporary streaming links
+/*!
+  Links returned by "get_temporary_link" remain valid for four hours, so there
+  is no need to ask the server for a new one every time a file is to be
+  streamed.  QDropbox2LinkCache remembers each link together with the
+  revision of the file it was issued for, and serves it until shortly before
+  the server would expire it.
+
+  A cached link is dropped when the library learns that the file changed:
+  through its own write, move, copy or remove operations, through deltas for
+  a watched folder (see QDropbox2::watchMetadata()), or when the caller
+  supplies a current revision that differs from the cached one.
+
+  Instances are created and owned by QDropbox2 (see QDropbox2::linkCache()).
+  All methods are thread-safe.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2LinkCache
+{
+public:
+    enum
+    {
+        //! Links are issued for four hours; stop serving them ten minutes early
+        DefaultLifetime = 4*60*60 - 10*60
+    };
+
+    //! Returns the current time, in msecs since the epoch
+    typedef std::function<qint64()> Clock;
+
+    /*!
+      Creates an empty cache.
+
+      \param lifetime Number of seconds a link is served after it was obtained.
+     */
+    explicit QDropbox2LinkCache(int lifetime = DefaultLifetime);
+
+    /*!
+      Returns the number of seconds a link is served after it was obtained.
+     */
+    int     lifetime() const;
+
+    /*!
+      Sets the number of seconds a link is served after it was obtained.  Values
+      above four hours will result in dead links being served.
+     */
+    void    setLifetime(int seconds);
+
+    /*!
+      Replaces the clock by which links expire, e.g. to test expiry without
+      waiting for it.  An empty Clock restores the system clock.
+     */
+    void    setClock(Clock clock);
+
+    /*!
+      Returns the number of cached links, including any that have expired but
+      not yet been purged.
+     */
+    int     count() const;
+
+    /*!
+      Retrieves an unexpired link for the path.
+
+      \param path Dropbox path of the file.
+      \param rev Current revision of the file, if known.  If given, a link issued
+                 for any other revision is not returned (and is dropped).
+      \param link Receives the link.
+      \returns <i>true</i> if a usable link was found.
+     */
+    bool    lookup(const QString& path, const QString& rev, QUrl& link);
+
+    /*!
+      Stores a link that was just obtained from the server.
+     */
+    void    insert(const QString& path, const QString& rev, const QUrl& link);
+
+    /*!
+      Drops the link for the path, or the links for all files beneath it if
+      the path is a folder.
+     */
+    void    invalidate(const QString& path);
+
+    /*!
+      Drops all expired links.
+     */
+    void    purge();
+
+    /*!
+      Drops all links.
+     */
+    void    clear();
+
+private:
+    struct Link
+    {
+        QString rev;
+        QUrl    url;
+        qint64  expires;    // msecs since epoch
+    };
+
+    qint64  now() const;
+    void    purgeExpired(qint64 now);
+
+    mutable QMutex  mutex;
+
+    int             _lifetime;
+    int             purgeAt;
+    Clock           clock;
+
+    QHash<QString, Link>    links;  // lower-cased path -> link
+};
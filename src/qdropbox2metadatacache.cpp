@@ -0,0 +1,315 @@
+#ifdef QTDROPBOX_DEBUG
+#include <QDebug>
+#endif
+
+#include "qdropbox2metadatacache.h"
+
+QDropbox2MetadataCache::QDropbox2MetadataCache(int max_entries, qint64 max_bytes)
+    : _maxEntries(max_entries),
+      _maxBytes(max_bytes),
+      totalBytes(0),
+      _generation(0),
+      _hits(0),
+      _misses(0),
+      head(nullptr),
+      tail(nullptr)
+{
+}
+
+QDropbox2MetadataCache::~QDropbox2MetadataCache()
+{
+    qDeleteAll(nodes);
+}
+
+void QDropbox2MetadataCache::setLimits(int max_entries, qint64 max_bytes)
+{
+    QMutexLocker locker(&mutex);
+    _maxEntries = max_entries;
+    _maxBytes = max_bytes;
+    evict();
+}
+
+int QDropbox2MetadataCache::maxEntries() const
+{
+    QMutexLocker locker(&mutex);
+    return _maxEntries;
+}
+
+qint64 QDropbox2MetadataCache::maxBytes() const
+{
+    QMutexLocker locker(&mutex);
+    return _maxBytes;
+}
+
+int QDropbox2MetadataCache::count() const
+{
+    QMutexLocker locker(&mutex);
+    return nodes.count();
+}
+
+qint64 QDropbox2MetadataCache::memoryUsage() const
+{
+    QMutexLocker locker(&mutex);
+    return totalBytes + paths.memoryUsage();
+}
+
+quint64 QDropbox2MetadataCache::hits() const
+{
+    QMutexLocker locker(&mutex);
+    return _hits;
+}
+
+quint64 QDropbox2MetadataCache::misses() const
+{
+    QMutexLocker locker(&mutex);
+    return _misses;
+}
+
+QString QDropbox2MetadataCache::normalize(const QString& path)
+{
+    // Dropbox paths are case-insensitive, and the root is "" in APIv2
+    QString key = path.toLower();
+    while(key.endsWith('/'))
+        key.chop(1);
+    return key;
+}
+
+QString QDropbox2MetadataCache::parentOf(const QString& key)
+{
+    int slash = key.lastIndexOf('/');
+    return (slash <= 0) ? QString("") : key.left(slash);
+}
+
+void QDropbox2MetadataCache::addRoot(const QString& root)
+{
+    QMutexLocker locker(&mutex);
+    QString key = normalize(root);
+    if(!watched.contains(key))
+    {
+        watched.append(key);
+        watchedIds.append(paths.insert(key));
+    }
+}
+
+void QDropbox2MetadataCache::removeRoot(const QString& root)
+{
+    QMutexLocker locker(&mutex);
+    QString key = normalize(root);
+    int index = watched.indexOf(key);
+    if(index < 0)
+        return;
+
+    watched.removeAt(index);
+    Id id = watchedIds.takeAt(index);
+
+    Node* node = head;
+    while(node)
+    {
+        Node* next = node->next;
+        if(!covers(node->id))
+            drop(node);
+        node = next;
+    }
+
+    paths.release(id);
+}
+
+QStringList QDropbox2MetadataCache::roots() const
+{
+    QMutexLocker locker(&mutex);
+    return watched;
+}
+
+bool QDropbox2MetadataCache::covers(Id id) const
+{
+    // list_folder/continue on a non-recursive cursor reports the direct
+    // children of the folder -- not the folder itself
+    return id != QDropbox2PathTable::Root && watchedIds.contains(paths.parent(id));
+}
+
+bool QDropbox2MetadataCache::covers(const QString& key) const
+{
+    // the roots are interned, so their ids can be found without the entry's
+    return !key.isEmpty() && watchedIds.contains(paths.find(parentOf(key)));
+}
+
+bool QDropbox2MetadataCache::isCovered(const QString& path) const
+{
+    QMutexLocker locker(&mutex);
+    return covers(normalize(path));
+}
+
+quint64 QDropbox2MetadataCache::generation() const
+{
+    QMutexLocker locker(&mutex);
+    return _generation;
+}
+
+void QDropbox2MetadataCache::unlink(Node* node)
+{
+    if(node->prev)
+        node->prev->next = node->next;
+    else
+        head = node->next;
+    if(node->next)
+        node->next->prev = node->prev;
+    else
+        tail = node->prev;
+    node->prev = node->next = nullptr;
+}
+
+void QDropbox2MetadataCache::pushFront(Node* node)
+{
+    node->prev = nullptr;
+    node->next = head;
+    if(head)
+        head->prev = node;
+    head = node;
+    if(!tail)
+        tail = node;
+}
+
+void QDropbox2MetadataCache::drop(Node* node)
+{
+    unlink(node);
+    nodes.remove(node->id);
+    totalBytes -= node->bytes;
+    paths.release(node->id);
+    delete node;
+}
+
+void QDropbox2MetadataCache::dropBeneath(Id ancestor, bool inclusive)
+{
+    if(ancestor == QDropbox2PathTable::None)
+        return;     // nothing cached has that path in it
+
+    Node* node = head;
+    while(node)
+    {
+        Node* next = node->next;
+        if((inclusive && node->id == ancestor) || paths.isBeneath(node->id, ancestor))
+            drop(node);
+        node = next;
+    }
+}
+
+void QDropbox2MetadataCache::evict()
+{
+    while(tail && (nodes.count() > _maxEntries || totalBytes + paths.memoryUsage() > _maxBytes))
+    {
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2MetadataCache: evicting" << paths.path(tail->id) << endl;
+#endif
+        drop(tail);
+    }
+}
+
+void QDropbox2MetadataCache::store(const QDropbox2Entry& entry)
+{
+    // interned with its display case, which path() gives back on lookup
+    Id id = paths.insert(entry.path);
+
+    Node* node = nodes.value(id, nullptr);
+    if(node)
+    {
+        unlink(node);
+        totalBytes -= node->bytes;
+        paths.release(id);      // the node already holds a reference
+    }
+    else
+    {
+        node = new Node;
+        node->id = id;
+        nodes.insert(id, node);
+    }
+
+    node->entry = entry;
+    node->entry.path.clear();
+    node->bytes = node->entry.memoryUsage() + qint64(sizeof(Node));
+    totalBytes += node->bytes;
+    pushFront(node);
+
+    evict();
+}
+
+bool QDropbox2MetadataCache::lookup(const QString& path, QDropbox2Entry& entry)
+{
+    QMutexLocker locker(&mutex);
+
+    Id id = paths.find(path);
+    Node* node = (id == QDropbox2PathTable::None) ? nullptr : nodes.value(id, nullptr);
+    if(!node)
+    {
+        ++_misses;
+        return false;
+    }
+
+    ++_hits;
+    unlink(node);
+    pushFront(node);
+    entry = node->entry;
+    entry.path = paths.path(id);
+    return true;
+}
+
+void QDropbox2MetadataCache::insert(const QDropbox2Entry& entry, quint64 generation)
+{
+    QMutexLocker locker(&mutex);
+
+    if(generation != _generation)
+        return;     // a delta arrived while this response was in flight
+
+    if(covers(normalize(entry.path)))
+        store(entry);
+}
+
+void QDropbox2MetadataCache::apply(const QList<QDropbox2Entry>& changes)
+{
+    QMutexLocker locker(&mutex);
+
+    ++_generation;
+
+    foreach(const QDropbox2Entry& entry, changes)
+    {
+        QString key = normalize(entry.path);
+
+        // a folder that was replaced or deleted takes its subtree with it
+        if(entry.type != QDropbox2Entry::File)
+            dropBeneath(paths.find(key), false);
+
+        if(covers(key))
+            store(entry);
+        else
+        {
+            Id id = paths.find(key);
+            if(nodes.contains(id))
+                drop(nodes.value(id));
+        }
+    }
+}
+
+void QDropbox2MetadataCache::invalidate(const QString& path)
+{
+    QMutexLocker locker(&mutex);
+
+    ++_generation;
+
+    dropBeneath(paths.find(path), true);
+}
+
+void QDropbox2MetadataCache::clear()
+{
+    QMutexLocker locker(&mutex);
+
+    ++_generation;
+
+    qDeleteAll(nodes);
+    nodes.clear();
+    head = tail = nullptr;
+    totalBytes = 0;
+
+    // only the roots are left in the table
+    paths.clear();
+    for(int i = 0;i < watched.count();++i)
+        watchedIds[i] = paths.insert(watched[i]);
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include "qdropbox2global.h"
+#include "qdropbox2entry.h"
+#include "qdropbox2pathtable.h"
+
+//! A bounded, least-recently-used cache of entry metadata held in memory
+/*!
+  QDropbox2MetadataCache lets QDropbox2File and QDropbox2Folder answer repeated
+  metadata requests without calling "get_metadata" on the server.
+
+  Serving metadata from memory is only safe if the cache learns about every
+  change, so entries are only held for paths that are the direct children of a
+  <i>watched root</i> (see QDropbox2::watchMetadata()).  Each watched root is
+  long-polled by the library, and the deltas returned by "list_folder/continue"
+  are applied to the cache with apply(): changed entries are replaced, deleted
+  entries are recorded as such.  No time-based expiry is involved.
+
+  The cache is bounded both by the number of entries and by their approximate
+  memory footprint; the least recently used entries are dropped first.
+
+  Paths are interned in a QDropbox2PathTable rather than held by every entry,
+  so the folders above the cached entries are stored once; a lookup resolves
+  the path one component at a time.
+
+  Instances are created and owned by QDropbox2 (see QDropbox2::metadataCache()).
+  All methods are thread-safe.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2MetadataCache
+{
+public:
+    /*!
+      Creates an empty cache.
+
+      \param max_entries Upper bound on the number of cached entries.
+      \param max_bytes Upper bound on the approximate memory used by the entries.
+     */
+    QDropbox2MetadataCache(int max_entries = 10000, qint64 max_bytes = 16*1024*1024);
+    ~QDropbox2MetadataCache();
+
+    /*!
+      Changes the bounds of the cache, dropping entries if it is now over budget.
+     */
+    void setLimits(int max_entries, qint64 max_bytes);
+
+    int     maxEntries() const;
+    qint64  maxBytes() const;
+
+    /*!
+      Returns the number of cached entries.
+     */
+    int     count() const;
+
+    /*!
+      Returns the approximate memory used by the cached entries.
+     */
+    qint64  memoryUsage() const;
+
+    /*!
+      Returns the number of lookups that were answered from the cache, and the
+      number that were not.
+     */
+    quint64 hits() const;
+    quint64 misses() const;
+
+    /*!
+      Starts caching the direct children of the given Dropbox folder.
+     */
+    void    addRoot(const QString& root);
+
+    /*!
+      Stops caching the children of the given Dropbox folder, and drops any
+      entries held for them.
+     */
+    void    removeRoot(const QString& root);
+
+    /*!
+      Returns the watched roots.
+     */
+    QStringList roots() const;
+
+    /*!
+      Indicates whether metadata for the path may be held by the cache.
+     */
+    bool    isCovered(const QString& path) const;
+
+    /*!
+      Returns a counter that changes whenever a delta is applied.  Take it
+      before requesting metadata from the server, and pass it to insert() with
+      the result, so that a response which raced with a delta cannot overwrite
+      newer information.
+     */
+    quint64 generation() const;
+
+    /*!
+      Retrieves the cached metadata for the path, marking it as most recently
+      used.
+
+      \returns <i>true</i> if the path was cached.
+     */
+    bool    lookup(const QString& path, QDropbox2Entry& entry);
+
+    /*!
+      Stores metadata obtained from the server.  The entry is ignored if its
+      path is not covered by a watched root, or if a delta was applied since
+      <i>generation</i> was taken.
+     */
+    void    insert(const QDropbox2Entry& entry, quint64 generation);
+
+    /*!
+      Applies a delta from "list_folder/continue" (or "list_folder") to the cache.
+     */
+    void    apply(const QList<QDropbox2Entry>& changes);
+
+    /*!
+      Drops the entry for the path, and any entries beneath it.
+     */
+    void    invalidate(const QString& path);
+
+    /*!
+      Drops all entries.  Watched roots are kept.
+     */
+    void    clear();
+
+private:
+    typedef QDropbox2PathTable::Id Id;
+
+    struct Node
+    {
+        Id              id;
+        QDropbox2Entry  entry;      // without its path, which is in the table
+        qint64          bytes;
+        Node*           prev;
+        Node*           next;
+    };
+
+    static QString  normalize(const QString& path);
+    static QString  parentOf(const QString& key);
+
+    bool    covers(Id id) const;
+    bool    covers(const QString& key) const;
+    void    store(const QDropbox2Entry& entry);
+    void    dropBeneath(Id ancestor, bool inclusive);
+    void    unlink(Node* node);
+    void    pushFront(Node* node);
+    void    drop(Node* node);
+    void    evict();
+
+    mutable QMutex  mutex;
+
+    int             _maxEntries;
+    qint64          _maxBytes;
+    qint64          totalBytes;
+    quint64         _generation;
+    quint64         _hits;
+    quint64         _misses;
+
+    QDropbox2PathTable      paths;
+    QHash<Id, Node*>        nodes;      // path -> node
+    Node*                   head;       // most recently used
+    Node*                   tail;       // least recently used
+
+    QStringList             watched;    // lower-cased roots
+    QList<Id>               watchedIds; // their ids, each holding a reference
+};
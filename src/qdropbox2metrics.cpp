@@ -0,0 +1,204 @@
+#include "qdropbox2metrics.h"
+
+//--------------------------------------
+// QDropbox2Metrics::Histogram
+
+const QVector<qint64>& QDropbox2Metrics::Histogram::bounds()
+{
+    static const QVector<qint64> b = QVector<qint64>()
+            << 5 << 10 << 25 << 50 << 100 << 250 << 500
+            << 1000 << 2500 << 5000 << 10000 << 30000 << 60000;
+    return b;
+}
+
+QDropbox2Metrics::Histogram::Histogram()
+    : buckets(bounds().count() + 1, 0),
+      count(0),
+      sum(0),
+      max(0)
+{
+}
+
+void QDropbox2Metrics::Histogram::add(qint64 msecs)
+{
+    const QVector<qint64>& b = bounds();
+
+    int i = 0;
+    while(i < b.count() && msecs > b[i])
+        ++i;
+
+    ++buckets[i];
+    ++count;
+    sum += msecs;
+    max = qMax(max, msecs);
+}
+
+//--------------------------------------
+// QDropbox2Metrics
+
+QDropbox2Metrics::QDropbox2Metrics()
+    : _inFlight(0)
+{
+}
+
+void QDropbox2Metrics::track(QNetworkReply* reply)
+{
+    // the probe is a child of the reply, so it lives on the reply's thread
+    // and goes away with it
+    new QDropbox2MetricsProbe(sharedFromThis(), reply);
+}
+
+void QDropbox2Metrics::recordRetry(const QString& endpoint)
+{
+    QMutexLocker locker(&mutex);
+    ++endpoints[endpoint].retries;
+}
+
+void QDropbox2Metrics::setObserver(Observer observer)
+{
+    QMutexLocker locker(&mutex);
+    this->observer = observer;
+}
+
+QMap<QString, QDropbox2Metrics::Endpoint> QDropbox2Metrics::snapshot() const
+{
+    QMutexLocker locker(&mutex);
+    return endpoints;
+}
+
+int QDropbox2Metrics::inFlight() const
+{
+    QMutexLocker locker(&mutex);
+    return _inFlight;
+}
+
+void QDropbox2Metrics::reset()
+{
+    QMutexLocker locker(&mutex);
+
+    QMap<QString, Endpoint> fresh;
+    for(QMap<QString, Endpoint>::const_iterator iter = endpoints.constBegin();iter != endpoints.constEnd();++iter)
+    {
+        if(iter->inFlight)
+            fresh[iter.key()].inFlight = iter->inFlight;
+    }
+    endpoints = fresh;
+}
+
+void QDropbox2Metrics::started(const QString& endpoint)
+{
+    QMutexLocker locker(&mutex);
+    ++endpoints[endpoint].inFlight;
+    ++_inFlight;
+}
+
+void QDropbox2Metrics::finished(const Sample& sample)
+{
+    Observer notify;
+    {
+        QMutexLocker locker(&mutex);
+
+        Endpoint& endpoint = endpoints[sample.endpoint];
+        --endpoint.inFlight;
+        --_inFlight;
+
+        ++endpoint.requests;
+        endpoint.bytesSent += sample.bytesSent;
+        endpoint.bytesReceived += sample.bytesReceived;
+        if(sample.error != QNetworkReply::NoError)
+            ++endpoint.errors[sample.error];
+
+        if(sample.handshake >= 0)
+            endpoint.latency[Handshake].add(sample.handshake);
+        if(sample.firstByte >= 0)
+            endpoint.latency[FirstByte].add(sample.firstByte);
+        endpoint.latency[Total].add(sample.total);
+
+        notify = observer;
+    }
+
+    // outside the lock, so the observer may call back into us
+    if(notify)
+        notify(sample);
+}
+
+//--------------------------------------
+// QDropbox2MetricsProbe
+
+QDropbox2MetricsProbe::QDropbox2MetricsProbe(QSharedPointer<QDropbox2Metrics> metrics, QNetworkReply* reply)
+    : QObject(reply),
+      metrics(metrics),
+      reply(reply),
+      reported(false)
+{
+    timer.start();
+
+    sample.endpoint      = reply->url().path();
+    sample.error         = QNetworkReply::NoError;
+    sample.httpStatus    = 0;
+    sample.bytesSent     = 0;
+    sample.bytesReceived = 0;
+    sample.handshake     = -1;
+    sample.firstByte     = -1;
+    sample.total         = 0;
+
+    connect(reply, &QNetworkReply::encrypted, this, &QDropbox2MetricsProbe::slot_encrypted);
+    connect(reply, &QNetworkReply::metaDataChanged, this, &QDropbox2MetricsProbe::slot_metaDataChanged);
+    connect(reply, &QNetworkReply::uploadProgress, this, &QDropbox2MetricsProbe::slot_uploadProgress);
+    connect(reply, &QNetworkReply::downloadProgress, this, &QDropbox2MetricsProbe::slot_downloadProgress);
+    connect(reply, &QNetworkReply::finished, this, &QDropbox2MetricsProbe::slot_finished);
+
+    metrics->started(sample.endpoint);
+}
+
+QDropbox2MetricsProbe::~QDropbox2MetricsProbe()
+{
+    // the probe goes away with its reply; one that never finished (e.g., it
+    // was deleted while in flight) must still leave the in-flight count
+    if(!reported)
+    {
+        sample.error = QNetworkReply::OperationCanceledError;
+        report();
+    }
+}
+
+void QDropbox2MetricsProbe::slot_encrypted()
+{
+    sample.handshake = timer.elapsed();
+}
+
+void QDropbox2MetricsProbe::slot_metaDataChanged()
+{
+    if(sample.firstByte < 0)
+        sample.firstByte = timer.elapsed();
+}
+
+void QDropbox2MetricsProbe::slot_uploadProgress(qint64 sent, qint64 /*total*/)
+{
+    sample.bytesSent = sent;
+}
+
+void QDropbox2MetricsProbe::slot_downloadProgress(qint64 received, qint64 /*total*/)
+{
+    sample.bytesReceived = received;
+}
+
+void QDropbox2MetricsProbe::slot_finished()
+{
+    // a reply only finishes once; make sure a late signal is not counted twice
+    if(reported)
+        return;
+
+    sample.error = reply->error();
+    sample.httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    report();
+
+    disconnect(reply, nullptr, this, nullptr);
+}
+
+void QDropbox2MetricsProbe::report()
+{
+    reported = true;
+    sample.total = timer.elapsed();
+    metrics->finished(sample);
+}
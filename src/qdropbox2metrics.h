@@ -0,0 +1,178 @@
+#pragma once
+
+#include <functional>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtNetwork/QNetworkReply>
+
+#include "qdropbox2global.h"
+
+//! Per-endpoint request statistics
+/*!
+  QDropbox2Metrics observes every request the library sends, and keeps, for
+  each APIv2 endpoint (e.g., "/2/files/upload"):
+
+  - the number of requests, the bytes sent and received, the number of
+    errors by error code, and the number of retries,
+  - the number of requests currently in flight,
+  - latency histograms for the connection handshake, time to first byte, and
+    total request time.
+
+  QNetworkAccessManager does not report name resolution or TCP connection
+  times separately, so the handshake phase covers everything from sending the
+  request until the TLS session is established (DNS, connect and TLS).  It is
+  only recorded for requests that opened a new connection; requests that reuse
+  a connection skip straight to time to first byte.
+
+  Set an observer with setObserver() to receive a Sample for each completed
+  request, e.g., to forward it to a monitoring system.
+
+  Instances are created and owned by QDropbox2 (see QDropbox2::enableMetrics()).
+  When metrics are not enabled, the cost to each request is a single pointer
+  test.  All methods are thread-safe.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2Metrics : public QEnableSharedFromThis<QDropbox2Metrics>
+{
+public:
+    //! Phases of a request that have latency histograms
+    enum Phase
+    {
+        Handshake,  /*!< DNS, TCP connect and TLS (new connections only) */
+        FirstByte,  /*!< Request sent until response headers received */
+        Total,      /*!< Request sent until response complete */
+        PhaseCount
+    };
+
+    //! A latency histogram with fixed millisecond bucket bounds
+    struct Histogram
+    {
+        Histogram();
+
+        void    add(qint64 msecs);
+
+        //! Upper bound of each bucket in milliseconds; the last bucket is unbounded
+        static const QVector<qint64>& bounds();
+
+        QVector<quint64> buckets;
+        quint64     count;
+        qint64      sum;
+        qint64      max;
+    };
+
+    //! Accumulated statistics for one endpoint
+    struct Endpoint
+    {
+        Endpoint() : requests(0), retries(0), inFlight(0), bytesSent(0), bytesReceived(0) {}
+
+        quint64     requests;
+        quint64     retries;
+        int         inFlight;
+        qint64      bytesSent;
+        qint64      bytesReceived;
+        QMap<int, quint64> errors;     // QNetworkReply::NetworkError -> count
+        Histogram   latency[PhaseCount];
+    };
+
+    //! The measurements of a single completed request
+    struct Sample
+    {
+        QString     endpoint;
+        int         error;          // QNetworkReply::NetworkError
+        int         httpStatus;
+        qint64      bytesSent;
+        qint64      bytesReceived;
+        qint64      handshake;      // msecs, or -1 if a connection was reused
+        qint64      firstByte;      // msecs, or -1 if no response arrived
+        qint64      total;          // msecs
+    };
+
+    typedef std::function<void(const Sample&)> Observer;
+
+    QDropbox2Metrics();
+
+    /*!
+      Starts observing a request.  The library calls this for every request it
+      sends; statistics are recorded when the reply finishes, or when it is
+      destroyed without finishing.  The instance must be owned by a QSharedPointer.
+     */
+    void    track(QNetworkReply* reply);
+
+    /*!
+      Counts a request that is about to be sent again after a failure.  The
+      repeated request itself is counted by track() as usual.
+
+      \param endpoint Path of the endpoint, e.g., "/2/files/upload_session/append_v2".
+     */
+    void    recordRetry(const QString& endpoint);
+
+    /*!
+      Sets a function to be called with the measurements of each completed
+      request.  It is called on the thread that owns the request, and should
+      return quickly.
+     */
+    void    setObserver(Observer observer);
+
+    /*!
+      Returns a copy of the statistics of every endpoint.
+     */
+    QMap<QString, Endpoint> snapshot() const;
+
+    /*!
+      Returns the number of requests currently in flight, over all endpoints.
+     */
+    int     inFlight() const;
+
+    /*!
+      Clears all statistics.  Requests in flight are still counted as such.
+     */
+    void    reset();
+
+private:
+    friend class QDropbox2MetricsProbe;
+
+    void    started(const QString& endpoint);
+    void    finished(const Sample& sample);
+
+    mutable QMutex  mutex;
+    QMap<QString, Endpoint> endpoints;
+    int             _inFlight;
+    Observer        observer;
+};
+
+//! \internal Measures one request on behalf of QDropbox2Metrics
+class QDropbox2MetricsProbe : public QObject
+{
+    Q_OBJECT
+
+public:
+    QDropbox2MetricsProbe(QSharedPointer<QDropbox2Metrics> metrics, QNetworkReply* reply);
+
+    /*!
+      Records a reply destroyed before it finished as cancelled.
+     */
+    ~QDropbox2MetricsProbe();
+
+private slots:
+    void    slot_encrypted();
+    void    slot_metaDataChanged();
+    void    slot_uploadProgress(qint64 sent, qint64 total);
+    void    slot_downloadProgress(qint64 received, qint64 total);
+    void    slot_finished();
+
+private:
+    void    report();
+
+    // keeps the statistics alive if metrics are disabled mid-request
+    QSharedPointer<QDropbox2Metrics> metrics;
+    QNetworkReply*      reply;
+    QElapsedTimer       timer;
+    bool                reported;
+
+    QDropbox2Metrics::Sample sample;
+};
@@ -0,0 +1,960 @@
+#include <algorithm>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+
+#ifdef QTDROPBOX_DEBUG
+#include <QDebug>
+#endif
+
+#include "qdropbox2mirror.h"
+#include "qdropbox2contentcache.h"
+#include "qdropbox2json.h"
+#include "qdropbox2linkcache.h"
+#include "qdropbox2metadatacache.h"
+#include "qdropbox2transfermanager.h"
+#include "qdropbox2upload.h"
+
+namespace
+{
+    // Qt opens no more than this many connections to a host per manager
+    const int ConnectionsPerManager = 6;
+
+    const char* StateFileName = ".qdropbox2mirror";
+
+    struct WalkEntry
+    {
+        QString     path;
+        bool        isDir;
+        qint64      size;
+        qint64      modified;
+    };
+
+    // shared by the tasks walking one tree; each directory is a task
+    struct Walk
+    {
+        QString             root;
+        QThreadPool         pool;
+        QMutex              mutex;
+        QVector<WalkEntry>  entries;
+    };
+
+    class WalkTask : public QRunnable
+    {
+    public:
+        WalkTask(Walk& walk, const QString& dir) : walk(walk), dir(dir) {}
+
+        void run() override
+        {
+            const QDir directory(dir.isEmpty() ? walk.root : walk.root + '/' + dir);
+            const QString prefix = dir.isEmpty() ? QString() : dir + '/';
+
+            QVector<WalkEntry> found;
+            foreach(const QFileInfo& info, directory.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot |
+                                                                   QDir::Hidden | QDir::NoSymLinks))
+            {
+                if(info.fileName().startsWith(StateFileName) ||
+                   info.fileName().startsWith(QDropbox2Sync::stateFileName()))
+                    continue;
+
+                WalkEntry entry;
+                entry.path      = prefix + info.fileName();
+                entry.isDir     = info.isDir();
+                entry.size      = entry.isDir ? 0 : info.size();
+                entry.modified  = info.lastModified().toMSecsSinceEpoch();
+                found.append(entry);
+
+                if(entry.isDir)
+                    walk.pool.start(new WalkTask(walk, entry.path));
+            }
+
+            QMutexLocker locker(&walk.mutex);
+            walk.entries += found;
+        }
+
+    private:
+        Walk&   walk;
+        QString dir;
+    };
+
+    class HashTask : public QRunnable
+    {
+    public:
+        HashTask(const QString& file, QString& hash) : file(file), hash(hash) {}
+
+        void run() override
+        {
+            QFile input(file);
+            if(input.open(QIODevice::ReadOnly))
+                hash = QDropbox2ContentHasher::hash(&input);
+        }
+
+    private:
+        QString     file;
+        QString&    hash;
+    };
+}
+
+// walks the local tree, one task per directory on a pool of its own; then
+// hands the entries back to the mirror
+class QDropbox2MirrorWalkTask : public QRunnable
+{
+public:
+    QDropbox2MirrorWalkTask(QObject* owner, int run, const QString& root, QVector<QDropbox2Mirror::Item>& local)
+        : owner(owner), runId(run), root(root), local(local) {}
+
+    void run() override
+    {
+        Walk walk;
+        walk.root = root;
+        walk.pool.start(new WalkTask(walk, QString()));
+        walk.pool.waitForDone();
+
+        local.reserve(walk.entries.count());
+        foreach(const WalkEntry& entry, walk.entries)
+        {
+            QDropbox2Mirror::Item item;
+            item.path       = entry.path;
+            item.isDir      = entry.isDir;
+            item.size       = entry.size;
+            item.modified   = entry.modified;
+            local.append(item);
+        }
+
+        QMetaObject::invokeMethod(owner, "slot_walked", Qt::QueuedConnection, Q_ARG(int, runId));
+    }
+
+private:
+    QObject*    owner;
+    int         runId;
+    QString     root;
+    QVector<QDropbox2Mirror::Item>& local;
+};
+
+// hashes the files that changed since they were mirrored, in parallel; then
+// hands them back to the mirror
+class QDropbox2MirrorHashTask : public QRunnable
+{
+public:
+    QDropbox2MirrorHashTask(QObject* owner, int run, const QString& root, QList<QDropbox2Mirror::Item>& items)
+        : owner(owner), runId(run), root(root), items(items) {}
+
+    void run() override
+    {
+        QThreadPool pool;
+        for(int i = 0;i < items.count();++i)
+            pool.start(new HashTask(root + '/' + items[i].path, items[i].hash));
+        pool.waitForDone();
+
+        QMetaObject::invokeMethod(owner, "slot_hashed", Qt::QueuedConnection, Q_ARG(int, runId));
+    }
+
+private:
+    QObject*    owner;
+    int         runId;
+    QString     root;
+    QList<QDropbox2Mirror::Item>& items;
+};
+
+QDropbox2Mirror::QDropbox2Mirror(const QString& local_root, const QString& remote_root, QDropbox2* api, QObject* parent)
+    : QObject(parent),
+      _api(api),
+      _localRoot(QDir(local_root).absolutePath()),
+      _remoteRoot(remote_root),
+      _concurrency(DefaultConcurrency),
+      _batchSize(BatchSize),
+      _largeFileSize(DefaultLargeFileSize),
+      nextManager(0),
+      transfers(new QDropbox2TransferManager(api, this)),
+      running(false),
+      runId(0),
+      aborted(false),
+      listed(false),
+      walked(false),
+      uploading(false),
+      trace(0),
+      batchKind(FinishBatch),
+      sessionsInFlight(0),
+      totalFiles(0),
+      uploadedFiles(0),
+      skippedFiles(0),
+      failedFiles(0),
+      createdFolders(0),
+      uploadedBytes(0),
+      lastErrorCode(0),
+      eventLoop(nullptr)
+{
+    while(_remoteRoot.endsWith('/'))
+        _remoteRoot.chop(1);
+    if(!_remoteRoot.isEmpty() && !_remoteRoot.startsWith('/'))
+        _remoteRoot.prepend('/');
+
+    _stateFile = QDir(_localRoot).filePath(StateFileName);
+
+    connect(transfers, &QDropbox2TransferManager::signal_jobFinished, this, &QDropbox2Mirror::slot_jobFinished);
+}
+
+QDropbox2Mirror::~QDropbox2Mirror()
+{
+    foreach(QNetworkReply* reply, requests.keys())
+    {
+        requests.remove(reply);
+        reply->abort();
+    }
+
+    // a walk or hashing in progress refers to our members, and posts back to us
+    worker.waitForDone();
+}
+
+void QDropbox2Mirror::setConcurrency(int count)
+{
+    _concurrency = qMax(1, count);
+    pump();
+}
+
+bool QDropbox2Mirror::run()
+{
+    if(!start())
+        return false;
+
+    if(running)
+    {
+        QEventLoop loop;
+        eventLoop = &loop;
+        loop.exec();
+        eventLoop = nullptr;
+    }
+
+    return failedFiles == 0 && lastErrorCode == 0;
+}
+
+bool QDropbox2Mirror::start()
+{
+    if(running)
+        return false;
+
+    // a walk left behind by a run that failed early still fills in local
+    worker.waitForDone();
+
+    running = true;
+    ++runId;
+    aborted = listed = walked = uploading = false;
+    totalFiles = uploadedFiles = skippedFiles = failedFiles = createdFolders = 0;
+    uploadedBytes = 0;
+    lastErrorCode = 0;
+    lastErrorMessage.clear();
+
+    remote.clear();
+    local.clear();
+    unhashed.clear();
+    changedFiles.clear();
+    folders.clear();
+    smallFiles.clear();
+    largeFiles.clear();
+    staged.clear();
+    committing.clear();
+    batchJob.clear();
+
+    QString cursor;
+    if(!QDropbox2Sync::loadState(_stateFile, _remoteRoot, cursor, records))
+        records.clear();
+
+    trace = _api->traceBegin("mirror", {{"path", _remoteRoot}});
+
+    // the listing proceeds on the network while the tree is walked
+    listFolder(QString());
+    if(!running)
+        return false;
+
+    worker.start(new QDropbox2MirrorWalkTask(this, runId, _localRoot, local));
+    return true;
+}
+
+void QDropbox2Mirror::slot_abort()
+{
+    // a walk or hashing cannot be interrupted; the run ends once it returns
+    aborted = true;
+
+    changedFiles.clear();
+    folders.clear();
+    smallFiles.clear();
+    largeFiles.clear();
+
+    foreach(const Item& item, staged)
+        fileFailed(item, QNetworkReply::OperationCanceledError, "Aborted.");
+    staged.clear();
+
+    // an asynchronous batch is left to complete on the server
+    if(!batchJob.isEmpty())
+        batchFailed(QNetworkReply::OperationCanceledError, "Aborted.");
+
+    transfers->slot_abort();
+    emit signal_operationAborted();
+    checkFinished();
+}
+
+void QDropbox2Mirror::slot_walked(int run)
+{
+    if(run != runId)
+        return;     // of an earlier run
+
+    walked = true;
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Mirror: walked" << local.count() << "entries" << endl;
+#endif
+
+    plan();
+}
+
+void QDropbox2Mirror::listFolder(const QString& cursor)
+{
+    QByteArray postdata;
+    QString path;
+
+    if(cursor.isEmpty())
+    {
+        QDropbox2JsonWriter json(_remoteRoot.size());
+        json.beginObject()
+                .value("path", _remoteRoot)
+                .value("recursive", true)
+            .endObject();
+        postdata = json.data();
+        path = "/2/files/list_folder";
+    }
+    else
+    {
+        QDropbox2JsonWriter json(cursor.size());
+        json.beginObject()
+                .value("cursor", cursor)
+            .endObject();
+        postdata = json.data();
+        path = "/2/files/list_folder/continue";
+    }
+
+    if(!post(QDROPBOX2_API_URL, path, postdata, ListFolder))
+        finish();
+}
+
+void QDropbox2Mirror::listFolderResult(QNetworkReply* reply, const QByteArray& response)
+{
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        // a mirror that does not exist yet is empty
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if(status != QDROPBOX_V2_ERROR || !response.contains("not_found"))
+        {
+            failed(status == QDROPBOX_V2_ERROR ? status : int(reply->error()), errorMessage(reply, response));
+            finish();
+            return;
+        }
+    }
+    else
+    {
+        const QJsonObject object = QJsonDocument::fromJson(response).object();
+        const QString root = QDropbox2Sync::key(_remoteRoot) + '/';
+
+        foreach(const QJsonValue& value, object.value("entries").toArray())
+        {
+            const QJsonObject entry = value.toObject();
+            const QString path_lower = entry.value("path_lower").toString();
+            if(!path_lower.startsWith(root))
+                continue;       // the root itself
+
+            Item item;
+            item.path  = entry.value("path_display").toString().mid(root.size());
+            item.isDir = entry.value(".tag").toString() == "folder";
+            item.size  = qint64(entry.value("size").toDouble());
+            item.hash  = entry.value("content_hash").toString();
+            remote.insert(path_lower.mid(root.size()), item);
+        }
+
+        if(object.value("has_more").toBool())
+        {
+            listFolder(object.value("cursor").toString());
+            return;
+        }
+    }
+
+    listed = true;
+    plan();
+}
+
+void QDropbox2Mirror::plan()
+{
+    // both the walk and the listing must be complete
+    if(!running || !listed || !walked)
+        return;
+
+    if(aborted)
+    {
+        failed(QNetworkReply::OperationCanceledError, "Aborted.");
+        finish();
+        return;
+    }
+
+    foreach(const Item& item, local)
+    {
+        const QString key = QDropbox2Sync::key(item.path);
+        QHash<QString, Item>::const_iterator there = remote.constFind(key);
+
+        if(item.isDir)
+        {
+            if(there == remote.constEnd() || !there->isDir)
+                folders.append(item.path);
+            continue;
+        }
+
+        ++totalFiles;
+        if(there == remote.constEnd() || there->isDir)
+        {
+            changedFiles.append(item);
+            continue;
+        }
+
+        // only what has changed since it was mirrored needs hashing
+        QDropbox2Sync::RecordMap::const_iterator record = records.constFind(key);
+        if(record != records.constEnd() && !record->hash.isEmpty() &&
+           record->size == item.size && record->modified == item.modified)
+        {
+            Item known = item;
+            known.hash = record->hash;
+            if(known.hash == there->hash)
+                ++skippedFiles;
+            else
+                changedFiles.append(known);
+        }
+        else
+            unhashed.append(item);
+    }
+
+    local.clear();
+
+    if(!unhashed.isEmpty())
+        worker.start(new QDropbox2MirrorHashTask(this, runId, _localRoot, unhashed));
+    else
+        planned();
+}
+
+void QDropbox2Mirror::slot_hashed(int run)
+{
+    if(run != runId || !running)
+        return;
+
+    if(aborted)
+    {
+        unhashed.clear();
+        remote.clear();
+        failed(QNetworkReply::OperationCanceledError, "Aborted.");
+        finish();
+        return;
+    }
+
+    foreach(const Item& item, unhashed)
+    {
+        if(item.hash == remote.value(QDropbox2Sync::key(item.path)).hash)
+        {
+            ++skippedFiles;
+            recordFile(item, item.hash);
+        }
+        else
+            changedFiles.append(item);
+    }
+    unhashed.clear();
+
+    planned();
+}
+
+void QDropbox2Mirror::planned()
+{
+    remote.clear();
+
+    foreach(const Item& item, changedFiles)
+    {
+        if(item.size > _largeFileSize)
+            largeFiles.append(item);
+        else
+            smallFiles.append(item);
+    }
+    changedFiles.clear();
+
+    // creating a folder creates its parents, so only the deepest are needed
+    std::sort(folders.begin(), folders.end());
+    QStringList leaves;
+    for(int i = 0;i < folders.count();++i)
+    {
+        if(i + 1 == folders.count() || !folders[i + 1].startsWith(folders[i] + '/'))
+            leaves.append(folders[i]);
+    }
+    folders = leaves;
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Mirror:" << folders.count() << "folders to create," << smallFiles.count() << "small and"
+             << largeFiles.count() << "large files to upload," << skippedFiles << "unchanged" << endl;
+#endif
+
+    emit signal_progress(skippedFiles, totalFiles);
+    createFolders();
+}
+
+void QDropbox2Mirror::createFolders()
+{
+    if(!running)
+        return;
+
+    if(folders.isEmpty())
+    {
+        uploadFiles();
+        return;
+    }
+
+    int chars = 0;
+    const int count = qMin(int(FolderBatchSize), folders.count());
+    for(int i = 0;i < count;++i)
+    {
+        Item item;
+        item.path = folders.takeFirst();
+        item.isDir = true;
+        committing.append(item);
+        chars += remotePath(item.path).size();
+    }
+
+    QDropbox2JsonWriter json(chars);
+    json.beginObject()
+            .beginArray("paths");
+    foreach(const Item& item, committing)
+        json.element(remotePath(item.path));
+    json.endArray()
+            .value("autorename", false)
+            .value("force_async", false)
+        .endObject();
+
+    batchKind = CreateFolders;
+    if(!post(QDROPBOX2_API_URL, "/2/files/create_folder_batch", json.data(), CreateFolders))
+        batchFailed(lastErrorCode, lastErrorMessage);
+}
+
+void QDropbox2Mirror::uploadFiles()
+{
+    uploading = true;
+
+    // large files run as sessions of their own, alongside the small ones
+    foreach(const Item& item, largeFiles)
+    {
+        const int id = transfers->upload(localPath(item.path), remotePath(item.path));
+        if(id)
+            largeJobs[id] = item;
+        else
+            fileFailed(item, QDropbox2::APIError, QString("%1 could not be read.").arg(localPath(item.path)));
+    }
+    largeFiles.clear();
+
+    pump();
+    commitIfReady();
+    checkFinished();
+}
+
+void QDropbox2Mirror::pump()
+{
+    while(running && uploading && sessionsInFlight < _concurrency && !smallFiles.isEmpty())
+        startSession(smallFiles.takeFirst());
+}
+
+void QDropbox2Mirror::startSession(const Item& item)
+{
+    QFile* file = new QFile(localPath(item.path));
+    if(!file->open(QIODevice::ReadOnly))
+    {
+        fileFailed(item, QDropbox2::APIError, file->errorString());
+        delete file;
+        return;
+    }
+
+    QUrl url;
+    url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
+    url.setPath("/2/files/upload_session/start");
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+    {
+        fileFailed(item, QDropbox2::APIError, "The request could not be created.");
+        delete file;
+        return;
+    }
+
+    // the whole file goes into a session that is closed at once, and waits
+    // there to be committed with others
+    QDropbox2JsonWriter json;
+    json.beginObject()
+            .value("close", true)
+        .endObject();
+
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
+    req.setHeader(QNetworkRequest::ContentLengthHeader, file->size());
+    req.setRawHeader("Dropbox-API-arg", json.data());
+
+    QNetworkReply* reply = networkAccessManager()->post(req, file);
+    file->setParent(reply);
+
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2Mirror::signal_operationAborted, reply, &QNetworkReply::abort);
+
+    Request request;
+    request.kind = StartSession;
+    request.item = item;
+    requests[reply] = request;
+    ++sessionsInFlight;
+}
+
+void QDropbox2Mirror::sessionResult(const Item& item, QNetworkReply* reply, const QByteArray& response)
+{
+    --sessionsInFlight;
+
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        fileFailed(item, status == QDROPBOX_V2_ERROR ? status : int(reply->error()), errorMessage(reply, response));
+    }
+    else
+    {
+        Item uploaded = item;
+        uploaded.session = QJsonDocument::fromJson(response).object().value("session_id").toString();
+        staged.append(uploaded);
+    }
+
+    pump();
+    commitIfReady();
+    checkFinished();
+}
+
+void QDropbox2Mirror::commitIfReady()
+{
+    // a full batch, or the last of them
+    if(staged.count() >= _batchSize || (smallFiles.isEmpty() && sessionsInFlight == 0))
+        commit();
+}
+
+void QDropbox2Mirror::commit()
+{
+    // one batch at a time; they would contend for the same lock
+    if(!running || !committing.isEmpty() || staged.isEmpty())
+        return;
+
+    int chars = 0;
+    const int count = qMin(_batchSize, staged.count());
+    for(int i = 0;i < count;++i)
+    {
+        committing.append(staged.takeFirst());
+        chars += remotePath(committing.last().path).size() + committing.last().session.size();
+    }
+
+    QDropbox2JsonWriter json(chars);
+    json.beginObject()
+            .beginArray("entries");
+    foreach(const Item& item, committing)
+    {
+        json.beginObject()
+                .beginObject("cursor")
+                    .value("session_id", item.session)
+                    .value("offset", item.size)
+                .endObject()
+                .beginObject("commit")
+                    .value("path", remotePath(item.path))
+                    .value("mode", "overwrite")
+                    .value("autorename", false)
+                    .value("mute", true)
+                .endObject()
+            .endObject();
+    }
+    json.endArray()
+        .endObject();
+
+    batchKind = FinishBatch;
+    if(!post(QDROPBOX2_API_URL, "/2/files/upload_session/finish_batch", json.data(), FinishBatch))
+        batchFailed(lastErrorCode, lastErrorMessage);
+}
+
+void QDropbox2Mirror::slot_checkBatch()
+{
+    if(batchJob.isEmpty())
+        return;
+
+    QDropbox2JsonWriter json(batchJob.size());
+    json.beginObject()
+            .value("async_job_id", batchJob)
+        .endObject();
+
+    const QString path = (batchKind == CreateFolders) ? "/2/files/create_folder_batch/check" :
+                                                        "/2/files/upload_session/finish_batch/check";
+    if(!post(QDROPBOX2_API_URL, path, json.data(), CheckBatch))
+        batchFailed(lastErrorCode, lastErrorMessage);
+}
+
+void QDropbox2Mirror::batchResult(QNetworkReply* reply, const QByteArray& response)
+{
+    if(committing.isEmpty())
+        return;     // aborted
+
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        batchFailed(status == QDROPBOX_V2_ERROR ? status : int(reply->error()), errorMessage(reply, response));
+        return;
+    }
+
+    const QJsonObject object = QJsonDocument::fromJson(response).object();
+    const QString tag = object.value(".tag").toString();
+
+    if(tag == "async_job_id" || tag == "in_progress")
+    {
+        if(tag == "async_job_id")
+            batchJob = object.value("async_job_id").toString();
+        QTimer::singleShot(PollInterval, this, SLOT(slot_checkBatch()));
+    }
+    else if(tag == "complete")
+        batchComplete(object.value("entries").toArray());
+    else
+        batchFailed(QDropbox2::APIError, QString("The batch failed: %1").arg(QString::fromUtf8(response)));
+}
+
+void QDropbox2Mirror::batchComplete(const QJsonArray& entries)
+{
+    for(int i = 0;i < committing.count();++i)
+    {
+        const Item& item = committing[i];
+        const QJsonObject entry = entries.at(i).toObject();
+        const bool success = entry.value(".tag").toString() == "success";
+
+        if(item.isDir)
+        {
+            // a folder that already exists will do
+            if(success || QJsonDocument(entry).toJson().contains("conflict"))
+                ++createdFolders;
+            else
+                failed(QDROPBOX_V2_ERROR, QString("%1 could not be created.").arg(remotePath(item.path)));
+            continue;
+        }
+
+        if(!success)
+        {
+            const QString reason = entry.value("failure").toObject().value(".tag").toString();
+            fileFailed(item, QDROPBOX_V2_ERROR, QString("%1 could not be committed: %2").arg(remotePath(item.path)).arg(reason));
+            continue;
+        }
+
+        ++uploadedFiles;
+        uploadedBytes += item.size;
+        recordFile(item, entry.value("content_hash").toString());
+
+        const QString path = remotePath(item.path);
+        _api->metadataCache()->invalidate(path);
+        _api->linkCache()->invalidate(path);
+        if(_api->contentCache())
+            _api->contentCache()->invalidate(path);
+    }
+
+    batchDone();
+}
+
+void QDropbox2Mirror::batchFailed(int error_code, const QString& error_message)
+{
+    if(batchKind == CreateFolders)
+        failed(error_code, error_message);
+    else
+    {
+        foreach(const Item& item, committing)
+            fileFailed(item, error_code, error_message);
+    }
+
+    batchDone();
+}
+
+void QDropbox2Mirror::batchDone()
+{
+    committing.clear();
+    batchJob.clear();
+
+    // what is committed survives an interruption
+    QDropbox2Sync::saveState(_stateFile, _remoteRoot, QString(), records);
+
+    if(batchKind == CreateFolders)
+        createFolders();
+    else
+        commitIfReady();
+    checkFinished();
+}
+
+void QDropbox2Mirror::slot_jobFinished(int id, int errorcode, const QString& errormessage)
+{
+    if(!largeJobs.contains(id))
+        return;
+
+    const Item item = largeJobs.take(id);
+    if(errorcode == 0)
+    {
+        // hashed on the next run, if it has to be compared
+        ++uploadedFiles;
+        uploadedBytes += item.size;
+        recordFile(item, item.hash);
+        QDropbox2Sync::saveState(_stateFile, _remoteRoot, QString(), records);
+    }
+    else
+        fileFailed(item, errorcode, errormessage);
+
+    checkFinished();
+}
+
+void QDropbox2Mirror::recordFile(const Item& item, const QString& hash)
+{
+    QDropbox2Sync::Record record;
+    record.path     = item.path;
+    record.size     = item.size;
+    record.modified = item.modified;
+    record.hash     = hash;
+    records[QDropbox2Sync::key(item.path)] = record;
+
+    emit signal_progress(uploadedFiles + skippedFiles + failedFiles, totalFiles);
+}
+
+void QDropbox2Mirror::failed(int error_code, const QString& error_message)
+{
+    lastErrorCode = error_code;
+    lastErrorMessage = error_message;
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Mirror error:" << error_code << error_message << endl;
+#endif
+
+    emit signal_errorOccurred(error_code, error_message);
+}
+
+void QDropbox2Mirror::fileFailed(const Item& item, int error_code, const QString& error_message)
+{
+    ++failedFiles;
+    failed(error_code, QString("%1: %2").arg(item.path).arg(error_message));
+    emit signal_progress(uploadedFiles + skippedFiles + failedFiles, totalFiles);
+}
+
+void QDropbox2Mirror::checkFinished()
+{
+    if(running && uploading && folders.isEmpty() && smallFiles.isEmpty() && largeFiles.isEmpty() &&
+       staged.isEmpty() && committing.isEmpty() && sessionsInFlight == 0 && largeJobs.isEmpty())
+        finish();
+}
+
+void QDropbox2Mirror::finish()
+{
+    if(!running)
+        return;
+    running = false;
+
+    QDropbox2Sync::saveState(_stateFile, _remoteRoot, QString(), records);
+
+    _api->traceEnd(trace, "mirror", {{"uploaded", uploadedFiles}, {"skipped", skippedFiles}, {"failed", failedFiles}});
+    trace = 0;
+
+    emit signal_finished(failedFiles == 0 && lastErrorCode == 0);
+
+    if(eventLoop)
+        eventLoop->exit();
+}
+
+void QDropbox2Mirror::slot_networkRequestFinished(QNetworkReply* reply)
+{
+    reply->deleteLater();
+
+    if(!requests.contains(reply))
+        return;
+
+    const Request request = requests.take(reply);
+    const QByteArray response = reply->readAll();
+
+    switch(request.kind)
+    {
+        case ListFolder:
+            listFolderResult(reply, response);
+            break;
+
+        case StartSession:
+            sessionResult(request.item, reply, response);
+            break;
+
+        case CreateFolders:
+        case FinishBatch:
+        case CheckBatch:
+            batchResult(reply, response);
+            break;
+    }
+}
+
+QNetworkReply* QDropbox2Mirror::post(const QString& base, const QString& path, const QByteArray& postdata,
+                                     RequestKind kind, const Item& item)
+{
+    QUrl url;
+    url.setUrl(base, QUrl::StrictMode);
+    url.setPath(path);
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+    {
+        failed(QDropbox2::APIError, "The request could not be created.");
+        return nullptr;
+    }
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+
+    QNetworkReply* reply = networkAccessManager()->post(req, postdata);
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2Mirror::signal_operationAborted, reply, &QNetworkReply::abort);
+
+    Request request;
+    request.kind = kind;
+    request.item = item;
+    requests[reply] = request;
+    return reply;
+}
+
+QNetworkAccessManager* QDropbox2Mirror::networkAccessManager()
+{
+    // one more request than the sessions, for the listing or a batch
+    const int needed = (_concurrency + 1 + ConnectionsPerManager - 1) / ConnectionsPerManager;
+    while(managers.count() < needed)
+    {
+        QNetworkAccessManager* manager = new QNetworkAccessManager(this);
+        connect(manager, &QNetworkAccessManager::finished, this, &QDropbox2Mirror::slot_networkRequestFinished);
+        managers.append(manager);
+    }
+
+    nextManager = (nextManager + 1) % needed;
+    return managers[nextManager];
+}
+
+QString QDropbox2Mirror::localPath(const QString& path) const
+{
+    return _localRoot + '/' + path;
+}
+
+QString QDropbox2Mirror::remotePath(const QString& path) const
+{
+    return _remoteRoot + '/' + path;
+}
+
+QString QDropbox2Mirror::errorMessage(QNetworkReply* reply, const QByteArray& response) const
+{
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    if(jsonError.error == QJsonParseError::NoError)
+    {
+        QJsonObject object = json.object();
+        if(object.contains("user_message"))
+            return object.value("user_message").toString();
+        if(object.contains("error_summary"))
+            return object.value("error_summary").toString();
+    }
+
+    return reply->errorString();
+}
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+
+#include "qdropbox2common.h"
+
+#include "qdropbox2.h"
+#include "qdropbox2sync.h"
+
+class QDropbox2TransferManager;
+
+//! Mirrors a local directory tree to a Dropbox folder, one way, in bulk
+/*!
+  QDropbox2Mirror is meant for backups of large trees.  A run
+
+  \li lists the remote folder recursively, while walking the local tree on
+      several threads;
+  \li hashes the local files that have changed since they were mirrored,
+      also on several threads;
+  \li creates the folders that are missing with create_folder_batch, up to
+      FolderBatchSize at a time, rather than one request per folder;
+  \li skips files whose content hash matches the remote copy;
+  \li uploads small files (up to largeFileSize()) each into a closed upload
+      session, several at a time, and commits them in groups of batchSize()
+      with upload_session/finish_batch; committing many files at once avoids
+      contention for the folder's namespace lock, which serializes
+      individual commits;
+  \li uploads large files through a QDropbox2TransferManager, whose uploads
+      of files too large for a single request run as parallel sessions.
+
+  Remote files are replaced, never removed: a file deleted locally stays in
+  the mirror.
+
+  The size, modification time and content hash of what has been mirrored is
+  saved in stateFile() as each batch is committed, so a later run only hashes
+  the local files that have changed, and a run that was interrupted resumes
+  where it stopped, with the files that were not committed yet.
+
+  A run works asynchronously on the thread the mirror lives on; the walk and
+  the hashing run on worker threads, and never block it.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2Mirror : public QObject
+{
+    Q_OBJECT
+
+public:     // typedefs and enums
+    enum
+    {
+        //! Requests in flight, unless set with setConcurrency()
+        DefaultConcurrency = 16,
+
+        //! Most files committed by one finish_batch call
+        BatchSize = 1000,
+
+        //! Most folders created by one create_folder_batch call
+        FolderBatchSize = 1000,
+
+        //! Size above which a file is uploaded through the transfer manager
+        DefaultLargeFileSize = 8*1024*1024,
+
+        //! Interval between checks on an asynchronous batch, in msecs
+        PollInterval = 500
+    };
+
+public:
+    /*!
+      Creates a mirror job.
+
+      \param local_root Local directory to mirror.
+      \param remote_root Dropbox folder to mirror it to.
+      \param api A QDropbox2 that is connected to an user account.
+      \param parent Parent QObject
+     */
+    QDropbox2Mirror(const QString& local_root, const QString& remote_root, QDropbox2* api, QObject* parent = 0);
+
+    /*!
+      Aborts a run in progress.
+     */
+    ~QDropbox2Mirror();
+
+    QString localRoot() const                   { return _localRoot; }
+    QString remoteRoot() const                  { return _remoteRoot; }
+
+    /*!
+      Sets the file in which the mirrored state is kept.  By default, it is
+      ".qdropbox2mirror" at the top of the local tree.  Files of that name are
+      never mirrored.
+     */
+    void    setStateFile(const QString& file_name)  { _stateFile = file_name; }
+    QString stateFile() const                   { return _stateFile; }
+
+    /*!
+      Sets the number of small files uploaded at a time.
+     */
+    void    setConcurrency(int count);
+    int     concurrency() const                 { return _concurrency; }
+
+    /*!
+      Sets the number of small files committed at a time; at most BatchSize.
+     */
+    void    setBatchSize(int count)             { _batchSize = qBound(1, count, int(BatchSize)); }
+    int     batchSize() const                   { return _batchSize; }
+
+    /*!
+      Sets the size above which a file is uploaded on its own.
+     */
+    void    setLargeFileSize(qint64 bytes)      { _largeFileSize = bytes; }
+    qint64  largeFileSize() const               { return _largeFileSize; }
+
+    /*!
+      Returns the manager that uploads large files.
+     */
+    QDropbox2TransferManager* transferManager() const { return transfers; }
+
+    /*!
+      Mirrors the tree.
+
+      \remark This is a blocking call.
+
+      \returns <i>true</i> if every file was mirrored.
+     */
+    bool    run();
+
+    /*!
+      Starts mirroring the tree, and returns at once; signal_finished()
+      reports the outcome.
+     */
+    bool    start();
+
+    bool    isRunning() const                   { return running; }
+
+    /*!
+      Returns the latest error code.
+    */
+    int     error() const                       { return lastErrorCode; }
+
+    /*!
+      Returns the latest error message.
+    */
+    QString errorString() const                 { return lastErrorMessage; }
+
+    /*!
+      Returns counts for the latest run.
+     */
+    int     filesTotal() const                  { return totalFiles; }
+    int     filesUploaded() const               { return uploadedFiles; }
+    int     filesSkipped() const                { return skippedFiles; }
+    int     filesFailed() const                 { return failedFiles; }
+    int     foldersCreated() const              { return createdFolders; }
+    qint64  bytesUploaded() const               { return uploadedBytes; }
+
+public slots:
+    /*!
+      Aborts the run in progress.  What has been committed is kept.
+     */
+    void    slot_abort();
+
+signals:
+    /*!
+      Emitted when an error occurs.
+    */
+    void    signal_errorOccurred(int errorcode, const QString& errormessage = QString());
+
+    /*!
+      Emitted as files are uploaded or skipped.
+     */
+    void    signal_progress(int filesDone, int filesTotal);
+
+    /*!
+      Emitted when a run has finished.
+
+      \param success <i>true</i> if every file was mirrored.
+     */
+    void    signal_finished(bool success);
+
+    /*!
+      Emitted when an in-progress operation is aborted.
+     */
+    void    signal_operationAborted();
+
+private slots:
+    void    slot_networkRequestFinished(QNetworkReply* reply);
+    void    slot_jobFinished(int id, int errorcode, const QString& errormessage);
+    void    slot_checkBatch();
+    void    slot_walked(int run);
+    void    slot_hashed(int run);
+
+private:        // typedefs and enums
+    struct Item
+    {
+        QString     path;       // relative to the roots
+        bool        isDir;
+        qint64      size;
+        qint64      modified;
+        QString     hash;
+        QString     session;    // small files, once uploaded
+
+        Item() : isDir(false), size(0), modified(0) {}
+    };
+
+    enum RequestKind
+    {
+        ListFolder,
+        CreateFolders,
+        StartSession,
+        FinishBatch,
+        CheckBatch
+    };
+
+    struct Request
+    {
+        RequestKind kind;
+        Item        item;       // StartSession
+    };
+
+private:        // methods
+    void    listFolder(const QString& cursor);
+    void    listFolderResult(QNetworkReply* reply, const QByteArray& response);
+    void    plan();
+    void    planned();
+    void    createFolders();
+    void    uploadFiles();
+    void    pump();
+    void    startSession(const Item& item);
+    void    sessionResult(const Item& item, QNetworkReply* reply, const QByteArray& response);
+    void    commit();
+    void    commitIfReady();
+    void    batchResult(QNetworkReply* reply, const QByteArray& response);
+    void    batchFailed(int error_code, const QString& error_message);
+    void    batchDone();
+    void    batchComplete(const QJsonArray& entries);
+    void    recordFile(const Item& item, const QString& hash);
+    void    failed(int error_code, const QString& error_message);
+    void    fileFailed(const Item& item, int error_code, const QString& error_message);
+    void    checkFinished();
+    void    finish();
+
+    QNetworkReply* post(const QString& base, const QString& path, const QByteArray& postdata,
+                        RequestKind kind, const Item& item = Item());
+    QNetworkReply* postFile(const Item& item);
+    QNetworkAccessManager* networkAccessManager();
+
+    QString localPath(const QString& path) const;
+    QString remotePath(const QString& path) const;
+    QString errorMessage(QNetworkReply* reply, const QByteArray& response) const;
+
+private:        // data members
+    QDropbox2*  _api;
+    QString     _localRoot;
+    QString     _remoteRoot;
+    QString     _stateFile;
+    int         _concurrency;
+    int         _batchSize;
+    qint64      _largeFileSize;
+
+    // enough managers for _concurrency connections
+    QList<QNetworkAccessManager*> managers;
+    int         nextManager;
+    QDropbox2TransferManager* transfers;
+
+    QDropbox2Sync::RecordMap records;   // what has been mirrored
+
+    // walks the tree, and hashes files; tasks fill in local and unhashed
+    QThreadPool worker;
+
+    bool        running;
+    int         runId;              // tells the tasks of a run apart from earlier ones
+    bool        aborted;
+    bool        listed;
+    bool        walked;
+    bool        uploading;
+    quint64     trace;
+
+    QHash<QString, Item> remote;        // by key, from the listing
+    QVector<Item> local;                // from the walk
+    QList<Item> unhashed;               // changed since mirrored, being hashed
+
+    QStringList folders;                // to create
+    QList<Item> changedFiles;           // to upload, once the rest is hashed
+    QList<Item> smallFiles;             // to upload
+    QList<Item> largeFiles;
+    QList<Item> staged;                 // uploaded, to commit
+    QList<Item> committing;             // in the batch being committed
+    QString     batchJob;               // async_job_id of that batch
+    RequestKind batchKind;
+    QHash<int, Item> largeJobs;
+    QHash<QNetworkReply*, Request> requests;
+    int         sessionsInFlight;
+
+    int         totalFiles;
+    int         uploadedFiles;
+    int         skippedFiles;
+    int         failedFiles;
+    int         createdFolders;
+    qint64      uploadedBytes;
+
+    int         lastErrorCode;
+    QString     lastErrorMessage;
+
+    QEventLoop* eventLoop;
+
+    friend class QDropbox2MirrorWalkTask;
+    friend class QDropbox2MirrorHashTask;
+};
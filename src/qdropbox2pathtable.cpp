@@ -0,0 +1,182 @@
+#include <cstring>
+
+#include <QStringList>
+
+#include "qdropbox2pathtable.h"
+
+const QDropbox2PathTable::Id QDropbox2PathTable::Root;
+const QDropbox2PathTable::Id QDropbox2PathTable::None;
+
+namespace
+{
+    // a node, its entry in the child index, and the header of its name
+    const qint64 NodeOverhead = 16 + 24 + 24;
+}
+
+QDropbox2PathTable::QDropbox2PathTable()
+{
+    clear();
+}
+
+uint QDropbox2PathTable::childHash(Id parent, const QString& name)
+{
+    return qHash(name.toCaseFolded(), parent);
+}
+
+QDropbox2PathTable::Id QDropbox2PathTable::child(Id parent, const QString& name, uint hash) const
+{
+    QMultiHash<uint, Id>::const_iterator it = children.constFind(hash);
+    for(;it != children.constEnd() && it.key() == hash;++it)
+    {
+        const Node& node = nodes[it.value()];
+        if(node.parent == parent && node.name.compare(name, Qt::CaseInsensitive) == 0)
+            return it.value();
+    }
+    return None;
+}
+
+QDropbox2PathTable::Id QDropbox2PathTable::insert(const QString& path)
+{
+    Id id = Root;
+
+    const QStringList components = path.split('/', QString::SkipEmptyParts);
+    foreach(const QString& component, components)
+    {
+        const uint hash = childHash(id, component);
+        Id next = child(id, component, hash);
+        if(next == None)
+        {
+            Node node;
+            node.parent = id;
+            node.refs = 0;
+            node.name = component;
+
+            if(freeIds.isEmpty())
+            {
+                next = Id(nodes.count());
+                nodes.append(node);
+            }
+            else
+            {
+                next = freeIds.takeLast();
+                nodes[next] = node;
+            }
+
+            children.insert(hash, next);
+            totalBytes += NodeOverhead + component.size() * qint64(sizeof(QChar));
+            ++nodes[id].refs;
+        }
+        else if(nodes[next].name != component)
+            nodes[next].name = component;       // a change of case
+
+        id = next;
+    }
+
+    ++nodes[id].refs;
+    return id;
+}
+
+void QDropbox2PathTable::release(Id id)
+{
+    while(id != Root)
+    {
+        Node& node = nodes[id];
+        Q_ASSERT(node.refs > 0);
+        if(--node.refs > 0)
+            return;
+
+        const Id parent = node.parent;
+        children.remove(childHash(parent, node.name), id);
+        totalBytes -= NodeOverhead + node.name.size() * qint64(sizeof(QChar));
+
+        node.name.clear();
+        freeIds.append(id);
+
+        // the freed node held a reference on its folder
+        id = parent;
+    }
+
+    if(nodes[Root].refs > 0)
+        --nodes[Root].refs;
+}
+
+QDropbox2PathTable::Id QDropbox2PathTable::find(const QString& path) const
+{
+    Id id = Root;
+
+    int begin = 0;
+    while(begin < path.size())
+    {
+        int end = path.indexOf('/', begin);
+        if(end < 0)
+            end = path.size();
+        if(end > begin)
+        {
+            const QString name = path.mid(begin, end - begin);
+            id = child(id, name, childHash(id, name));
+            if(id == None)
+                return None;
+        }
+        begin = end + 1;
+    }
+
+    return id;
+}
+
+QString QDropbox2PathTable::path(Id id) const
+{
+    if(id == Root)
+        return QString("");
+
+    int length = 0;
+    for(Id i = id;i != Root;i = nodes[i].parent)
+        length += nodes[i].name.size() + 1;
+
+    // filled from the end, so the walk up the tree is only done twice
+    QString result(length, Qt::Uninitialized);
+    QChar* out = result.data() + length;
+    for(Id i = id;i != Root;i = nodes[i].parent)
+    {
+        const QString& name = nodes[i].name;
+        out -= name.size();
+        std::memcpy(out, name.constData(), name.size() * sizeof(QChar));
+        *--out = QChar('/');
+    }
+
+    return result;
+}
+
+int QDropbox2PathTable::depth(Id id) const
+{
+    int result = 0;
+    for(;id != Root;id = nodes[id].parent)
+        ++result;
+    return result;
+}
+
+bool QDropbox2PathTable::isBeneath(Id id, Id ancestor) const
+{
+    if(id == ancestor || ancestor == None)
+        return false;
+
+    while(id != Root)
+    {
+        id = nodes[id].parent;
+        if(id == ancestor)
+            return true;
+    }
+    return false;
+}
+
+void QDropbox2PathTable::clear()
+{
+    Node root;
+    root.parent = Root;
+    root.refs = 0;
+
+    nodes.clear();
+    nodes.append(root);
+    freeIds.clear();
+    children.clear();
+    totalBytes = NodeOverhead;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "qdropbox2global.h"
+
+//! An interned table of Dropbox paths, stored as a tree of components
+/*!
+  Holding paths as full strings repeats every parent folder in every path
+  beneath it; in a deep tree, most of the memory spent on paths goes to those
+  prefixes.  QDropbox2PathTable stores each path component once, as a node
+  holding the id of its parent and its own name, and hands out a 32-bit id
+  for each path:
+
+  \li insert() and find() resolve a path one component at a time, with one
+      hash lookup each, so they are O(depth) in the number of components;
+  \li path() rebuilds the display form of a path from its id, also in
+      O(depth);
+  \li isBeneath() checks whether one path lies beneath another by walking
+      parent ids, without comparing strings.
+
+  Like Dropbox, the table is case-insensitive: paths that only differ in case
+  have the same id, and the display form is that of the latest insert().
+  Only the display form of a name is stored.
+
+  Nodes are reference counted.  Every insert() holds a reference on the path
+  it returns, to be given back with release(); a node is freed with its last
+  reference, and its id is reused by later inserts.  The root ("") has id
+  Root and is never freed.
+
+  \remark The table is not thread-safe; its owner serializes access.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2PathTable
+{
+public:     // typedefs and enums
+    typedef quint32 Id;
+
+    //! Id of the root
+    static const Id Root = 0;
+
+    //! Returned by find() for a path that is not in the table
+    static const Id None = 0xffffffffu;
+
+public:
+    QDropbox2PathTable();
+
+    /*!
+      Adds a path, and every folder above it, to the table, and takes a
+      reference on it.
+
+      \returns The id of the path.
+     */
+    Id      insert(const QString& path);
+
+    /*!
+      Gives back a reference taken by insert().  The path, and then any
+      folder above it that is no longer referenced, is freed.
+     */
+    void    release(Id id);
+
+    /*!
+      Returns the id of a path, or None if the path is not in the table.
+     */
+    Id      find(const QString& path) const;
+
+    /*!
+      Returns the display form of a path, with a leading slash; "" for the
+      root.
+     */
+    QString path(Id id) const;
+
+    /*!
+      Returns the last component of a path.
+     */
+    QString name(Id id) const                   { return nodes[id].name; }
+
+    /*!
+      Returns the id of the folder that holds a path; Root for the root.
+     */
+    Id      parent(Id id) const                 { return id == Root ? Root : nodes[id].parent; }
+
+    /*!
+      Returns the number of components above a path; zero for the root.
+     */
+    int     depth(Id id) const;
+
+    /*!
+      Indicates whether a path lies strictly beneath another.
+     */
+    bool    isBeneath(Id id, Id ancestor) const;
+
+    /*!
+      Returns the number of nodes in the table, the root included.
+     */
+    int     count() const                       { return nodes.count() - freeIds.count(); }
+
+    /*!
+      Returns the approximate heap footprint of the table, in bytes.
+     */
+    qint64  memoryUsage() const                 { return totalBytes; }
+
+    /*!
+      Frees every node but the root.  Ids handed out earlier are no longer
+      valid.
+     */
+    void    clear();
+
+private:
+    struct Node
+    {
+        Id          parent;
+        quint32     refs;       // references held by insert() and by children
+        QString     name;       // display form
+    };
+
+    static uint childHash(Id parent, const QString& name);
+
+    Id      child(Id parent, const QString& name, uint hash) const;
+
+    QVector<Node>           nodes;
+    QVector<Id>             freeIds;
+
+    // child lookup, by a hash of the parent and the case-folded name; names
+    // are compared through the nodes, so they are not stored a second time
+    QMultiHash<uint, Id>    children;
+    qint64                  totalBytes;
+};
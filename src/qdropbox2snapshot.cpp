@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cstring>
+
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include "qdropbox2snapshot.h"
+#include "qdropbox2upload.h"
+
+namespace
+{
+    const int HashBytes = 32;
+
+    // files hashed by each task of a scan
+    const int HashBatch = 64;
+
+    int compareChars(const QChar* a, int la, const QChar* b, int lb)
+    {
+        const int n = qMin(la, lb);
+        for(int i = 0;i < n;++i)
+        {
+            if(a[i] != b[i])
+                return a[i].unicode() < b[i].unicode() ? -1 : 1;
+        }
+        return la - lb;
+    }
+
+    class HashTask : public QRunnable
+    {
+    public:
+        HashTask(const QStringList& files, QVector<QString>& hashes, int begin, int end)
+            : files(files), hashes(hashes), begin(begin), end(end) {}
+
+        void run() override
+        {
+            for(int i = begin;i < end;++i)
+            {
+                QFile file(files[i]);
+                if(file.open(QIODevice::ReadOnly))
+                    hashes[i] = QDropbox2ContentHasher::hash(&file);
+            }
+        }
+
+    private:
+        const QStringList& files;
+        QVector<QString>& hashes;
+        int begin;
+        int end;
+    };
+}
+
+QDropbox2Snapshot::QDropbox2Snapshot()
+    : sorted(true)
+{
+}
+
+void QDropbox2Snapshot::reserve(int entries, int path_chars)
+{
+    nodes.reserve(entries);
+    pool.reserve(path_chars);
+}
+
+void QDropbox2Snapshot::append(const QString& path, bool is_dir, qint64 size, qint64 modified, const QString& content_hash)
+{
+    const QString lower = path.toLower();
+
+    Node node;
+    node.key        = quint32(pool.size());
+    node.length     = quint32(lower.size());
+    node.pathLength = quint32(path.size());
+    node.size       = size;
+    node.modified   = modified;
+    node.isDir      = is_dir;
+    node.hash       = -1;
+
+    pool.append(lower.constData(), lower.size());
+    if(lower == path)
+        node.path = node.key;
+    else
+    {
+        node.path = quint32(pool.size());
+        pool.append(path.constData(), path.size());
+    }
+
+    if(!content_hash.isEmpty())
+    {
+        const QByteArray raw = QByteArray::fromHex(content_hash.toLatin1());
+        if(raw.size() == HashBytes)
+        {
+            node.hash = hashes.size() / HashBytes;
+            hashes.append(raw);
+        }
+    }
+
+    if(sorted && !nodes.isEmpty() && compare(nodes.last(), *this, node) >= 0)
+        sorted = false;
+    nodes.append(node);
+}
+
+void QDropbox2Snapshot::appendContents(const QDropbox2Folder::ContentsList& contents, const QString& root)
+{
+    QString prefix = root.toLower();
+    if(!prefix.endsWith('/'))
+        prefix += '/';
+
+    reserve(nodes.count() + contents.count());
+    foreach(const QDropbox2EntityInfo& info, contents)
+    {
+        if(info.isDeleted() || !info.path().toLower().startsWith(prefix))
+            continue;
+
+        // remote modification times say nothing about local files
+        append(info.path().mid(prefix.size()), info.isDirectory(), qint64(info.bytes()), -1, info.contentHash());
+    }
+}
+
+void QDropbox2Snapshot::sort()
+{
+    if(sorted)
+        return;
+
+    std::stable_sort(nodes.begin(), nodes.end(),
+                     [this](const Node& a, const Node& b) { return compare(a, *this, b) < 0; });
+
+    // of equal keys, keep the one appended last
+    int kept = 0;
+    for(int i = 0;i < nodes.count();++i)
+    {
+        if(i + 1 < nodes.count() && compare(nodes[i], *this, nodes[i + 1]) == 0)
+            continue;
+        nodes[kept++] = nodes[i];
+    }
+    nodes.resize(kept);
+
+    sorted = true;
+}
+
+QString QDropbox2Snapshot::path(int index) const
+{
+    const Node& node = nodes[index];
+    return QString(pool.constData() + node.path, int(node.pathLength));
+}
+
+QString QDropbox2Snapshot::key(int index) const
+{
+    const Node& node = nodes[index];
+    return QString(pool.constData() + node.key, int(node.length));
+}
+
+QString QDropbox2Snapshot::contentHash(int index) const
+{
+    const Node& node = nodes[index];
+    if(node.hash < 0)
+        return QString();
+    return QString::fromLatin1(hashes.mid(node.hash * HashBytes, HashBytes).toHex());
+}
+
+int QDropbox2Snapshot::indexOf(const QString& path) const
+{
+    Q_ASSERT(sorted);
+
+    const QString lower = path.toLower();
+    int low = 0;
+    int high = nodes.count() - 1;
+    while(low <= high)
+    {
+        const int middle = low + (high - low) / 2;
+        const Node& node = nodes[middle];
+        const int result = compareChars(pool.constData() + node.key, int(node.length), lower.constData(), lower.size());
+        if(result == 0)
+            return middle;
+        if(result < 0)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+    return -1;
+}
+
+qint64 QDropbox2Snapshot::memoryUsage() const
+{
+    return qint64(nodes.capacity()) * qint64(sizeof(Node)) +
+           qint64(pool.capacity()) * qint64(sizeof(QChar)) +
+           qint64(hashes.capacity());
+}
+
+int QDropbox2Snapshot::compare(const Node& a, const QDropbox2Snapshot& other, const Node& b) const
+{
+    return compareChars(pool.constData() + a.key, int(a.length), other.pool.constData() + b.key, int(b.length));
+}
+
+bool QDropbox2Snapshot::differs(const Node& a, const QDropbox2Snapshot& other, const Node& b) const
+{
+    if(a.isDir != b.isDir)
+        return true;
+    if(a.isDir)
+        return false;
+
+    if(a.hash >= 0 && b.hash >= 0)
+        return std::memcmp(hashes.constData() + a.hash * HashBytes,
+                           other.hashes.constData() + b.hash * HashBytes, HashBytes) != 0;
+
+    return a.size != b.size || (a.modified >= 0 && b.modified >= 0 && a.modified != b.modified);
+}
+
+QDropbox2Snapshot::Diff QDropbox2Snapshot::diff(const QDropbox2Snapshot& from, const QDropbox2Snapshot& to)
+{
+    Q_ASSERT(from.sorted && to.sorted);
+
+    Diff result;
+    int i = 0;
+    int j = 0;
+
+    while(i < from.nodes.count() && j < to.nodes.count())
+    {
+        const int order = from.compare(from.nodes[i], to, to.nodes[j]);
+        if(order < 0)
+            result.deleted.append(i++);
+        else if(order > 0)
+            result.added.append(j++);
+        else
+        {
+            if(from.differs(from.nodes[i], to, to.nodes[j]))
+                result.modified.append(j);
+            ++i;
+            ++j;
+        }
+    }
+
+    for(;i < from.nodes.count();++i)
+        result.deleted.append(i);
+    for(;j < to.nodes.count();++j)
+        result.added.append(j);
+
+    return result;
+}
+
+QDropbox2Snapshot QDropbox2Snapshot::scan(const QString& root, bool hash)
+{
+    const QString base = QFileInfo(root).absoluteFilePath();
+
+    QStringList files;
+    QVector<QFileInfo> infos;
+
+    QDirIterator it(base, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::NoSymLinks,
+                    QDirIterator::Subdirectories);
+    while(it.hasNext())
+    {
+        it.next();
+        infos.append(it.fileInfo());
+    }
+
+    QVector<QString> hashes;
+    if(hash)
+    {
+        foreach(const QFileInfo& info, infos)
+            files.append(info.isDir() ? QString() : info.absoluteFilePath());
+        hashes.resize(files.count());
+
+        QThreadPool pool;
+        for(int begin = 0;begin < files.count();begin += HashBatch)
+            pool.start(new HashTask(files, hashes, begin, qMin(begin + HashBatch, files.count())));
+        pool.waitForDone();
+    }
+
+    QDropbox2Snapshot snapshot;
+    snapshot.reserve(infos.count());
+    for(int i = 0;i < infos.count();++i)
+    {
+        const QFileInfo& info = infos[i];
+        snapshot.append(info.absoluteFilePath().mid(base.size() + 1), info.isDir(),
+                        info.isDir() ? 0 : info.size(), info.lastModified().toMSecsSinceEpoch(),
+                        hash ? hashes[i] : QString());
+    }
+
+    snapshot.sort();
+    return snapshot;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "qdropbox2global.h"
+#include "qdropbox2folder.h"
+
+//! A compact, sorted listing of a tree, local or remote, that can be diffed
+/*!
+  A QDropbox2Folder::ContentsList holds one QObject per entry, and finding
+  an entry in it means a linear search; comparing two listings that way is
+  quadratic.  QDropbox2Snapshot holds the same information for a whole tree
+  in a few flat arrays:
+
+  \li one record per entry, sorted by key (the lower-cased relative path);
+  \li every path in a single shared character pool, rather than a QString
+      per entry; the display form of a path is only stored when it differs
+      from its key;
+  \li content hashes as 32 raw bytes in a second pool, rather than as
+      64-character strings.
+
+  A snapshot is filled with append() or appendContents() (or taken from the
+  local filesystem by scan()), and then sorted once with sort().  Lookups by
+  path are binary searches, and diff() merges two sorted snapshots in a
+  single linear pass.
+
+  Entries are compared by content hash when both sides have one, and
+  otherwise by size and, when both sides know it, modification time.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2Snapshot
+{
+public:
+    //! The changes that turn one snapshot into another
+    struct Diff
+    {
+        QVector<int>    added;      // indices in the newer snapshot
+        QVector<int>    modified;   // indices in the newer snapshot
+        QVector<int>    deleted;    // indices in the older snapshot
+    };
+
+    QDropbox2Snapshot();
+
+    /*!
+      Reserves room for a number of entries, and of path characters in total.
+     */
+    void    reserve(int entries, int path_chars = 0);
+
+    /*!
+      Adds an entry.  The snapshot must be sorted again before it is searched
+      or diffed.
+
+      \param path Path relative to the root of the tree.
+      \param is_dir Whether the entry is a folder.
+      \param size Size of a file.
+      \param modified Modification time, in msecs since the epoch; -1 if unknown.
+      \param content_hash Content hash of a file, in hex; empty if unknown.
+     */
+    void    append(const QString& path, bool is_dir, qint64 size, qint64 modified = -1,
+                   const QString& content_hash = QString());
+
+    /*!
+      Adds the entries of a folder listing that lie beneath <i>root</i>;
+      deleted entries are left out.
+     */
+    void    appendContents(const QDropbox2Folder::ContentsList& contents, const QString& root);
+
+    /*!
+      Sorts the entries by key.  Of several entries with the same key, the
+      one appended last is kept.
+     */
+    void    sort();
+    bool    isSorted() const                    { return sorted; }
+
+    int     count() const                       { return nodes.count(); }
+    bool    isEmpty() const                     { return nodes.isEmpty(); }
+
+    QString path(int index) const;
+    QString key(int index) const;
+    bool    isDir(int index) const              { return nodes[index].isDir; }
+    qint64  size(int index) const               { return nodes[index].size; }
+    qint64  modified(int index) const           { return nodes[index].modified; }
+    QString contentHash(int index) const;
+
+    /*!
+      Returns the index of a path, or -1.  The snapshot must be sorted.
+     */
+    int     indexOf(const QString& path) const;
+
+    /*!
+      Returns the approximate heap footprint of the snapshot, in bytes.
+     */
+    qint64  memoryUsage() const;
+
+    /*!
+      Compares two sorted snapshots.
+
+      \param from The older state (e.g., the remote listing).
+      \param to The newer state (e.g., a scan of the local tree).
+      \returns What was added to, modified in and deleted from <i>from</i>.
+     */
+    static Diff diff(const QDropbox2Snapshot& from, const QDropbox2Snapshot& to);
+
+    /*!
+      Takes a sorted snapshot of a local directory tree.
+
+      \param root The directory.
+      \param hash Also compute the content hash of every file, in parallel;
+                  reading every file makes this far slower.
+     */
+    static QDropbox2Snapshot scan(const QString& root, bool hash = false);
+
+private:
+    struct Node
+    {
+        quint32 key;        // offset of the key in the pool
+        quint32 path;       // offset of the display path; the same when equal
+        quint32 length;     // of the key
+        quint32 pathLength; // of the display path; lowercasing may change it
+        qint32  hash;       // index in the hash pool, or -1
+        qint64  size;
+        qint64  modified;
+        bool    isDir;
+    };
+
+    int     compare(const Node& a, const QDropbox2Snapshot& other, const Node& b) const;
+    bool    differs(const Node& a, const QDropbox2Snapshot& other, const Node& b) const;
+
+    QVector<Node>   nodes;
+    QString         pool;
+    QByteArray      hashes;
+    bool            sorted;
+};
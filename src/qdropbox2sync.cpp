@@ -0,0 +1,1177 @@
+#include <algorithm>
+
+#include <QDataStream>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QThreadPool>
+
+#ifdef QTDROPBOX_DEBUG
+#include <QDebug>
+#endif
+
+#include "qdropbox2sync.h"
+#include "qdropbox2contentcache.h"
+#include "qdropbox2json.h"
+#include "qdropbox2linkcache.h"
+#include "qdropbox2metadatacache.h"
+#include "qdropbox2transfermanager.h"
+#include "qdropbox2upload.h"
+
+namespace
+{
+    const quint32 StateMagic    = 0x51443253;      // "QD2S"
+    const quint32 StateVersion  = 1;
+
+    // files hashed by each task of a scan
+    const int HashBatch = 64;
+
+    QString parentKey(const QString& key)
+    {
+        const int slash = key.lastIndexOf('/');
+        return slash < 0 ? QString() : key.left(slash);
+    }
+
+    struct HashJob
+    {
+        QString     key;
+        QString     file;
+        QString     hash;
+    };
+
+    class HashTask : public QRunnable
+    {
+    public:
+        HashTask(QVector<HashJob>& jobs, int begin, int end)
+            : jobs(jobs), begin(begin), end(end) {}
+
+        void run() override
+        {
+            for(int i = begin;i < end;++i)
+            {
+                QFile file(jobs[i].file);
+                if(file.open(QIODevice::ReadOnly))
+                    jobs[i].hash = QDropbox2ContentHasher::hash(&file);
+            }
+        }
+
+    private:
+        QVector<HashJob>& jobs;
+        int begin;
+        int end;
+    };
+
+    void scanDirectory(const QString& root, const QString& dir, bool recursive,
+                       const QDropbox2Sync::RecordMap& records,
+                       const QMultiHash<QString, QString>& children,
+                       QDropbox2Sync::LocalChanges& changes,
+                       QVector<HashJob>& hashes, QStringList* dirs)
+    {
+        const QDir directory(dir.isEmpty() ? root : root + '/' + dir);
+        if(!directory.exists())
+            return;
+        if(dirs)
+            dirs->append(dir);
+
+        const QString prefix = dir.isEmpty() ? QString() : dir + '/';
+        QSet<QString> seen;
+
+        const QFileInfoList entries = directory.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot |
+                                                              QDir::Hidden | QDir::NoSymLinks);
+        foreach(const QFileInfo& info, entries)
+        {
+            if(info.fileName().startsWith(QDropbox2Sync::stateFileName()))
+                continue;
+
+            const QString path = prefix + info.fileName();
+            const QString key = QDropbox2Sync::key(path);
+            seen.insert(key);
+
+            QDropbox2Sync::RecordMap::const_iterator record = records.constFind(key);
+            const bool known = record != records.constEnd();
+
+            QDropbox2Sync::LocalChange change;
+            change.path     = path;
+            change.exists   = true;
+
+            if(info.isDir())
+            {
+                const bool is_new = !known || !record->isDir;
+                if(is_new)
+                {
+                    change.isDir = true;
+                    changes.insert(key, change);
+                }
+
+                // everything beneath a new directory is new as well
+                if(recursive || is_new)
+                    scanDirectory(root, path, true, records, children, changes, hashes, dirs);
+                continue;
+            }
+
+            change.size     = info.size();
+            change.modified = info.lastModified().toMSecsSinceEpoch();
+            if(known && !record->isDir && record->size == change.size && record->modified == change.modified)
+                continue;
+
+            changes.insert(key, change);
+
+            HashJob job;
+            job.key  = key;
+            job.file = info.absoluteFilePath();
+            hashes.append(job);
+        }
+
+        // what was synchronized here before, and is gone now
+        foreach(const QString& key, children.values(QDropbox2Sync::key(dir)))
+        {
+            if(seen.contains(key))
+                continue;
+
+            const QDropbox2Sync::Record& record = records[key];
+            QDropbox2Sync::LocalChange change;
+            change.path  = record.path;
+            change.isDir = record.isDir;
+            changes.insert(key, change);
+        }
+    }
+
+    // whether a local directory still holds only what was last synchronized,
+    // unchanged; anything else would be lost with it
+    bool unchangedTree(const QString& root, const QString& dir, const QDropbox2Sync::RecordMap& records)
+    {
+        const QDir top(root);
+        QDirIterator it(top.filePath(dir), QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::NoSymLinks,
+                        QDirIterator::Subdirectories);
+        while(it.hasNext())
+        {
+            it.next();
+            const QFileInfo info = it.fileInfo();
+            QDropbox2Sync::RecordMap::const_iterator record = records.constFind(QDropbox2Sync::key(top.relativeFilePath(it.filePath())));
+            if(record == records.constEnd() || record->isDir != info.isDir())
+                return false;
+            if(!info.isDir() && (record->size != info.size() || record->modified != info.lastModified().toMSecsSinceEpoch()))
+                return false;
+        }
+        return true;
+    }
+
+    bool isPresent(const QDropbox2Sync::LocalChange& change)  { return change.exists; }
+    bool isPresent(const QDropbox2Sync::RemoteChange& change) { return change.type != QDropbox2Entry::Deleted; }
+
+    // whether anything beneath keys[index] is present in the changes; keys
+    // are sorted, so a directory's descendants follow it directly
+    template<class Changes>
+    bool changedBeneath(const QStringList& keys, int index, const Changes& changes)
+    {
+        const QString prefix = keys[index] + '/';
+        for(int i = index + 1;i < keys.count() && keys[i].startsWith(prefix);++i)
+        {
+            typename Changes::const_iterator change = changes.constFind(keys[i]);
+            if(change != changes.constEnd() && isPresent(*change))
+                return true;
+        }
+        return false;
+    }
+
+    void removeTree(QDropbox2Sync::RecordMap& records, const QString& key)
+    {
+        const bool is_dir = records.value(key).isDir;
+        records.remove(key);
+        if(!is_dir)
+            return;
+
+        const QString prefix = key + '/';
+        for(QDropbox2Sync::RecordMap::iterator it = records.begin();it != records.end();)
+        {
+            if(it.key().startsWith(prefix))
+                it = records.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    // scans for local changes on the scanner pool, then hands them back to
+    // the synchronizer
+    class ScanTask : public QRunnable
+    {
+    public:
+        ScanTask(QObject* owner, const QString& root, const QStringList& dirs, bool recursive,
+                 const QDropbox2Sync::RecordMap& records, QDropbox2Sync::LocalChanges& changes, QStringList& scanned)
+            : owner(owner), root(root), dirs(dirs), recursive(recursive), records(records),
+              changes(changes), scanned(scanned) {}
+
+        void run() override
+        {
+            QDropbox2Sync::scanLocal(root, dirs, recursive, records, changes, &scanned);
+            QMetaObject::invokeMethod(owner, "slot_localScanned", Qt::QueuedConnection);
+        }
+
+    private:
+        QObject*    owner;
+        QString     root;
+        QStringList dirs;
+        bool        recursive;
+        QDropbox2Sync::RecordMap records;       // a copy; the pass leaves ours alone until it returns
+        QDropbox2Sync::LocalChanges& changes;
+        QStringList& scanned;
+    };
+
+    QDropbox2Sync::Action makeAction(QDropbox2Sync::ActionType type, const QString& key,
+                                     const QDropbox2Sync::Record& record, const QString& rev = QString())
+    {
+        QDropbox2Sync::Action action;
+        action.type   = type;
+        action.key    = key;
+        action.rev    = rev;
+        action.record = record;
+        return action;
+    }
+}
+
+QDropbox2Sync::QDropbox2Sync(const QString& local_root, const QString& remote_root, QDropbox2* api, QObject* parent)
+    : QObject(parent),
+      _api(api),
+      _localRoot(QDir(local_root).absolutePath()),
+      _remoteRoot(remote_root),
+      QNAM(this),
+      transfers(new QDropbox2TransferManager(api, this)),
+      watcher(nullptr),
+      watching(false),
+      pollTimeout(30),
+      _rescanInterval(300),
+      pollReply(nullptr),
+      passRunning(false),
+      passAgain(false),
+      fullScan(true),
+      scanning(false),
+      scanAborted(false),
+      passActions(0),
+      passFailures(0),
+      passTrace(0),
+      lastErrorCode(0),
+      eventLoop(nullptr)
+{
+    // "" for the root of the account, otherwise "/folder"
+    while(_remoteRoot.endsWith('/'))
+        _remoteRoot.chop(1);
+    if(!_remoteRoot.isEmpty() && !_remoteRoot.startsWith('/'))
+        _remoteRoot.prepend('/');
+
+    _stateFile = QDir(_localRoot).filePath(stateFileName());
+    if(!loadState(_stateFile, _remoteRoot, cursor, _records))
+    {
+        cursor.clear();
+        _records.clear();
+    }
+
+    // new files must not replace anything we have not seen; changed files
+    // name the revision they replace (see reconcile())
+    transfers->setOverwrite(false);
+    transfers->setRenaming(true);
+
+    connect(transfers, &QDropbox2TransferManager::signal_jobFinished, this, &QDropbox2Sync::slot_jobFinished);
+    connect(&QNAM, &QNetworkAccessManager::finished, this, &QDropbox2Sync::slot_networkRequestFinished);
+
+    passTimer.setSingleShot(true);
+    connect(&passTimer, &QTimer::timeout, this, &QDropbox2Sync::slot_startPass);
+    connect(&rescanTimer, &QTimer::timeout, this, &QDropbox2Sync::slot_rescan);
+}
+
+QDropbox2Sync::~QDropbox2Sync()
+{
+    stop();
+
+    // a scan in progress refers to our members, and posts back to us
+    scanner.waitForDone();
+
+    // the cursor of an unfinished pass was not committed, so whatever it
+    // did not get to is picked up again next time
+    foreach(QNetworkReply* reply, requests.keys())
+    {
+        requests.remove(reply);
+        reply->abort();
+    }
+
+    saveState(_stateFile, _remoteRoot, cursor, _records);
+}
+
+void QDropbox2Sync::setRescanInterval(int seconds)
+{
+    _rescanInterval = qMax(0, seconds);
+    if(!watching)
+        return;
+
+    if(_rescanInterval)
+        rescanTimer.start(_rescanInterval * 1000);
+    else
+        rescanTimer.stop();
+}
+
+bool QDropbox2Sync::synchronize()
+{
+    if(!passRunning)
+        slot_startPass();
+
+    if(passRunning)
+    {
+        QEventLoop loop;
+        eventLoop = &loop;
+        loop.exec();
+        eventLoop = nullptr;
+    }
+
+    return passFailures == 0;
+}
+
+bool QDropbox2Sync::start(int timeout)
+{
+    if(watching)
+        return true;
+
+    watching = true;
+    pollTimeout = timeout;
+    fullScan = true;
+
+    watcher = new QFileSystemWatcher(this);
+    connect(watcher, &QFileSystemWatcher::directoryChanged, this, &QDropbox2Sync::slot_directoryChanged);
+
+    if(_rescanInterval)
+        rescanTimer.start(_rescanInterval * 1000);
+
+    if(!passRunning)
+        slot_startPass();
+    return passRunning || passFailures == 0;
+}
+
+void QDropbox2Sync::stop()
+{
+    watching = false;
+    passTimer.stop();
+    rescanTimer.stop();
+
+    if(watcher)
+    {
+        watcher->deleteLater();
+        watcher = nullptr;
+    }
+
+    if(pollReply)
+    {
+        requests.remove(pollReply);
+        pollReply->abort();
+        pollReply = nullptr;
+    }
+}
+
+void QDropbox2Sync::slot_abort()
+{
+    // a scan cannot be interrupted; the pass ends once it returns
+    if(scanning)
+        scanAborted = true;
+
+    stop();
+    transfers->slot_abort();
+    emit signal_operationAborted();
+}
+
+void QDropbox2Sync::requestPass(int msecs)
+{
+    if(passRunning)
+        passAgain = true;
+    else if(!passTimer.isActive())
+        passTimer.start(msecs);
+}
+
+void QDropbox2Sync::slot_rescan()
+{
+    fullScan = true;
+    requestPass(0);
+}
+
+void QDropbox2Sync::slot_directoryChanged(const QString& path)
+{
+    dirtyDirs.insert(path);
+    requestPass();
+}
+
+void QDropbox2Sync::slot_startPass()
+{
+    if(passRunning)
+    {
+        passAgain = true;
+        return;
+    }
+
+    passTimer.stop();
+
+    passRunning = true;
+    passAgain = false;
+    passActions = 0;
+    passFailures = 0;
+    passCursor = cursor;
+    remoteChanges.clear();
+    lastErrorCode = 0;
+    lastErrorMessage.clear();
+
+    passTrace = _api->traceBegin("sync", {{"path", _remoteRoot}, {"full", fullScan}});
+    listFolder();
+}
+
+void QDropbox2Sync::listFolder()
+{
+    QByteArray postdata;
+    QString path;
+
+    if(passCursor.isEmpty())
+    {
+        QDropbox2JsonWriter json(_remoteRoot.size());
+        json.beginObject()
+                .value("path", _remoteRoot)
+                .value("recursive", true)
+                .value("include_deleted", true)
+            .endObject();
+        postdata = json.data();
+        path = "/2/files/list_folder";
+    }
+    else
+    {
+        QDropbox2JsonWriter json(passCursor.size());
+        json.beginObject()
+                .value("cursor", passCursor)
+            .endObject();
+        postdata = json.data();
+        path = "/2/files/list_folder/continue";
+    }
+
+    if(!post(QDROPBOX2_API_URL, path, postdata, ListFolder))
+        finishPass();
+}
+
+QNetworkReply* QDropbox2Sync::post(const QString& base, const QString& path, const QByteArray& postdata,
+                                   RequestKind kind, const Action& action)
+{
+    QUrl url;
+    url.setUrl(base, QUrl::StrictMode);
+    url.setPath(path);
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req, kind != Longpoll))
+    {
+        failed(QDropbox2::APIError, "The request could not be created.");
+        return nullptr;
+    }
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Sync::post()" << path << postdata << endl;
+#endif
+
+    QNetworkReply* reply = QNAM.post(req, postdata);
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2Sync::signal_operationAborted, reply, &QNetworkReply::abort);
+
+    Request request;
+    request.kind = kind;
+    request.action = action;
+    requests[reply] = request;
+    return reply;
+}
+
+void QDropbox2Sync::slot_networkRequestFinished(QNetworkReply* reply)
+{
+    reply->deleteLater();
+
+    if(!requests.contains(reply))
+        return;
+
+    const Request request = requests.take(reply);
+    const QByteArray response = reply->readAll();
+
+    switch(request.kind)
+    {
+        case ListFolder:
+            listFolderResult(reply, response);
+            break;
+
+        case Longpoll:
+            longpollResult(reply, response);
+            break;
+
+        case Operation:
+            operationResult(request.action, reply, response);
+            if(idle())
+                finishPass();
+            break;
+    }
+}
+
+void QDropbox2Sync::listFolderResult(QNetworkReply* reply, const QByteArray& response)
+{
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        if(!passCursor.isEmpty() && response.contains("reset"))
+        {
+            // the cursor has expired; start over from a full listing.  Remote
+            // deletions made meanwhile are missed, but nothing is lost
+            passCursor.clear();
+            remoteChanges.clear();
+            listFolder();
+            return;
+        }
+
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        failed(status == QDROPBOX_V2_ERROR ? status : int(reply->error()), errorMessage(reply, response));
+        finishPass();
+        return;
+    }
+
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    if(jsonError.error != QJsonParseError::NoError)
+    {
+        failed(QDropbox2::APIError, "Dropbox API did not send correct answer for the folder listing.");
+        finishPass();
+        return;
+    }
+
+    const QJsonObject object = json.object();
+    const QString root = key(_remoteRoot) + '/';
+
+    foreach(const QJsonValue& value, object.value("entries").toArray())
+    {
+        const QJsonObject entry = value.toObject();
+        const QString path_lower = entry.value("path_lower").toString();
+        if(!path_lower.startsWith(root))
+            continue;       // the root itself
+
+        RemoteChange change;
+        change.path = entry.value("path_display").toString().mid(root.size());
+        change.size = qint64(entry.value("size").toDouble());
+        change.hash = entry.value("content_hash").toString();
+        change.rev  = entry.value("rev").toString();
+
+        const QString tag = entry.value(".tag").toString();
+        change.type = (tag == "folder") ? QDropbox2Entry::Folder :
+                          (tag == "deleted" ? QDropbox2Entry::Deleted : QDropbox2Entry::File);
+
+        // later entries for the same path supersede earlier ones
+        remoteChanges.insert(path_lower.mid(root.size()), change);
+    }
+
+    passCursor = object.value("cursor").toString();
+    if(object.value("has_more").toBool())
+    {
+        listFolder();
+        return;
+    }
+
+    QStringList dirs;
+    if(fullScan)
+        dirs.append(QString());
+    else
+    {
+        foreach(const QString& dir, dirtyDirs)
+            dirs.append(relativePath(dir));
+    }
+
+    // reading and hashing the files that changed can take a long time; the
+    // pass goes on in slot_localScanned()
+    scanning = true;
+    scanAborted = false;
+    localChanges.clear();
+    scannedDirs.clear();
+    scanner.start(new ScanTask(this, _localRoot, dirs, fullScan, _records, localChanges, scannedDirs));
+
+    fullScan = false;
+    dirtyDirs.clear();
+}
+
+void QDropbox2Sync::slot_localScanned()
+{
+    scanning = false;
+
+    if(scanAborted)
+    {
+        localChanges.clear();
+        remoteChanges.clear();
+        failed(QNetworkReply::OperationCanceledError, "The synchronization was cancelled.");
+        finishPass();
+        return;
+    }
+
+    watchDirectories(scannedDirs);
+    scannedDirs.clear();
+
+    QList<Action> actions = reconcile(_records, localChanges, remoteChanges);
+    remoteChanges.clear();
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Sync:" << localChanges.count() << "local changes," << actions.count() << "actions" << endl;
+#endif
+
+    localChanges.clear();
+    execute(actions);
+}
+
+void QDropbox2Sync::scanLocal(const QString& root, const QStringList& dirs, bool recursive,
+                              const RecordMap& records, LocalChanges& changes, QStringList* scanned)
+{
+    // what was synchronized, by directory, to find what has gone
+    QMultiHash<QString, QString> children;
+    children.reserve(records.count());
+    for(RecordMap::const_iterator it = records.constBegin();it != records.constEnd();++it)
+        children.insert(parentKey(it.key()), it.key());
+
+    QVector<HashJob> hashes;
+    foreach(const QString& dir, dirs)
+        scanDirectory(root, dir, recursive, records, children, changes, hashes, scanned);
+
+    if(hashes.isEmpty())
+        return;
+
+    QThreadPool pool;
+    for(int begin = 0;begin < hashes.count();begin += HashBatch)
+        pool.start(new HashTask(hashes, begin, qMin(begin + HashBatch, hashes.count())));
+    pool.waitForDone();
+
+    foreach(const HashJob& job, hashes)
+    {
+        // a file that cannot be read now is looked at again next time
+        if(job.hash.isEmpty())
+            changes.remove(job.key);
+        else
+            changes[job.key].hash = job.hash;
+    }
+}
+
+QList<QDropbox2Sync::Action> QDropbox2Sync::reconcile(RecordMap& records, const LocalChanges& local, const RemoteChanges& remote)
+{
+    QList<Action> actions;
+
+    // parents sort before their descendants
+    QStringList keys;
+    keys.reserve(local.count() + remote.count());
+    for(LocalChanges::const_iterator it = local.constBegin();it != local.constEnd();++it)
+        keys.append(it.key());
+    for(RemoteChanges::const_iterator it = remote.constBegin();it != remote.constEnd();++it)
+    {
+        if(!local.contains(it.key()))
+            keys.append(it.key());
+    }
+    std::sort(keys.begin(), keys.end());
+
+    QString removed;        // a directory removed as a whole, with "/"
+
+    for(int i = 0;i < keys.count();++i)
+    {
+        const QString& key = keys[i];
+        if(!removed.isEmpty() && key.startsWith(removed))
+            continue;
+
+        RecordMap::const_iterator existing = records.constFind(key);
+        const bool known = existing != records.constEnd();
+        const Record previous = known ? *existing : Record();
+
+        LocalChanges::const_iterator l = local.constFind(key);
+        RemoteChanges::const_iterator r = remote.constFind(key);
+        const bool local_changed = l != local.constEnd();
+        const bool remote_changed = r != remote.constEnd();
+
+        Record record;
+        if(local_changed)
+        {
+            record.path     = l->path;
+            record.isDir    = l->isDir;
+            record.size     = l->size;
+            record.modified = l->modified;
+            record.hash     = l->hash;
+        }
+
+        Record downloaded;
+        if(remote_changed)
+        {
+            downloaded.path  = r->path;
+            downloaded.isDir = r->type == QDropbox2Entry::Folder;
+            downloaded.size  = r->size;
+            downloaded.hash  = r->hash;
+            downloaded.rev   = r->rev;
+        }
+
+        if(local_changed && !remote_changed)
+        {
+            if(!l->exists)
+            {
+                if(!known)
+                    continue;
+
+                // keep what was added on the other side beneath a removed directory
+                if(previous.isDir && changedBeneath(keys, i, remote))
+                    removeTree(records, key);
+                else
+                {
+                    actions.append(makeAction(RemoveRemote, key, previous));
+                    if(previous.isDir)
+                        removed = key + '/';
+                }
+            }
+            else if(l->isDir)
+            {
+                if(!known || !previous.isDir)
+                    actions.append(makeAction(CreateRemoteFolder, key, record));
+            }
+            else if(known && !previous.isDir && previous.hash == l->hash)
+            {
+                // touched, not modified
+                record.rev = previous.rev;
+                records[key] = record;
+            }
+            else
+                actions.append(makeAction(Upload, key, record, previous.rev));
+        }
+        else if(remote_changed && !local_changed)
+        {
+            if(r->type == QDropbox2Entry::Deleted)
+            {
+                if(!known)
+                    continue;
+
+                if(previous.isDir && changedBeneath(keys, i, local))
+                    removeTree(records, key);
+                else
+                {
+                    actions.append(makeAction(RemoveLocal, key, previous));
+                    if(previous.isDir)
+                        removed = key + '/';
+                }
+            }
+            else if(r->type == QDropbox2Entry::Folder)
+            {
+                if(!known || !previous.isDir)
+                    actions.append(makeAction(CreateLocalFolder, key, downloaded));
+            }
+            else if(known && !previous.isDir && previous.hash == r->hash)
+            {
+                // typically our own upload, coming back with its revision
+                records[key].rev = r->rev;
+            }
+            else
+                actions.append(makeAction(Download, key, downloaded));
+        }
+        else if(!l->exists && r->type == QDropbox2Entry::Deleted)
+        {
+            removeTree(records, key);
+            removed = key + '/';
+        }
+        else if(!l->exists)
+        {
+            // removed here, changed there: keep the change
+            actions.append(makeAction(downloaded.isDir ? CreateLocalFolder : Download, key, downloaded));
+        }
+        else if(r->type == QDropbox2Entry::Deleted)
+        {
+            actions.append(makeAction(l->isDir ? CreateRemoteFolder : Upload, key, record));
+        }
+        else if(l->isDir || r->type == QDropbox2Entry::Folder)
+        {
+            if(l->isDir && r->type == QDropbox2Entry::Folder)
+                records[key] = downloaded;
+#ifdef QTDROPBOX_DEBUG
+            else
+                qDebug() << "QDropbox2Sync: a file and a folder at" << l->path << "; left alone" << endl;
+#endif
+        }
+        else if(l->hash == r->hash)
+        {
+            // changed identically on both sides
+            record.rev = r->rev;
+            records[key] = record;
+        }
+        else
+        {
+            // the upload names the revision last synchronized, which is no
+            // longer current, so Dropbox keeps it under a new name
+            actions.append(makeAction(Conflict, key, downloaded, previous.rev));
+        }
+    }
+
+    return actions;
+}
+
+void QDropbox2Sync::execute(const QList<Action>& actions)
+{
+    passActions = actions.count();
+
+    foreach(const Action& action, actions)
+        perform(action);
+
+    if(idle())
+        finishPass();
+}
+
+void QDropbox2Sync::perform(const Action& action)
+{
+    const QString local_path = localPath(action.record.path);
+    const QString remote_path = remotePath(action.record.path);
+
+    switch(action.type)
+    {
+        case Upload:
+        case Conflict:
+        {
+            const int id = transfers->upload(local_path, remote_path, 0, action.rev);
+            if(id)
+                jobs[id] = action;
+            else
+                failed(QDropbox2::APIError, QString("%1 could not be read.").arg(local_path));
+            break;
+        }
+
+        case Download:
+            QDir().mkpath(QFileInfo(local_path).absolutePath());
+            jobs[transfers->download(remote_path, local_path, 0, action.record.size)] = action;
+            break;
+
+        case RemoveLocal:
+        {
+            // what has been changed or added since the scan is left in place;
+            // the next pass finds it, and uploads it
+            QFileInfo info(local_path);
+            bool changed = false;
+            bool result = true;
+            if(action.record.isDir)
+            {
+                changed = !unchangedTree(_localRoot, action.record.path, _records);
+                if(!changed)
+                    result = QDir(local_path).removeRecursively();
+            }
+            else if(info.exists())
+            {
+                changed = info.size() != action.record.size ||
+                          info.lastModified().toMSecsSinceEpoch() != action.record.modified;
+                if(!changed)
+                    result = QFile::remove(local_path);
+            }
+
+            if(changed)
+                failed(QDropbox2::APIError, QString("%1 was removed remotely, but has changed locally; it was kept.").arg(local_path));
+            else if(result)
+                succeeded(action);
+            else
+                failed(QDropbox2::APIError, QString("%1 could not be removed.").arg(local_path));
+            break;
+        }
+
+        case CreateLocalFolder:
+            if(QDir().mkpath(local_path))
+                succeeded(action);
+            else
+                failed(QDropbox2::APIError, QString("%1 could not be created.").arg(local_path));
+            break;
+
+        case RemoveRemote:
+        {
+            QDropbox2JsonWriter json(remote_path.size() + action.record.rev.size());
+            json.beginObject()
+                    .value("path", remote_path);
+            // only if it has not changed since it was last synchronized
+            if(!action.record.isDir && !action.record.rev.isEmpty())
+                json.value("parent_rev", action.record.rev);
+            json.endObject();
+
+            post(QDROPBOX2_API_URL, "/2/files/delete_v2", json.data(), Operation, action);
+            break;
+        }
+
+        case CreateRemoteFolder:
+        {
+            QDropbox2JsonWriter json(remote_path.size());
+            json.beginObject()
+                    .value("path", remote_path)
+                    .value("autorename", false)
+                .endObject();
+
+            post(QDROPBOX2_API_URL, "/2/files/create_folder_v2", json.data(), Operation, action);
+            break;
+        }
+    }
+}
+
+void QDropbox2Sync::operationResult(const Action& action, QNetworkReply* reply, const QByteArray& response)
+{
+    if(reply->error() == QNetworkReply::NoError)
+    {
+        _api->metadataCache()->invalidate(remotePath(action.record.path));
+        _api->linkCache()->invalidate(remotePath(action.record.path));
+        if(_api->contentCache())
+            _api->contentCache()->invalidate(remotePath(action.record.path));
+        succeeded(action);
+        return;
+    }
+
+    // already gone, or already there
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if(status == QDROPBOX_V2_ERROR &&
+       ((action.type == RemoveRemote && response.contains("not_found")) ||
+        (action.type == CreateRemoteFolder && response.contains("conflict/folder"))))
+    {
+        succeeded(action);
+        return;
+    }
+
+    failed(status == QDROPBOX_V2_ERROR ? status : int(reply->error()), errorMessage(reply, response));
+}
+
+void QDropbox2Sync::slot_jobFinished(int id, int errorcode, const QString& errormessage)
+{
+    if(!jobs.contains(id))
+        return;
+
+    const Action action = jobs.take(id);
+    if(errorcode == 0)
+        succeeded(action);
+    else
+        failed(errorcode, errormessage);
+
+    if(idle())
+        finishPass();
+}
+
+void QDropbox2Sync::succeeded(const Action& action)
+{
+    switch(action.type)
+    {
+        case Conflict:
+        {
+            // the local version is safe under its new name; now take the remote one
+            Action download = action;
+            download.type = Download;
+            download.rev.clear();
+            perform(download);
+            return;
+        }
+
+        case Download:
+        {
+            Record record = action.record;
+            QFileInfo info(localPath(record.path));
+            record.size     = info.size();
+            record.modified = info.lastModified().toMSecsSinceEpoch();
+            _records[action.key] = record;
+            break;
+        }
+
+        case Upload:            // the new revision arrives with the next remote delta
+        case CreateLocalFolder:
+        case CreateRemoteFolder:
+            _records[action.key] = action.record;
+            break;
+
+        case RemoveLocal:
+        case RemoveRemote:
+            removeTree(_records, action.key);
+            break;
+    }
+}
+
+void QDropbox2Sync::failed(int error_code, const QString& error_message)
+{
+    ++passFailures;
+    lastErrorCode = error_code;
+    lastErrorMessage = error_message;
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Sync error:" << error_code << error_message << endl;
+#endif
+
+    emit signal_errorOccurred(error_code, error_message);
+}
+
+bool QDropbox2Sync::idle() const
+{
+    return !scanning && jobs.isEmpty() && requests.count() == (pollReply ? 1 : 0);
+}
+
+void QDropbox2Sync::finishPass()
+{
+    if(!passRunning)
+        return;
+
+    if(passFailures == 0)
+        cursor = passCursor;
+    else
+    {
+        // what failed will be found again: the remote changes from the old
+        // cursor, the local ones by a full scan
+        fullScan = true;
+    }
+
+    if(!saveState(_stateFile, _remoteRoot, cursor, _records))
+        failed(QDropbox2::APIError, QString("%1 could not be written.").arg(_stateFile));
+
+    passRunning = false;
+    _api->traceEnd(passTrace, "sync", {{"actions", passActions}, {"failures", passFailures}});
+    passTrace = 0;
+
+    emit signal_synchronized(passFailures == 0, passActions);
+
+    if(eventLoop)
+        eventLoop->exit();
+
+    if(watching)
+    {
+        if(passAgain || !dirtyDirs.isEmpty())
+            requestPass();
+        slot_poll();
+    }
+}
+
+void QDropbox2Sync::slot_poll()
+{
+    if(!watching || pollReply || cursor.isEmpty())
+        return;
+
+    QDropbox2JsonWriter json(cursor.size());
+    json.beginObject()
+            .value("cursor", cursor)
+            .value("timeout", pollTimeout)
+        .endObject();
+
+    pollReply = post(QDROPBOX2_NOTIFY_URL, "/2/files/list_folder/longpoll", json.data(), Longpoll);
+}
+
+void QDropbox2Sync::longpollResult(QNetworkReply* reply, const QByteArray& response)
+{
+    pollReply = nullptr;
+    if(!watching)
+        return;
+
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        // a pass deals with an expired cursor
+        if(response.contains("reset"))
+            requestPass(0);
+        else
+            QTimer::singleShot(pollTimeout * 1000, this, SLOT(slot_poll()));
+        return;
+    }
+
+    const QJsonObject object = QJsonDocument::fromJson(response).object();
+    if(object.value("changes").toBool())
+    {
+        requestPass(0);
+        return;
+    }
+
+    // the server may ask us to wait before polling again
+    const int backoff = object.value("backoff").toInt();
+    if(backoff > 0)
+        QTimer::singleShot(backoff * 1000, this, SLOT(slot_poll()));
+    else
+        slot_poll();
+}
+
+void QDropbox2Sync::watchDirectories(const QStringList& dirs)
+{
+    if(!watcher || dirs.isEmpty())
+        return;
+
+    QSet<QString> watched;
+    foreach(const QString& path, watcher->directories())
+        watched.insert(path);
+
+    QStringList paths;
+    foreach(const QString& dir, dirs)
+    {
+        const QString path = localPath(dir);
+        if(!watched.contains(path))
+            paths.append(path);
+    }
+
+    if(!paths.isEmpty())
+        watcher->addPaths(paths);
+}
+
+QString QDropbox2Sync::localPath(const QString& path) const
+{
+    return path.isEmpty() ? _localRoot : _localRoot + '/' + path;
+}
+
+QString QDropbox2Sync::remotePath(const QString& path) const
+{
+    return _remoteRoot + '/' + path;
+}
+
+QString QDropbox2Sync::relativePath(const QString& local_path) const
+{
+    const QString path = QDir(_localRoot).relativeFilePath(local_path);
+    return path == "." ? QString() : path;
+}
+
+QString QDropbox2Sync::errorMessage(QNetworkReply* reply, const QByteArray& response) const
+{
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    if(jsonError.error == QJsonParseError::NoError)
+    {
+        QJsonObject object = json.object();
+        if(object.contains("user_message"))
+            return object.value("user_message").toString();
+        if(object.contains("error_summary"))
+            return object.value("error_summary").toString();
+    }
+
+    return reply->errorString();
+}
+
+bool QDropbox2Sync::saveState(const QString& file_name, const QString& remote_root,
+                              const QString& cursor, const RecordMap& records)
+{
+    QSaveFile file(file_name);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_4);
+    out << StateMagic << StateVersion << key(remote_root) << cursor << quint32(records.count());
+
+    for(RecordMap::const_iterator it = records.constBegin();it != records.constEnd();++it)
+    {
+        const Record& record = it.value();
+        out << record.path << record.isDir << record.size << record.modified << record.hash << record.rev;
+    }
+
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+bool QDropbox2Sync::loadState(const QString& file_name, const QString& remote_root,
+                              QString& cursor, RecordMap& records)
+{
+    QFile file(file_name);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_4);
+
+    quint32 magic, version, count;
+    QString root;
+    in >> magic >> version >> root >> cursor >> count;
+    if(in.status() != QDataStream::Ok || magic != StateMagic || version != StateVersion || root != key(remote_root))
+        return false;
+
+    records.clear();
+    records.reserve(count);
+    for(quint32 i = 0;i < count && in.status() == QDataStream::Ok;++i)
+    {
+        Record record;
+        in >> record.path >> record.isDir >> record.size >> record.modified >> record.hash >> record.rev;
+        records.insert(key(record.path), record);
+    }
+
+    return in.status() == QDataStream::Ok;
+}
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
+
+#include "qdropbox2common.h"
+
+#include "qdropbox2.h"
+#include "qdropbox2entry.h"
+
+class QFileSystemWatcher;
+class QDropbox2TransferManager;
+
+//! Keeps a local directory tree and a Dropbox folder in step, in both directions
+/*!
+  QDropbox2Sync mirrors changes made on either side to the other.  Each pass
+  of synchronize()
+
+  \li fetches the remote changes since the previous pass, from a recursive
+      list_folder cursor;
+  \li scans the local directories that have changed since the previous pass
+      (all of them, the first time), comparing each file's size and
+      modification time to what was last synchronized; the scan, and the
+      hashing of changed files, run on a worker thread;
+  \li reconciles the two sets of changes against the last synchronized state
+      (see reconcile()), and carries out the result: files go through a
+      QDropbox2TransferManager, deletions and new folders are applied
+      directly.
+
+  Files are compared by their Dropbox content hash (see
+  QDropbox2ContentHasher), which the server reports with every file.  A local
+  file is only hashed when its size or modification time has changed, and it
+  is only transferred when its hash differs from the other side's; a file
+  that was touched, or that already exists on both sides (as when an existing
+  tree is first synchronized), costs no transfer.
+
+  When a file has changed on both sides, the local version is uploaded as a
+  replacement of the last synchronized revision.  Dropbox refuses to replace
+  a revision that is no longer current, and keeps the upload under a new
+  name instead (the same <i>autorename</i> semantics as
+  QDropbox2File::setRenaming()); the remote version is then downloaded, and
+  the renamed copy arrives with the next pass.  No version is lost.
+
+  start() keeps the two sides synchronized continuously: local changes are
+  reported by a QFileSystemWatcher (inotify, on Linux), remote changes by a
+  list_folder longpoll, and either starts a new pass.  Directory watches do
+  not report a file written in place, so a full scan is also made every
+  setRescanInterval() seconds.
+
+  The synchronized state (the cursor, and per path the size, modification
+  time, content hash and revision) is saved in the file stateFileName() at
+  the top of the local tree, and survives restarts.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2Sync : public QObject
+{
+    Q_OBJECT
+
+public:     // typedefs and enums
+    //! What was last synchronized for a path
+    struct Record
+    {
+        QString     path;       // relative to the roots, as last seen
+        bool        isDir;
+        qint64      size;
+        qint64      modified;   // local modification time, msecs since the epoch
+        QString     hash;       // content hash
+        QString     rev;        // remote revision, if known
+
+        Record() : isDir(false), size(0), modified(0) {}
+    };
+
+    //! A path that has changed locally since it was last synchronized
+    struct LocalChange
+    {
+        QString     path;
+        bool        exists;
+        bool        isDir;
+        qint64      size;
+        qint64      modified;
+        QString     hash;
+
+        LocalChange() : exists(false), isDir(false), size(0), modified(0) {}
+    };
+
+    //! A path that has changed remotely, from a list_folder delta
+    struct RemoteChange
+    {
+        QString                 path;
+        QDropbox2Entry::Type    type;
+        qint64                  size;
+        QString                 hash;
+        QString                 rev;
+
+        RemoteChange() : type(QDropbox2Entry::Deleted), size(0) {}
+    };
+
+    enum ActionType
+    {
+        Upload,
+        Download,
+        Conflict,               // upload as a renamed copy, then download
+        RemoveLocal,
+        RemoveRemote,
+        CreateLocalFolder,
+        CreateRemoteFolder
+    };
+
+    struct Action
+    {
+        ActionType  type;
+        QString     key;
+        QString     rev;        // the revision an upload replaces, if any
+        Record      record;     // what to record once the action succeeds
+    };
+
+    // keyed by key(), as Dropbox paths are not case-sensitive
+    typedef QHash<QString, Record>          RecordMap;
+    typedef QHash<QString, LocalChange>     LocalChanges;
+    typedef QHash<QString, RemoteChange>    RemoteChanges;
+
+public:
+    /*!
+      Creates a synchronizer, and loads the state of previous runs, if any.
+
+      \param local_root Local directory to synchronize.
+      \param remote_root Dropbox folder to synchronize; empty or "/" for the
+                         whole account.
+      \param api A QDropbox2 that is connected to an user account.
+      \param parent Parent QObject
+     */
+    QDropbox2Sync(const QString& local_root, const QString& remote_root, QDropbox2* api, QObject* parent = 0);
+
+    /*!
+      Stops synchronizing, and saves the state.
+     */
+    ~QDropbox2Sync();
+
+    QString localRoot() const                   { return _localRoot; }
+    QString remoteRoot() const                  { return _remoteRoot; }
+
+    /*!
+      Name of the file in which the state is saved.  Files of this name are
+      never synchronized.
+     */
+    static QString stateFileName()              { return ".qdropbox2sync"; }
+
+    /*!
+      Returns the manager that carries out the transfers; use it to set
+      limits on concurrency and memory, or to follow progress.
+     */
+    QDropbox2TransferManager* transferManager() const { return transfers; }
+
+    /*!
+      Sets the interval, in seconds, of the full local scans made by start().
+      Zero disables them.
+     */
+    void    setRescanInterval(int seconds);
+    int     rescanInterval() const              { return _rescanInterval; }
+
+    /*!
+      Runs one pass, as described above.
+
+      \remark This is a blocking call.
+
+      \returns <i>true</i> if every change was carried out.
+     */
+    bool    synchronize();
+
+    /*!
+      Synchronizes continuously, starting with a pass, until stop() is called.
+
+      \param timeout Timeout of the remote longpoll, in seconds.
+      \returns <i>true</i> if the first pass could be started.
+     */
+    bool    start(int timeout = 30);
+
+    /*!
+      Stops synchronizing continuously.  A pass in progress is completed.
+     */
+    void    stop();
+
+    bool    isWatching() const                  { return watching; }
+    bool    isRunning() const                   { return passRunning; }
+
+    /*!
+      Returns the latest error code.
+    */
+    int     error() const                       { return lastErrorCode; }
+
+    /*!
+      Returns the latest error message.
+    */
+    QString errorString() const                 { return lastErrorMessage; }
+
+    /*!
+      Returns the synchronized state.
+     */
+    const RecordMap& records() const            { return _records; }
+
+    /*!
+      Returns the key of a path relative to the roots.
+     */
+    static QString key(const QString& path)     { return path.toLower(); }
+
+    /*!
+      Decides what to do about the changes on either side.  Paths that need no
+      transfer (e.g., a file touched but not modified, or changed identically
+      on both sides) are recorded at once; the others are returned, and are
+      recorded as each action succeeds.
+
+      \param records The synchronized state; updated.
+      \param local Local changes, by key().
+      \param remote Remote changes, by key().
+      \returns The actions to carry out.
+     */
+    static QList<Action> reconcile(RecordMap& records, const LocalChanges& local, const RemoteChanges& remote);
+
+    /*!
+      Scans local directories for changes against the synchronized state.
+      Subdirectories that are new, or all of them if <i>recursive</i> is set,
+      are scanned as well.  Files whose size or modification time has changed
+      are hashed, in parallel.
+
+      \remark This is a blocking call.
+
+      \param root The local root.
+      \param dirs The directories to scan, relative to the root.
+      \param recursive Scan all subdirectories, and not only new ones.
+      \param records The synchronized state.
+      \param changes Receives the changes found.
+      \param scanned Receives the directories scanned, relative to the root.
+     */
+    static void scanLocal(const QString& root, const QStringList& dirs, bool recursive,
+                          const RecordMap& records, LocalChanges& changes, QStringList* scanned = nullptr);
+
+    /*!
+      Scans a single local directory; see above.
+     */
+    static void scanLocal(const QString& root, const QString& dir, bool recursive,
+                          const RecordMap& records, LocalChanges& changes, QStringList* scanned = nullptr)
+    {
+        scanLocal(root, QStringList(dir), recursive, records, changes, scanned);
+    }
+
+    /*!
+      Saves or loads the synchronized state.  A state saved for another remote
+      root is not loaded.
+     */
+    static bool saveState(const QString& file_name, const QString& remote_root,
+                          const QString& cursor, const RecordMap& records);
+    static bool loadState(const QString& file_name, const QString& remote_root,
+                          QString& cursor, RecordMap& records);
+
+public slots:
+    /*!
+      Stops synchronizing continuously, and cancels the pass in progress.
+     */
+    void    slot_abort();
+
+signals:
+    /*!
+      Emitted when an error occurs.
+    */
+    void    signal_errorOccurred(int errorcode, const QString& errormessage = QString());
+
+    /*!
+      Emitted when a pass has finished.
+
+      \param success <i>true</i> if every change was carried out.
+      \param actions The number of changes carried out or attempted.
+     */
+    void    signal_synchronized(bool success, int actions);
+
+    /*!
+      Emitted when an in-progress operation is aborted.
+     */
+    void    signal_operationAborted();
+
+private slots:
+    void    slot_startPass();
+    void    slot_poll();
+    void    slot_rescan();
+    void    slot_directoryChanged(const QString& path);
+    void    slot_jobFinished(int id, int errorcode, const QString& errormessage);
+    void    slot_networkRequestFinished(QNetworkReply* reply);
+    void    slot_localScanned();
+
+private:        // typedefs and enums
+    enum RequestKind
+    {
+        ListFolder,
+        Longpoll,
+        Operation
+    };
+
+    struct Request
+    {
+        RequestKind kind;
+        Action      action;
+    };
+
+private:        // methods
+    void    requestPass(int msecs = 500);
+    void    listFolder();
+    void    listFolderResult(QNetworkReply* reply, const QByteArray& response);
+    void    longpollResult(QNetworkReply* reply, const QByteArray& response);
+    void    operationResult(const Action& action, QNetworkReply* reply, const QByteArray& response);
+    void    execute(const QList<Action>& actions);
+    void    perform(const Action& action);
+    void    succeeded(const Action& action);
+    void    failed(int error_code, const QString& error_message);
+    void    finishPass();
+    bool    idle() const;
+    void    watchDirectories(const QStringList& dirs);
+
+    QNetworkReply* post(const QString& base, const QString& path, const QByteArray& postdata,
+                        RequestKind kind, const Action& action = Action());
+
+    QString localPath(const QString& path) const;
+    QString remotePath(const QString& path) const;
+    QString relativePath(const QString& local_path) const;
+    QString errorMessage(QNetworkReply* reply, const QByteArray& response) const;
+
+private:        // data members
+    QDropbox2*  _api;
+    QString     _localRoot;
+    QString     _remoteRoot;
+    QString     _stateFile;
+
+    QNetworkAccessManager QNAM;
+    QDropbox2TransferManager* transfers;
+    QFileSystemWatcher* watcher;
+
+    QString     cursor;
+    RecordMap   _records;
+
+    bool        watching;
+    int         pollTimeout;
+    int         _rescanInterval;
+    QTimer      passTimer;
+    QTimer      rescanTimer;
+    QNetworkReply* pollReply;
+
+    // the pass in progress; the cursor is only committed once every change
+    // it delivered has been carried out
+    QString     passCursor;
+    bool        passRunning;
+    bool        passAgain;
+    bool        fullScan;
+    QSet<QString> dirtyDirs;
+    RemoteChanges remoteChanges;
+    QHash<QNetworkReply*, Request> requests;
+    QHash<int, Action> jobs;
+
+    // the local scan of the pass, on the scanner pool; the task fills in
+    // the changes and directories it found
+    QThreadPool scanner;
+    bool        scanning;
+    bool        scanAborted;
+    LocalChanges localChanges;
+    QStringList scannedDirs;
+
+    int         passActions;
+    int         passFailures;
+    quint64     passTrace;
+
+    int         lastErrorCode;
+    QString     lastErrorMessage;
+
+    QEventLoop* eventLoop;
+};
@@ -0,0 +1,468 @@
+#include <QDir>
+#include <QFile>
+#include <QRunnable>
+
+#ifdef QTDROPBOX_DEBUG
+#include <QDebug>
+#endif
+
+#include "qdropbox2thumbnails.h"
+#include "qdropbox2contentcache.h"
+#include "qdropbox2json.h"
+
+namespace
+{
+    // Qt opens no more than this many connections to a host per manager
+    const int ConnectionsPerManager = 6;
+
+    const char* const SizeTags[] = {
+        "w32h32", "w64h64", "w128h128", "w256h256", "w480h320",
+        "w640h480", "w960h640", "w1024h768", "w2048h1536"
+    };
+
+    const char* const FormatTags[] = { "jpeg", "png" };
+
+    // "path/not_found" for {".tag": "path", "path": {".tag": "not_found"}}
+    QString failureTag(const QJsonObject& failure)
+    {
+        QString tag = failure.value(".tag").toString();
+        QJsonValue detail = failure.value(tag);
+        if(detail.isObject())
+        {
+            QString inner = detail.toObject().value(".tag").toString();
+            if(!inner.isEmpty())
+                tag += "/" + inner;
+        }
+        return tag;
+    }
+}
+
+// parses and decodes a batch response, and stores the thumbnails in the
+// cache, on the decoder pool; then hands the batch back to the manager
+class QDropbox2ThumbnailTask : public QRunnable
+{
+public:
+    typedef QSharedPointer<QDropbox2ContentCache> CachePtr;
+
+    QDropbox2ThumbnailTask(QObject* owner, int batch_id, const QByteArray& response,
+                           bool& valid, QVector<QDropbox2Thumbnails::Result>& results,
+                           CachePtr cache, QDropbox2Thumbnails::Size size, QDropbox2Thumbnails::Format format)
+        : owner(owner), batchId(batch_id), response(response), valid(valid), results(results),
+          cache(cache), size(size), format(format) {}
+
+    void run() override
+    {
+        valid = QDropbox2Thumbnails::decodeBatch(response, results);
+        response.clear();
+
+        if(valid && cache)
+        {
+            foreach(const QDropbox2Thumbnails::Result& result, results)
+            {
+                if(!result.image.isEmpty() && !result.id.isEmpty() && !result.rev.isEmpty())
+                    cache->insert(QDropbox2Thumbnails::cacheKey(result.id, result.rev, size, format), result.image);
+            }
+        }
+
+        QMetaObject::invokeMethod(owner, "slot_decoded", Qt::QueuedConnection, Q_ARG(int, batchId));
+    }
+
+private:
+    QObject*    owner;
+    int         batchId;
+    QByteArray  response;
+    bool&       valid;
+    QVector<QDropbox2Thumbnails::Result>& results;
+    CachePtr    cache;
+    QDropbox2Thumbnails::Size   size;
+    QDropbox2Thumbnails::Format format;
+};
+
+QDropbox2Thumbnails::QDropbox2Thumbnails(QDropbox2* api, QObject* parent)
+    : QObject(parent),
+      _api(api),
+      _size(W64H64),
+      _format(Jpeg),
+      _maxConcurrency(DefaultConcurrency),
+      nextManager(0),
+      nextBatch(0),
+      scheduling(false),
+      running(false),
+      outstanding(0),
+      failed(0),
+      eventLoop(nullptr)
+{
+}
+
+QDropbox2Thumbnails::~QDropbox2Thumbnails()
+{
+    // abandon whatever is in flight; nobody is waiting for the outcome
+    QList<QNetworkReply*> replies = inflight.keys();
+    inflight.clear();
+    foreach(QNetworkReply* reply, replies)
+        reply->abort();
+
+    // tasks refer to their batch, and post back to us
+    decoder.waitForDone();
+}
+
+void QDropbox2Thumbnails::setMaxConcurrency(int count)
+{
+    _maxConcurrency = qMax(1, count);
+    if(!queued.isEmpty())
+        requestSchedule();
+}
+
+bool QDropbox2Thumbnails::enableCache(const QString& directory, qint64 max_bytes)
+{
+    disableCache();
+
+    if(!QDir().mkpath(directory))
+        return false;
+
+    _cache = QSharedPointer<QDropbox2ContentCache>(new QDropbox2ContentCache(directory, max_bytes));
+    return true;
+}
+
+void QDropbox2Thumbnails::disableCache()
+{
+    // tasks still decoding hold their own reference
+    _cache.clear();
+}
+
+QString QDropbox2Thumbnails::cacheKey(const QString& id, const QString& rev, Size size, Format format)
+{
+    return QString("%1.%2.%3").arg(QDropbox2ContentCache::key(id, rev))
+                              .arg(SizeTags[size])
+                              .arg(FormatTags[format]);
+}
+
+void QDropbox2Thumbnails::request(const QStringList& paths)
+{
+    foreach(const QString& path, paths)
+        enqueue(path);
+    requestSchedule();
+}
+
+void QDropbox2Thumbnails::request(const QDropbox2Folder::ContentsList& files)
+{
+    foreach(const QDropbox2EntityInfo& info, files)
+    {
+        if(info.isDirectory() || info.isDeleted())
+            continue;
+
+        if(_cache && !info.id().isEmpty() && !info.revisionHash().isEmpty())
+        {
+            QFile* file = _cache->open(cacheKey(info.id(), info.revisionHash(), _size, _format));
+            if(file)
+            {
+                QByteArray image = file->readAll();
+                delete file;
+
+                if(!image.isEmpty())
+                {
+                    start();
+                    hits.append(qMakePair(info.path(), image));
+                    continue;
+                }
+            }
+        }
+
+        enqueue(info.path());
+    }
+
+    requestSchedule();
+}
+
+void QDropbox2Thumbnails::start()
+{
+    if(!running)
+    {
+        running = true;
+        failed = 0;
+    }
+    ++outstanding;
+}
+
+void QDropbox2Thumbnails::enqueue(const QString& path)
+{
+    start();
+
+    Item item;
+    item.path = path;
+    item.size = _size;
+    item.format = _format;
+    queued.append(item);
+}
+
+bool QDropbox2Thumbnails::waitForFinished()
+{
+    if(!eventLoop)
+        eventLoop = new QEventLoop(this);
+    while(outstanding)
+        eventLoop->exec();
+
+    return failed == 0;
+}
+
+void QDropbox2Thumbnails::slot_abort()
+{
+    while(!queued.isEmpty())
+        fail(queued.takeFirst().path, QNetworkReply::OperationCanceledError, "The request was cancelled.");
+
+    // replies are connected to this, and fail their batch as they finish
+    emit signal_operationAborted();
+
+    checkFinished();
+}
+
+//--------------------------------------
+// Scheduling
+
+void QDropbox2Thumbnails::requestSchedule()
+{
+    if(scheduling)
+        return;
+
+    scheduling = true;
+    QMetaObject::invokeMethod(this, "slot_schedule", Qt::QueuedConnection);
+}
+
+void QDropbox2Thumbnails::slot_schedule()
+{
+    scheduling = false;
+    schedule();
+}
+
+void QDropbox2Thumbnails::schedule()
+{
+    while(!hits.isEmpty())
+    {
+        QPair<QString, QByteArray> hit = hits.takeFirst();
+        deliver(hit.first, hit.second);
+    }
+
+    while(inflight.count() < _maxConcurrency && !queued.isEmpty())
+    {
+        // a batch holds thumbnails of one size and format
+        BatchPtr batch(new Batch());
+        batch->id = ++nextBatch;
+        batch->size = queued.first().size;
+        batch->format = queued.first().format;
+        batch->valid = false;
+
+        for(int i = 0;i < queued.count() && batch->items.count() < BatchSize;)
+        {
+            if(queued[i].size == batch->size && queued[i].format == batch->format)
+                batch->items.append(queued.takeAt(i));
+            else
+                ++i;
+        }
+
+        if(!startBatch(batch))
+        {
+            foreach(const Item& item, batch->items)
+                fail(item.path, QDropbox2::APIError, "Could not create the thumbnail request.");
+        }
+    }
+
+    checkFinished();
+}
+
+QNetworkAccessManager* QDropbox2Thumbnails::networkAccessManager()
+{
+    const int needed = (_maxConcurrency + ConnectionsPerManager - 1) / ConnectionsPerManager;
+    while(managers.count() < needed)
+    {
+        QNetworkAccessManager* manager = new QNetworkAccessManager(this);
+        connect(manager, &QNetworkAccessManager::finished, this, &QDropbox2Thumbnails::slot_networkRequestFinished);
+        managers.append(manager);
+    }
+
+    nextManager = (nextManager + 1) % needed;
+    return managers[nextManager];
+}
+
+//--------------------------------------
+// Batches
+
+QByteArray QDropbox2Thumbnails::batchRequest(const QStringList& paths, Size size, Format format)
+{
+    int chars = 0;
+    foreach(const QString& path, paths)
+        chars += path.size() + 64;
+
+    QDropbox2JsonWriter json(chars);
+    json.beginObject()
+            .beginArray("entries");
+    foreach(const QString& path, paths)
+    {
+        json.beginObject()
+                .value("path", path)
+                .value("format", FormatTags[format])
+                .value("size", SizeTags[size])
+            .endObject();
+    }
+    json.endArray()
+        .endObject();
+
+    return json.data();
+}
+
+bool QDropbox2Thumbnails::startBatch(BatchPtr batch)
+{
+    QUrl url;
+    url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
+    url.setPath("/2/files/get_thumbnail_batch");
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+        return false;
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+
+    QStringList paths;
+    foreach(const Item& item, batch->items)
+        paths.append(item.path);
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Thumbnails: batch" << batch->id << "of" << paths.count() << "thumbnails" << endl;
+#endif
+
+    QNetworkReply* reply = networkAccessManager()->post(req, batchRequest(paths, batch->size, batch->format));
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2Thumbnails::signal_operationAborted, reply, &QNetworkReply::abort);
+
+    inflight[reply] = batch;
+    return true;
+}
+
+void QDropbox2Thumbnails::slot_networkRequestFinished(QNetworkReply* reply)
+{
+    reply->deleteLater();
+
+    BatchPtr batch = inflight.take(reply);
+    if(!batch)
+        return;
+
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        const int error_code = (status == QDROPBOX_V2_ERROR) ? status : int(reply->error());
+        const QString error_message = errorMessage(reply, reply->readAll());
+        foreach(const Item& item, batch->items)
+            fail(item.path, error_code, error_message);
+    }
+    else
+    {
+        // the response carries every thumbnail in base64; decoding it (and
+        // writing the cache) is left to the pool
+        decoding[batch->id] = batch;
+        decoder.start(new QDropbox2ThumbnailTask(this, batch->id, reply->readAll(),
+                                                 batch->valid, batch->results,
+                                                 _cache, batch->size, batch->format));
+    }
+
+    // a slot is free for the next batch
+    requestSchedule();
+}
+
+void QDropbox2Thumbnails::slot_decoded(int id)
+{
+    BatchPtr batch = decoding.take(id);
+    if(!batch)
+        return;
+
+    for(int i = 0;i < batch->items.count();++i)
+    {
+        const QString& path = batch->items[i].path;
+        if(!batch->valid || i >= batch->results.count())
+            fail(path, QDropbox2::APIError, "Dropbox API did not send correct answer for thumbnail data.");
+        else if(batch->results[i].image.isEmpty())
+            fail(path, QDROPBOX_V2_ERROR, batch->results[i].error);
+        else
+            deliver(path, batch->results[i].image);
+    }
+
+    checkFinished();
+}
+
+bool QDropbox2Thumbnails::decodeBatch(const QByteArray& response, QVector<Result>& results)
+{
+    results.clear();
+
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    if(jsonError.error != QJsonParseError::NoError || !json.object().value("entries").isArray())
+        return false;
+
+    QJsonArray entries = json.object().value("entries").toArray();
+    results.resize(entries.count());
+    for(int i = 0;i < entries.count();++i)
+    {
+        QJsonObject entry = entries[i].toObject();
+        Result& result = results[i];
+
+        if(entry.value(".tag").toString() == "success")
+        {
+            QJsonObject metadata = entry.value("metadata").toObject();
+            result.path  = metadata.value("path_display").toString();
+            result.id    = metadata.value("id").toString();
+            result.rev   = metadata.value("rev").toString();
+            result.image = QByteArray::fromBase64(entry.value("thumbnail").toString().toLatin1());
+            if(result.image.isEmpty())
+                result.error = "empty_thumbnail";
+        }
+        else
+            result.error = failureTag(entry.value("failure").toObject());
+    }
+
+    return true;
+}
+
+//--------------------------------------
+// Results
+
+void QDropbox2Thumbnails::deliver(const QString& path, const QByteArray& image)
+{
+    --outstanding;
+    emit signal_thumbnailReady(path, image);
+}
+
+void QDropbox2Thumbnails::fail(const QString& path, int error_code, const QString& error_message)
+{
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Thumbnails: " << path << "failed" << error_code << error_message << endl;
+#endif
+
+    --outstanding;
+    ++failed;
+    emit signal_thumbnailFailed(path, error_code, error_message);
+}
+
+void QDropbox2Thumbnails::checkFinished()
+{
+    if(!running || outstanding)
+        return;
+
+    running = false;
+
+    emit signal_finished(failed == 0);
+    if(eventLoop)
+        eventLoop->exit();
+}
+
+QString QDropbox2Thumbnails::errorMessage(QNetworkReply* reply, const QByteArray& response) const
+{
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    if(jsonError.error == QJsonParseError::NoError)
+    {
+        QJsonObject object = json.object();
+        if(object.contains("user_message"))
+            return object.value("user_message").toString();
+        if(object.contains("error_summary"))
+            return object.value("error_summary").toString();
+    }
+
+    return reply->errorString();
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+
+#include "qdropbox2common.h"
+
+#include "qdropbox2.h"
+#include "qdropbox2folder.h"
+
+class QDropbox2ContentCache;
+
+//! Retrieves thumbnails of many images at once, with a local thumbnail cache
+/*!
+  QDropbox2Thumbnails fetches thumbnails through get_thumbnail_batch, which
+  returns up to 25 thumbnails per request (see BatchSize).  Requested files
+  are grouped into batches, and up to setMaxConcurrency() batches are in
+  flight at a time.
+
+  The thumbnails arrive base64-encoded inside a JSON response.  Each response
+  is parsed, decoded and written to the cache on a worker pool, so a batch of
+  large thumbnails does not hold up the thread that requested them; the
+  results are then delivered through signal_thumbnailReady() on that thread.
+
+  With a cache enabled (see enableCache()), thumbnails are kept on disk under
+  the file id, revision, size and format of the image, so they are never
+  served for a different version of the file.  Files requested with their
+  metadata (e.g., from a folder listing) are answered from the cache without
+  any network traffic; thumbnails of files requested by path alone are
+  cached as they arrive, but always fetched.
+
+  The manager works asynchronously on the thread it lives on;
+  waitForFinished() blocks until every request has been answered.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2Thumbnails : public QObject
+{
+    Q_OBJECT
+
+public:     // typedefs and enums
+    enum Size
+    {
+        W32H32,
+        W64H64,
+        W128H128,
+        W256H256,
+        W480H320,
+        W640H480,
+        W960H640,
+        W1024H768,
+        W2048H1536
+    };
+
+    enum Format
+    {
+        Jpeg,
+        Png
+    };
+
+    enum
+    {
+        //! Thumbnails per request; the most get_thumbnail_batch accepts
+        BatchSize = 25,
+
+        //! Requests in flight, unless set with setMaxConcurrency()
+        DefaultConcurrency = 4,
+
+        //! Cache size, unless given to enableCache()
+        DefaultCacheSize = 64*1024*1024
+    };
+
+    //! A thumbnail decoded from a batch response
+    struct Result
+    {
+        QString     path;       // display path, from the returned metadata
+        QString     id;
+        QString     rev;
+        QByteArray  image;      // empty if the thumbnail failed
+        QString     error;      // the failure reported by the server
+    };
+
+public:
+    /*!
+      Creates a manager without a cache.
+
+      \param api A QDropbox2 that is connected to an user account.
+      \param parent Parent QObject
+     */
+    QDropbox2Thumbnails(QDropbox2* api, QObject* parent = 0);
+
+    /*!
+      Aborts all requests, and waits for responses still being decoded.
+     */
+    ~QDropbox2Thumbnails();
+
+    /*!
+      Sets the size of the thumbnails requested afterwards.  Defaults to W64H64.
+     */
+    void    setSize(Size size)                  { _size = size; }
+    Size    size() const                        { return _size; }
+
+    /*!
+      Sets the image format of the thumbnails requested afterwards.  Defaults
+      to Jpeg; Png is better suited to images with transparency.
+     */
+    void    setFormat(Format format)            { _format = format; }
+    Format  format() const                      { return _format; }
+
+    /*!
+      Sets the largest number of batch requests in flight at a time.
+     */
+    void    setMaxConcurrency(int count);
+    int     maxConcurrency() const              { return _maxConcurrency; }
+
+    /*!
+      Keeps thumbnails in a local directory, replacing any previously enabled
+      cache.  The directory should not be shared with a content cache.
+
+      \param directory Local directory to hold the cached thumbnails.
+      \param max_bytes Upper bound on the total size of the cached thumbnails.
+      \returns <i>true</i> if the cache directory is usable or <i>false</i> if it is not.
+     */
+    bool    enableCache(const QString& directory, qint64 max_bytes = DefaultCacheSize);
+
+    /*!
+      Disables the cache.  Thumbnails already cached are left on disk.
+     */
+    void    disableCache();
+
+    /*!
+      Returns the thumbnail cache, or <i>nullptr</i> if none is enabled.
+     */
+    QDropbox2ContentCache* cache() const        { return _cache.data(); }
+
+    /*!
+      Requests thumbnails of image files by Dropbox path.
+
+      \remark This is an asynchronous call.  Emits signal_thumbnailReady() or
+      signal_thumbnailFailed() for each path, and signal_finished() once every
+      queued request has been answered.
+     */
+    void    request(const QStringList& paths);
+
+    /*!
+      Requests thumbnails of image files from their metadata.  Files whose
+      thumbnail is cached for their current revision are answered from the
+      cache; folders and deleted entries are skipped.
+
+      \remark This is an asynchronous call.  See request(const QStringList&).
+     */
+    void    request(const QDropbox2Folder::ContentsList& files);
+
+    /*!
+      Returns the number of thumbnails requested but not yet delivered.
+     */
+    int     pendingCount() const                { return outstanding; }
+
+    /*!
+      Waits until every queued request has been answered.
+
+      \remark This is a blocking call.
+
+      \returns <i>true</i> if every thumbnail was delivered.
+     */
+    bool    waitForFinished();
+
+    /*!
+      Builds the cache key of a thumbnail.
+     */
+    static QString cacheKey(const QString& id, const QString& rev, Size size, Format format);
+
+    /*!
+      Builds the body of a get_thumbnail_batch request.
+     */
+    static QByteArray batchRequest(const QStringList& paths, Size size, Format format);
+
+    /*!
+      Decodes a get_thumbnail_batch response.  The results are in the order
+      of the request entries.
+
+      \returns <i>false</i> if the response is not valid.
+     */
+    static bool decodeBatch(const QByteArray& response, QVector<Result>& results);
+
+public slots:
+    /*!
+      Drops every queued request, and aborts those in flight.  Their
+      thumbnails are reported through signal_thumbnailFailed().
+     */
+    void    slot_abort();
+
+signals:
+    /*!
+      Emitted when a thumbnail has been retrieved or read from the cache.
+
+      \param path Dropbox path of the file, as requested.
+      \param image The encoded thumbnail, in the requested format.
+     */
+    void    signal_thumbnailReady(const QString& path, const QByteArray& image);
+
+    /*!
+      Emitted when a thumbnail could not be retrieved (e.g., the file is not
+      an image, or is too large to have one).
+     */
+    void    signal_thumbnailFailed(const QString& path, int errorcode, const QString& errormessage);
+
+    /*!
+      Emitted when the last queued request has been answered.
+
+      \param success <i>true</i> if every thumbnail was delivered.
+     */
+    void    signal_finished(bool success);
+
+    /*!
+      Emitted when an in-progress operation is aborted.
+     */
+    void    signal_operationAborted();
+
+private slots:
+    void    slot_schedule();
+    void    slot_networkRequestFinished(QNetworkReply* reply);
+    void    slot_decoded(int batch);
+
+private:        // typedefs and enums
+    struct Item
+    {
+        QString     path;
+        Size        size;
+        Format      format;
+    };
+
+    struct Batch
+    {
+        int             id;
+        Size            size;
+        Format          format;
+        QList<Item>     items;
+
+        // filled in by the decoding task
+        bool            valid;
+        QVector<Result> results;
+    };
+
+    typedef QSharedPointer<Batch> BatchPtr;
+
+private:        // methods
+    void    start();
+    void    enqueue(const QString& path);
+    void    requestSchedule();
+    void    schedule();
+    bool    startBatch(BatchPtr batch);
+    void    deliver(const QString& path, const QByteArray& image);
+    void    fail(const QString& path, int error_code, const QString& error_message);
+    void    checkFinished();
+
+    QNetworkAccessManager* networkAccessManager();
+    QString errorMessage(QNetworkReply* reply, const QByteArray& response) const;
+
+private:        // data members
+    QDropbox2*  _api;
+
+    Size        _size;
+    Format      _format;
+    int         _maxConcurrency;
+
+    // shared with decoding tasks, which may still be storing into it
+    QSharedPointer<QDropbox2ContentCache> _cache;
+
+    QList<QNetworkAccessManager*> managers;
+    int         nextManager;
+
+    QThreadPool decoder;
+
+    QList<Item>                 queued;     // not yet in a batch
+    QList<QPair<QString, QByteArray>> hits; // answered from the cache
+    QHash<QNetworkReply*, BatchPtr> inflight;
+    QHash<int, BatchPtr>        decoding;
+    int         nextBatch;
+    bool        scheduling;
+
+    // set from the first request until the last is answered
+    bool        running;
+    int         outstanding;
+    int         failed;
+
+    QEventLoop* eventLoop;
+};
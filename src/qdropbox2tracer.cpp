@@ -0,0 +1,150 @@
+#include <QCoreApplication>
+#include <QSaveFile>
+#include <QThread>
+
+#include "qdropbox2tracer.h"
+#include "qdropbox2json.h"
+
+QDropbox2Tracer::QDropbox2Tracer(int max_events)
+    : nextId(0),
+      maxEvents(max_events),
+      _dropped(0)
+{
+    clock.start();
+}
+
+quint64 QDropbox2Tracer::begin(const char* name, const QVariantMap& args)
+{
+    quint64 id = static_cast<quint32>(nextId.fetchAndAddRelaxed(1) + 1);
+    record('b', id, name, args);
+    return id;
+}
+
+void QDropbox2Tracer::step(quint64 id, const char* name, const QVariantMap& args)
+{
+    record('b', id, name, args);
+}
+
+void QDropbox2Tracer::end(quint64 id, const char* name, const QVariantMap& args)
+{
+    record('e', id, name, args);
+}
+
+void QDropbox2Tracer::instant(quint64 id, const char* name, const QVariantMap& args)
+{
+    record('n', id, name, args);
+}
+
+void QDropbox2Tracer::record(char phase, quint64 id, const char* name, const QVariantMap& args)
+{
+    Event event;
+    event.phase     = phase;
+    event.name      = name;
+    event.id        = id;
+    event.timestamp = clock.nsecsElapsed() / 1000;
+    event.thread    = reinterpret_cast<quintptr>(QThread::currentThreadId());
+    event.args      = args;
+
+    QMutexLocker locker(&mutex);
+    if(events.count() >= maxEvents)
+    {
+        ++_dropped;
+        return;
+    }
+    events.append(event);
+}
+
+int QDropbox2Tracer::count() const
+{
+    QMutexLocker locker(&mutex);
+    return events.count();
+}
+
+int QDropbox2Tracer::dropped() const
+{
+    QMutexLocker locker(&mutex);
+    return _dropped;
+}
+
+void QDropbox2Tracer::clear()
+{
+    QMutexLocker locker(&mutex);
+    events.clear();
+    _dropped = 0;
+}
+
+QByteArray QDropbox2Tracer::toChromeTrace() const
+{
+    QVector<Event> snapshot;
+    {
+        QMutexLocker locker(&mutex);
+        snapshot = events;
+    }
+
+    const qint64 pid = QCoreApplication::applicationPid();
+
+    QDropbox2JsonWriter json(snapshot.count() * 32);
+    json.beginObject()
+            .value("displayTimeUnit", "ms")
+            .beginArray("traceEvents");
+
+    foreach(const Event& event, snapshot)
+    {
+        const char phase[2] = { event.phase, '\0' };
+
+        // async events of one operation share a category and id, so the
+        // viewer nests its steps beneath it
+        json.beginObject()
+                .value("name", event.name)
+                .value("cat", "qdropbox2")
+                .value("ph", phase)
+                .value("id", QString("0x%1").arg(event.id, 0, 16))
+                .value("ts", event.timestamp)
+                .value("pid", pid)
+                .value("tid", event.thread);
+
+        if(!event.args.isEmpty())
+        {
+            json.beginObject("args");
+            for(QVariantMap::const_iterator iter = event.args.constBegin();iter != event.args.constEnd();++iter)
+            {
+                const QByteArray key = iter.key().toUtf8();
+                switch(static_cast<int>(iter->type()))
+                {
+                    case QMetaType::Bool:
+                        json.value(key.constData(), iter->toBool());
+                        break;
+                    case QMetaType::Int:
+                    case QMetaType::LongLong:
+                        json.value(key.constData(), iter->toLongLong());
+                        break;
+                    case QMetaType::UInt:
+                    case QMetaType::ULongLong:
+                        json.value(key.constData(), iter->toULongLong());
+                        break;
+                    default:
+                        json.value(key.constData(), iter->toString());
+                        break;
+                }
+            }
+            json.endObject();
+        }
+
+        json.endObject();
+    }
+
+    json.endArray()
+        .endObject();
+
+    return json.data();
+}
+
+bool QDropbox2Tracer::save(const QString& filename) const
+{
+    QSaveFile file(filename);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    file.write(toChromeTrace());
+    return file.commit();
+}
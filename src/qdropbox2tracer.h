@@ -0,0 +1,116 @@
+#pragma once
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QVariantMap>
+#include <QtCore/QVector>
+
+#include "qdropbox2global.h"
+
+//! Records the lifecycle of library operations as trace events
+/*!
+  QDropbox2Tracer records begin and end events for the logical operations the
+  library performs (e.g., a file upload, each chunk of an upload session, each
+  page of a folder listing, or a longpoll), so that a run can be examined on a
+  timeline.
+
+  Every operation is given a correlation id by begin(); the steps that make up
+  the operation are recorded with step() and end() using that same id, and are
+  shown nested beneath it.  The events can be exported in the Chrome
+  trace-event format with toChromeTrace() or save(), and loaded into
+  chrome://tracing or Perfetto.
+
+  Event names must be string literals (or otherwise outlive the tracer); they
+  are stored by pointer to keep recording cheap.
+
+  Instances are created and owned by QDropbox2 (see QDropbox2::enableTracing()).
+  All methods are thread-safe.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2Tracer
+{
+public:
+    /*!
+      Creates an empty tracer.
+
+      \param max_events Number of events kept; further events are counted by
+                        dropped() and discarded.
+     */
+    explicit QDropbox2Tracer(int max_events = 1000000);
+
+    /*!
+      Begins a new operation.
+
+      \param name Name of the operation, e.g., "putFile".
+      \param args Values shown with the event.
+      \returns The correlation id of the operation.
+     */
+    quint64 begin(const char* name, const QVariantMap& args = QVariantMap());
+
+    /*!
+      Begins a step of the operation with the given id.  Steps are ended with
+      end(), and may themselves have steps.
+     */
+    void    step(quint64 id, const char* name, const QVariantMap& args = QVariantMap());
+
+    /*!
+      Ends the most recently begun, and not yet ended, operation or step with
+      the given id.
+     */
+    void    end(quint64 id, const char* name, const QVariantMap& args = QVariantMap());
+
+    /*!
+      Records a point in time within the operation with the given id.
+     */
+    void    instant(quint64 id, const char* name, const QVariantMap& args = QVariantMap());
+
+    /*!
+      Returns the number of events recorded.
+     */
+    int     count() const;
+
+    /*!
+      Returns the number of events discarded because the tracer was full.
+     */
+    int     dropped() const;
+
+    /*!
+      Discards all recorded events.
+     */
+    void    clear();
+
+    /*!
+      Returns the recorded events as a Chrome trace-event JSON document.
+     */
+    QByteArray toChromeTrace() const;
+
+    /*!
+      Writes the recorded events as a Chrome trace-event JSON file.
+
+      \returns <i>true</i> if the file was written.
+     */
+    bool    save(const QString& filename) const;
+
+private:
+    struct Event
+    {
+        char        phase;          // 'b', 'e' or 'n'
+        const char* name;
+        quint64     id;
+        qint64      timestamp;      // usecs since the tracer was created
+        quint64     thread;
+        QVariantMap args;
+    };
+
+    void    record(char phase, quint64 id, const char* name, const QVariantMap& args);
+
+    mutable QMutex  mutex;
+
+    QElapsedTimer   clock;
+    QAtomicInt      nextId;
+
+    int             maxEvents;
+    int             _dropped;
+    QVector<Event>  events;
+};
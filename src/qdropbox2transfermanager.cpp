@@ -0,0 +1,635 @@
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef QTDROPBOX_DEBUG
+#include <QDebug>
+#endif
+
+#include "qdropbox2transfermanager.h"
+#include "qdropbox2contentcache.h"
+#include "qdropbox2json.h"
+#include "qdropbox2metadatacache.h"
+#include "qdropbox2linkcache.h"
+#include "qdropbox2upload.h"
+
+namespace
+{
+    // Qt opens no more than this many connections to a host per manager
+    const int ConnectionsPerManager = 6;
+}
+
+QDropbox2TransferManager::QDropbox2TransferManager(QDropbox2* api, QObject* parent)
+    : QObject(parent),
+      _api(api),
+      _maxConcurrency(DefaultConcurrency),
+      _memoryBudget(DefaultMemoryBudget),
+      _largeFileSize(DefaultLargeFileSize),
+      overwrite_(true),
+      rename_(false),
+      nextId(0),
+      nextSequence(0),
+      scheduling(false),
+      activeLarge(0),
+      reserved(0),
+      totalBytes(0),
+      finishedBytes(0),
+      succeeded(0),
+      failed(0),
+      eventLoop(nullptr)
+{
+}
+
+QDropbox2TransferManager::~QDropbox2TransferManager()
+{
+    // abandon whatever is in flight; nobody is waiting for the outcome.
+    // upload pipelines and partial downloads are our children, and are
+    // aborted and discarded as they are deleted
+    foreach(JobPtr job, active)
+    {
+        if(job->reply)
+        {
+            replies.remove(job->reply);
+            job->reply->abort();
+        }
+    }
+}
+
+void QDropbox2TransferManager::setMaxConcurrency(int count)
+{
+    _maxConcurrency = qMax(1, count);
+    requestSchedule();
+}
+
+int QDropbox2TransferManager::download(const QString& remote_path, const QString& local_file, int priority, qint64 size)
+{
+    JobPtr job(new Job);
+    job->direction  = Download;
+    job->priority   = priority;
+    job->remotePath = remote_path;
+    job->localFile  = local_file;
+    job->size       = size;
+
+    return enqueue(job);
+}
+
+int QDropbox2TransferManager::upload(const QString& local_file, const QString& remote_path, int priority, const QString& rev)
+{
+    QFileInfo info(local_file);
+    if(!info.isFile())
+        return 0;
+
+    JobPtr job(new Job);
+    job->direction  = Upload;
+    job->priority   = priority;
+    job->remotePath = remote_path;
+    job->localFile  = local_file;
+    job->rev        = rev;
+    job->overwrite  = overwrite_;
+    job->rename     = rename_ || !rev.isEmpty();
+    job->size       = info.size();
+
+    return enqueue(job);
+}
+
+int QDropbox2TransferManager::enqueue(JobPtr job)
+{
+    // the counters cover the jobs since the queue was last empty
+    if(jobs.isEmpty())
+    {
+        totalBytes = finishedBytes = 0;
+        succeeded = failed = 0;
+    }
+
+    job->id         = ++nextId;
+    job->sequence   = nextSequence++;
+    job->done       = 0;
+    job->memory     = 0;
+    job->large      = job->size > _largeFileSize;
+    job->reply      = nullptr;
+    job->output     = nullptr;
+    job->pipeline   = nullptr;
+    job->trace      = 0;
+    job->errorCode  = 0;
+
+    if(job->size > 0)
+        totalBytes += job->size;
+
+    jobs[job->id] = job;
+    pending[job->large][QueueKey(-job->priority, job->sequence)] = job;
+
+    // jobs are usually queued in bulk; decide what to start once the
+    // caller is done
+    requestSchedule();
+
+    return job->id;
+}
+
+bool QDropbox2TransferManager::setPriority(int id, int priority)
+{
+    JobPtr job = jobs.value(id);
+    if(!job || active.contains(id))
+        return false;
+
+    pending[job->large].remove(QueueKey(-job->priority, job->sequence));
+    job->priority = priority;
+    pending[job->large][QueueKey(-job->priority, job->sequence)] = job;
+
+    return true;
+}
+
+bool QDropbox2TransferManager::cancel(int id)
+{
+    JobPtr job = jobs.value(id);
+    if(!job)
+        return false;
+
+    job->errorCode = QNetworkReply::OperationCanceledError;
+    job->errorMessage = "The transfer was cancelled.";
+
+    if(!active.contains(id))
+    {
+        pending[job->large].remove(QueueKey(-job->priority, job->sequence));
+        complete(job, job->errorCode, job->errorMessage);
+    }
+    else if(job->reply)
+        job->reply->abort();            // finishes the job through slot_networkRequestFinished()
+    else if(job->pipeline)
+        job->pipeline->slot_abort();    // finishes the job through slot_uploadFinished()
+
+    return true;
+}
+
+void QDropbox2TransferManager::slot_abort()
+{
+    for(int i = 0;i < 2;++i)
+    {
+        while(!pending[i].isEmpty())
+        {
+            JobPtr job = pending[i].take(pending[i].firstKey());
+            complete(job, QNetworkReply::OperationCanceledError, "The transfer was cancelled.");
+        }
+    }
+
+    foreach(JobPtr job, active)
+    {
+        job->errorCode = QNetworkReply::OperationCanceledError;
+        job->errorMessage = "The transfer was cancelled.";
+    }
+
+    // replies and upload pipelines are connected to this
+    emit signal_operationAborted();
+}
+
+qint64 QDropbox2TransferManager::bytesDone() const
+{
+    qint64 done = finishedBytes;
+    foreach(const JobPtr& job, active)
+        done += job->done;
+    return done;
+}
+
+bool QDropbox2TransferManager::waitForFinished()
+{
+    if(!eventLoop)
+        eventLoop = new QEventLoop(this);
+    while(!jobs.isEmpty())
+        eventLoop->exec();
+
+    return failed == 0;
+}
+
+//--------------------------------------
+// Scheduling
+
+void QDropbox2TransferManager::requestSchedule()
+{
+    if(scheduling)
+        return;
+
+    scheduling = true;
+    QMetaObject::invokeMethod(this, "slot_schedule", Qt::QueuedConnection);
+}
+
+void QDropbox2TransferManager::slot_schedule()
+{
+    scheduling = false;
+    schedule();
+}
+
+void QDropbox2TransferManager::schedule()
+{
+    while(active.count() < _maxConcurrency)
+    {
+        JobPtr job = takeNext();
+        if(!job)
+            break;
+
+        job->memory = reservation(*job);
+        reserved += job->memory;
+        if(job->large)
+            ++activeLarge;
+        active[job->id] = job;
+
+        job->trace = _api->traceBegin("transfer", {{"path", job->remotePath},
+                                                   {"direction", job->direction == Download ? "download" : "upload"}});
+
+        if(!startJob(job))
+        {
+            if(!job->errorCode)
+                job->errorCode = QDropbox2::APIError;
+            if(job->errorMessage.isEmpty())
+                job->errorMessage = "Could not create the transfer request.";
+            complete(job, job->errorCode, job->errorMessage);
+        }
+    }
+}
+
+QDropbox2TransferManager::JobPtr QDropbox2TransferManager::takeNext()
+{
+    const bool have_small = !pending[0].isEmpty();
+    const bool have_large = !pending[1].isEmpty();
+    if(!have_small && !have_large)
+        return JobPtr();
+
+    int first;
+    if(!have_large)
+        first = 0;
+    else if(!have_small)
+        first = 1;
+    else if(pending[0].firstKey().first != pending[1].firstKey().first)
+        first = pending[0].firstKey().first < pending[1].firstKey().first ? 0 : 1;   // higher priority
+    else
+        first = (activeLarge < active.count() - activeLarge) ? 1 : 0;                // fewer slots
+
+    // if the preferred job does not fit in the memory budget, the other kind
+    // may; otherwise wait for memory to be released
+    for(int i = 0;i < 2;++i)
+    {
+        const int kind = (i == 0) ? first : 1 - first;
+        if(pending[kind].isEmpty())
+            continue;
+
+        const JobPtr& job = pending[kind].first();
+        if(active.isEmpty() || reserved + reservation(*job) <= _memoryBudget)
+            return pending[kind].take(pending[kind].firstKey());
+    }
+
+    return JobPtr();
+}
+
+qint64 QDropbox2TransferManager::reservation(const Job& job) const
+{
+    // an upload pipeline holds a chunk in each stage, and one in each of its
+    // two queues (see QDropbox2Upload::setQueueDepth())
+    if(job.direction == Upload && job.size > MaxSingleUpload)
+        return 5 * qint64(LargeUploadChunkSize);
+    return StreamBufferSize;
+}
+
+QDropbox2TransferManager::JobPtr QDropbox2TransferManager::findJob(QObject* source) const
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(source);
+    if(reply && replies.contains(reply))
+        return active.value(replies.value(reply));
+
+    foreach(const JobPtr& job, active)
+    {
+        if(job->pipeline == source)
+            return job;
+    }
+
+    return JobPtr();
+}
+
+QNetworkAccessManager* QDropbox2TransferManager::networkAccessManager()
+{
+    const int needed = (_maxConcurrency + ConnectionsPerManager - 1) / ConnectionsPerManager;
+    while(managers.count() < needed)
+    {
+        QNetworkAccessManager* manager = new QNetworkAccessManager(this);
+        connect(manager, &QNetworkAccessManager::finished, this, &QDropbox2TransferManager::slot_networkRequestFinished);
+        managers.append(manager);
+        managerLoad.append(0);
+    }
+
+    int least = 0;
+    for(int i = 1;i < managers.count();++i)
+    {
+        if(managerLoad[i] < managerLoad[least])
+            least = i;
+    }
+
+    ++managerLoad[least];
+    return managers[least];
+}
+
+//--------------------------------------
+// Transfers
+
+bool QDropbox2TransferManager::startJob(JobPtr job)
+{
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2TransferManager::startJob " << job->id << job->remotePath << job->localFile << endl;
+#endif
+
+    return (job->direction == Download) ? startDownload(job) : startUpload(job);
+}
+
+bool QDropbox2TransferManager::startDownload(JobPtr job)
+{
+    QUrl url;
+    url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
+    url.setPath("/2/files/download");
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+        return false;
+
+    QDropbox2JsonWriter json(job->remotePath.size(), QDropbox2JsonWriter::AsciiSafe);
+    json.beginObject()
+            .value("path", job->remotePath)
+        .endObject();
+    req.setRawHeader("Dropbox-API-arg", json.data());
+
+    // written beside the local file, and only moved over it once complete
+    job->output = new QSaveFile(job->localFile, this);
+    if(!job->output->open(QIODevice::WriteOnly))
+    {
+        job->errorMessage = job->output->errorString();
+        return false;
+    }
+
+    QNetworkReply* reply = networkAccessManager()->get(req);
+
+    // bounds the memory of a download; the rest waits in the socket
+    reply->setReadBufferSize(StreamBufferSize);
+
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2TransferManager::signal_operationAborted, reply, &QNetworkReply::abort);
+    connect(reply, &QNetworkReply::readyRead, this, &QDropbox2TransferManager::slot_readyRead);
+    connect(reply, &QNetworkReply::downloadProgress, this, &QDropbox2TransferManager::slot_downloadProgress);
+
+    job->reply = reply;
+    replies[reply] = job->id;
+    return true;
+}
+
+bool QDropbox2TransferManager::startUpload(JobPtr job)
+{
+    if(job->size > MaxSingleUpload)
+    {
+        QDropbox2Upload* pipeline = new QDropbox2Upload(job->localFile, job->remotePath, _api, this);
+        pipeline->setOverwrite(job->overwrite);
+        pipeline->setRenaming(job->rename);
+        pipeline->setRevision(job->rev);
+        pipeline->setChunkSize(LargeUploadChunkSize);
+        pipeline->setQueueDepth(1);
+
+        connect(this, &QDropbox2TransferManager::signal_operationAborted, pipeline, &QDropbox2Upload::slot_abort);
+        connect(pipeline, &QDropbox2Upload::signal_uploadProgress, this, &QDropbox2TransferManager::slot_uploadProgress);
+        connect(pipeline, &QDropbox2Upload::signal_finished, this, &QDropbox2TransferManager::slot_uploadFinished);
+
+        job->pipeline = pipeline;
+        if(!pipeline->start())
+        {
+            job->errorCode = pipeline->error();
+            job->errorMessage = pipeline->errorString();
+            return false;
+        }
+        return true;
+    }
+
+    QUrl url;
+    url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
+    url.setPath("/2/files/upload");
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+        return false;
+
+    QFile* file = new QFile(job->localFile);
+    if(!file->open(QIODevice::ReadOnly))
+    {
+        job->errorMessage = file->errorString();
+        delete file;
+        return false;
+    }
+
+    QDropbox2JsonWriter json(job->remotePath.size() + job->rev.size(), QDropbox2JsonWriter::AsciiSafe);
+    json.beginObject()
+            .value("path", job->remotePath);
+
+    if(job->rev.isEmpty())
+        json.value("mode", job->overwrite ? "overwrite" : "add");
+    else
+        json.beginObject("mode")
+                .value(".tag", "update")
+                .value("update", job->rev)
+            .endObject();
+
+    json.value("autorename", job->rename)
+            .value("mute", true)
+        .endObject();
+
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
+    req.setHeader(QNetworkRequest::ContentLengthHeader, file->size());
+    req.setRawHeader("Dropbox-API-arg", json.data());
+
+    // the content is streamed from disk; the reply takes ownership of the file
+    QNetworkReply* reply = networkAccessManager()->post(req, file);
+    file->setParent(reply);
+
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2TransferManager::signal_operationAborted, reply, &QNetworkReply::abort);
+    connect(reply, &QNetworkReply::uploadProgress, this, &QDropbox2TransferManager::slot_uploadProgress);
+
+    job->reply = reply;
+    replies[reply] = job->id;
+    return true;
+}
+
+void QDropbox2TransferManager::slot_readyRead()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    JobPtr job = findJob(reply);
+    if(!job || !job->output)
+        return;
+
+    // an error response is left in the reply, to be reported once finished
+    if(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 200)
+        return;
+
+    const QByteArray data = reply->readAll();
+    if(job->output->write(data) != data.size())
+    {
+        job->errorCode = QDropbox2::APIError;
+        job->errorMessage = job->output->errorString();
+        reply->abort();
+    }
+}
+
+void QDropbox2TransferManager::slot_downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+    JobPtr job = findJob(sender());
+    if(!job)
+        return;
+
+    if(job->size < 0 && bytesTotal > 0)
+    {
+        job->size = bytesTotal;
+        totalBytes += bytesTotal;
+    }
+
+    job->done = bytesReceived;
+    emit signal_progress(bytesDone(), totalBytes);
+}
+
+void QDropbox2TransferManager::slot_uploadProgress(qint64 bytesSent, qint64 /*bytesTotal*/)
+{
+    JobPtr job = findJob(sender());
+    if(!job)
+        return;
+
+    job->done = bytesSent;
+    emit signal_progress(bytesDone(), totalBytes);
+}
+
+void QDropbox2TransferManager::slot_networkRequestFinished(QNetworkReply* reply)
+{
+    reply->deleteLater();
+
+    const int index = managers.indexOf(reply->manager());
+    if(index >= 0)
+        --managerLoad[index];
+
+    if(!replies.contains(reply))
+        return;
+
+    JobPtr job = active.value(replies.take(reply));
+    if(!job)
+        return;
+    job->reply = nullptr;
+
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    if(job->errorCode)
+    {
+        // cancelled, or the output could not be written
+    }
+    else if(reply->error() != QNetworkReply::NoError)
+    {
+        job->errorCode = (status == QDROPBOX_V2_ERROR) ? status : int(reply->error());
+        job->errorMessage = errorMessage(reply, reply->readAll());
+    }
+    else if(job->direction == Download)
+    {
+        const QByteArray data = reply->readAll();
+        if(job->output->write(data) != data.size() || !job->output->commit())
+        {
+            job->errorCode = QDropbox2::APIError;
+            job->errorMessage = job->output->errorString();
+        }
+    }
+    else
+    {
+        // changes we make ourselves will also arrive as deltas for watched
+        // folders, but not before the caller may look at the result
+        _api->metadataCache()->invalidate(job->remotePath);
+        _api->linkCache()->invalidate(job->remotePath);
+        if(_api->contentCache())
+            _api->contentCache()->invalidate(job->remotePath);
+    }
+
+    complete(job, job->errorCode, job->errorMessage);
+}
+
+void QDropbox2TransferManager::slot_uploadFinished(bool success)
+{
+    JobPtr job = findJob(sender());
+    if(!job)
+        return;
+
+    if(!success && !job->errorCode)
+    {
+        job->errorCode = job->pipeline->error();
+        job->errorMessage = job->pipeline->errorString();
+    }
+
+    complete(job, job->errorCode, job->errorMessage);
+}
+
+QString QDropbox2TransferManager::errorMessage(QNetworkReply* reply, const QByteArray& response) const
+{
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    if(jsonError.error == QJsonParseError::NoError)
+    {
+        QJsonObject object = json.object();
+        if(object.contains("user_message"))
+            return object.value("user_message").toString();
+        if(object.contains("error_summary"))
+            return object.value("error_summary").toString();
+    }
+
+    return reply->errorString();
+}
+
+void QDropbox2TransferManager::release(JobPtr job)
+{
+    if(!active.remove(job->id))
+        return;
+
+    reserved -= job->memory;
+    if(job->large)
+        --activeLarge;
+
+    if(job->output)
+    {
+        // discards the partial download, unless it was committed
+        job->output->deleteLater();
+        job->output = nullptr;
+    }
+
+    if(job->pipeline)
+    {
+        job->pipeline->deleteLater();
+        job->pipeline = nullptr;
+    }
+}
+
+void QDropbox2TransferManager::complete(JobPtr job, int error_code, const QString& error_message)
+{
+    release(job);
+    jobs.remove(job->id);
+
+    if(error_code == 0)
+    {
+        ++succeeded;
+        finishedBytes += qMax(job->size, job->done);
+    }
+    else
+    {
+        // what a failed job would have transferred is no longer expected
+        ++failed;
+        if(job->size > 0)
+            totalBytes -= job->size;
+    }
+
+    _api->traceEnd(job->trace, "transfer", {{"error", error_code}});
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2TransferManager: job" << job->id << "finished" << error_code << error_message << endl;
+#endif
+
+    emit signal_jobFinished(job->id, error_code, error_message);
+    emit signal_progress(bytesDone(), totalBytes);
+
+    if(jobs.isEmpty())
+    {
+        emit signal_finished(failed == 0);
+        if(eventLoop)
+            eventLoop->exit();
+    }
+    else
+        requestSchedule();
+}
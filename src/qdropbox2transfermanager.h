@@ -0,0 +1,324 @@
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QPair>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+
+#include "qdropbox2common.h"
+
+#include "qdropbox2.h"
+
+class QDropbox2Upload;
+
+//! Runs many uploads and downloads with bounded concurrency and memory
+/*!
+  QDropbox2File and QDropbox2Upload each perform a single transfer.
+  QDropbox2TransferManager queues any number of them, and runs the queue
+  within limits on the number of transfers in flight (see
+  setMaxConcurrency()) and on the memory they may hold (see
+  setMemoryBudget()).
+
+  Downloads are written to the local file as they arrive, and only hold the
+  network read buffer in memory; they replace the local file once complete.
+  Uploads of files that fit in a single request are streamed from disk.
+  Larger uploads go through a QDropbox2Upload with a fixed chunk size, and
+  reserve the memory its pipeline may hold.
+
+  \li Jobs of higher priority are started first; within a priority, jobs
+      start in the order they were queued.
+  \li Small and large files are scheduled fairly: while both are waiting,
+      each of the two kinds gets at least half of the transfer slots, so
+      a batch of large files does not hold up the small ones queued behind
+      it, nor the other way around.  A file is large if it is bigger than
+      setLargeFileSize().
+  \li signal_progress() reports progress over all jobs, and
+      signal_jobFinished() the outcome of each.
+  \li cancel() drops a single job, and slot_abort() all of them, in the same
+      manner as QDropbox2File::slot_abort().
+
+  Because Qt opens at most six connections to a host per
+  QNetworkAccessManager, the manager uses as many of them as the
+  concurrency limit requires.
+
+  The manager works asynchronously on the thread it lives on;
+  waitForFinished() blocks until the queue has drained.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2TransferManager : public QObject
+{
+    Q_OBJECT
+
+public:     // typedefs and enums
+    enum Direction
+    {
+        Download,
+        Upload
+    };
+
+    enum
+    {
+        //! Transfers in flight, unless set with setMaxConcurrency()
+        DefaultConcurrency = 16,
+
+        //! Memory budget, unless set with setMemoryBudget()
+        DefaultMemoryBudget = 200*1024*1024,
+
+        //! Size above which a file is scheduled as a large file
+        DefaultLargeFileSize = 8*1024*1024,
+
+        //! Memory reserved by a transfer streamed to or from disk
+        StreamBufferSize = 256*1024,
+
+        //! Chunk size of uploads too large for a single request
+        LargeUploadChunkSize = 8*1024*1024
+    };
+
+public:
+    /*!
+      Creates an empty manager.
+
+      \param api A QDropbox2 that is connected to an user account.
+      \param parent Parent QObject
+     */
+    QDropbox2TransferManager(QDropbox2* api, QObject* parent = 0);
+
+    /*!
+      Aborts all jobs.
+     */
+    ~QDropbox2TransferManager();
+
+    /*!
+      Sets the largest number of transfers in flight at a time.
+     */
+    void    setMaxConcurrency(int count);
+    int     maxConcurrency() const              { return _maxConcurrency; }
+
+    /*!
+      Limits the memory that transfers in flight may hold.  A job whose
+      reservation does not fit waits until enough other jobs have finished,
+      unless no job is in flight at all.
+     */
+    void    setMemoryBudget(qint64 bytes)       { _memoryBudget = bytes; requestSchedule(); }
+    qint64  memoryBudget() const                { return _memoryBudget; }
+
+    /*!
+      Sets the size above which a file is scheduled as a large file.
+     */
+    void    setLargeFileSize(qint64 bytes)      { _largeFileSize = bytes; }
+    qint64  largeFileSize() const               { return _largeFileSize; }
+
+    /*!
+      See QDropbox2File::setOverwrite().  Applies to uploads queued afterwards.
+     */
+    void    setOverwrite(bool overwrite = true) { overwrite_ = overwrite; }
+    bool    overwrite() const                   { return overwrite_; }
+
+    /*!
+      See QDropbox2File::setRenaming().  Applies to uploads queued afterwards.
+     */
+    void    setRenaming(bool rename = true)     { rename_ = rename; }
+    bool    renaming() const                    { return rename_; }
+
+    /*!
+      Queues the download of a Dropbox file to a local file.
+
+      \param remote_path Dropbox path of the file.
+      \param local_file Local file to write; replaced once the download completes.
+      \param priority Jobs of higher priority start first.
+      \param size Size of the file, if known (e.g., from a folder listing); used
+                  to schedule it as a small or large file, and in the progress.
+      \returns The id of the job.
+     */
+    int     download(const QString& remote_path, const QString& local_file, int priority = 0, qint64 size = -1);
+
+    /*!
+      Queues the upload of a local file to Dropbox.
+
+      \param local_file Local file to read.
+      \param remote_path Dropbox path to upload to.
+      \param priority Jobs of higher priority start first.
+      \param rev If given, the upload only replaces this revision of the file; if
+                 the file has changed since, Dropbox keeps both, renaming the
+                 upload (see QDropbox2Upload::setRevision()).
+      \returns The id of the job, or zero if the local file does not exist.
+     */
+    int     upload(const QString& local_file, const QString& remote_path, int priority = 0, const QString& rev = QString());
+
+    /*!
+      Cancels a queued or running job.  A cancelled job is reported through
+      signal_jobFinished() like one that failed.
+
+      \returns <i>true</i> if the job was queued or running.
+     */
+    bool    cancel(int id);
+
+    /*!
+      Changes the priority of a job that has not started yet.
+     */
+    bool    setPriority(int id, int priority);
+
+    /*!
+      Returns the number of jobs waiting to start.
+     */
+    int     pendingCount() const                { return pending[0].count() + pending[1].count(); }
+
+    /*!
+      Returns the number of jobs in flight.
+     */
+    int     activeCount() const                 { return active.count(); }
+
+    /*!
+      Returns the memory reserved by the jobs in flight.
+     */
+    qint64  memoryInUse() const                 { return reserved; }
+
+    /*!
+      Returns the bytes transferred so far by all jobs, and the total expected.
+      Jobs of unknown size count towards the total once their size is known.
+     */
+    qint64  bytesDone() const;
+    qint64  bytesTotal() const                  { return totalBytes; }
+
+    /*!
+      Returns the number of jobs that completed successfully, and that failed
+      or were cancelled, since the queue was last empty.
+     */
+    int     succeededCount() const              { return succeeded; }
+    int     failedCount() const                 { return failed; }
+
+    /*!
+      Waits until all queued jobs have finished.
+
+      \remark This is a blocking call.
+
+      \returns <i>true</i> if every job succeeded.
+     */
+    bool    waitForFinished();
+
+public slots:
+    /*!
+      Cancels every queued and running job.
+     */
+    void    slot_abort();
+
+signals:
+    /*!
+      Emitted as bytes are transferred by any job.
+
+      \param bytesDone The amount of data transferred so far by all jobs.
+      \param bytesTotal Total expected over all jobs.
+     */
+    void    signal_progress(qint64 bytesDone, qint64 bytesTotal);
+
+    /*!
+      Emitted when a job has completed, failed or been cancelled.
+
+      \param id The id of the job.
+      \param errorcode Zero on success, or the error that occurred.
+      \param errormessage A text string version of the error, if available.
+     */
+    void    signal_jobFinished(int id, int errorcode, const QString& errormessage);
+
+    /*!
+      Emitted when the last queued job has finished.
+
+      \param success <i>true</i> if every job succeeded.
+     */
+    void    signal_finished(bool success);
+
+    /*!
+      Emitted when an in-progress operation is aborted.
+     */
+    void    signal_operationAborted();
+
+private slots:
+    void    slot_schedule();
+    void    slot_readyRead();
+    void    slot_downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void    slot_uploadProgress(qint64 bytesSent, qint64 bytesTotal);
+    void    slot_networkRequestFinished(QNetworkReply* reply);
+    void    slot_uploadFinished(bool success);
+
+private:        // typedefs and enums
+    struct Job
+    {
+        int         id;
+        Direction   direction;
+        int         priority;
+        quint64     sequence;       // order queued, within a priority
+        QString     remotePath;
+        QString     localFile;
+        QString     rev;            // uploads; the revision replaced
+        bool        overwrite;
+        bool        rename;
+        qint64      size;           // -1 until known
+        qint64      done;
+        qint64      memory;         // reserved while in flight
+        bool        large;
+
+        QNetworkReply*      reply;
+        QSaveFile*          output;     // downloads
+        QDropbox2Upload*    pipeline;   // large uploads
+        quint64             trace;
+
+        // set when the job is cancelled, or its output cannot be written
+        int                 errorCode;
+        QString             errorMessage;
+    };
+
+    typedef QSharedPointer<Job> JobPtr;
+
+    // orders pending jobs by priority, then by the order they were queued
+    typedef QPair<int, quint64> QueueKey;
+
+private:        // methods
+    int     enqueue(JobPtr job);
+    void    requestSchedule();
+    void    schedule();
+    JobPtr  takeNext();
+    JobPtr  findJob(QObject* source) const;
+    bool    startJob(JobPtr job);
+    bool    startDownload(JobPtr job);
+    bool    startUpload(JobPtr job);
+    void    complete(JobPtr job, int error_code, const QString& error_message);
+    void    release(JobPtr job);
+
+    QNetworkAccessManager* networkAccessManager();
+    QString errorMessage(QNetworkReply* reply, const QByteArray& response) const;
+    qint64  reservation(const Job& job) const;
+
+private:        // data members
+    QDropbox2*  _api;
+
+    int         _maxConcurrency;
+    qint64      _memoryBudget;
+    qint64      _largeFileSize;
+    bool        overwrite_;
+    bool        rename_;
+
+    // enough managers to open _maxConcurrency connections, and the number
+    // of requests in flight on each
+    QList<QNetworkAccessManager*> managers;
+    QVector<int> managerLoad;
+
+    int         nextId;
+    quint64     nextSequence;
+    bool        scheduling;
+
+    QMap<QueueKey, JobPtr>      pending[2];     // small files, large files
+    QHash<int, JobPtr>          jobs;           // pending and active, by id
+    QMap<int, JobPtr>           active;
+    QHash<QNetworkReply*, int>  replies;
+    int         activeLarge;
+
+    qint64      reserved;
+    qint64      totalBytes;
+    qint64      finishedBytes;      // transferred by jobs no longer active
+    int         succeeded;
+    int         failed;
+
+    QEventLoop* eventLoop;
+};
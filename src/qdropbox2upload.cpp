@@ -0,0 +1,853 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QQueue>
+#include <QRunnable>
+#include <QWaitCondition>
+
+#ifdef QTDROPBOX_DEBUG
+#include <QDebug>
+#endif
+
+#include "qdropbox2upload.h"
+#include "qdropbox2contentcache.h"
+#include "qdropbox2json.h"
+#include "qdropbox2metadatacache.h"
+#include "qdropbox2linkcache.h"
+#include "qdropbox2metrics.h"
+
+//--------------------------------------
+// QDropbox2ContentHasher
+
+QDropbox2ContentHasher::QDropbox2ContentHasher()
+    : overall(QCryptographicHash::Sha256),
+      block(QCryptographicHash::Sha256),
+      inBlock(0)
+{
+}
+
+void QDropbox2ContentHasher::addData(const char* data, qint64 len)
+{
+    while(len > 0)
+    {
+        const qint64 n = qMin(len, qint64(BlockSize) - inBlock);
+        block.addData(data, int(n));
+        inBlock += n;
+        data += n;
+        len -= n;
+
+        if(inBlock == BlockSize)
+        {
+            overall.addData(block.result());
+            block.reset();
+            inBlock = 0;
+        }
+    }
+}
+
+QString QDropbox2ContentHasher::result()
+{
+    // a partial last block counts as a block of its own; empty content
+    // hashes no blocks at all
+    if(inBlock)
+    {
+        overall.addData(block.result());
+        block.reset();
+        inBlock = 0;
+    }
+
+    return QString::fromLatin1(overall.result().toHex());
+}
+
+void QDropbox2ContentHasher::reset()
+{
+    overall.reset();
+    block.reset();
+    inBlock = 0;
+}
+
+QString QDropbox2ContentHasher::hash(QIODevice* device)
+{
+    QDropbox2ContentHasher hasher;
+    QByteArray data(BlockSize, Qt::Uninitialized);
+
+    forever
+    {
+        const qint64 n = device->read(data.data(), data.size());
+        if(n < 0)
+            return QString();
+        if(n == 0)
+            break;
+        hasher.addData(data.constData(), n);
+    }
+
+    return hasher.result();
+}
+
+//--------------------------------------
+// QDropbox2Upload pipeline
+
+namespace
+{
+    // a queue of limited capacity between two stages; the stage feeding it
+    // waits while it is full, the stage draining it while it is empty
+    template<typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(int capacity)
+            : capacity(capacity),
+              aborted(false)
+        {}
+
+        // 'stalled' accumulates the msecs spent waiting for room
+        bool push(const T& item, qint64& stalled)
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            QMutexLocker locker(&mutex);
+            while(!aborted && items.count() >= capacity)
+                notFull.wait(&mutex);
+            stalled += timer.elapsed();
+
+            if(aborted)
+                return false;
+
+            items.enqueue(item);
+            notEmpty.wakeOne();
+            return true;
+        }
+
+        // 'stalled' accumulates the msecs spent waiting for an item
+        bool pop(T& item, qint64& stalled)
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            QMutexLocker locker(&mutex);
+            while(!aborted && items.isEmpty())
+                notEmpty.wait(&mutex);
+            stalled += timer.elapsed();
+
+            if(aborted)
+                return false;
+
+            item = items.dequeue();
+            notFull.wakeOne();
+            return true;
+        }
+
+        // for a consumer that must not block (i.e., one on an event loop)
+        bool tryPop(T& item)
+        {
+            QMutexLocker locker(&mutex);
+            if(aborted || items.isEmpty())
+                return false;
+
+            item = items.dequeue();
+            notFull.wakeOne();
+            return true;
+        }
+
+        // releases everything waiting on the queue; further calls fail
+        void abort()
+        {
+            QMutexLocker locker(&mutex);
+            aborted = true;
+            items.clear();
+            notFull.wakeAll();
+            notEmpty.wakeAll();
+        }
+
+    private:
+        QMutex          mutex;
+        QWaitCondition  notFull;
+        QWaitCondition  notEmpty;
+        QQueue<T>       items;
+        int             capacity;
+        bool            aborted;
+    };
+}
+
+struct QDropbox2Upload::Chunk
+{
+    qint64      offset;
+    QByteArray  data;
+    bool        last;
+};
+
+typedef QSharedPointer<QDropbox2Upload::Chunk> ChunkPtr;
+
+// state shared by the owning QDropbox2Upload and its stage threads; it
+// outlives whichever of them finishes last
+struct QDropbox2Upload::Pipeline
+{
+    explicit Pipeline(int depth)
+        : toHash(depth),
+          toSend(depth)
+    {}
+
+    void abort()
+    {
+        toHash.abort();
+        toSend.abort();
+    }
+
+    void record(QDropbox2Upload::Stage stage, qint64 busy, qint64 stalled, qint64 bytes)
+    {
+        QMutexLocker locker(&mutex);
+        stats[stage].busy += busy;
+        stats[stage].stalled += stalled;
+        stats[stage].bytes += bytes;
+        ++stats[stage].chunks;
+    }
+
+    BoundedQueue<ChunkPtr>  toHash;
+    BoundedQueue<ChunkPtr>  toSend;
+
+    mutable QMutex          mutex;
+    StageStats              stats[Send];    // Read and Hash; Send is kept by the owner
+    QString                 contentHash;
+};
+
+namespace
+{
+    typedef QSharedPointer<QDropbox2Upload::Pipeline> PipelinePtr;
+
+    // reads the local file in chunks
+    class ReadStage : public QRunnable
+    {
+    public:
+        ReadStage(PipelinePtr pipeline, QObject* owner, const QString& filename, qint64 total,
+                  qint64 chunk_size, QSharedPointer<QDropbox2ChunkController> controller)
+            : pipeline(pipeline),
+              owner(owner),
+              filename(filename),
+              total(total),
+              chunkSize(chunk_size),
+              controller(controller)
+        {}
+
+        void run() override
+        {
+            QFile file(filename);
+            if(!file.open(QIODevice::ReadOnly))
+            {
+                failed(file.errorString());
+                return;
+            }
+
+            qint64 offset = 0;
+            forever
+            {
+                QElapsedTimer timer;
+                timer.start();
+
+                // the size is decided as each chunk is read, from what has
+                // been learned about the chunks sent so far
+                const qint64 len = qMin(controller ? controller->chunkSize() : chunkSize, total - offset);
+
+                ChunkPtr chunk(new QDropbox2Upload::Chunk);
+                chunk->offset = offset;
+                chunk->data   = file.read(len);
+                chunk->last   = (offset + len == total);
+
+                if(chunk->data.size() != len)
+                {
+                    failed(file.error() != QFileDevice::NoError ? file.errorString()
+                                                               : QString("%1 changed while it was being uploaded.").arg(filename));
+                    return;
+                }
+
+                const qint64 busy = timer.elapsed();
+                qint64 stalled = 0;
+                const bool pushed = pipeline->toHash.push(chunk, stalled);
+                pipeline->record(QDropbox2Upload::Read, busy, stalled, len);
+
+                if(!pushed || chunk->last)
+                    return;
+                offset += len;
+            }
+        }
+
+    private:
+        void failed(const QString& message)
+        {
+            pipeline->abort();
+            QMetaObject::invokeMethod(owner, "slot_stageFailed", Qt::QueuedConnection, Q_ARG(QString, message));
+        }
+
+        PipelinePtr pipeline;
+        QObject*    owner;
+        QString     filename;
+        qint64      total;
+        qint64      chunkSize;
+        QSharedPointer<QDropbox2ChunkController> controller;
+    };
+
+    // feeds each chunk to the content hasher, then hands it to the sender
+    class HashStage : public QRunnable
+    {
+    public:
+        HashStage(PipelinePtr pipeline, QObject* owner)
+            : pipeline(pipeline),
+              owner(owner)
+        {}
+
+        void run() override
+        {
+            QDropbox2ContentHasher hasher;
+
+            forever
+            {
+                qint64 stalled = 0;
+                ChunkPtr chunk;
+                if(!pipeline->toHash.pop(chunk, stalled))
+                    return;
+
+                QElapsedTimer timer;
+                timer.start();
+
+                hasher.addData(chunk->data);
+                if(chunk->last)
+                {
+                    QMutexLocker locker(&pipeline->mutex);
+                    pipeline->contentHash = hasher.result();
+                }
+
+                const qint64 busy = timer.elapsed();
+                const bool pushed = pipeline->toSend.push(chunk, stalled);
+                pipeline->record(QDropbox2Upload::Hash, busy, stalled, chunk->data.size());
+
+                if(!pushed)
+                    return;
+
+                // the sender lives on an event loop, and cannot wait on the queue
+                QMetaObject::invokeMethod(owner, "slot_chunkReady", Qt::QueuedConnection);
+
+                if(chunk->last)
+                    return;
+            }
+        }
+
+    private:
+        PipelinePtr pipeline;
+        QObject*    owner;
+    };
+
+    // where the session really is, from a 409 turning a chunk away for its
+    // offset; -1 if it was turned away for anything else
+    qint64 correctOffset(const QJsonObject& response)
+    {
+        // finish wraps the lookup error of append_v2 in one of its own
+        QJsonObject error = response.value("error").toObject();
+        if(error.value(".tag").toString() == "lookup_failed")
+            error = error.value("lookup_failed").toObject();
+
+        if(error.value(".tag").toString() != "incorrect_offset")
+            return -1;
+        return qint64(error.value("correct_offset").toDouble(-1));
+    }
+}
+
+//--------------------------------------
+// QDropbox2Upload
+
+QDropbox2Upload::QDropbox2Upload(QDropbox2* api, QObject* parent)
+    : QObject(parent)
+{
+    init(api, QString(), QString());
+}
+
+QDropbox2Upload::QDropbox2Upload(const QString& local_file, const QString& remote_path, QDropbox2* api, QObject* parent)
+    : QObject(parent)
+{
+    init(api, local_file, remote_path);
+}
+
+QDropbox2Upload::~QDropbox2Upload()
+{
+    // the stages refer to us; they must be gone before we are
+    stopPipeline();
+    pool.waitForDone();
+}
+
+void QDropbox2Upload::init(QDropbox2* api, const QString& local_file, const QString& remote_path)
+{
+    _api            = api;
+    localFile_      = local_file;
+    remotePath_     = remote_path;
+    overwrite_      = true;
+    rename_         = false;
+    chunkSize_      = 2 * QDropbox2ChunkController::Unit;
+    adaptive        = true;
+    controller      = QSharedPointer<QDropbox2ChunkController>::create(chunkSize_);
+    queueDepth      = 2;
+    running         = false;
+    eventLoop       = nullptr;
+    reply           = nullptr;
+    sendStep        = nullptr;
+    attempts        = 0;
+    total           = 0;
+    sent            = 0;
+    _elapsed        = 0;
+    lastErrorCode   = 0;
+    trace           = 0;
+
+    // one thread each for the read and hash stages
+    pool.setMaxThreadCount(2);
+
+    retryTimer.setSingleShot(true);
+    connect(&retryTimer, &QTimer::timeout, this, &QDropbox2Upload::slot_retry);
+
+    connect(&QNAM, &QNetworkAccessManager::finished, this, &QDropbox2Upload::slot_networkRequestFinished);
+}
+
+void QDropbox2Upload::setChunkSize(qint64 bytes)
+{
+    // chunks other than the last must be multiples of 4 MB
+    const qint64 unit = QDropbox2ChunkController::Unit;
+    chunkSize_ = qBound(unit, (bytes / unit) * unit, QDropbox2ChunkController::maximumChunkSize());
+    adaptive = false;
+}
+
+qint64 QDropbox2Upload::chunkSize() const
+{
+    return adaptive ? controller->chunkSize() : chunkSize_;
+}
+
+void QDropbox2Upload::setAdaptiveChunkSize(bool adaptive)
+{
+    this->adaptive = adaptive;
+}
+
+bool QDropbox2Upload::start()
+{
+    if(running)
+        return false;
+
+    lastErrorCode = 0;
+    lastErrorMessage = "";
+
+    QFileInfo info(localFile_);
+    if(!_api || !info.isFile() || remotePath_.isEmpty())
+    {
+        lastErrorCode = QDropbox2::APIError;
+        lastErrorMessage = !_api ? "No QDropbox2 instance was given." :
+                                   (remotePath_.isEmpty() ? "No Dropbox path was given." :
+                                                            QString("%1 is not a file.").arg(localFile_));
+        emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+        return false;
+    }
+
+    // stages of an earlier, aborted upload may still be winding down
+    pool.waitForDone();
+
+    total    = info.size();
+    sent     = 0;
+    reply    = nullptr;
+    sending.clear();
+    sessionId.clear();
+    _contentHash.clear();
+    _metadata = QJsonObject();
+    sendStats = StageStats();
+
+    pipeline = PipelinePtr(new Pipeline(queueDepth));
+    running = true;
+
+    trace = _api->traceBegin("upload", {{"path", remotePath_}, {"bytes", total}});
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Upload::start " << localFile_ << remotePath_ << total << endl;
+#endif
+
+    clock.start();
+    idleTimer.start();
+
+    pool.start(new ReadStage(pipeline, this, localFile_, total, chunkSize_,
+                             adaptive ? controller : QSharedPointer<QDropbox2ChunkController>()));
+    pool.start(new HashStage(pipeline, this));
+
+    return true;
+}
+
+bool QDropbox2Upload::upload()
+{
+    if(!start())
+        return false;
+
+    if(!eventLoop)
+        eventLoop = new QEventLoop(this);
+    while(running)
+        eventLoop->exec();
+
+    return lastErrorCode == 0;
+}
+
+void QDropbox2Upload::slot_abort()
+{
+    if(!running)
+        return;
+
+    lastErrorCode = QNetworkReply::OperationCanceledError;
+    lastErrorMessage = "The upload was aborted.";
+    finish(false);
+}
+
+QDropbox2EntityInfo QDropbox2Upload::metadata() const
+{
+    return QDropbox2EntityInfo(_metadata);
+}
+
+qint64 QDropbox2Upload::elapsed() const
+{
+    return running ? clock.elapsed() : _elapsed;
+}
+
+QDropbox2Upload::StageStats QDropbox2Upload::stageStats(Stage stage) const
+{
+    StageStats stats;
+    if(stage == Send)
+        stats = sendStats;
+    else if(pipeline && stage >= Read && stage < Send)
+    {
+        QMutexLocker locker(&pipeline->mutex);
+        stats = pipeline->stats[stage];
+    }
+
+    const qint64 ms = elapsed();
+    if(ms > 0)
+        stats.utilisation = qMin(1.0, double(stats.busy) / ms);
+    return stats;
+}
+
+void QDropbox2Upload::slot_chunkReady()
+{
+    sendNext();
+}
+
+void QDropbox2Upload::slot_stageFailed(const QString& message)
+{
+    if(running)
+        fail(QDropbox2::APIError, message);
+}
+
+QByteArray QDropbox2Upload::commitInfo() const
+{
+    QDropbox2JsonWriter json(remotePath_.size() + rev_.size(), QDropbox2JsonWriter::AsciiSafe);
+    json.beginObject()
+            .value("path", remotePath_);
+
+    if(rev_.isEmpty())
+        json.value("mode", overwrite_ ? "overwrite" : "add");
+    else
+        json.beginObject("mode")
+                .value(".tag", "update")
+                .value("update", rev_)
+            .endObject();
+
+    json.value("autorename", rename_)
+            .value("mute", true)
+        .endObject();
+    return json.data();
+}
+
+void QDropbox2Upload::sendNext()
+{
+    // one chunk at a time; a session only accepts them in order
+    if(!running || reply)
+        return;
+
+    ChunkPtr chunk;
+    if(!pipeline->toSend.tryPop(chunk))
+        return;
+
+    sendStats.stalled += idleTimer.elapsed();
+
+    sending = chunk;
+    attempts = 0;
+    sendChunk();
+}
+
+void QDropbox2Upload::sendChunk()
+{
+    ChunkPtr chunk = sending;
+    const bool first = (chunk->offset == 0);
+
+    QUrl url;
+    url.setUrl(QDROPBOX2_CONTENT_URL, QUrl::StrictMode);
+
+    QByteArray arg;
+    if(first && chunk->last)
+    {
+        // it all fits in a single request
+        url.setPath("/2/files/upload");
+        sendStep = "upload";
+        arg = commitInfo();
+    }
+    else
+    {
+        QDropbox2JsonWriter json(sessionId.size() + 64, QDropbox2JsonWriter::AsciiSafe);
+        json.beginObject();
+
+        if(first)
+        {
+            url.setPath("/2/files/upload_session/start");
+            sendStep = "upload_session/start";
+        }
+        else
+        {
+            json.beginObject("cursor")
+                    .value("session_id", sessionId)
+                    .value("offset", chunk->offset)
+                .endObject();
+
+            if(chunk->last)
+            {
+                url.setPath("/2/files/upload_session/finish");
+                sendStep = "upload_session/finish";
+            }
+            else
+            {
+                url.setPath("/2/files/upload_session/append_v2");
+                sendStep = "upload_session/append_v2";
+            }
+        }
+
+        if(chunk->last)
+            json.raw("commit", commitInfo());
+        else
+            json.value("close", false);
+
+        json.endObject();
+        arg = json.data();
+    }
+
+    Q_ASSERT(url.isValid());
+
+    QNetworkRequest req;
+    if(!_api->createAPIv2Reqeust(url, req))
+    {
+        fail(QDropbox2::APIError, "Could not create the upload request.");
+        return;
+    }
+
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
+    req.setRawHeader("Dropbox-API-arg", arg);
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Upload::sendNext " << url.toString() << chunk->offset << chunk->data.size() << endl;
+#endif
+
+    _api->traceStep(trace, sendStep, {{"offset", chunk->offset}, {"bytes", chunk->data.size()}, {"attempt", attempts}});
+
+    sendTimer.start();
+
+    // the chunk is shared with the request, not copied
+    reply = QNAM.post(req, chunk->data);
+    _api->trackRequest(reply);
+    connect(this, &QDropbox2Upload::signal_operationAborted, reply, &QNetworkReply::abort);
+    connect(reply, &QNetworkReply::uploadProgress, this, &QDropbox2Upload::slot_uploadProgress);
+}
+
+void QDropbox2Upload::slot_networkRequestFinished(QNetworkReply* rply)
+{
+    rply->deleteLater();
+
+    // a request abandoned by stopPipeline()
+    if(rply != reply)
+        return;
+
+    reply = nullptr;
+    ChunkPtr chunk = sending;
+
+    const qint64 msecs = sendTimer.elapsed();
+    sendStats.busy += msecs;
+    idleTimer.start();
+
+    const int status = rply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const QByteArray response = rply->readAll();
+
+    _api->traceEnd(trace, sendStep, {{"status", status}});
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Upload::slot_networkRequestFinished " << status << response << endl;
+#endif
+
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(response, &jsonError);
+    QJsonObject object = (jsonError.error == QJsonParseError::NoError) ? json.object() : QJsonObject();
+
+    // a resend of a chunk the server did get the first time, but whose
+    // answer was lost, is turned away for its offset; the session says how
+    // much of it already arrived
+    const qint64 end = chunk->offset + chunk->data.size();
+    const qint64 correct_offset = (rply->error() != QNetworkReply::NoError && status == QDROPBOX_V2_ERROR &&
+                                   attempts > 0 && chunk->offset > 0) ? correctOffset(object) : -1;
+    const bool received = (correct_offset == end && !chunk->last);
+
+    if(!received && correct_offset > chunk->offset && correct_offset <= end)
+    {
+        // send only the rest; a finish still has to commit, even if that
+        // leaves nothing to send
+#ifdef QTDROPBOX_DEBUG
+        qDebug() << "QDropbox2Upload: resuming chunk at" << chunk->offset << "from" << correct_offset << endl;
+#endif
+        sendStats.bytes += correct_offset - chunk->offset;
+        sending = ChunkPtr(new Chunk{correct_offset, chunk->data.mid(int(correct_offset - chunk->offset)), chunk->last});
+        sendChunk();
+        return;
+    }
+
+    if(rply->error() != QNetworkReply::NoError && !received)
+    {
+        controller->recordFailure(chunk->data.size());
+
+        // the chunk is still at hand; send it again unless the server
+        // refused it for good
+        const bool transient = (status == 0 || status == QDropbox2::MaxRequestsExceeded || status >= 500);
+        if(transient && attempts < MaxRetries)
+        {
+            ++attempts;
+            if(_api->metrics())
+                _api->metrics()->recordRetry(rply->url().path());
+
+            // resending at once would only add to the load that made the
+            // server turn the chunk away
+            bool ok = false;
+            const int retry_after = rply->rawHeader("Retry-After").trimmed().toInt(&ok);
+            const int delay = (ok && retry_after >= 0) ? retry_after * 1000 : (RetryDelay << (attempts - 1));
+
+#ifdef QTDROPBOX_DEBUG
+            qDebug() << "QDropbox2Upload: retrying chunk at" << chunk->offset << "in" << delay << "ms after" << rply->errorString() << endl;
+#endif
+            retryTimer.start(delay);
+            return;
+        }
+
+        QString message;
+        if(object.contains("user_message"))
+            message = object.value("user_message").toString();
+        else if(object.contains("error_summary"))
+            message = object.value("error_summary").toString();
+        else
+            message = rply->errorString();
+
+        fail(status == QDROPBOX_V2_ERROR ? status : int(rply->error()), message);
+        return;
+    }
+
+    controller->recordSuccess(chunk->data.size(), msecs);
+
+    sending.clear();
+    sendStats.bytes += chunk->data.size();
+    ++sendStats.chunks;
+
+    if(chunk->offset == 0 && !chunk->last)
+    {
+        sessionId = object.value("session_id").toString();
+        if(sessionId.isEmpty())
+        {
+            fail(QDropbox2::APIError, "The server did not start an upload session.");
+            return;
+        }
+    }
+
+    sent = chunk->offset + chunk->data.size();
+    emit signal_uploadProgress(sent, total);
+
+    if(!chunk->last)
+    {
+        sendNext();
+        return;
+    }
+
+    _metadata = object;
+    {
+        QMutexLocker locker(&pipeline->mutex);
+        _contentHash = pipeline->contentHash;
+    }
+
+    // changes we make ourselves will also arrive as deltas for watched
+    // folders, but not before the caller may look at the result
+    _api->metadataCache()->invalidate(remotePath_);
+    _api->linkCache()->invalidate(remotePath_);
+    if(_api->contentCache())
+        _api->contentCache()->invalidate(remotePath_);
+
+    const QString remote_hash = object.value("content_hash").toString();
+    if(!remote_hash.isEmpty() && remote_hash != _contentHash)
+    {
+        fail(QDropbox2::APIError, "The uploaded content does not match the local file.");
+        return;
+    }
+
+    finish(true);
+}
+
+void QDropbox2Upload::slot_retry()
+{
+    if(running && sending && !reply)
+        sendChunk();
+}
+
+void QDropbox2Upload::slot_uploadProgress(qint64 bytesSent, qint64 /*bytesTotal*/)
+{
+    if(sending)
+        emit signal_uploadProgress(sending->offset + bytesSent, total);
+}
+
+void QDropbox2Upload::fail(int error_code, const QString& error_message)
+{
+    lastErrorCode = error_code;
+    lastErrorMessage = error_message;
+
+#ifdef QTDROPBOX_DEBUG
+    qDebug() << "QDropbox2Upload error: " << lastErrorCode << lastErrorMessage << endl;
+#endif
+
+    emit signal_errorOccurred(lastErrorCode, lastErrorMessage);
+    finish(false);
+}
+
+void QDropbox2Upload::finish(bool success)
+{
+    stopPipeline();
+
+    if(_contentHash.isEmpty())
+    {
+        // known once the hash stage has seen the whole file, even if
+        // sending it failed
+        QMutexLocker locker(&pipeline->mutex);
+        _contentHash = pipeline->contentHash;
+    }
+
+    _elapsed = clock.elapsed();
+    running = false;
+
+    _api->traceEnd(trace, "upload", {{"error", lastErrorCode}});
+    trace = 0;
+
+    emit signal_finished(success);
+
+    if(eventLoop)
+        eventLoop->exit();
+}
+
+void QDropbox2Upload::stopPipeline()
+{
+    if(pipeline)
+        pipeline->abort();
+
+    retryTimer.stop();
+
+    if(reply)
+    {
+        // forget the request first, so its finished() is ignored
+        QNetworkReply* rply = reply;
+        reply = nullptr;
+        sending.clear();
+        rply->abort();
+    }
+}
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
+
+#include "qdropbox2common.h"
+
+#include "qdropbox2.h"
+#include "qdropbox2entityinfo.h"
+#include "qdropbox2chunkcontroller.h"
+
+//! Computes the Dropbox content hash of a stream of bytes
+/*!
+  Dropbox identifies file content by its "content_hash": the content is split
+  into 4 MB blocks, each block is hashed with SHA-256, and the concatenated
+  block hashes are hashed with SHA-256 once more.  The hash is reported in the
+  metadata of every file, so a local file can be compared with its copy on
+  Dropbox without downloading it.
+
+  Data may be added in pieces of any size.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2ContentHasher
+{
+public:
+    enum
+    {
+        //! Size of the blocks that are hashed individually
+        BlockSize = 4*1024*1024
+    };
+
+    QDropbox2ContentHasher();
+
+    /*!
+      Adds <i>len</i> bytes to the content.
+     */
+    void    addData(const char* data, qint64 len);
+    void    addData(const QByteArray& data) { addData(data.constData(), data.size()); }
+
+    /*!
+      Returns the content hash, as a lower-case hex string, of the data added
+      so far.  No more data may be added afterwards, until reset().
+     */
+    QString result();
+
+    /*!
+      Starts over with empty content.
+     */
+    void    reset();
+
+    /*!
+      Returns the content hash of everything that remains to be read from
+      <i>device</i>, or an empty string if the device could not be read.
+     */
+    static QString hash(QIODevice* device);
+
+private:
+    QCryptographicHash  overall;
+    QCryptographicHash  block;
+    qint64              inBlock;
+};
+
+//! Uploads a local file through a pipeline of concurrent stages
+/*!
+  QDropbox2File holds the content of a file in memory and uploads it once
+  flush() or close() is called.  For a file that already exists on disk,
+  QDropbox2Upload avoids both the memory and the waiting: the file is read,
+  hashed and sent in chunks by three stages that run at the same time,
+
+  \li <b>Read</b> reads the next chunk from the local file, on a thread of
+      its own;
+  \li <b>Hash</b> feeds each chunk to a QDropbox2ContentHasher, on another;
+  \li <b>Send</b> uploads each hashed chunk through an upload session, on the
+      thread the QDropbox2Upload lives on.
+
+  The stages are connected by bounded queues (see setQueueDepth()).  While
+  one chunk is on the wire, the next ones are being read and hashed, so the
+  upload takes about as long as its slowest stage rather than as long as all
+  three together; and since a stage blocks while the queue after it is full,
+  no more than a few chunks are ever held in memory.  stageStats() reports
+  how busy each stage was, which shows where the time went.
+
+  The chunk size adapts to the link as the upload proceeds (see
+  QDropbox2ChunkController), and a chunk that fails for a transient reason
+  (a network error, or a 429 or 5xx response) is sent again, up to
+  MaxRetries times.  Before each resend the upload waits as long as the
+  server asked in a Retry-After header, or else RetryDelay milliseconds,
+  doubled for every further attempt.  Should a resent chunk turn out to
+  have arrived the first time after all (only its answer was lost), the
+  upload carries on from the offset the session reports instead of failing.
+
+  Once the upload has been committed, the content hash computed locally is
+  checked against the one Dropbox reports for the new file.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2Upload : public QObject
+{
+    Q_OBJECT
+
+public:     // typedefs and enums
+    enum
+    {
+        //! Number of times a chunk is sent again after a transient failure
+        MaxRetries = 3,
+
+        //! Msecs before the first resend, unless the server says otherwise
+        RetryDelay = 500
+    };
+
+    enum Stage
+    {
+        Read,
+        Hash,
+        Send,
+        StageCount
+    };
+
+    //! How one stage of the pipeline spent its time
+    struct StageStats
+    {
+        qint64  busy;           // msecs spent working on chunks
+        qint64  stalled;        // msecs spent waiting on the queue before or after the stage
+        qint64  chunks;
+        qint64  bytes;
+        double  utilisation;    // busy time as a fraction of the elapsed time
+
+        StageStats()
+            : busy(0), stalled(0), chunks(0), bytes(0), utilisation(0.0)
+        {}
+    };
+
+public:
+    /*!
+      Default constructor.  Use setLocalFile() and setRemotePath() before
+      starting the upload.
+
+      \param api A QDropbox2 that is connected to an user account.
+      \param parent Parent QObject
+     */
+    QDropbox2Upload(QDropbox2* api, QObject* parent = 0);
+
+    /*!
+      Creates an upload of a local file to a Dropbox path.
+
+      \param local_file Path of the file on the local file system.
+      \param remote_path Dropbox path the file is uploaded to.
+      \param api A QDropbox2 that is connected to an user account.
+      \param parent Parent QObject
+     */
+    QDropbox2Upload(const QString& local_file, const QString& remote_path, QDropbox2* api, QObject* parent = 0);
+
+    /*!
+      Aborts an upload in progress, and waits for the stage threads to stop.
+     */
+    ~QDropbox2Upload();
+
+    void    setLocalFile(const QString& local_file) { localFile_ = local_file; }
+    QString localFile() const                       { return localFile_; }
+
+    void    setRemotePath(const QString& remote_path) { remotePath_ = remote_path; }
+    QString remotePath() const                      { return remotePath_; }
+
+    /*!
+      See QDropbox2File::setOverwrite().
+     */
+    void    setOverwrite(bool overwrite = true)     { overwrite_ = overwrite; }
+    bool    overwrite() const                       { return overwrite_; }
+
+    /*!
+      See QDropbox2File::setRenaming().
+     */
+    void    setRenaming(bool rename = true)         { rename_ = rename; }
+    bool    renaming() const                        { return rename_; }
+
+    /*!
+      Makes the upload replace only the given revision of the file.  If the
+      file has changed on Dropbox since, the upload is treated as a conflict,
+      and renamed if renaming() is set.  An empty revision (the default) uses
+      the overwrite() setting instead.
+     */
+    void    setRevision(const QString& rev)         { rev_ = rev; }
+    QString revision() const                        { return rev_; }
+
+    /*!
+      Sets a fixed size for the chunks the file is read, hashed and sent in,
+      instead of adapting the size to the link.  The size is rounded down to a
+      multiple of 4 MB, and kept between 4 MB and the largest such multiple
+      Dropbox accepts in one request.
+     */
+    void    setChunkSize(qint64 bytes);
+
+    /*!
+      Returns the fixed chunk size, or the size the next chunk read will
+      have if the size adapts.
+     */
+    qint64  chunkSize() const;
+
+    /*!
+      Lets the chunk size adapt to the measured throughput and failure rate of
+      the link (the default).  The measurements carry over from one upload to
+      the next.
+     */
+    void    setAdaptiveChunkSize(bool adaptive = true);
+    bool    adaptiveChunkSize() const               { return adaptive; }
+
+    /*!
+      Returns the controller that adapts the chunk size.
+     */
+    QDropbox2ChunkController* chunkController() const { return controller.data(); }
+
+    /*!
+      Sets the number of chunks each queue between two stages may hold before
+      the stage feeding it waits.  At most about twice this many chunks, plus
+      one per stage, are held in memory.  The default is 2.
+     */
+    void    setQueueDepth(int depth)                { queueDepth = qMax(1, depth); }
+
+    /*!
+      Starts the upload.
+
+      \remark This is an asynchronous call.  signal_finished() is emitted when
+      the upload has completed or failed.
+
+      \returns <i>true</i> if the upload was started.
+     */
+    bool    start();
+
+    /*!
+      Uploads the file.
+
+      \remark This is a blocking call.
+
+      \returns <i>true</i> if the file was uploaded.
+     */
+    bool    upload();
+
+    /*!
+      Indicates whether an upload is in progress.
+     */
+    bool    isRunning() const                       { return running; }
+
+    /*!
+      If an error occurred you can access the last error code by using this function.
+     */
+    int     error() const                           { return lastErrorCode; }
+
+    /*!
+      Returns a description of the last error.
+     */
+    QString errorString() const                     { return lastErrorMessage; }
+
+    /*!
+      Returns the content hash of the local file, once it has been read
+      completely.
+     */
+    QString contentHash() const                     { return _contentHash; }
+
+    /*!
+      Returns the metadata Dropbox reported for the uploaded file.
+     */
+    QDropbox2EntityInfo metadata() const;
+
+    /*!
+      Returns the number of milliseconds the last upload took, or has taken
+      so far.
+     */
+    qint64  elapsed() const;
+
+    /*!
+      Returns how the given stage of the last upload spent its time.
+     */
+    StageStats stageStats(Stage stage) const;
+
+public slots:
+    void    slot_abort();
+
+signals:
+    /*!
+      This signal is emitted whenever an error occurs.
+
+      \param errorcode The occurred error.
+      \param errormessage A text string version of the error, if available.
+     */
+    void    signal_errorOccurred(int errorcode, const QString& errormessage = QString());
+
+    /*!
+      Emitted as the file content is uploaded to Dropbox.
+
+      \param bytesSent The amount of data sent so far.
+      \param bytesTotal Size of the file.
+     */
+    void    signal_uploadProgress(qint64 bytesSent, qint64 bytesTotal);
+
+    /*!
+      Emitted when the upload has completed, failed or been aborted.
+
+      \param success <i>true</i> if the file was uploaded.
+     */
+    void    signal_finished(bool success);
+
+    /*!
+      \internal Aborts the request in flight.
+     */
+    void    signal_operationAborted();
+
+private slots:
+    void    slot_chunkReady();
+    void    slot_stageFailed(const QString& message);
+    void    slot_networkRequestFinished(QNetworkReply* reply);
+    void    slot_uploadProgress(qint64 bytesSent, qint64 bytesTotal);
+    void    slot_retry();
+
+public:         // internal
+    struct Pipeline;
+    struct Chunk;
+
+private:        // methods
+    void    init(QDropbox2* api, const QString& local_file, const QString& remote_path);
+
+    void    sendNext();
+    void    sendChunk();
+    void    fail(int error_code, const QString& error_message);
+    void    finish(bool success);
+    void    stopPipeline();
+
+    QByteArray commitInfo() const;
+
+private:        // data members
+    QNetworkAccessManager QNAM;
+    QDropbox2*  _api;
+
+    QString     localFile_;
+    QString     remotePath_;
+    bool        overwrite_;
+    bool        rename_;
+    QString     rev_;
+    qint64      chunkSize_;
+    bool        adaptive;
+    QSharedPointer<QDropbox2ChunkController> controller;
+    int         queueDepth;
+
+    // the read and hash stages each occupy a thread of this pool
+    QThreadPool pool;
+    QSharedPointer<Pipeline> pipeline;
+
+    bool        running;
+    QEventLoop* eventLoop;
+
+    // send stage; runs on our own thread
+    QNetworkReply* reply;
+    QSharedPointer<Chunk> sending;
+    const char* sendStep;
+    int         attempts;
+    QTimer      retryTimer;             // delays the resend of a failed chunk
+    QString     sessionId;
+    qint64      total;
+    qint64      sent;
+    QElapsedTimer sendTimer;
+    QElapsedTimer idleTimer;
+    StageStats  sendStats;
+
+    QElapsedTimer clock;
+    qint64      _elapsed;
+
+    int         lastErrorCode;
+    QString     lastErrorMessage;
+
+    QString     _contentHash;
+    QJsonObject _metadata;
+
+    quint64     trace;
+};
@@ -0,0 +1,901 @@
+#include <cstring>
+
+#include "qdropbox2zipreader.h"
+
+namespace
+{
+    const quint32 LocalHeaderSignature      = 0x04034b50;
+    const quint32 CentralHeaderSignature    = 0x02014b50;
+    const quint32 Zip64EndSignature         = 0x06064b50;
+    const quint32 EndOfCentralSignature     = 0x06054b50;
+    const quint32 DescriptorSignature       = 0x08074b50;
+
+    const quint16 Zip64ExtraTag             = 0x0001;
+
+    const quint16 FlagEncrypted             = 0x0001;
+    const quint16 FlagDescriptor            = 0x0008;
+
+    const int     LocalHeaderSize           = 30;
+
+    inline quint16 le16(const uchar* p)     { return quint16(p[0] | (p[1] << 8)); }
+    inline quint32 le32(const uchar* p)     { return quint32(le16(p)) | (quint32(le16(p + 2)) << 16); }
+    inline quint64 le64(const uchar* p)     { return quint64(le32(p)) | (quint64(le32(p + 4)) << 32); }
+
+    bool isHeader(quint32 signature)
+    {
+        return signature == LocalHeaderSignature || signature == CentralHeaderSignature ||
+               signature == Zip64EndSignature || signature == EndOfCentralSignature;
+    }
+
+    struct CrcTable
+    {
+        quint32 entries[256];
+
+        CrcTable()
+        {
+            for(quint32 i = 0;i < 256;++i)
+            {
+                quint32 c = i;
+                for(int k = 0;k < 8;++k)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+
+    quint32 crc32(quint32 crc, const char* data, int len)
+    {
+        static const CrcTable table;
+
+        crc = ~crc;
+        for(int i = 0;i < len;++i)
+            crc = table.entries[(crc ^ uchar(data[i])) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+}
+
+//! A raw DEFLATE (RFC 1951) decoder that can stop and resume at any input boundary
+/*!
+  Decoding is done in steps -- a block header, a literal, a match -- and the
+  input position and bit buffer are only committed at the end of a step.
+  When the input runs out in the middle of one, inflate() returns with the
+  state of the last committed step, and the caller feeds the rest of the
+  input again, with more appended.
+ */
+class QDropbox2Inflater
+{
+public:
+    enum Status
+    {
+        NeedInput,
+        StreamEnd,
+        Error
+    };
+
+    QDropbox2Inflater();
+
+    void    reset();
+
+    /*!
+      Decodes as much of the input as possible.
+
+      \param data The input not consumed by earlier calls.
+      \param len Its length.
+      \param consumed Receives the number of bytes used.
+      \param out Receives the decoded bytes.
+     */
+    Status  inflate(const uchar* data, int len, int& consumed, QByteArray& out);
+
+    QString errorString() const                 { return lastErrorMessage; }
+
+private:
+    enum Mode
+    {
+        Header,
+        Copy,
+        Codes,
+        End,
+        Failed
+    };
+
+    enum
+    {
+        WindowSize = 32768,
+        MaxCodeLength = 15,
+        MaxSymbols = 288,
+
+        // returned by decode()
+        MoreInput = -1,
+        BadCode = -2
+    };
+
+    struct Huffman
+    {
+        short   count[MaxCodeLength + 1];       // codes of each length
+        short   symbol[MaxSymbols];             // in canonical order
+    };
+
+    struct Bits
+    {
+        const uchar* data;
+        int         len;
+        int         pos;
+        quint32     buffer;
+        int         count;
+
+        bool need(int n)
+        {
+            while(count < n)
+            {
+                if(pos == len)
+                    return false;
+                buffer |= quint32(data[pos++]) << count;
+                count += 8;
+            }
+            return true;
+        }
+
+        int take(int n)
+        {
+            const int value = int(buffer & ((1u << n) - 1));
+            buffer >>= n;
+            count -= n;
+            return value;
+        }
+    };
+
+    static int build(Huffman& h, const short* lengths, int n);
+    static int decode(Bits& bits, const Huffman& h);
+
+    int     dynamicTables(Bits& bits);
+    Status  fail(const QString& message);
+
+    inline void put(uchar c, QByteArray& out)
+    {
+        window[windowPos++ & (WindowSize - 1)] = c;
+        out.append(char(c));
+        ++total;
+    }
+
+    Mode        mode;
+    bool        last;                           // the current block is the final one
+    int         storedLeft;
+
+    // committed bit reader state
+    quint32     bitBuffer;
+    int         bitCount;
+
+    Huffman     lencode;
+    Huffman     distcode;
+    Huffman     fixedLencode;
+    Huffman     fixedDistcode;
+
+    uchar       window[WindowSize];
+    quint32     windowPos;
+    quint64     total;
+
+    QString     lastErrorMessage;
+};
+
+namespace
+{
+    const short LengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const short LengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const short DistanceBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577 };
+    const short DistanceExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    // order of the code length code lengths in a dynamic block header
+    const short CodeLengthOrder[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+}
+
+QDropbox2Inflater::QDropbox2Inflater()
+{
+    short lengths[MaxSymbols];
+    int symbol = 0;
+    for(;symbol < 144;++symbol)
+        lengths[symbol] = 8;
+    for(;symbol < 256;++symbol)
+        lengths[symbol] = 9;
+    for(;symbol < 280;++symbol)
+        lengths[symbol] = 7;
+    for(;symbol < MaxSymbols;++symbol)
+        lengths[symbol] = 8;
+    build(fixedLencode, lengths, MaxSymbols);
+
+    for(symbol = 0;symbol < 30;++symbol)
+        lengths[symbol] = 5;
+    build(fixedDistcode, lengths, 30);
+
+    reset();
+}
+
+void QDropbox2Inflater::reset()
+{
+    mode = Header;
+    last = false;
+    storedLeft = 0;
+    bitBuffer = 0;
+    bitCount = 0;
+    windowPos = 0;
+    total = 0;
+    lastErrorMessage.clear();
+}
+
+int QDropbox2Inflater::build(Huffman& h, const short* lengths, int n)
+{
+    // canonical codes: only the number of codes of each length, and the
+    // symbols in order of their codes, are needed to decode
+    std::memset(h.count, 0, sizeof(h.count));
+    for(int symbol = 0;symbol < n;++symbol)
+        ++h.count[lengths[symbol]];
+    if(h.count[0] == n)
+        return 0;
+
+    int left = 1;
+    for(int len = 1;len <= MaxCodeLength;++len)
+    {
+        left <<= 1;
+        left -= h.count[len];
+        if(left < 0)
+            return left;        // over-subscribed
+    }
+
+    short offsets[MaxCodeLength + 1];
+    offsets[1] = 0;
+    for(int len = 1;len < MaxCodeLength;++len)
+        offsets[len + 1] = offsets[len] + h.count[len];
+
+    for(int symbol = 0;symbol < n;++symbol)
+    {
+        if(lengths[symbol])
+            h.symbol[offsets[lengths[symbol]]++] = short(symbol);
+    }
+
+    return left;                // non-zero if incomplete
+}
+
+int QDropbox2Inflater::decode(Bits& bits, const Huffman& h)
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for(int len = 1;len <= MaxCodeLength;++len)
+    {
+        if(!bits.need(1))
+            return MoreInput;
+        code |= bits.take(1);
+
+        const int count = h.count[len];
+        if(code - count < first)
+            return h.symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return BadCode;
+}
+
+int QDropbox2Inflater::dynamicTables(Bits& bits)
+{
+    if(!bits.need(14))
+        return 0;
+    const int nlen = bits.take(5) + 257;
+    const int ndist = bits.take(5) + 1;
+    const int ncode = bits.take(4) + 4;
+    if(nlen > 286 || ndist > 30)
+        return -1;
+
+    short lengths[320];
+    int index = 0;
+    for(;index < ncode;++index)
+    {
+        if(!bits.need(3))
+            return 0;
+        lengths[CodeLengthOrder[index]] = short(bits.take(3));
+    }
+    for(;index < 19;++index)
+        lengths[CodeLengthOrder[index]] = 0;
+
+    // the code length code is held in lencode until the real one is built
+    if(build(lencode, lengths, 19) != 0)
+        return -1;
+
+    index = 0;
+    while(index < nlen + ndist)
+    {
+        int symbol = decode(bits, lencode);
+        if(symbol == MoreInput)
+            return 0;
+        if(symbol < 0)
+            return -1;
+
+        if(symbol < 16)
+        {
+            lengths[index++] = short(symbol);
+            continue;
+        }
+
+        short len = 0;
+        int repeat;
+        if(symbol == 16)
+        {
+            if(index == 0)
+                return -1;
+            len = lengths[index - 1];
+            if(!bits.need(2))
+                return 0;
+            repeat = 3 + bits.take(2);
+        }
+        else if(symbol == 17)
+        {
+            if(!bits.need(3))
+                return 0;
+            repeat = 3 + bits.take(3);
+        }
+        else
+        {
+            if(!bits.need(7))
+                return 0;
+            repeat = 11 + bits.take(7);
+        }
+
+        if(index + repeat > nlen + ndist)
+            return -1;
+        while(repeat--)
+            lengths[index++] = len;
+    }
+
+    if(lengths[256] == 0)
+        return -1;              // no end-of-block code
+
+    // a single code of one bit is the only incomplete code allowed
+    int left = build(lencode, lengths, nlen);
+    if(left && (left < 0 || nlen != lencode.count[0] + lencode.count[1]))
+        return -1;
+    left = build(distcode, lengths + nlen, ndist);
+    if(left && (left < 0 || ndist != distcode.count[0] + distcode.count[1]))
+        return -1;
+
+    return 1;
+}
+
+QDropbox2Inflater::Status QDropbox2Inflater::fail(const QString& message)
+{
+    mode = Failed;
+    lastErrorMessage = message;
+    return Error;
+}
+
+QDropbox2Inflater::Status QDropbox2Inflater::inflate(const uchar* data, int len, int& consumed, QByteArray& out)
+{
+    Bits bits = { data, len, 0, bitBuffer, bitCount };
+
+    consumed = 0;
+    auto commit = [&]()
+    {
+        consumed = bits.pos;
+        bitBuffer = bits.buffer;
+        bitCount = bits.count;
+    };
+
+    for(;;)
+    {
+        if(mode == End)
+            return StreamEnd;
+        if(mode == Failed)
+            return Error;
+
+        if(mode == Header)
+        {
+            if(!bits.need(3))
+                return NeedInput;
+            const bool final = bits.take(1);
+            const int type = bits.take(2);
+
+            if(type == 0)
+            {
+                // stored: the rest of the byte is skipped, and the length
+                // follows with its complement
+                bits.take(bits.count & 7);
+                if(!bits.need(32))
+                    return NeedInput;
+                const int length = bits.take(16);
+                const int complement = bits.take(16);
+                if(length != (~complement & 0xffff))
+                    return fail("stored block length mismatch");
+                storedLeft = length;
+                mode = Copy;
+            }
+            else if(type == 1)
+            {
+                lencode = fixedLencode;
+                distcode = fixedDistcode;
+                mode = Codes;
+            }
+            else if(type == 2)
+            {
+                const int result = dynamicTables(bits);
+                if(result == 0)
+                    return NeedInput;
+                if(result < 0)
+                    return fail("invalid dynamic block header");
+                mode = Codes;
+            }
+            else
+                return fail("invalid block type");
+
+            last = final;
+            commit();
+            continue;
+        }
+
+        if(mode == Copy)
+        {
+            // byte aligned, with the bit buffer empty
+            const int n = qMin(storedLeft, bits.len - bits.pos);
+            for(int i = 0;i < n;++i)
+                put(bits.data[bits.pos + i], out);
+            bits.pos += n;
+            storedLeft -= n;
+            commit();
+
+            if(storedLeft)
+                return NeedInput;
+            mode = last ? End : Header;
+            continue;
+        }
+
+        int symbol = decode(bits, lencode);
+        if(symbol == MoreInput)
+            return NeedInput;
+        if(symbol < 0)
+            return fail("invalid literal/length code");
+
+        if(symbol < 256)
+            put(uchar(symbol), out);
+        else if(symbol == 256)
+            mode = last ? End : Header;
+        else
+        {
+            symbol -= 257;
+            if(symbol >= 29)
+                return fail("invalid length code");
+            if(!bits.need(LengthExtra[symbol]))
+                return NeedInput;
+            int length = LengthBase[symbol] + bits.take(LengthExtra[symbol]);
+
+            symbol = decode(bits, distcode);
+            if(symbol == MoreInput)
+                return NeedInput;
+            if(symbol < 0 || symbol >= 30)
+                return fail("invalid distance code");
+            if(!bits.need(DistanceExtra[symbol]))
+                return NeedInput;
+            const quint32 distance = quint32(DistanceBase[symbol] + bits.take(DistanceExtra[symbol]));
+            if(distance > total)
+                return fail("distance too far back");
+
+            while(length--)
+                put(window[(windowPos - distance) & (WindowSize - 1)], out);
+        }
+
+        commit();
+    }
+}
+
+//--------------------------------------
+
+QDropbox2ZipReader::QDropbox2ZipReader(QObject* parent)
+    : QObject(parent),
+      state(LocalHeader),
+      ended(false),
+      offset(0),
+      flags(0),
+      expectedCrc(0),
+      compressedSize(0),
+      uncompressedSize(0),
+      zip64(false),
+      consumed(0),
+      produced(0),
+      crc(0),
+      inflater(new QDropbox2Inflater),
+      entryCount(0)
+{
+}
+
+QDropbox2ZipReader::~QDropbox2ZipReader()
+{
+}
+
+bool QDropbox2ZipReader::addData(const QByteArray& data)
+{
+    if(state == Failed)
+        return false;
+    if(state == Done)
+        return true;        // the central directory is not needed
+
+    if(offset == pending.size())
+    {
+        pending = data;
+        offset = 0;
+    }
+    else
+        pending.append(data);
+
+    const bool result = process();
+
+    // what is left is the part of a header or code that has not arrived yet
+    pending.remove(0, offset);
+    offset = 0;
+    return result;
+}
+
+bool QDropbox2ZipReader::finish()
+{
+    ended = true;
+    if(!process())
+        return false;
+    if(state != Done)
+        return fail("The zip archive ended before its central directory");
+    return true;
+}
+
+bool QDropbox2ZipReader::process()
+{
+    for(;;)
+    {
+        bool progressed = false;
+        switch(state)
+        {
+            case LocalHeader:           progressed = readHeader();      break;
+            case Stored:                progressed = readStored();      break;
+            case StoredUntilDescriptor: progressed = scanStored();      break;
+            case Deflated:              progressed = readDeflated();    break;
+            case Descriptor:            progressed = readDescriptor();  break;
+            case Done:                  offset = pending.size();        return true;
+            case Failed:                return false;
+        }
+
+        if(state == Failed)
+            return false;
+        if(!progressed)
+            return true;
+    }
+}
+
+bool QDropbox2ZipReader::fail(const QString& message)
+{
+    state = Failed;
+    lastErrorMessage = message;
+    return false;
+}
+
+void QDropbox2ZipReader::output(const char* data, int len)
+{
+    crc = crc32(crc, data, len);
+    produced += quint64(len);
+    emit signal_entryData(QByteArray(data, len));
+}
+
+bool QDropbox2ZipReader::readHeader()
+{
+    if(available() < 4)
+        return false;
+
+    const quint32 signature = le32(at(0));
+    if(signature == CentralHeaderSignature || signature == Zip64EndSignature || signature == EndOfCentralSignature)
+    {
+        state = Done;
+        return true;
+    }
+    if(signature != LocalHeaderSignature)
+        return fail("Invalid zip local header");
+    if(available() < LocalHeaderSize)
+        return false;
+
+    const uchar* header = at(0);
+    const int name_length = le16(header + 26);
+    const int extra_length = le16(header + 28);
+    if(available() < LocalHeaderSize + name_length + extra_length)
+        return false;
+
+    flags = le16(header + 6);
+    const quint16 method = le16(header + 8);
+    expectedCrc = le32(header + 14);
+    compressedSize = le32(header + 18);
+    uncompressedSize = le32(header + 22);
+
+    if(flags & FlagEncrypted)
+        return fail("Encrypted zip entries are not supported");
+    if(method != 0 && method != 8)
+        return fail(QString("Unsupported zip compression method %1").arg(method));
+
+    // Dropbox names entries in UTF-8, whether or not the flag says so
+    const QString name = QString::fromUtf8(reinterpret_cast<const char*>(header + LocalHeaderSize), name_length);
+
+    // sizes that do not fit in 32 bits are in the Zip64 extra field
+    zip64 = false;
+    const uchar* extra = header + LocalHeaderSize + name_length;
+    for(int pos = 0;pos + 4 <= extra_length;)
+    {
+        const quint16 tag = le16(extra + pos);
+        const int size = le16(extra + pos + 2);
+        if(pos + 4 + size > extra_length)
+            break;
+
+        if(tag == Zip64ExtraTag)
+        {
+            zip64 = true;
+            const uchar* field = extra + pos + 4;
+            int used = 0;
+            if(uncompressedSize == 0xffffffffu && used + 8 <= size)
+            {
+                uncompressedSize = le64(field + used);
+                used += 8;
+            }
+            if(compressedSize == 0xffffffffu && used + 8 <= size)
+                compressedSize = le64(field + used);
+        }
+        pos += 4 + size;
+    }
+
+    offset += LocalHeaderSize + name_length + extra_length;
+    consumed = 0;
+    produced = 0;
+    crc = 0;
+    ++entryCount;
+
+    if(method == 8)
+    {
+        inflater->reset();
+        state = Deflated;
+    }
+    else if(flags & FlagDescriptor)
+        state = StoredUntilDescriptor;
+    else
+        state = Stored;
+
+    emit signal_entryStarted(name, name.endsWith('/'));
+    return true;
+}
+
+bool QDropbox2ZipReader::readStored()
+{
+    const int n = int(qMin(compressedSize - consumed, quint64(available())));
+    if(n > 0)
+    {
+        output(reinterpret_cast<const char*>(at(0)), n);
+        offset += n;
+        consumed += quint64(n);
+    }
+
+    if(consumed == compressedSize)
+        return endEntry(expectedCrc, uncompressedSize);
+    return n > 0;
+}
+
+bool QDropbox2ZipReader::scanStored()
+{
+    // a stored entry of unknown size ends with the first data descriptor
+    // whose checksum and sizes match what precedes it
+    bool progressed = false;
+    for(;;)
+    {
+        const uchar* data = at(0);
+        const int count = available();
+
+        int found = -1;
+        for(int i = 0;i + 4 <= count;++i)
+        {
+            if(le32(data + i) == DescriptorSignature)
+            {
+                found = i;
+                break;
+            }
+        }
+
+        if(found < 0)
+        {
+            // keep a possible partial signature
+            const int safe = qMax(0, count - 3);
+            if(safe > 0)
+            {
+                output(reinterpret_cast<const char*>(data), safe);
+                offset += safe;
+                consumed += quint64(safe);
+                progressed = true;
+            }
+            if(ended && available() > 0)
+                return fail("Unterminated stored zip entry");
+            return progressed;
+        }
+
+        if(found > 0)
+        {
+            output(reinterpret_cast<const char*>(data), found);
+            offset += found;
+            consumed += quint64(found);
+            progressed = true;
+            continue;
+        }
+
+        // a descriptor is followed by the next header; the sizes are 64-bit
+        // for Zip64 entries, and may be either when the header did not say
+        const int forms[] = { zip64 ? 24 : 16, zip64 ? 16 : 24 };
+        bool waiting = false;
+        for(int length : forms)
+        {
+            if(count < length + 4)
+            {
+                waiting = waiting || !ended;
+                continue;
+            }
+
+            const bool wide = (length == 24);
+            const bool matches = le32(data + 4) == crc &&
+                    (wide ? le64(data + 8) == consumed && le64(data + 16) == produced
+                          : le32(data + 8) == quint32(consumed) && le32(data + 12) == quint32(produced));
+            if(matches && isHeader(le32(data + length)))
+            {
+                offset += length;
+                return endEntry(crc, produced);
+            }
+        }
+        if(waiting)
+            return progressed;
+
+        // the signature was part of the content
+        output(reinterpret_cast<const char*>(data), 1);
+        offset += 1;
+        consumed += 1;
+        progressed = true;
+    }
+}
+
+bool QDropbox2ZipReader::readDeflated()
+{
+    if(available() == 0)
+        return false;
+
+    QByteArray out;
+    int used = 0;
+    const QDropbox2Inflater::Status status = inflater->inflate(at(0), available(), used, out);
+    offset += used;
+    consumed += quint64(used);
+    if(!out.isEmpty())
+        output(out.constData(), out.size());
+
+    if(status == QDropbox2Inflater::Error)
+        return fail(QString("Corrupt zip entry: %1").arg(inflater->errorString()));
+
+    if(status == QDropbox2Inflater::StreamEnd)
+    {
+        if(flags & FlagDescriptor)
+        {
+            state = Descriptor;
+            return true;
+        }
+        return endEntry(expectedCrc, uncompressedSize);
+    }
+
+    return used > 0 || !out.isEmpty();
+}
+
+bool QDropbox2ZipReader::readDescriptor()
+{
+    // the signature is optional, and the sizes are 64-bit for Zip64
+    // entries; when the local header did not say, what follows tells
+    if(available() < 4)
+        return ended ? fail("Truncated zip data descriptor") : false;
+
+    const int base = (le32(at(0)) == DescriptorSignature) ? 4 : 0;
+    const int small = base + 12;
+    const int large = base + 20;
+
+    bool wide = zip64;
+    if(!wide)
+    {
+        if(available() < small + 4)
+            return ended ? fail("Truncated zip data descriptor") : false;
+        if(!isHeader(le32(at(small))))
+        {
+            if(available() < large + 4)
+                return ended ? fail("Truncated zip data descriptor") : false;
+            if(!isHeader(le32(at(large))))
+                return fail("Invalid zip data descriptor");
+            wide = true;
+        }
+    }
+    else if(available() < large)
+        return ended ? fail("Truncated zip data descriptor") : false;
+
+    const quint32 descriptor_crc = le32(at(base));
+    const quint64 compressed = wide ? le64(at(base + 4)) : le32(at(base + 4));
+    const quint64 uncompressed = wide ? le64(at(base + 12)) : le32(at(base + 8));
+    offset += wide ? large : small;
+
+    if(compressed != consumed)
+        return fail("Size mismatch in zip data descriptor");
+    return endEntry(descriptor_crc, uncompressed);
+}
+
+bool QDropbox2ZipReader::endEntry(quint32 expected_crc, quint64 size)
+{
+    if(produced != size)
+        return fail("Size mismatch in zip entry");
+    if(crc != expected_crc)
+        return fail("Checksum mismatch in zip entry");
+
+    state = LocalHeader;
+    emit signal_entryFinished();
+    return true;
+}
+
+//--------------------------------------
+
+QDropbox2ZipEntry::QDropbox2ZipEntry(const QString& name, QObject* parent)
+    : QIODevice(parent),
+      _name(name),
+      chunkOffset(0),
+      buffered(0),
+      complete(false)
+{
+    open(QIODevice::ReadOnly);
+}
+
+void QDropbox2ZipEntry::appendData(const QByteArray& data)
+{
+    if(data.isEmpty())
+        return;
+
+    chunks.append(data);
+    buffered += data.size();
+    emit readyRead();
+}
+
+void QDropbox2ZipEntry::setComplete()
+{
+    complete = true;
+    emit readChannelFinished();
+}
+
+qint64 QDropbox2ZipEntry::readData(char* data, qint64 maxlen)
+{
+    if(!buffered)
+        return complete ? -1 : 0;
+
+    qint64 read = 0;
+    while(read < maxlen && !chunks.isEmpty())
+    {
+        const QByteArray& chunk = chunks.first();
+        const qint64 n = qMin(maxlen - read, qint64(chunk.size() - chunkOffset));
+        std::memcpy(data + read, chunk.constData() + chunkOffset, size_t(n));
+        read += n;
+        chunkOffset += int(n);
+
+        if(chunkOffset == chunk.size())
+        {
+            chunks.removeFirst();
+            chunkOffset = 0;
+        }
+    }
+
+    buffered -= read;
+    return read;
+}
+
+qint64 QDropbox2ZipEntry::writeData(const char* /*data*/, qint64 /*len*/)
+{
+    return -1;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QIODevice>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QString>
+
+#include "qdropbox2global.h"
+
+class QDropbox2Inflater;
+
+//! Decodes a zip archive incrementally, as it arrives
+/*!
+  QDropbox2ZipReader takes an archive in pieces of any size, through
+  addData(), and reports each entry as soon as its bytes are decoded: an
+  entry starts with signal_entryStarted(), its content follows in one or
+  more signal_entryData() calls, and signal_entryFinished() ends it once its
+  CRC-32 has been checked.  Only the part of the archive that cannot be
+  decoded yet is held, so an archive of any size can be extracted while it
+  is being downloaded.
+
+  Archives are read front to back, from their local headers; the central
+  directory at the end is not needed and is skipped.  Entries may be stored
+  or deflated, and may have their sizes in a data descriptor after the
+  content (as archives created on the fly do), including Zip64 sizes.
+
+  \remark Encrypted entries, and compression methods other than deflate,
+  are reported as errors.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2ZipReader : public QObject
+{
+    Q_OBJECT
+
+public:
+    QDropbox2ZipReader(QObject* parent = 0);
+    ~QDropbox2ZipReader();
+
+    /*!
+      Decodes the next piece of the archive.
+
+      \returns <i>false</i> if the archive is invalid; decoding stops there.
+     */
+    bool    addData(const QByteArray& data);
+
+    /*!
+      Marks the end of the archive.
+
+      \returns <i>false</i> if the archive is invalid, or ended in the middle
+      of an entry.
+     */
+    bool    finish();
+
+    /*!
+      Indicates whether the last local header has been passed.
+     */
+    bool    atEnd() const                       { return state == Done; }
+
+    bool    hasError() const                    { return state == Failed; }
+    QString errorString() const                 { return lastErrorMessage; }
+
+    /*!
+      Returns the number of entries decoded so far.
+     */
+    int     entries() const                     { return entryCount; }
+
+signals:
+    /*!
+      Emitted when the header of an entry has been decoded.
+
+      \param name Path of the entry within the archive, with '/' separators.
+      \param is_dir Whether the entry is a folder (its name ends with '/').
+     */
+    void    signal_entryStarted(const QString& name, bool is_dir);
+
+    /*!
+      Emitted with the next piece of the content of the current entry.
+     */
+    void    signal_entryData(const QByteArray& data);
+
+    /*!
+      Emitted when the content of the current entry is complete, and its
+      checksum has been verified.
+     */
+    void    signal_entryFinished();
+
+private:        // typedefs and enums
+    enum State
+    {
+        LocalHeader,
+        Stored,             // sizes known up front
+        StoredUntilDescriptor,
+        Deflated,
+        Descriptor,
+        Done,
+        Failed
+    };
+
+private:        // methods
+    bool    process();
+    bool    readHeader();
+    bool    readStored();
+    bool    scanStored();
+    bool    readDeflated();
+    bool    readDescriptor();
+    bool    endEntry(quint32 crc, quint64 size);
+    void    output(const char* data, int len);
+    bool    fail(const QString& message);
+
+    int     available() const                   { return pending.size() - offset; }
+    const uchar* at(int pos) const              { return reinterpret_cast<const uchar*>(pending.constData()) + offset + pos; }
+
+private:        // data members
+    State       state;
+    bool        ended;
+
+    QByteArray  pending;                        // received, not yet decoded
+    int         offset;                         // decoded part of pending
+
+    // the current entry
+    quint16     flags;
+    quint32     expectedCrc;
+    quint64     compressedSize;
+    quint64     uncompressedSize;
+    bool        zip64;
+    quint64     consumed;                       // compressed bytes so far
+    quint64     produced;                       // uncompressed bytes so far
+    quint32     crc;
+
+    QScopedPointer<QDropbox2Inflater> inflater;
+
+    int         entryCount;
+    QString     lastErrorMessage;
+};
+
+//! A zip entry handed out as a sequential QIODevice while it is decoded
+/*!
+  The content is appended as the archive arrives, and readyRead() is emitted
+  for each piece; readChannelFinished() is emitted once the entry is
+  complete.  Content that has not been read yet is held in memory.
+ */
+class QDROPBOXSHARED_EXPORT QDropbox2ZipEntry : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    QDropbox2ZipEntry(const QString& name, QObject* parent = 0);
+
+    QString name() const                        { return _name; }
+
+    /*!
+      Indicates whether the whole entry has been decoded.
+     */
+    bool    isComplete() const                  { return complete; }
+
+    bool    isSequential() const override       { return true; }
+    bool    atEnd() const override              { return complete && buffered == 0 && QIODevice::atEnd(); }
+    qint64  bytesAvailable() const override     { return buffered + QIODevice::bytesAvailable(); }
+
+    void    appendData(const QByteArray& data);
+    void    setComplete();
+
+protected:
+    qint64  readData(char* data, qint64 maxlen) override;
+    qint64  writeData(const char* data, qint64 len) override;
+
+private:
+    QString             _name;
+    QList<QByteArray>   chunks;
+    int                 chunkOffset;            // read from the first chunk
+    qint64              buffered;
+    bool                complete;
+};
@@ -1,13 +1,47 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <random>
 
+#include <QBuffer>
+#include <QElapsedTimer>
 #include <QMap>
 #include <QFile>
+#include <QRunnable>
 #include <QTextStream>
 #include <QSharedPointer>
 #include <QSignalSpy>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "qtdropbox2test.h"
 
+#if defined(QDROPBOX2_BENCHMARKS)
+#include <cstdlib>
+#include <new>
+
+// count heap allocations so benchmarks can report more than wall time; the
+// count is per-thread so that it does not serialize multi-threaded benchmarks
+static thread_local quint64 allocation_count = 0;
+
+void* operator new(std::size_t size)
+{
+    ++allocation_count;
+    void* p = std::malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+#endif
+
 typedef QMap<QString, QSharedPointer<QDropbox2EntityInfo>> QDropbox2EntityInfoMap;
 
 QtDropbox2Test::QtDropbox2Test()
@@ -354,6 +388,32 @@ void QtDropbox2Test::moveFile()
     QVERIFY(db_file.move(to_name));
 }
 
+void QtDropbox2Test::serverSideCopy()
+{
+    QVERIFY(db2 != nullptr);
+
+    // Copy a file through a copy reference; the reference may just as well
+    // be saved by another account
+    QDropbox2File source(db_path, db2);
+    QDateTime expires;
+    QString reference = source.copyReference(&expires);
+    QVERIFY(!reference.isEmpty());
+    QVERIFY(expires.isValid());
+
+    QDropbox2File by_reference(QString("/QtDropbox2_3.%1").arg(suffix), db2);
+    QVERIFY(by_reference.saveCopyReference(reference));
+    QVERIFY(by_reference.remove());
+
+    // Have the server fetch a URL into a file
+    QUrl link = source.temporaryLink();
+    QVERIFY(link.isValid());
+
+    QDropbox2File by_url(QString("/QtDropbox2_4.%1").arg(suffix), db2);
+    QVERIFY(by_url.saveUrl(link));
+    QCOMPARE(by_url.metadata().bytes(), source.metadata().bytes());
+    QVERIFY(by_url.remove());
+}
+
 void QtDropbox2Test::getRevisions()
 {
     QVERIFY(db2 != nullptr);
@@ -393,6 +453,10 @@ void QtDropbox2Test::getLink()
     QUrl url = db_file.temporaryLink();
     QVERIFY(url.isValid());
     qDebug() << url.toDisplayString() << endl;
+
+    // a second request is answered from the link cache
+    QCOMPARE(db2->linkCache()->count(), 1);
+    QCOMPARE(db_file.temporaryLink(), url);
 }
 
 void QtDropbox2Test::search()
@@ -428,6 +492,39 @@ void QtDropbox2Test::search()
     //}
 }
 
+void QtDropbox2Test::searchPages()
+{
+    QVERIFY(db2 != nullptr);
+
+    // Search a folder, page by page, for files of the test file's extension
+    QFileInfo info(db_path);
+    QDropbox2Folder db_folder(info.path(), db2);
+
+    QDropbox2Folder::SearchFilter filter;
+    filter.extensions.append(suffix);
+    filter.filenameOnly = true;
+
+    QEventLoop loop;
+    int pages = 0;
+    bool found = false;
+    connect(&db_folder, &QDropbox2Folder::signal_searchPage, [&](const QDropbox2Folder::EntryList& entries, bool has_more) {
+        ++pages;
+        foreach(const QDropbox2Entry& entry, entries)
+            found = found || entry.path.compare(db_path, Qt::CaseInsensitive) == 0;
+        if(!has_more)
+            loop.quit();
+    });
+    connect(&db_folder, &QDropbox2Folder::signal_errorOccurred, &loop, &QEventLoop::quit);
+
+    // one result per page, to go through the continuation
+    QVERIFY(db_folder.searchPages(info.completeBaseName(), filter, 1));
+    loop.exec();
+
+    QCOMPARE(db_folder.error(), 0);
+    QVERIFY(pages > 0);
+    QVERIFY(found);
+}
+
 void QtDropbox2Test::downloadFile()
 {
     QVERIFY(db2 != nullptr);
@@ -470,6 +567,32 @@ void QtDropbox2Test::downloadFile()
     //out.flush();
 }
 
+void QtDropbox2Test::downloadFileCached()
+{
+    QVERIFY(db2 != nullptr);
+
+    QTemporaryDir cache_dir;
+    QVERIFY(cache_dir.isValid());
+    QCOMPARE(db2->enableContentCache(cache_dir.path()), true);
+
+    // the first open populates the cache...
+    {
+        QDropbox2File db_file(db_path, db2);
+        QCOMPARE(db_file.open(QIODevice::ReadOnly), true);
+        db_file.close();
+    }
+    QVERIFY(db2->contentCache()->size() > 0);
+
+    // ...and the second is served from it
+    QDropbox2File db_file(db_path, db2);
+    QCOMPARE(db_file.open(QIODevice::ReadOnly), true);
+    QByteArray data = db_file.readAll();
+    QCOMPARE(md5, QCryptographicHash::hash(data, QCryptographicHash::Md5));
+    db_file.close();
+
+    db2->disableContentCache();
+}
+
 void QtDropbox2Test::removeFile()
 {
     QVERIFY(db2 != nullptr);
@@ -492,4 +615,3230 @@ void QtDropbox2Test::removeFile()
 }
 #endif      // QDROPBOX2_FILE_TESTS
 
+namespace
+{
+    // answers every HTTP request with the same JSON body after a fixed delay,
+    // standing in for the round trip to the Dropbox servers
+    class StubServer : public QTcpServer
+    {
+    public:
+        StubServer(int delay, const QByteArray& body)
+            : delay(delay), body(body), bandwidth(0.0), lossPerMB(0.0), random(1), received(0), waiting(0), mostWaiting(0) {}
+
+        QUrl url() const
+        {
+            QUrl url;
+            url.setScheme("http");
+            url.setHost(serverAddress().toString());
+            url.setPort(serverPort());
+            return url;
+        }
+
+        // answers the next request with this instead, adding the given
+        // header lines; queued answers are used in order
+        void queue(int status, const QByteArray& response, const QByteArray& headers = QByteArray())
+        {
+            queued.append(Answer{status, response, headers});
+        }
+
+        // answers every request for this path with this instead, ahead of
+        // the queued answers
+        void answer(const QByteArray& path, int status, const QByteArray& response)
+        {
+            routes[path] = Answer{status, response, QByteArray()};
+        }
+
+        // drops the bodies of requests for this path as they arrive, keeping
+        // only their sizes and Dropbox-API-Arg headers; for uploads too large
+        // to hold
+        void discard(const QByteArray& path)
+        {
+            discarded[path] = QList<Discarded>();
+        }
+
+        // emulates a link: each answer is further delayed by the time its
+        // request body takes at 'bandwidth' bytes per msec (unless zero), and
+        // a request fails with a 503 with a chance that grows with its size
+        void setLink(double bandwidth, double lossPerMB)
+        {
+            this->bandwidth = bandwidth;
+            this->lossPerMB = lossPerMB;
+        }
+
+        // keeps the body of every request for this path, not just the latest
+        void record(const QByteArray& path)
+        {
+            recorded[path] = QList<QByteArray>();
+        }
+
+        int requests() const        { return received; }
+
+        // the requests for a path, and the body of the latest of them
+        int requests(const QByteArray& path) const      { return counts.value(path); }
+        QByteArray lastBody(const QByteArray& path) const { return bodies.value(path); }
+
+        // the bodies of the requests for a recorded path, in order of arrival
+        QList<QByteArray> recordedBodies(const QByteArray& path) const { return recorded.value(path); }
+
+        // the most requests that were waiting for their answer at once
+        int mostConcurrent() const  { return mostWaiting; }
+
+        // the requests for a discarded path, in order of arrival
+        struct Discarded
+        {
+            qint64      size;
+            QByteArray  arg;
+        };
+        QList<Discarded> discardedRequests(const QByteArray& path) const { return discarded.value(path); }
+
+    protected:
+        void incomingConnection(qintptr handle) override
+        {
+            QTcpSocket* socket = new QTcpSocket(this);
+            socket->setSocketDescriptor(handle);
+            QSharedPointer<Connection> connection(new Connection{QByteArray(), QByteArray(), 0, 0});
+            connect(socket, &QTcpSocket::readyRead, socket, [this, socket, connection]() {
+                QByteArray& pending = connection->pending;
+                pending.append(socket->readAll());
+                for(;;)
+                {
+                    if(connection->skip > 0)
+                    {
+                        // the rest of a discarded body
+                        const qint64 n = qMin(connection->skip, qint64(pending.size()));
+                        pending.remove(0, int(n));
+                        connection->skip -= n;
+                        if(connection->skip > 0)
+                            return;
+                        respond(socket, connection->path, connection->length);
+                    }
+
+                    int header_end = pending.indexOf("\r\n\r\n");
+                    if(header_end < 0)
+                        return;
+                    const QByteArray header = pending.left(header_end);
+                    const qint64 length = headerValue(header, "content-length").toLongLong();
+                    const QByteArray path = pending.left(pending.indexOf("\r\n")).split(' ').value(1);
+
+                    if(discarded.contains(path))
+                    {
+                        discarded[path].append(Discarded{length, headerValue(header, "dropbox-api-arg")});
+                        const qint64 available = qMin(length, qint64(pending.size() - header_end - 4));
+                        pending.remove(0, header_end + 4 + int(available));
+                        connection->path = path;
+                        connection->length = length;
+                        connection->skip = length - available;
+                        if(connection->skip > 0)
+                            return;
+                        respond(socket, path, length);
+                        continue;
+                    }
+
+                    if(pending.size() < header_end + 4 + length)
+                        return;
+                    bodies[path] = pending.mid(header_end + 4, int(length));
+                    if(recorded.contains(path))
+                        recorded[path].append(bodies[path]);
+                    pending.remove(0, header_end + 4 + int(length));
+                    respond(socket, path, length);
+                }
+            });
+            connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        }
+
+    private:
+        struct Answer
+        {
+            int         status;
+            QByteArray  response;
+            QByteArray  headers;
+        };
+
+        // what has arrived on a connection, and the request whose body is
+        // being discarded, if any
+        struct Connection
+        {
+            QByteArray  pending;
+            QByteArray  path;
+            qint64      length;
+            qint64      skip;
+        };
+
+        static QByteArray headerValue(const QByteArray& header, const QByteArray& name)
+        {
+            const int field = header.toLower().indexOf("\r\n" + name + ":");
+            if(field < 0)
+                return QByteArray();
+            const int begin = field + name.size() + 3;
+            return header.mid(begin, header.indexOf("\r\n", begin) - begin).trimmed();
+        }
+
+        // answers a request that has been received in full
+        void respond(QTcpSocket* socket, const QByteArray& path, qint64 length)
+        {
+            ++counts[path];
+            ++received;
+            mostWaiting = qMax(mostWaiting, ++waiting);
+            const double p_lost = 1.0 - std::exp(-lossPerMB * length / (1024.0 * 1024.0));
+            const Answer answer = (lossPerMB > 0.0 && uniform(random) < p_lost) ? Answer{503, "{}", QByteArray()} :
+                                  routes.contains(path) ? routes.value(path) :
+                                  (queued.isEmpty() ? Answer{200, body, QByteArray()} : queued.takeFirst());
+            const int wait = delay + (bandwidth > 0.0 ? int(length / bandwidth) : 0);
+            QTimer::singleShot(wait, socket, [this, socket, answer]() {
+                --waiting;
+                socket->write("HTTP/1.1 " + QByteArray::number(answer.status) + " Stub\r\n" + answer.headers +
+                              "Content-Type: application/json\r\nContent-Length: "
+                              + QByteArray::number(answer.response.size()) + "\r\n\r\n" + answer.response);
+            });
+        }
+
+        int         delay;
+        QByteArray  body;
+        double      bandwidth;
+        double      lossPerMB;
+        std::mt19937 random;
+        std::uniform_real_distribution<double> uniform;
+        QList<Answer> queued;
+        QMap<QByteArray, Answer> routes;
+        QMap<QByteArray, int> counts;
+        QMap<QByteArray, QByteArray> bodies;
+        QMap<QByteArray, QList<QByteArray>> recorded;
+        QMap<QByteArray, QList<Discarded>> discarded;
+        int         received;
+        int         waiting;
+        int         mostWaiting;
+    };
+
+    const char* const StubAccount = "{\"account_id\": \"dbid:AAH4f99T0taONIb-OurWxbNQ6ywGRopQngc\", "
+                                    "\"name\": {\"display_name\": \"Stub\"}, \"email\": \"stub@example.com\", "
+                                    "\"country\": \"US\", \"referral_link\": \"https://db.tt/ZITNuhtI\"}";
+
+    // issues blocking requests on a pool thread, through that thread's own
+    // transport of a shared QDropbox2
+    class UserInfoTask : public QRunnable
+    {
+    public:
+        UserInfoTask(QDropbox2* api, int iterations, QAtomicInt* failures)
+            : api(api), iterations(iterations), failures(failures) {}
+
+        void run() override
+        {
+            for(int i = 0;i < iterations;++i)
+            {
+                QDropbox2User user;
+                if(!api->userInfo(user) || api->error() != QDropbox2::NoError || user.displayName() != "Stub")
+                    failures->ref();
+            }
+        }
+
+    private:
+        QDropbox2*  api;
+        int         iterations;
+        QAtomicInt* failures;
+    };
+
+    // runs the tasks of a pool while this thread's event loop keeps serving
+    // a StubServer
+    void waitForPool(QThreadPool& pool)
+    {
+        while(!pool.waitForDone(1))
+            QCoreApplication::processEvents();
+    }
+
+    class NoTokenTask : public QRunnable
+    {
+    public:
+        NoTokenTask(QDropbox2* api, int* error) : api(api), error(error) {}
+
+        void run() override
+        {
+            QNetworkRequest req;
+            api->createAPIv2Reqeust(QUrl(QDROPBOX2_API_URL), req);
+            *error = api->error();
+        }
+
+    private:
+        QDropbox2*  api;
+        int*        error;
+    };
+
+    class SubmitTask : public QRunnable
+    {
+    public:
+        SubmitTask(QDropbox2Engine* engine, int count, QObject* receiver, QAtomicInt* finished)
+            : engine(engine), count(count), receiver(receiver), finished(finished) {}
+
+        void run() override
+        {
+            // nothing listens on the discard port, so each request fails fast
+            QNetworkRequest req(QUrl("http://127.0.0.1:9/"));
+            for(int i = 0;i < count;++i)
+            {
+                QDropbox2EngineReply* reply = engine->post(req, QByteArray("{}"));
+                // this pool thread has no event loop; deliver to the receiver's
+                reply->moveToThread(receiver->thread());
+                QAtomicInt* counter = finished;
+                QObject::connect(reply, &QDropbox2EngineReply::signal_finished, receiver, [reply, counter]() {
+                    counter->ref();
+                    reply->deleteLater();
+                });
+            }
+        }
+
+    private:
+        QDropbox2Engine*    engine;
+        int                 count;
+        QObject*            receiver;
+        QAtomicInt*         finished;
+    };
+
+    class TraceTask : public QRunnable
+    {
+    public:
+        TraceTask(QDropbox2Tracer* tracer, int count) : tracer(tracer), count(count) {}
+
+        void run() override
+        {
+            for(int i = 0;i < count;++i)
+            {
+                quint64 id = tracer->begin("longpoll");
+                tracer->end(id, "longpoll");
+            }
+        }
+
+    private:
+        QDropbox2Tracer*    tracer;
+        int                 count;
+    };
+
+    // a stand-in for the server: each chunk costs a round trip plus its
+    // transfer time, and fails with a chance that grows with its size; time
+    // is simulated, so the links take no time to test
+    struct Link
+    {
+        const char* name;
+        double      rtt;            // msecs
+        double      bandwidth;      // bytes per msec
+        double      lossPerMB;      // failures per MB sent
+    };
+
+    const Link Links[] = {
+        { "long fat pipe",    300.0,  10000.0,  0.0    },
+        { "fast LAN",           5.0, 200000.0,  0.0    },
+        { "lossy long haul",  300.0,  10000.0,  0.002  },
+        { "lossy broadband",   50.0,  50000.0,  0.01   },
+    };
+
+    // returns the goodput in MB/s of uploading 'total' bytes, in chunks of
+    // 'fixed' bytes or of the sizes the controller chooses
+    double simulateUpload(const Link& link, qint64 total, qint64 fixed, QDropbox2ChunkController* controller)
+    {
+        std::mt19937 random(1);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+        double elapsed = 0.0;
+        qint64 sent = 0;
+        while(sent < total)
+        {
+            const qint64 chunk = qMin(controller ? controller->chunkSize() : fixed, total - sent);
+            const double msecs = link.rtt + chunk / link.bandwidth * (0.95 + 0.1 * uniform(random));
+            const double p_fail = 1.0 - std::exp(-link.lossPerMB * chunk / (1024.0 * 1024.0));
+
+            elapsed += msecs;
+            if(uniform(random) < p_fail)
+            {
+                if(controller)
+                    controller->recordFailure(chunk);
+            }
+            else
+            {
+                sent += chunk;
+                if(controller)
+                    controller->recordSuccess(chunk, qint64(msecs));
+            }
+        }
+
+        return total / (1024.0 * 1024.0) / (elapsed / 1000.0);
+    }
+
+    // a synchronized tree of folders of files, and changes on both sides as
+    // a local scan and list_folder would deliver them; in all but the last
+    // ten folders, six files are changed, and two folders are removed
+    void makeSyncChanges(int folders, int files, QDropbox2Sync::RecordMap& records,
+                         QDropbox2Sync::LocalChanges& local, QDropbox2Sync::RemoteChanges& remote)
+    {
+        records.reserve(folders * (files + 1));
+        for(int d = 0;d < folders;++d)
+        {
+            QDropbox2Sync::Record dir;
+            dir.path = QString("Dir%1").arg(d);
+            dir.isDir = true;
+            records.insert(QDropbox2Sync::key(dir.path), dir);
+
+            for(int j = 0;j < files;++j)
+            {
+                QDropbox2Sync::Record file;
+                file.path = QString("Dir%1/File%2.txt").arg(d).arg(j);
+                file.size = 100;
+                file.modified = 1000;
+                file.hash = QString("h%1-%2").arg(d).arg(j);
+                file.rev = "r1";
+                records.insert(QDropbox2Sync::key(file.path), file);
+            }
+        }
+
+        for(int d = 0;d < folders - 10;++d)
+        {
+            auto changeLocal = [&](int j, bool exists, const QString& hash, qint64 modified)
+            {
+                QDropbox2Sync::LocalChange change;
+                change.path = QString("Dir%1/File%2.txt").arg(d).arg(j);
+                change.exists = exists;
+                change.size = 100;
+                change.modified = modified;
+                change.hash = hash;
+                local.insert(QDropbox2Sync::key(change.path), change);
+            };
+            auto changeRemote = [&](int j, const QString& hash, const QString& rev)
+            {
+                QDropbox2Sync::RemoteChange change;
+                change.path = QString("Dir%1/File%2.txt").arg(d).arg(j);
+                change.type = QDropbox2Entry::File;
+                change.size = 100;
+                change.hash = hash;
+                change.rev = rev;
+                remote.insert(QDropbox2Sync::key(change.path), change);
+            };
+
+            changeLocal(0, true, QString("local%1").arg(d), 2000);      // modified here
+            changeLocal(1, true, QString("h%1-1").arg(d), 2000);        // touched
+            changeLocal(2, false, QString(), 0);                        // removed here
+            changeRemote(3, QString("remote%1").arg(d), "r2");          // modified there
+            changeRemote(4, QString("h%1-4").arg(d), "r2");             // our own upload, echoed
+            changeLocal(5, true, QString("both%1").arg(d), 2000);       // modified on both sides,
+            changeRemote(5, QString((d % 2) ? "other%1" : "both%1").arg(d), "r2");  // half identically
+        }
+
+        // a folder removed there, and one removed here
+        QDropbox2Sync::RemoteChange removed;
+        removed.path = QString("Dir%1").arg(folders - 2);
+        remote.insert(QDropbox2Sync::key(removed.path), removed);
+
+        QDropbox2Sync::LocalChange gone;
+        gone.path = QString("Dir%1").arg(folders - 3);
+        gone.isDir = true;
+        local.insert(QDropbox2Sync::key(gone.path), gone);
+    }
+
+    // writes 'count' files of up to 1000 bytes into twenty folders
+    QString localTreePath(int i)        { return QString("d%1/f%2").arg(i % 20).arg(i); }
+    QByteArray localTreeContent(int i)  { return QByteArray(i % 1000 + 1, char('a' + i % 26)); }
+
+    bool makeLocalTree(const QString& root, int count)
+    {
+        for(int i = 0;i < count;++i)
+        {
+            const QString path = root + "/" + localTreePath(i);
+            QDir().mkpath(QFileInfo(path).absolutePath());
+            QFile file(path);
+            if(!file.open(QIODevice::WriteOnly))
+                return false;
+            file.write(localTreeContent(i));
+        }
+        return true;
+    }
+
+    // a recursive listing of the tree makeLocalTree() writes, as found under
+    // /Sync: its folders, every 'every'-th of its files with the content of
+    // the local one, and 'extra' files only the server has
+    QByteArray localTreeListing(int count, int every, int extra)
+    {
+        QByteArray entries = "{\".tag\": \"folder\", \"path_lower\": \"/sync\", \"path_display\": \"/Sync\"}";
+        for(int d = 0;d < qMin(count, 20);++d)
+            entries += QString(", {\".tag\": \"folder\", \"path_lower\": \"/sync/d%1\", \"path_display\": \"/Sync/d%1\"}").arg(d).toUtf8();
+        for(int i = 0;i < count;i += every)
+        {
+            QDropbox2ContentHasher hasher;
+            hasher.addData(localTreeContent(i));
+            entries += QString(", {\".tag\": \"file\", \"path_lower\": \"/sync/%1\", \"path_display\": \"/Sync/%1\", "
+                               "\"size\": %2, \"content_hash\": \"%3\", \"rev\": \"r1\"}")
+                           .arg(localTreePath(i)).arg(localTreeContent(i).size()).arg(hasher.result()).toUtf8();
+        }
+        for(int i = 0;i < extra;++i)
+            entries += QString(", {\".tag\": \"file\", \"path_lower\": \"/sync/d0/r%1\", \"path_display\": \"/Sync/d0/r%1\", "
+                               "\"size\": 6, \"content_hash\": \"%2\", \"rev\": \"r1\"}").arg(i).arg(QString(64, '0')).toUtf8();
+        return "{\"entries\": [" + entries + "], \"cursor\": \"c1\", \"has_more\": false}";
+    }
+
+    QString snapshotHash(int i)     { return QString("%1").arg(i, 64, 16, QChar('0')); }
+    QString snapshotPath(int i)     { return QString("Backup/Folder%1/File%2.dat").arg(i / 100).arg(i); }
+
+    // a remote listing of 'count' files, a hundred to a folder, and a local
+    // scan of the same tree where one in a hundred files was deleted, one
+    // modified and one added; both arrive unsorted
+    void makeSnapshots(int count, QDropbox2Snapshot& remote, QDropbox2Snapshot& local)
+    {
+        const int stride = 7919;            // coprime with count; shuffles the order
+
+        remote.reserve(count, count * 40);
+        local.reserve(count, count * 40);
+
+        for(int n = 0;n < count;++n)
+        {
+            const int i = int((qint64(n) * stride) % count);
+            const QString path = snapshotPath(i);
+
+            remote.append(path, false, 1000 + i % 7, -1, snapshotHash(i));
+
+            if(i % 100 == 1)
+                continue;                                                   // deleted here
+            if(i % 100 == 2)
+                local.append(path, false, 1000 + i % 7, -1, snapshotHash(i + 1));  // modified here
+            else
+                local.append(path, false, 1000 + i % 7, -1, snapshotHash(i));
+            if(i % 100 == 3)
+                local.append(path + ".new", false, 10);                     // added here
+        }
+    }
+
+    // a hundred files to a folder, five levels down
+    QString archivePath(int i)
+    {
+        return QString("/Team Archive/Projects/Project%1/Assets/Folder%2/File%3.dat")
+                .arg(i / 100000).arg(i / 100).arg(i);
+    }
+
+    const QDateTime TimestampStart(QDate(2015, 5, 12), QTime(15, 50, 38), Qt::UTC);
+
+    // the timestamps of a listing, a few seconds apart
+    QVector<QString> makeTimestamps(int count)
+    {
+        QVector<QString> stamps(count);
+        for(int i = 0;i < count;++i)
+            stamps[i] = TimestampStart.addSecs(qint64(i) * 97).toString("yyyy-MM-ddTHH:mm:ssZ");
+        return stamps;
+    }
+
+    quint32 zipCrc32(const QByteArray& data)
+    {
+        quint32 crc = 0xffffffffu;
+        for(char c : data)
+        {
+            crc ^= uchar(c);
+            for(int k = 0;k < 8;++k)
+                crc = (crc & 1) ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+        }
+        return ~crc;
+    }
+
+    void zipValue(QByteArray& out, quint64 value, int bytes)
+    {
+        for(int i = 0;i < bytes;++i)
+            out.append(char((value >> (8 * i)) & 0xff));
+    }
+
+    QByteArray zipContent(int i)
+    {
+        return QByteArray("line of file ").append(QByteArray::number(i)).append('\n').repeated(1 + i % 50);
+    }
+
+    // appends an entry whose content is already encoded, with its sizes in
+    // the local header or in a data descriptor after the content, and in
+    // their Zip64 form if asked
+    void addEncodedZipEntry(QByteArray& archive, const QString& name, const QByteArray& data,
+                            const QByteArray& compressed, int method, bool zip64, bool descriptor)
+    {
+        const QByteArray encoded = name.toUtf8();
+        const quint32 crc = zipCrc32(data);
+        zipValue(archive, 0x04034b50, 4);
+        zipValue(archive, zip64 ? 45 : 20, 2);
+        zipValue(archive, descriptor ? 0x0808 : 0x0800, 2); // UTF-8 name
+        zipValue(archive, quint64(method), 2);
+        zipValue(archive, 0, 4);                    // time and date
+        zipValue(archive, descriptor ? 0 : crc, 4);
+        if(zip64)
+            zipValue(archive, Q_UINT64_C(0xffffffffffffffff), 8);
+        else
+        {
+            zipValue(archive, descriptor ? 0 : quint64(compressed.size()), 4);
+            zipValue(archive, descriptor ? 0 : quint64(data.size()), 4);
+        }
+        zipValue(archive, quint64(encoded.size()), 2);
+        zipValue(archive, zip64 ? 20 : 0, 2);
+        archive.append(encoded);
+        if(zip64)
+        {
+            zipValue(archive, 0x0001, 2);
+            zipValue(archive, 16, 2);
+            zipValue(archive, descriptor ? 0 : quint64(data.size()), 8);
+            zipValue(archive, descriptor ? 0 : quint64(compressed.size()), 8);
+        }
+        archive.append(compressed);
+        if(descriptor)
+        {
+            zipValue(archive, 0x08074b50, 4);
+            zipValue(archive, crc, 4);
+            zipValue(archive, quint64(compressed.size()), zip64 ? 8 : 4);
+            zipValue(archive, quint64(data.size()), zip64 ? 8 : 4);
+        }
+    }
+
+    // appends an entry the way download_zip writes it: with the sizes in a
+    // data descriptor after the content
+    void addZipEntry(QByteArray& archive, const QString& name, const QByteArray& data, bool deflate)
+    {
+        // qCompress() is a zlib stream behind a 4-byte length; the raw
+        // deflate data is between its 2-byte header and 4-byte trailer
+        const QByteArray zlib = qCompress(data);
+        const QByteArray compressed = deflate ? zlib.mid(6, zlib.size() - 10) : data;
+        addEncodedZipEntry(archive, name, data, compressed, deflate ? 8 : 0, false, true);
+    }
+
+    // deflate data of stored blocks (BTYPE 00), each of them holding one of
+    // the pieces, which may be empty; the last block ends the stream if final
+    QByteArray storedBlocks(const QList<QByteArray>& pieces, bool final = true)
+    {
+        QByteArray stream;
+        for(int i = 0;i < pieces.count();++i)
+        {
+            zipValue(stream, (final && i + 1 == pieces.count()) ? 1 : 0, 1);
+            zipValue(stream, quint64(pieces[i].size()), 2);
+            zipValue(stream, quint64(~pieces[i].size() & 0xffff), 2);
+            stream.append(pieces[i]);
+        }
+        return stream;
+    }
+
+    // a folder of 'count' files, one in ten of them stored, and the total
+    // size of their content
+    QByteArray makeZipArchive(int count, qint64& total)
+    {
+        QByteArray archive;
+        addZipEntry(archive, "Folder/", QByteArray(), false);
+        total = 0;
+        for(int i = 0;i < count;++i)
+        {
+            const QByteArray data = zipContent(i);
+            addZipEntry(archive, QString("Folder/Sub%1/File%2.txt").arg(i / 1000).arg(i), data, i % 10 != 0);
+            total += data.size();
+        }
+        zipValue(archive, 0x06054b50, 4);           // the central directory is not read
+        archive.append(QByteArray(18, '\0'));
+        return archive;
+    }
+
+    // feeds an archive in network-sized pieces, which split headers, codes
+    // and descriptors; returns false if an entry did not match zipContent()
+    bool readZipArchive(const QByteArray& archive, int& entries, qint64& received)
+    {
+        QDropbox2ZipReader reader;
+        int started = 0;
+        int finished = 0;
+        QByteArray current;
+        bool matches = true;
+        received = 0;
+        QObject::connect(&reader, &QDropbox2ZipReader::signal_entryStarted, [&](const QString&, bool) { ++started; current.clear(); });
+        QObject::connect(&reader, &QDropbox2ZipReader::signal_entryData, [&](const QByteArray& data) { current += data; received += data.size(); });
+        QObject::connect(&reader, &QDropbox2ZipReader::signal_entryFinished, [&]() {
+            if(finished > 0)
+                matches = matches && current == zipContent(finished - 1);
+            ++finished;
+        });
+
+        for(int pos = 0;pos < archive.size();pos += 1460)
+            matches = reader.addData(archive.mid(pos, 1460)) && matches;
+        matches = reader.finish() && reader.atEnd() && matches;
+
+        entries = (started == finished) ? finished : -1;
+        return matches;
+    }
+
+    // feeds an archive in pieces of the given size, and collects its
+    // entries; returns false if the reader reported an error
+    bool readZipEntries(const QByteArray& archive, int piece, QStringList& names, QList<QByteArray>& contents)
+    {
+        QDropbox2ZipReader reader;
+        QObject::connect(&reader, &QDropbox2ZipReader::signal_entryStarted, [&](const QString& name, bool) { names.append(name); contents.append(QByteArray()); });
+        QObject::connect(&reader, &QDropbox2ZipReader::signal_entryData, [&](const QByteArray& data) { contents.last() += data; });
+
+        for(int pos = 0;pos < archive.size();pos += piece)
+        {
+            if(!reader.addData(archive.mid(pos, piece)))
+                return false;
+        }
+        return reader.finish();
+    }
+
+    QByteArray thumbnailImage(int i)
+    {
+        QByteArray data(20000 + i % 4096, '\0');
+        for(int k = 0;k < data.size();++k)
+            data[k] = char((k * 31 + i) & 0xff);
+        return data;
+    }
+
+    QJsonObject thumbnailMetadata(int i)
+    {
+        QJsonObject json;
+        json.insert(".tag", QString("file"));
+        json.insert("path_display", QString("/Photos/IMG_%1.jpg").arg(i));
+        json.insert("id", QString("id:thumb%1").arg(i));
+        json.insert("rev", QString("0123456789a%1").arg(i));
+        return json;
+    }
+
+    // a get_thumbnail_batch response for a batch of thumbnails
+    QByteArray thumbnailResponse(int batch)
+    {
+        QJsonArray entries;
+        for(int k = 0;k < QDropbox2Thumbnails::BatchSize;++k)
+        {
+            const int i = batch * QDropbox2Thumbnails::BatchSize + k;
+            QJsonObject entry;
+            entry.insert(".tag", QString("success"));
+            entry.insert("metadata", thumbnailMetadata(i));
+            entry.insert("thumbnail", QString::fromLatin1(thumbnailImage(i).toBase64()));
+            entries.append(entry);
+        }
+        QJsonObject response;
+        response.insert("entries", entries);
+        return QJsonDocument(response).toJson(QJsonDocument::Compact);
+    }
+}
+
+void QtDropbox2Test::jsonWriter()
+{
+    // quotes, a backslash, a control character, Latin-1 and a non-BMP character
+    const QString path = QString::fromUtf8("/Caf\xc3\xa9 \"quoted\"\\dir\t/\xf0\x9f\x93\x81 file.txt");
+    QJsonParseError jsonError;
+
+    QDropbox2JsonWriter body(path.size());
+    body.beginObject()
+            .value("path", path)
+            .value("mode", "overwrite")
+            .value("autorename", true)
+            .value("limit", quint64(10))
+        .endObject();
+    QJsonDocument json = QJsonDocument::fromJson(body.data(), &jsonError);
+    QCOMPARE(jsonError.error, QJsonParseError::NoError);
+    QCOMPARE(json.object().value("path").toString(), path);
+    QCOMPARE(json.object().value("limit").toInt(), 10);
+
+    // header values must be plain ASCII, and still decode to the same path
+    QDropbox2JsonWriter header(path.size(), QDropbox2JsonWriter::AsciiSafe);
+    header.beginObject()
+            .value("path", path)
+        .endObject();
+    foreach(char c, header.data())
+        QVERIFY(c >= 0x20 && c < 0x7f);
+    json = QJsonDocument::fromJson(header.data(), &jsonError);
+    QCOMPARE(jsonError.error, QJsonParseError::NoError);
+    QCOMPARE(json.object().value("path").toString(), path);
+}
+
+void QtDropbox2Test::metadataCache()
+{
+    QDropbox2MetadataCache cache(1000, 1024*1024);
+    cache.addRoot("/Watched");
+
+    QList<QDropbox2Entry> page;
+    for(int i = 0;i < 1000;++i)
+    {
+        QDropbox2Entry entry;
+        entry.type  = QDropbox2Entry::File;
+        entry.id    = QString("id:a4ayc_80_OEAAAAAAAAA%1").arg(i);
+        entry.path  = QString("/Watched/file_%1.txt").arg(i);
+        entry.rev   = QString("a1c10ce0dd%1").arg(i);
+        entry.bytes = quint64(i);
+        page.append(entry);
+    }
+    cache.apply(page);
+    QCOMPARE(cache.count(), 1000);
+
+    // lookups are case-insensitive, and only cover the watched folder
+    QDropbox2Entry entry;
+    QVERIFY(cache.lookup("/watched/FILE_42.txt", entry));
+    QCOMPARE(entry.bytes, quint64(42));
+    QVERIFY(!cache.isCovered("/Elsewhere/file_42.txt"));
+    QVERIFY(!cache.isCovered("/Watched/sub/file_42.txt"));
+
+    // a response that raced with a delta must not overwrite it
+    quint64 generation = cache.generation();
+    QDropbox2Entry deleted = page.at(7);
+    deleted.type = QDropbox2Entry::Deleted;
+    cache.apply(QList<QDropbox2Entry>() << deleted);
+    cache.insert(page.at(7), generation);
+    QVERIFY(cache.lookup("/Watched/file_7.txt", entry));
+    QCOMPARE(entry.type, QDropbox2Entry::Deleted);
+
+    // bounded by entry count, least recently used first
+    cache.setLimits(500, 1024*1024);
+    QCOMPARE(cache.count(), 500);
+    QVERIFY(cache.lookup("/Watched/file_7.txt", entry));
+    QVERIFY(cache.lookup("/Watched/file_42.txt", entry));
+    QVERIFY(!cache.lookup("/Watched/file_0.txt", entry));
+
+    cache.removeRoot("/Watched");
+    QCOMPARE(cache.count(), 0);
+}
+
+void QtDropbox2Test::linkCache()
+{
+    qint64 now = Q_INT64_C(1500000000000);
+    QDropbox2LinkCache cache;
+    cache.setClock([&now]() { return now; });
+
+    // a link is served until shortly before the four hours the server
+    // keeps it alive
+    const QUrl link("https://dl.dropboxusercontent.com/apitl/1/stub");
+    QUrl found;
+    cache.insert("/Folder/File.txt", "r1", link);
+    now += qint64(QDropbox2LinkCache::DefaultLifetime) * 1000 - 1;
+    QVERIFY(now < Q_INT64_C(1500000000000) + 4 * 60 * 60 * 1000);
+    QVERIFY(cache.lookup("/Folder/File.txt", "r1", found));
+    QCOMPARE(found, link);
+    ++now;
+    QVERIFY(!cache.lookup("/Folder/File.txt", "r1", found));
+    QCOMPARE(cache.count(), 0);
+
+    // paths are not case-sensitive; another revision is a miss, and drops
+    // the link
+    cache.insert("/Folder/File.txt", "r1", link);
+    QVERIFY(cache.lookup("/FOLDER/file.TXT", QString(), found));
+    QVERIFY(!cache.lookup("/folder/file.txt", "r2", found));
+    QVERIFY(!cache.lookup("/folder/file.txt", QString(), found));
+
+    // invalidating a file drops its link, and a folder those beneath it
+    cache.insert("/Folder/a", "r1", link);
+    cache.insert("/Folder/Sub/b", "r1", link);
+    cache.insert("/Other/c", "r1", link);
+    cache.invalidate("/folder/A");
+    QCOMPARE(cache.count(), 2);
+    cache.invalidate("/FOLDER");
+    QCOMPARE(cache.count(), 1);
+    QVERIFY(cache.lookup("/Other/c", "r1", found));
+
+    // expired links are swept once the table has doubled
+    cache.clear();
+    cache.setLifetime(60);
+    for(int i = 0;i < 63;++i)
+        cache.insert(QString("/old%1").arg(i), "r1", link);
+    now += 60 * 1000;
+    QCOMPARE(cache.count(), 63);
+    cache.insert("/new", "r1", link);
+    QCOMPARE(cache.count(), 1);
+
+    // prefetching asks only for links not cached, and reports how many it added
+    StubServer server(0, "{\"metadata\": {\"rev\": \"r7\"}, \"link\": \"https://dl.dropboxusercontent.com/apitl/1/new\"}");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+    api.linkCache()->insert("/Cached", "r1", link);
+
+    QSignalSpy prefetched(&api, SIGNAL(signal_temporaryLinksPrefetched(int)));
+    QSignalSpy errors(&api, SIGNAL(signal_errorOccurred(int,QString)));
+    QVERIFY(api.prefetchTemporaryLinks(QStringList() << "/a" << "/cached" << "/b"));
+    QTRY_COMPARE_WITH_TIMEOUT(prefetched.count(), 1, 10000);
+    QCOMPARE(prefetched.last().first().toInt(), 2);
+    QCOMPARE(server.requests("/2/files/get_temporary_link"), 2);
+    QVERIFY(api.linkCache()->lookup("/A", "r7", found));
+    QCOMPARE(found, QUrl("https://dl.dropboxusercontent.com/apitl/1/new"));
+
+    // with everything cached, at once and without a request
+    QVERIFY(api.prefetchTemporaryLinks(QStringList() << "/a" << "/b"));
+    QCOMPARE(prefetched.count(), 2);
+    QCOMPARE(prefetched.last().first().toInt(), 0);
+    QCOMPARE(server.requests(), 2);
+
+    // and a link that could not be had is not counted
+    server.queue(409, "{\"error_summary\": \"path/not_found/\"}");
+    QVERIFY(api.prefetchTemporaryLinks(QStringList() << "/missing" << "/c"));
+    QTRY_COMPARE_WITH_TIMEOUT(prefetched.count(), 3, 10000);
+    QCOMPARE(prefetched.last().first().toInt(), 1);
+    QCOMPARE(errors.count(), 1);
+    QCOMPARE(server.requests(), 4);
+}
+
+void QtDropbox2Test::threadErrors()
+{
+    // error state belongs to the thread that caused it
+    QDropbox2 api;
+    int worker_error = QDropbox2::NoError;
+    QThreadPool pool;
+    pool.start(new NoTokenTask(&api, &worker_error));
+    pool.waitForDone();
+    QCOMPARE(worker_error, int(QDropbox2::APIError));
+    QCOMPARE(api.error(), QDropbox2::NoError);
+}
+
+void QtDropbox2Test::concurrentRequests()
+{
+    // blocking requests from several threads at once, each through its own
+    // transport, are all answered
+    StubServer server(5, StubAccount);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    QAtomicInt failures;
+    QThreadPool pool;
+    pool.setMaxThreadCount(4);
+    for(int i = 0;i < 4;++i)
+        pool.start(new UserInfoTask(&api, 5, &failures));
+    waitForPool(pool);
+    QCOMPARE(failures.load(), 0);
+
+    // an instance destroyed while the pool's threads still hold its transports
+    // leaves them to those threads, which go on serving another instance
+    QDropbox2* gone = new QDropbox2("not-a-real-token");
+    gone->setServerOverride(server.url());
+    for(int i = 0;i < 4;++i)
+        pool.start(new UserInfoTask(gone, 1, &failures));
+    waitForPool(pool);
+    delete gone;
+
+    for(int i = 0;i < 4;++i)
+        pool.start(new UserInfoTask(&api, 2, &failures));
+    waitForPool(pool);
+    QCOMPARE(failures.load(), 0);
+    QCOMPARE(server.requests(), 4 * 5 + 4 + 4 * 2);
+}
+
+void QtDropbox2Test::engineSubmission()
+{
+    QDropbox2Engine engine(2);
+
+    // results are parsed off the I/O thread and delivered on the submitting thread
+    QDropbox2EngineReply* reply = engine.post(QNetworkRequest(QUrl("http://127.0.0.1:9/")), QByteArray("{}"),
+                                              [](const QByteArray& data) { return QVariant(data.size()); });
+    QSignalSpy spy(reply, &QDropbox2EngineReply::signal_finished);
+    QVERIFY(spy.wait(10000));
+    QVERIFY(reply->isFinished());
+    QVERIFY(reply->error() != QNetworkReply::NoError);
+    delete reply;
+
+    // requests submitted from several threads are all answered
+    QAtomicInt finished;
+    QObject receiver;
+    QThreadPool pool;
+    for(int i = 0;i < 4;++i)
+        pool.start(new SubmitTask(&engine, 10, &receiver, &finished));
+    pool.waitForDone();
+    QTRY_COMPARE_WITH_TIMEOUT(finished.load(), 40, 30000);
+}
+
+void QtDropbox2Test::requestMetrics()
+{
+    // bucket bounds are inclusive upper limits
+    QDropbox2Metrics::Histogram histogram;
+    histogram.add(0);
+    histogram.add(5);
+    histogram.add(6);
+    histogram.add(1000000);
+    QCOMPARE(histogram.count, quint64(4));
+    QCOMPARE(histogram.buckets[0], quint64(2));
+    QCOMPARE(histogram.buckets[1], quint64(1));
+    QCOMPARE(histogram.buckets.last(), quint64(1));
+    QCOMPARE(histogram.max, qint64(1000000));
+
+    // nothing listens on the discard port, so every request fails quickly
+    QSharedPointer<QDropbox2Metrics> metrics = QSharedPointer<QDropbox2Metrics>::create();
+    QAtomicInt observed;
+    metrics->setObserver([&observed](const QDropbox2Metrics::Sample&) { observed.ref(); });
+
+    QDropbox2Engine engine(2);
+    engine.setMetrics(metrics);
+
+    const int requests = 20;
+    QList<QDropbox2EngineReply*> replies;
+    for(int i = 0;i < requests;++i)
+        replies.append(engine.post(QNetworkRequest(QUrl("http://127.0.0.1:9/2/files/get_metadata")), QByteArray("{}")));
+
+    QTRY_COMPARE_WITH_TIMEOUT(observed.load(), requests, 30000);
+
+    QMap<QString, QDropbox2Metrics::Endpoint> snapshot = metrics->snapshot();
+    QVERIFY(snapshot.contains("/2/files/get_metadata"));
+
+    const QDropbox2Metrics::Endpoint& endpoint = snapshot["/2/files/get_metadata"];
+    QCOMPARE(endpoint.requests, quint64(requests));
+    QCOMPARE(endpoint.inFlight, 0);
+    QCOMPARE(endpoint.errors.value(QNetworkReply::ConnectionRefusedError), quint64(requests));
+    QCOMPARE(endpoint.latency[QDropbox2Metrics::Total].count, quint64(requests));
+    QCOMPARE(endpoint.latency[QDropbox2Metrics::Handshake].count, quint64(0));
+
+    metrics->reset();
+    QVERIFY(metrics->snapshot().isEmpty());
+
+    // a reply deleted in flight, or aborted and then deleted, is counted
+    // once, and no longer in flight
+    QNetworkAccessManager manager;
+    QNetworkReply* deleted = manager.post(QNetworkRequest(QUrl("http://127.0.0.1:9/2/files/download")), QByteArray());
+    metrics->track(deleted);
+    QCOMPARE(metrics->inFlight(), 1);
+    delete deleted;
+    QCOMPARE(metrics->inFlight(), 0);
+
+    QNetworkReply* aborted = manager.post(QNetworkRequest(QUrl("http://127.0.0.1:9/2/files/download")), QByteArray());
+    metrics->track(aborted);
+    aborted->abort();
+    delete aborted;
+    QCOMPARE(metrics->inFlight(), 0);
+
+    const QDropbox2Metrics::Endpoint cancelled = metrics->snapshot().value("/2/files/download");
+    QCOMPARE(cancelled.requests, quint64(2));
+    QCOMPARE(cancelled.inFlight, 0);
+    QCOMPARE(cancelled.errors.value(QNetworkReply::OperationCanceledError), quint64(2));
+
+    QTRY_VERIFY_WITH_TIMEOUT(std::all_of(replies.begin(), replies.end(),
+                                         [](QDropbox2EngineReply* r) { return r->isFinished(); }), 10000);
+    qDeleteAll(replies);
+}
+
+void QtDropbox2Test::traceExport()
+{
+    QDropbox2Tracer tracer;
+
+    // an upload session as QDropbox2File::putFile() records it
+    quint64 id = tracer.begin("putFile", {{"path", "/test.bin"}, {"bytes", 3 * 1024 * 1024}});
+    tracer.step(id, "upload_session/start");
+    tracer.end(id, "upload_session/start", {{"status", 200}});
+    tracer.step(id, "upload_session/finish", {{"offset", 0}, {"bytes", 3 * 1024 * 1024}});
+    tracer.end(id, "upload_session/finish", {{"status", 200}});
+    tracer.end(id, "putFile", {{"error", 0}});
+    QCOMPARE(tracer.count(), 6);
+
+    QJsonParseError jsonError;
+    QJsonDocument json = QJsonDocument::fromJson(tracer.toChromeTrace(), &jsonError);
+    QCOMPARE(jsonError.error, QJsonParseError::NoError);
+
+    QJsonArray events = json.object().value("traceEvents").toArray();
+    QCOMPARE(events.count(), 6);
+    QCOMPARE(events[0].toObject().value("ph").toString(), QString("b"));
+    QCOMPARE(events[0].toObject().value("args").toObject().value("path").toString(), QString("/test.bin"));
+    QCOMPARE(events[5].toObject().value("ph").toString(), QString("e"));
+    foreach(const QJsonValue& event, events)
+        QCOMPARE(event.toObject().value("id").toString(), QString("0x%1").arg(id, 0, 16));
+
+    // events beyond the limit are counted, not kept
+    QDropbox2Tracer bounded(2);
+    bounded.begin("contents");
+    bounded.begin("contents");
+    bounded.begin("contents");
+    QCOMPARE(bounded.count(), 2);
+    QCOMPARE(bounded.dropped(), 1);
+
+    // no event recorded from several threads at once is lost
+    tracer.clear();
+    QThreadPool pool;
+    pool.setMaxThreadCount(4);
+    for(int i = 0;i < 4;++i)
+        pool.start(new TraceTask(&tracer, 1000));
+    pool.waitForDone();
+    QCOMPARE(tracer.count(), 4 * 1000 * 2);
+}
+
+void QtDropbox2Test::fileRead()
+{
+    // Truncate needs no download; the file is never closed, since close()
+    // would upload it
+    QDropbox2File file("/test.bin", nullptr);
+    QVERIFY(file.open(QIODevice::ReadWrite | QIODevice::Truncate));
+
+    const quint32 values = 64 * 1024;
+    {
+        QDataStream out(&file);
+        for(quint32 i = 0;i < values;++i)
+            out << i;
+    }
+    file.write("first\nsecond\n");
+
+    // QDataStream-style small reads
+    file.reset();
+    QDataStream in(&file);
+    quint32 value = 0;
+    bool in_order = true;
+    for(quint32 i = 0;i < values;++i)
+    {
+        in >> value;
+        in_order &= (value == i);
+    }
+    QVERIFY(in_order);
+    QCOMPARE(file.bytesAvailable(), qint64(13));
+
+    QCOMPARE(file.readLine(), QByteArray("first\n"));
+    QCOMPARE(file.peekShared(), QByteArray("second\n"));
+    QCOMPARE(file.readLine(), QByteArray("second\n"));
+    QVERIFY(file.atEnd());
+
+    // the whole content is handed out without a copy
+    file.reset();
+    QByteArray all = file.peekShared();
+    QCOMPARE(all.size(), int(values * sizeof(quint32) + 13));
+    QCOMPARE(file.readAllShared().constData(), all.constData());
+    QCOMPARE(file.bytesAvailable(), qint64(0));
+
+    // but only a range that is exactly one block of the buffer
+    QVERIFY(file.seek(4));
+    QByteArray rest = file.peekShared();
+    QCOMPARE(rest, all.mid(4));
+    QVERIFY(file.peekShared().constData() != rest.constData());
+}
+
+void QtDropbox2Test::chunkedWrite()
+{
+    // overwrite-at-position semantics, across a block boundary
+    QDropbox2ChunkedBuffer small(4);
+    small.write(0, "abcdefghij", 10);
+    QCOMPARE(small.blockCount(), 3);
+    QCOMPARE(small.write(3, "XYZ", 3), qint64(3));
+    QCOMPARE(small.write(10, "kl", 2), qint64(2));
+    QCOMPARE(small.write(13, "m", 1), qint64(-1));
+    QCOMPARE(small.toByteArray(), QByteArray("abcXYZghijkl"));
+
+    char line[16];
+    small.write(small.size(), "\nrest", 5);
+    QCOMPARE(small.readLine(0, line, sizeof(line)), qint64(13));
+    QCOMPARE(QByteArray(line, 13), QByteArray("abcXYZghijkl\n"));
+
+    // a reader sees a snapshot, and is unaffected by later writes
+    QScopedPointer<QIODevice> reader(small.createReader(2, 6));
+    small.write(2, "______", 6);
+    QCOMPARE(reader->size(), qint64(6));
+    QCOMPARE(reader->readAll(), QByteArray("cXYZgh"));
+    QVERIFY(reader->reset());
+    QCOMPARE(reader->read(3), QByteArray("cXY"));
+
+    // whole blocks are handed out shared
+    QDropbox2ChunkedBuffer buffer;
+    QByteArray block(QDropbox2ChunkedBuffer::DefaultBlockSize, 'x');
+    buffer.write(0, block.constData(), block.size());
+    buffer.write(buffer.size(), block.constData(), block.size());
+    QByteArray first = buffer.mid(0, block.size());
+    QCOMPARE(buffer.mid(0, block.size()).constData(), first.constData());
+    QCOMPARE(buffer.blockCount(), 2);
+}
+
+void QtDropbox2Test::spillBuffer()
+{
+    // content beyond the budget goes to disk, oldest first
+    QDropbox2ChunkedBuffer buffer(1024);
+    buffer.setMemoryBudget(4 * 1024);
+
+    QByteArray expected;
+    for(int i = 0;i < 64;++i)
+    {
+        QByteArray block(1024, char('a' + i % 26));
+        buffer.write(buffer.size(), block.constData(), block.size());
+        expected.append(block);
+    }
+
+    QVERIFY(buffer.memoryUsage() <= 4 * 1024);
+    QCOMPARE(buffer.spilled() + buffer.memoryUsage(), buffer.size());
+    QCOMPARE(buffer.toByteArray(), expected);
+
+    // overwriting spilled content goes to the spill file
+    buffer.write(10, "0123456789", 10);
+    expected.replace(10, 10, "0123456789");
+    QCOMPARE(buffer.mid(0, 100), expected.left(100));
+
+    // a reader streams spilled and in-memory blocks alike
+    QScopedPointer<QIODevice> reader(buffer.createReader(1000, 60 * 1024));
+    QCOMPARE(reader->readAll(), expected.mid(1000, 60 * 1024));
+
+    // uploaded content is released, and can no longer be touched
+    buffer.discard(32 * 1024 + 10);
+    QCOMPARE(buffer.discarded(), qint64(32 * 1024));
+    QCOMPARE(buffer.spilled() + buffer.memoryUsage(), qint64(32 * 1024));
+    char byte;
+    QCOMPARE(buffer.read(100, &byte, 1), qint64(0));
+    QCOMPARE(buffer.write(100, "x", 1), qint64(-1));
+    QCOMPARE(buffer.mid(32 * 1024), expected.mid(32 * 1024));
+}
+
+void QtDropbox2Test::streamFailure()
+{
+    // the first chunk opens the session, the second fails
+    StubServer server(0, "{}");
+    server.queue(200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    server.queue(500, "{\"error_summary\": \"internal_error/\"}");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    // enough for the second chunk whether the first made the controller
+    // double the size, keep it or halve it
+    const int chunk = QDropbox2ChunkController().chunkSize();
+    QDropbox2File file("/stream.bin", &api);
+    file.setFlushThreshold(QDropbox2ChunkController::Unit);
+    QSignalSpy errors(&file, SIGNAL(signal_errorOccurred(int, QString)));
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+
+    const QByteArray content(3 * chunk + 100, 'x');
+    QCOMPARE(file.write(content), qint64(content.size()));
+    QTRY_COMPARE_WITH_TIMEOUT(errors.count(), 1, 10000);
+    QCOMPARE(server.requests(), 2);
+
+    // the first chunk is gone from the buffer, so nothing is sent again
+    QVERIFY(!file.flush());
+    QVERIFY(!file.flush());
+    QCOMPARE(file.write("more"), qint64(-1));
+    file.close();
+    QCOMPARE(server.requests(), 2);
+
+    // until the file is written anew
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QCOMPARE(file.write("small"), qint64(5));
+    QVERIFY(file.flush());
+    QCOMPARE(server.requests(), 3);
+}
+
+void QtDropbox2Test::contentHash()
+{
+    // the reference: SHA-256 over the SHA-256 of each 4 MB block
+    const int block_size = QDropbox2ContentHasher::BlockSize;
+    QByteArray content(2 * block_size + 12345, Qt::Uninitialized);
+    for(int i = 0;i < content.size();++i)
+        content[i] = char(i * 31 + (i >> 13));
+
+    QCryptographicHash overall(QCryptographicHash::Sha256);
+    for(int i = 0;i < content.size();i += block_size)
+        overall.addData(QCryptographicHash::hash(content.mid(i, block_size), QCryptographicHash::Sha256));
+    const QString expected = QString::fromLatin1(overall.result().toHex());
+
+    // pieces that straddle block boundaries make no difference
+    QDropbox2ContentHasher hasher;
+    for(int i = 0;i < content.size();i += 1000003)
+        hasher.addData(content.mid(i, 1000003));
+    QCOMPARE(hasher.result(), expected);
+
+    QBuffer buffer(&content);
+    buffer.open(QIODevice::ReadOnly);
+    QCOMPARE(QDropbox2ContentHasher::hash(&buffer), expected);
+
+    // empty content hashes no blocks at all
+    hasher.reset();
+    QCOMPARE(hasher.result(), QString::fromLatin1(QCryptographicHash::hash(QByteArray(), QCryptographicHash::Sha256).toHex()));
+}
+
+void QtDropbox2Test::uploadPipeline()
+{
+    const int chunk = QDropbox2ChunkController::Unit;
+    QByteArray content(5 * chunk + 1000, Qt::Uninitialized);
+    for(int i = 0;i < content.size();++i)
+        content[i] = char(i * 31 + (i >> 13));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString local = dir.path() + "/upload.bin";
+    QFile file(local);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(content);
+    file.close();
+
+    // a slow link, on which the second chunk fails once
+    StubServer server(50, "{}");
+    server.queue(200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    server.queue(503, "{}");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    QDropbox2Upload upload(local, "/upload.bin", &api);
+    upload.setChunkSize(chunk);
+    upload.setQueueDepth(1);
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(upload.upload());
+    QVERIFY(timer.elapsed() >= QDropbox2Upload::RetryDelay);
+    QDropbox2ContentHasher hasher;
+    hasher.addData(content);
+    QCOMPARE(upload.contentHash(), hasher.result());
+
+    // six chunks, one of them sent twice
+    QCOMPARE(server.requests(), 7);
+    QCOMPARE(upload.stageStats(QDropbox2Upload::Read).chunks, qint64(6));
+    QCOMPARE(upload.stageStats(QDropbox2Upload::Hash).chunks, qint64(6));
+    QCOMPARE(upload.stageStats(QDropbox2Upload::Send).chunks, qint64(6));
+    QCOMPARE(upload.stageStats(QDropbox2Upload::Send).bytes, qint64(content.size()));
+
+    // reading is far faster than sending, so it waited for room in the queue
+    QVERIFY(upload.stageStats(QDropbox2Upload::Read).stalled > 0);
+
+    // a refusal is final
+    StubServer refusing(0, "{}");
+    refusing.queue(409, "{\"error_summary\": \"path/conflict/file/\"}");
+    QVERIFY(refusing.listen(QHostAddress::LocalHost));
+    api.setServerOverride(refusing.url());
+
+    QDropbox2Upload single(local, "/upload.bin", &api);
+    single.setChunkSize(QDropbox2ChunkController::maximumChunkSize());
+    QVERIFY(!single.upload());
+    QCOMPARE(single.error(), int(QDROPBOX_V2_ERROR));
+    QCOMPARE(single.errorString(), QString("path/conflict/file/"));
+    QCOMPARE(refusing.requests(), 1);
+
+    // and a transient failure is retried only so often, as late as the
+    // server asks
+    StubServer failing(0, "{}");
+    failing.queue(429, "{}", "Retry-After: 1\r\n");
+    for(int i = 0;i < QDropbox2Upload::MaxRetries;++i)
+        failing.queue(503, "{}", "Retry-After: 0\r\n");
+    QVERIFY(failing.listen(QHostAddress::LocalHost));
+    api.setServerOverride(failing.url());
+
+    timer.start();
+    QVERIFY(!single.upload());
+    QVERIFY(timer.elapsed() >= 1000);
+    QCOMPARE(failing.requests(), QDropbox2Upload::MaxRetries + 1);
+
+    // resent chunks that had arrived the first time are turned away for
+    // their offset: an append is taken as done, and a finish sends only
+    // what is missing
+    StubServer lossy(0, "{}");
+    lossy.queue(200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    lossy.queue(503, "{}", "Retry-After: 0\r\n");
+    lossy.queue(409, QString("{\"error_summary\": \"incorrect_offset/\", \"error\": "
+                             "{\".tag\": \"incorrect_offset\", \"correct_offset\": %1}}").arg(2 * chunk).toUtf8());
+    for(int i = 0;i < 3;++i)
+        lossy.queue(200, "{}");
+    lossy.queue(503, "{}", "Retry-After: 0\r\n");
+    lossy.queue(409, QString("{\"error_summary\": \"lookup_failed/incorrect_offset/\", \"error\": {\".tag\": \"lookup_failed\", "
+                             "\"lookup_failed\": {\".tag\": \"incorrect_offset\", \"correct_offset\": %1}}}").arg(content.size()).toUtf8());
+    lossy.discard("/2/files/upload_session/finish");
+    QVERIFY(lossy.listen(QHostAddress::LocalHost));
+    api.setServerOverride(lossy.url());
+
+    QVERIFY(upload.upload());
+    QCOMPARE(lossy.requests(), 9);
+    QCOMPARE(lossy.requests("/2/files/upload_session/append_v2"), 5);
+    QCOMPARE(upload.stageStats(QDropbox2Upload::Send).chunks, qint64(6));
+    QCOMPARE(upload.stageStats(QDropbox2Upload::Send).bytes, qint64(content.size()));
+
+    const QList<StubServer::Discarded> finishes = lossy.discardedRequests("/2/files/upload_session/finish");
+    QCOMPARE(finishes.count(), 3);
+    QCOMPARE(finishes[1].size, qint64(1000));
+    QCOMPARE(finishes[2].size, qint64(0));
+    QCOMPARE(QJsonDocument::fromJson(finishes[2].arg).object().value("cursor").toObject().value("offset").toDouble(),
+             double(content.size()));
+
+    // but not if the session is somewhere the chunk cannot account for
+    StubServer lost(0, "{}");
+    lost.queue(200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    lost.queue(503, "{}", "Retry-After: 0\r\n");
+    lost.queue(409, "{\"error_summary\": \"incorrect_offset/\", \"error\": {\".tag\": \"incorrect_offset\", \"correct_offset\": 0}}");
+    QVERIFY(lost.listen(QHostAddress::LocalHost));
+    api.setServerOverride(lost.url());
+
+    QVERIFY(!upload.upload());
+    QCOMPARE(upload.error(), int(QDROPBOX_V2_ERROR));
+    QCOMPARE(upload.errorString(), QString("incorrect_offset/"));
+    QCOMPARE(lost.requests(), 3);
+}
+
+void QtDropbox2Test::chunkController()
+{
+    const qint64 total = qint64(2) * 1024 * 1024 * 1024;
+
+    for(const Link& link : Links)
+    {
+        QDropbox2ChunkController controller;
+
+        const double largest = simulateUpload(link, total, QDropbox2ChunkController::maximumChunkSize(), nullptr);
+        const double smallest = simulateUpload(link, total, QDropbox2ChunkController::Unit, nullptr);
+        const double adaptive = simulateUpload(link, total, 0, &controller);
+
+        // within reach of the better fixed size, whichever that is for the link
+        QVERIFY(adaptive >= 0.85 * qMax(largest, smallest));
+        if(link.lossPerMB > 0.0)
+            QVERIFY(controller.chunkSize() < QDropbox2ChunkController::maximumChunkSize());
+    }
+
+    // the simulation above only stands in for these: real uploads through a
+    // server that delays its answers as a link would
+    const int chunk = QDropbox2ChunkController::Unit;
+    QByteArray content(16 * chunk, Qt::Uninitialized);
+    for(int i = 0;i < content.size();++i)
+        content[i] = char(i * 7 + (i >> 11));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString local = dir.path() + "/upload.bin";
+    QFile file(local);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(content);
+    file.close();
+
+    QDropbox2ContentHasher hasher;
+    hasher.addData(content);
+
+    // where the round trip dominates, the chunks grow to amortise it
+    StubServer slow(200, "{}");
+    slow.answer("/2/files/upload_session/start", 200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    slow.setLink(50000.0, 0.0);
+    QVERIFY(slow.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(slow.url());
+
+    QDropbox2Upload adaptive(local, "/upload.bin", &api);
+    QVERIFY(adaptive.upload());
+    QCOMPARE(adaptive.contentHash(), hasher.result());
+    QVERIFY(adaptive.chunkController()->chunkSize() > 2 * chunk);
+    QVERIFY(adaptive.chunkController()->overhead() > 100.0);
+
+    // and every chunk that fails is measured, and sent again
+    StubServer failing(5, "{}");
+    failing.queue(200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    for(int i = 1;i <= 20;++i)
+        failing.queue(i % 3 ? 200 : 503, "{}", "Retry-After: 0\r\n");
+    QVERIFY(failing.listen(QHostAddress::LocalHost));
+    api.setServerOverride(failing.url());
+
+    QDropbox2Upload fixed(local, "/upload.bin", &api);
+    fixed.setChunkSize(chunk);
+    QVERIFY(fixed.upload());
+    QCOMPARE(fixed.contentHash(), hasher.result());
+    QCOMPARE(fixed.stageStats(QDropbox2Upload::Send).chunks, qint64(16));
+    QCOMPARE(failing.requests("/2/files/upload_session/append_v2"), 14 + 6);
+    QCOMPARE(failing.requests(), 16 + 6);
+    QVERIFY(fixed.chunkController()->failureRate() > 0.0);
+}
+
+void QtDropbox2Test::transferQueue()
+{
+    QDropbox2 api("not-a-real-token");
+    QDropbox2TransferManager manager(&api);
+
+    QMap<int, int> outcomes;
+    connect(&manager, &QDropbox2TransferManager::signal_jobFinished,
+            [&outcomes](int id, int errorcode, const QString&) { outcomes[id] = errorcode; });
+    QSignalSpy finished(&manager, SIGNAL(signal_finished(bool)));
+
+    // nothing starts until control returns to the event loop
+    const int count = 2000;
+    QList<int> ids;
+    for(int i = 0;i < count;++i)
+        ids.append(manager.download(QString("/file%1").arg(i), QString("file%1").arg(i), i % 4, (i % 100) ? 1024 : 64 * 1024 * 1024));
+
+    QCOMPARE(manager.pendingCount(), count);
+    QCOMPARE(manager.activeCount(), 0);
+    QCOMPARE(manager.bytesTotal(), qint64(count / 100) * 64 * 1024 * 1024 + qint64(count - count / 100) * 1024);
+
+    // a local file that does not exist is refused outright
+    QCOMPARE(manager.upload("/no/such/file", "/file"), 0);
+
+    QVERIFY(manager.setPriority(ids[5], 100));
+    QVERIFY(manager.cancel(ids[0]));
+    QCOMPARE(outcomes.value(ids[0]), int(QNetworkReply::OperationCanceledError));
+    QCOMPARE(manager.pendingCount(), count - 1);
+    QVERIFY(!manager.cancel(ids[0]));
+
+    // cancelling the queue finishes every job, and the queue as a whole
+    manager.slot_abort();
+    QCOMPARE(manager.pendingCount(), 0);
+    QCOMPARE(outcomes.count(), count);
+    QCOMPARE(manager.failedCount(), count);
+    QCOMPARE(finished.count(), 1);
+    QCOMPARE(finished.first().first().toBool(), false);
+    QCOMPARE(manager.bytesTotal(), qint64(0));
+}
+
+void QtDropbox2Test::transferScheduling()
+{
+    StubServer server(100, "{}");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QDropbox2TransferManager manager(&api);
+    QList<int> order;
+    int most = 0;
+    connect(&manager, &QDropbox2TransferManager::signal_jobFinished,
+            [&](int id, int errorcode, const QString&) {
+                // the finished job is no longer counted as active
+                most = qMax(most, manager.activeCount() + 1);
+                if(errorcode == 0)
+                    order.append(id);
+            });
+
+    // no more transfers in flight than allowed
+    manager.setMaxConcurrency(3);
+    for(int i = 0;i < 10;++i)
+        manager.download(QString("/file%1").arg(i), dir.path() + QString("/file%1").arg(i));
+    QTRY_COMPARE(manager.activeCount(), 3);
+    QCOMPARE(manager.pendingCount(), 7);
+    QVERIFY(manager.waitForFinished());
+    QCOMPARE(order.count(), 10);
+    QCOMPARE(most, 3);
+    QCOMPARE(server.requests(), 10);
+
+    QFile downloaded(dir.path() + "/file9");
+    QVERIFY(downloaded.open(QIODevice::ReadOnly));
+    QCOMPARE(downloaded.readAll(), QByteArray("{}"));
+    downloaded.close();
+
+    // each streamed transfer reserves its read buffer, and the budget holds
+    // back the jobs that do not fit
+    manager.setMaxConcurrency(16);
+    manager.setMemoryBudget(2 * QDropbox2TransferManager::StreamBufferSize);
+    most = 0;
+    for(int i = 0;i < 6;++i)
+        manager.download(QString("/file%1").arg(i), dir.path() + QString("/file%1").arg(i));
+    QTRY_COMPARE(manager.activeCount(), 2);
+    QCOMPARE(manager.memoryInUse(), qint64(2 * QDropbox2TransferManager::StreamBufferSize));
+    QCOMPARE(manager.pendingCount(), 4);
+    QVERIFY(manager.waitForFinished());
+    QCOMPARE(most, 2);
+    QCOMPARE(manager.memoryInUse(), qint64(0));
+
+    // but a job larger than the whole budget runs on its own
+    manager.setMemoryBudget(QDropbox2TransferManager::StreamBufferSize / 2);
+    most = 0;
+    for(int i = 0;i < 3;++i)
+        manager.download(QString("/file%1").arg(i), dir.path() + QString("/file%1").arg(i));
+    QVERIFY(manager.waitForFinished());
+    QCOMPARE(most, 1);
+
+    // an upload too large for a single request reserves its whole pipeline
+    const QString large = dir.path() + "/large.bin";
+    QFile sparse(large);
+    QVERIFY(sparse.open(QIODevice::WriteOnly));
+    QVERIFY(sparse.resize(qint64(MaxSingleUpload) + 1));
+    sparse.close();
+
+    manager.setMemoryBudget(QDropbox2TransferManager::DefaultMemoryBudget);
+    QVERIFY(manager.upload(large, "/large.bin") != 0);
+    QTRY_COMPARE(manager.activeCount(), 1);
+    QCOMPARE(manager.memoryInUse(), 5 * qint64(QDropbox2TransferManager::LargeUploadChunkSize));
+    manager.slot_abort();
+    QVERIFY(!manager.waitForFinished());
+    QCOMPARE(manager.memoryInUse(), qint64(0));
+
+    // higher priorities go first, and a job queued while another runs
+    // overtakes the lower priorities still waiting
+    manager.setMaxConcurrency(1);
+    order.clear();
+    QList<int> ids;
+    for(int i = 0;i < 4;++i)
+        ids.append(manager.download(QString("/file%1").arg(i), dir.path() + QString("/file%1").arg(i), (i == 3) ? 5 : 0));
+    QVERIFY(manager.setPriority(ids[1], 10));
+    QTRY_COMPARE(manager.activeCount(), 1);
+    QVERIFY(!manager.setPriority(ids[1], 0));
+    ids.append(manager.download("/file4", dir.path() + "/file4", 20));
+    QVERIFY(manager.waitForFinished());
+    QCOMPARE(order, QList<int>() << ids[1] << ids[4] << ids[3] << ids[0] << ids[2]);
+
+    // small files are not held up behind large ones queued before them:
+    // each kind gets one of the two slots
+    manager.setMaxConcurrency(2);
+    order.clear();
+    QSet<int> large_ids;
+    for(int i = 0;i < 4;++i)
+        large_ids.insert(manager.download(QString("/large%1").arg(i), dir.path() + QString("/large%1").arg(i), 0, 64 * 1024 * 1024));
+    for(int i = 0;i < 4;++i)
+        manager.download(QString("/small%1").arg(i), dir.path() + QString("/small%1").arg(i), 0, 1024);
+    QVERIFY(manager.waitForFinished());
+    QCOMPARE(order.count(), 8);
+    QVERIFY(large_ids.contains(order[0]) != large_ids.contains(order[1]));
+}
+
+void QtDropbox2Test::syncReconcile()
+{
+    const int folders = 100;
+    const int files = 10;
+
+    QDropbox2Sync::RecordMap records;
+    QDropbox2Sync::LocalChanges local;
+    QDropbox2Sync::RemoteChanges remote;
+    makeSyncChanges(folders, files, records, local, remote);
+    QCOMPARE(records.count(), folders * (files + 1));
+
+    QList<QDropbox2Sync::Action> actions = QDropbox2Sync::reconcile(records, local, remote);
+
+    const int changed = folders - 10;
+    QMap<int, int> counts;
+    foreach(const QDropbox2Sync::Action& action, actions)
+        ++counts[action.type];
+
+    QCOMPARE(counts.value(QDropbox2Sync::Upload), changed);
+    QCOMPARE(counts.value(QDropbox2Sync::Download), changed);
+    QCOMPARE(counts.value(QDropbox2Sync::Conflict), changed / 2);
+    QCOMPARE(counts.value(QDropbox2Sync::RemoveRemote), changed + 1);
+    QCOMPARE(counts.value(QDropbox2Sync::RemoveLocal), 1);
+    QCOMPARE(actions.count(), changed * 3 + changed / 2 + 2);
+
+    // what needs no transfer is recorded at once
+    QCOMPARE(records.value("dir0/file1.txt").modified, qint64(2000));
+    QCOMPARE(records.value("dir0/file4.txt").rev, QString("r2"));
+    QCOMPARE(records.value("dir0/file5.txt").hash, QString("both0"));
+    QCOMPARE(records.value("dir1/file5.txt").hash, QString("h1-5"));
+
+    // the conflict names the revision last synchronized
+    foreach(const QDropbox2Sync::Action& action, actions)
+    {
+        if(action.type == QDropbox2Sync::Conflict)
+            QCOMPARE(action.rev, QString("r1"));
+    }
+
+    // the state survives a restart
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString state = dir.path() + "/" + QDropbox2Sync::stateFileName();
+    QVERIFY(QDropbox2Sync::saveState(state, "/Sync", "cursor", records));
+
+    QString cursor;
+    QDropbox2Sync::RecordMap loaded;
+    QVERIFY(QDropbox2Sync::loadState(state, "/sync", cursor, loaded));
+    QCOMPARE(cursor, QString("cursor"));
+    QCOMPARE(loaded.count(), records.count());
+    QCOMPARE(loaded.value("dir7/file9.txt").hash, records.value("dir7/file9.txt").hash);
+
+    // a pass against a stand-in server, over a tree of which the server has
+    // every other file already, and a few the local side does not: only
+    // those are transferred
+    const int count = 2000;
+    const QString root = dir.path() + "/tree";
+    QVERIFY(makeLocalTree(root, count));
+
+    StubServer server(0, "{}");
+    server.answer("/2/files/list_folder", 200, localTreeListing(count, 2, 10));
+    server.answer("/2/files/list_folder/continue", 200, "{\"entries\": [], \"cursor\": \"c2\", \"has_more\": false}");
+    server.answer("/2/files/download", 200, "remote");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    QDropbox2Sync sync(root, "/Sync", &api);
+    QSignalSpy synchronized(&sync, SIGNAL(signal_synchronized(bool,int)));
+    QVERIFY(sync.synchronize());
+    QCOMPARE(synchronized.count(), 1);
+    QCOMPARE(synchronized.first().at(1).toInt(), count / 2 + 10);
+    QCOMPARE(server.requests("/2/files/upload"), count / 2);
+    QCOMPARE(server.requests("/2/files/download"), 10);
+    QCOMPARE(server.requests("/2/files/create_folder_v2"), 0);
+    QCOMPARE(sync.records().count(), 20 + count + 10);
+    QCOMPARE(sync.records().value("d0/f0").rev, QString("r1"));
+    QDropbox2ContentHasher hasher;
+    hasher.addData(localTreeContent(1));
+    QCOMPARE(sync.records().value("d1/f1").hash, hasher.result());
+    QVERIFY(QFile::exists(root + "/d0/r9"));
+
+    // the next pass only asks for the changes since
+    QVERIFY(sync.synchronize());
+    QCOMPARE(synchronized.count(), 2);
+    QCOMPARE(synchronized.last().at(1).toInt(), 0);
+    QCOMPARE(server.requests("/2/files/list_folder"), 1);
+    QCOMPARE(server.requests("/2/files/list_folder/continue"), 1);
+    QCOMPARE(server.requests("/2/files/upload"), count / 2);
+    QCOMPARE(server.requests("/2/files/download"), 10);
+    QVERIFY(!QDropbox2Sync::loadState(state, "/elsewhere", cursor, loaded));
+
+    // a local tree: the first scan finds every file, a rescan none of them
+    const int tree = 200;
+    const QString root = dir.path() + "/tree";
+    QVERIFY(makeLocalTree(root, tree));
+
+    QDropbox2Sync::RecordMap synced;
+    QDropbox2Sync::LocalChanges scanned;
+    QDropbox2Sync::scanLocal(root, QString(), true, synced, scanned);
+    QCOMPARE(scanned.count(), tree + 20);
+
+    // nothing on the other side: everything is to be sent
+    actions = QDropbox2Sync::reconcile(synced, scanned, QDropbox2Sync::RemoteChanges());
+    QCOMPARE(actions.count(), tree + 20);
+    foreach(const QDropbox2Sync::Action& action, actions)
+        synced.insert(action.key, action.record);
+
+    scanned.clear();
+    QDropbox2Sync::scanLocal(root, QString(), true, synced, scanned);
+    QVERIFY(scanned.isEmpty());
+
+    // a removed file is found by scanning its folder alone
+    QVERIFY(QFile::remove(root + "/d3/f3"));
+    QDropbox2Sync::scanLocal(root, "d3", false, synced, scanned);
+    QCOMPARE(scanned.count(), 1);
+    QVERIFY(!scanned.value("d3/f3").exists);
+}
+
+void QtDropbox2Test::mirrorRun()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(QDir().mkpath(dir.path() + "/sub"));
+
+    QMap<QString, QByteArray> contents;
+    contents["a.txt"]       = "alpha";
+    contents["b.txt"]       = "bravo";
+    contents["c.txt"]       = "charlie";
+    contents["sub/d.txt"]   = "delta";
+    contents["big.bin"]     = QByteArray(100, 'x');
+
+    QMap<QString, QString> hashes;
+    for(QMap<QString, QByteArray>::const_iterator it = contents.constBegin();it != contents.constEnd();++it)
+    {
+        QFile file(dir.path() + "/" + it.key());
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(it.value());
+
+        QDropbox2ContentHasher hasher;
+        hasher.addData(it.value());
+        hashes[it.key()] = hasher.result();
+    }
+
+    // a recursive listing of the mirror; the stale file has another content
+    auto listing = [&hashes](const QStringList& folders, const QStringList& files, const QString& stale) -> QByteArray {
+        QString entries = "{\".tag\": \"folder\", \"path_lower\": \"/mirror\", \"path_display\": \"/Mirror\"}";
+        foreach(const QString& name, folders)
+            entries += QString(", {\".tag\": \"folder\", \"path_lower\": \"/mirror/%1\", \"path_display\": \"/Mirror/%1\"}").arg(name);
+        foreach(const QString& name, files)
+            entries += QString(", {\".tag\": \"file\", \"path_lower\": \"/mirror/%1\", \"path_display\": \"/Mirror/%1\", "
+                               "\"content_hash\": \"%2\"}").arg(name).arg(name == stale ? QString(64, '0') : hashes.value(name));
+        return "{\"entries\": [" + entries.toUtf8() + "], \"cursor\": \"c\", \"has_more\": false}";
+    };
+
+    StubServer server(0, "{}");
+    server.answer("/2/files/list_folder", 200, listing(QStringList(), QStringList() << "a.txt" << "b.txt", "b.txt"));
+    server.answer("/2/files/create_folder_batch", 200, "{\".tag\": \"complete\", \"entries\": [{\".tag\": \"success\"}]}");
+    server.answer("/2/files/upload_session/start", 200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    server.answer("/2/files/upload_session/finish_batch", 200, "{\".tag\": \"complete\", \"entries\": "
+                  "[{\".tag\": \"success\"}, {\".tag\": \"success\"}, {\".tag\": \"success\"}]}");
+    server.answer("/2/files/upload", 200, "{}");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    // the run goes on after start() returns
+    QDropbox2Mirror mirror(dir.path(), "/Mirror", &api);
+    mirror.setLargeFileSize(64);
+    QSignalSpy finished(&mirror, SIGNAL(signal_finished(bool)));
+    QVERIFY(mirror.start());
+    QVERIFY(mirror.isRunning());
+    QTRY_COMPARE_WITH_TIMEOUT(finished.count(), 1, 10000);
+    QCOMPARE(finished.first().first().toBool(), true);
+
+    // the same file is skipped, the missing folder created, the small files
+    // committed together, and the large one uploaded on its own
+    QCOMPARE(mirror.filesTotal(), 5);
+    QCOMPARE(mirror.filesSkipped(), 1);
+    QCOMPARE(mirror.filesUploaded(), 4);
+    QCOMPARE(mirror.filesFailed(), 0);
+    QCOMPARE(mirror.foldersCreated(), 1);
+    QCOMPARE(server.requests("/2/files/create_folder_batch"), 1);
+    QCOMPARE(server.requests("/2/files/upload_session/start"), 3);
+    QCOMPARE(server.requests("/2/files/upload_session/finish_batch"), 1);
+    QCOMPARE(server.requests("/2/files/upload"), 1);
+
+    const QJsonArray paths = QJsonDocument::fromJson(server.lastBody("/2/files/create_folder_batch")).object().value("paths").toArray();
+    QCOMPARE(paths.count(), 1);
+    QCOMPARE(paths.first().toString(), QString("/Mirror/sub"));
+
+    // each entry commits its session at the end of the file
+    QMap<QString, qint64> committed;
+    foreach(const QJsonValue& value, QJsonDocument::fromJson(server.lastBody("/2/files/upload_session/finish_batch")).object().value("entries").toArray())
+    {
+        const QJsonObject cursor = value.toObject().value("cursor").toObject();
+        const QJsonObject commit = value.toObject().value("commit").toObject();
+        QCOMPARE(cursor.value("session_id").toString(), QString("AAAAAAAAAZE"));
+        QCOMPARE(commit.value("mode").toString(), QString("overwrite"));
+        committed[commit.value("path").toString()] = qint64(cursor.value("offset").toDouble());
+    }
+    QMap<QString, qint64> expected;
+    expected["/Mirror/b.txt"]       = contents["b.txt"].size();
+    expected["/Mirror/c.txt"]       = contents["c.txt"].size();
+    expected["/Mirror/sub/d.txt"]   = contents["sub/d.txt"].size();
+    QCOMPARE(committed, expected);
+
+    // once everything is in place, a run only lists
+    server.answer("/2/files/list_folder", 200, listing(QStringList("sub"), contents.keys(), QString()));
+    QVERIFY(mirror.run());
+    QCOMPARE(mirror.filesSkipped(), 5);
+    QCOMPARE(mirror.filesUploaded(), 0);
+    QCOMPARE(server.requests("/2/files/list_folder"), 2);
+    QCOMPARE(server.requests("/2/files/upload_session/start"), 3);
+
+    // and a file changed since it was mirrored is uploaded again
+    QFile changed(dir.path() + "/c.txt");
+    QVERIFY(changed.open(QIODevice::WriteOnly));
+    changed.write("charlie, again");
+    changed.close();
+
+    QVERIFY(mirror.run());
+    QCOMPARE(mirror.filesSkipped(), 4);
+    QCOMPARE(mirror.filesUploaded(), 1);
+    QCOMPARE(server.requests("/2/files/upload_session/finish_batch"), 2);
+    const QJsonArray entries = QJsonDocument::fromJson(server.lastBody("/2/files/upload_session/finish_batch")).object().value("entries").toArray();
+    QCOMPARE(entries.count(), 1);
+    QCOMPARE(entries.first().toObject().value("commit").toObject().value("path").toString(), QString("/Mirror/c.txt"));
+
+    // a run interrupted between two batch commits resumes after the
+    // committed batch: the server answers with a hash of its own, so a file
+    // is only skipped by way of the saved state, not by hashing it again
+    QTemporaryDir tree;
+    QVERIFY(tree.isValid());
+    QStringList names;
+    for(int i = 0;i < 6;++i)
+    {
+        names.append(QString("f%1.txt").arg(i));
+        QFile file(tree.path() + "/" + names.last());
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(names.last().toUtf8());
+    }
+
+    const QString stored(64, 'f');
+    StubServer resumable(0, "{}");
+    resumable.answer("/2/files/list_folder", 200, listing(QStringList(), QStringList(), QString()));
+    resumable.answer("/2/files/upload_session/start", 200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    resumable.answer("/2/files/upload_session/finish_batch", 200, QString("{\".tag\": \"complete\", \"entries\": "
+                     "[{\".tag\": \"success\", \"content_hash\": \"%1\"}, {\".tag\": \"success\", \"content_hash\": \"%1\"}]}")
+                     .arg(stored).toUtf8());
+    resumable.record("/2/files/upload_session/finish_batch");
+    QVERIFY(resumable.listen(QHostAddress::LocalHost));
+    api.setServerOverride(resumable.url());
+
+    // batchSize() files are committed at a time; stop once the first two are
+    QScopedPointer<QDropbox2Mirror> interrupted(new QDropbox2Mirror(tree.path(), "/Mirror", &api));
+    interrupted->setConcurrency(1);
+    interrupted->setBatchSize(2);
+    connect(interrupted.data(), &QDropbox2Mirror::signal_progress, [&]() {
+        if(interrupted->filesUploaded() == 2)
+            QMetaObject::invokeMethod(interrupted.data(), "slot_abort", Qt::QueuedConnection);
+    });
+    QVERIFY(!interrupted->run());
+    QCOMPARE(interrupted->filesUploaded(), 2);
+    interrupted.reset();
+
+    QStringList first;
+    foreach(const QJsonValue& value, QJsonDocument::fromJson(resumable.recordedBodies("/2/files/upload_session/finish_batch").first())
+                                         .object().value("entries").toArray())
+        first.append(value.toObject().value("commit").toObject().value("path").toString().section('/', -1));
+    QCOMPARE(first.count(), 2);
+
+    // the server now holds the committed files, and a new mirror of the
+    // same tree picks up the saved state
+    auto holding = [&](const QStringList& files) -> QByteArray {
+        QString entries = "{\".tag\": \"folder\", \"path_lower\": \"/mirror\", \"path_display\": \"/Mirror\"}";
+        foreach(const QString& name, files)
+            entries += QString(", {\".tag\": \"file\", \"path_lower\": \"/mirror/%1\", \"path_display\": \"/Mirror/%1\", "
+                               "\"content_hash\": \"%2\"}").arg(name).arg(stored);
+        return "{\"entries\": [" + entries.toUtf8() + "], \"cursor\": \"c\", \"has_more\": false}";
+    };
+    resumable.answer("/2/files/list_folder", 200, holding(first));
+    const int batches = resumable.recordedBodies("/2/files/upload_session/finish_batch").count();
+
+    QDropbox2Mirror resumed(tree.path(), "/Mirror", &api);
+    resumed.setBatchSize(2);
+    QVERIFY(resumed.run());
+    QCOMPARE(resumed.filesTotal(), 6);
+    QCOMPARE(resumed.filesSkipped(), 2);
+    QCOMPARE(resumed.filesUploaded(), 4);
+
+    QStringList rest;
+    foreach(const QByteArray& body, resumable.recordedBodies("/2/files/upload_session/finish_batch").mid(batches))
+        foreach(const QJsonValue& value, QJsonDocument::fromJson(body).object().value("entries").toArray())
+            rest.append(value.toObject().value("commit").toObject().value("path").toString().section('/', -1));
+    QCOMPARE(rest.count(), 4);
+    QStringList all = first + rest;
+    all.sort();
+    QCOMPARE(all, names);
+}
+
+void QtDropbox2Test::snapshotDiff()
+{
+    const int count = 10000;
+
+    QDropbox2Snapshot remote;
+    QDropbox2Snapshot local;
+    makeSnapshots(count, remote, local);
+    remote.sort();
+    local.sort();
+    QCOMPARE(remote.count(), count);
+    QCOMPARE(local.count(), count);
+
+    QDropbox2Snapshot::Diff diff = QDropbox2Snapshot::diff(remote, local);
+    QCOMPARE(diff.added.count(), count / 100);
+    QCOMPARE(diff.modified.count(), count / 100);
+    QCOMPARE(diff.deleted.count(), count / 100);
+    QVERIFY(local.path(diff.added.first()).endsWith(".new"));
+    QCOMPARE(remote.path(diff.deleted.first()).section('/', -1), QString("File1.dat"));
+
+    // lookups are case-insensitive
+    int found = 0;
+    for(int i = 0;i < count;i += 10)
+        found += remote.indexOf(snapshotPath(i).toUpper()) >= 0;
+    QCOMPARE(found, count / 10);
+
+    const int index = remote.indexOf("backup/folder42/file4242.dat");
+    QVERIFY(index >= 0);
+    QCOMPARE(remote.path(index), QString("Backup/Folder42/File4242.dat"));
+    QCOMPARE(remote.contentHash(index), snapshotHash(4242));
+
+    // of entries appended twice, the last one counts
+    QDropbox2Snapshot twice;
+    twice.append("b", false, 1);
+    twice.append("a", false, 1);
+    twice.append("B", false, 2);
+    twice.sort();
+    QCOMPARE(twice.count(), 2);
+    QCOMPARE(twice.size(twice.indexOf("b")), qint64(2));
+
+    // a path whose lowercase form is longer (U+0130 lowercases to "i"
+    // and a combining dot) keeps both intact
+    const QString dotted = QString::fromUtf8("\xc4\xb0stanbul/Foto.jpg");
+    QDropbox2Snapshot special;
+    special.append(dotted, false, 1);
+    special.append("Z", false, 1);
+    special.sort();
+    const int dotted_index = special.indexOf(dotted);
+    QVERIFY(dotted_index >= 0);
+    QCOMPARE(special.path(dotted_index), dotted);
+    QCOMPARE(special.key(dotted_index), dotted.toLower());
+    QCOMPARE(special.path(special.indexOf("z")), QString("Z"));
+
+    // a local scan, compared by content against a listing with hashes
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QDir().mkpath(dir.path() + "/sub");
+    QDropbox2Snapshot listing;
+    for(int i = 0;i < 10;++i)
+    {
+        const QByteArray content(100, char('a' + i));
+        QFile file(dir.path() + QString("/sub/f%1").arg(i));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(content);
+
+        QDropbox2ContentHasher hasher;
+        hasher.addData(content);
+        listing.append(QString("sub/f%1").arg(i), false, content.size(), -1, i == 5 ? snapshotHash(5) : hasher.result());
+    }
+    listing.append("sub", true, 0);
+    listing.append("gone", false, 1);
+    listing.sort();
+
+    QDropbox2Snapshot scanned = QDropbox2Snapshot::scan(dir.path(), true);
+    QCOMPARE(scanned.count(), 11);
+    diff = QDropbox2Snapshot::diff(listing, scanned);
+    QCOMPARE(diff.added.count(), 0);
+    QCOMPARE(diff.modified.count(), 1);
+    QCOMPARE(scanned.path(diff.modified.first()), QString("sub/f5"));
+    QCOMPARE(diff.deleted.count(), 1);
+}
+
+void QtDropbox2Test::pathTable()
+{
+    const int count = 200000;
+
+    QDropbox2PathTable table;
+    QVector<QDropbox2PathTable::Id> ids(count);
+    qint64 plain = 0;
+    for(int i = 0;i < count;++i)
+    {
+        const QString path = archivePath(i);
+        ids[i] = table.insert(path);
+
+        // a lower-cased key and the display path, each with a string header
+        plain += 2 * (path.size() * qint64(sizeof(QChar)) + 24);
+    }
+    const qint64 interned = table.memoryUsage() + count * qint64(sizeof(QDropbox2PathTable::Id));
+    QVERIFY(interned < plain / 2);
+
+    // lookups are case-insensitive, and walk one component at a time
+    int found = 0;
+    for(int i = 0;i < count;i += 10)
+        found += table.find(archivePath(i).toUpper()) == ids[i];
+    QCOMPARE(found, count / 10);
+
+    QCOMPARE(table.path(ids[4242]), archivePath(4242));
+    QCOMPARE(table.depth(ids[4242]), 6);
+    QCOMPARE(table.find("/team archive/projects/project0/assets/folder42/"),
+             table.parent(ids[4242]));
+    QVERIFY(table.isBeneath(ids[4242], table.find("/Team Archive/Projects")));
+    QVERIFY(!table.isBeneath(ids[4242], table.find("/Team Archive/Projects/Project1")));
+    QCOMPARE(table.find("/Team Archive/Missing"), QDropbox2PathTable::None);
+
+    // the display form follows the latest insert
+    QDropbox2PathTable::Id renamed = table.insert(archivePath(4242).toUpper());
+    QCOMPARE(renamed, ids[4242]);
+    QCOMPARE(table.name(renamed), QString("FILE4242.DAT"));
+    table.release(renamed);
+
+    // releasing every path frees every folder
+    for(int i = 0;i < count;++i)
+        table.release(ids[i]);
+    QCOMPARE(table.count(), 1);
+    QCOMPARE(table.find(archivePath(0)), QDropbox2PathTable::None);
+
+    // the metadata cache interns its paths too
+    QDropbox2MetadataCache cache(count, qint64(1) << 40);
+    cache.addRoot("/Team Archive/Projects/Project0/Assets/Folder0");
+    QList<QDropbox2Entry> page;
+    for(int i = 0;i < 100;++i)
+    {
+        QDropbox2Entry entry;
+        entry.type = QDropbox2Entry::File;
+        entry.path = archivePath(i);
+        page.append(entry);
+    }
+    cache.apply(page);
+    QDropbox2Entry entry;
+    QVERIFY(cache.lookup(archivePath(42).toLower(), entry));
+    QCOMPARE(entry.path, archivePath(42));
+    cache.invalidate("/Team Archive/Projects/Project0/Assets/Folder0");
+    QCOMPARE(cache.count(), 0);
+}
+
+void QtDropbox2Test::timestamp()
+{
+    // the same instants as QLocale parses them
+    const QVector<QString> stamps = makeTimestamps(10000);
+    const QDateTime& start = TimestampStart;
+    for(int i = 0;i < stamps.count();++i)
+    {
+        QDateTime parsed = QLocale(QLocale::English).toDateTime(stamps[i], "yyyy-MM-ddTHH:mm:ssZ");
+        parsed.setTimeSpec(Qt::UTC);
+
+        qint64 msecs = 0;
+        QVERIFY(QDropbox2EntityInfo::parseTimestamp(stamps[i], msecs));
+        QCOMPARE(msecs, parsed.toMSecsSinceEpoch());
+    }
+
+    // leap days, the epoch, and malformed input
+    qint64 msecs = 0;
+    QVERIFY(QDropbox2EntityInfo::parseTimestamp("1970-01-01T00:00:00Z", msecs));
+    QCOMPARE(msecs, qint64(0));
+    QVERIFY(QDropbox2EntityInfo::parseTimestamp("2016-02-29T23:59:59Z", msecs));
+    QCOMPARE(msecs, QDateTime(QDate(2016, 2, 29), QTime(23, 59, 59), Qt::UTC).toMSecsSinceEpoch());
+    QVERIFY(!QDropbox2EntityInfo::parseTimestamp("2015-02-29T00:00:00Z", msecs));
+    QVERIFY(!QDropbox2EntityInfo::parseTimestamp("2015-05-12 15:50:38Z", msecs));
+    QVERIFY(!QDropbox2EntityInfo::parseTimestamp("2015-05-12T15:50:38", msecs));
+    QVERIFY(!QDropbox2EntityInfo::parseTimestamp("2015-05-12T24:00:00Z", msecs));
+
+    // metadata carries the timestamps of the JSON, not of the key names
+    QJsonObject json;
+    json.insert(".tag", QString("file"));
+    json.insert("path_display", QString("/Photos/IMG_0001.jpg"));
+    json.insert("client_modified", QString("2015-05-12T15:50:38Z"));
+    json.insert("server_modified", QString("2015-05-12T15:51:02Z"));
+    QDropbox2EntityInfo info(json);
+    QCOMPARE(info.clientModified(), start);
+    QCOMPARE(info.serverModified(), start.addSecs(24));
+    QCOMPARE(info.toEntry().clientModified, start.toMSecsSinceEpoch());
+    QCOMPARE(info.filename(), QString("IMG_0001.jpg"));
+
+    json.insert(".tag", QString("folder"));
+    json.remove("client_modified");
+    json.remove("server_modified");
+    QVERIFY(!QDropbox2EntityInfo(json).clientModified().isValid());
+    QCOMPARE(QDropbox2EntityInfo(json).clientModifiedMSecs(), NoTimestamp);
+
+    // times before the epoch are valid, not missing
+    json.insert("client_modified", QString("1969-07-20T20:17:40Z"));
+    const QDateTime landing(QDate(1969, 7, 20), QTime(20, 17, 40), Qt::UTC);
+    QCOMPARE(QDropbox2EntityInfo(json).clientModified(), landing);
+    QCOMPARE(QDropbox2EntityInfo(json).toEntry().clientModified, landing.toMSecsSinceEpoch());
+    QVERIFY(QDropbox2EntityInfo(json).toEntry().clientModified < 0);
+}
+
+void QtDropbox2Test::largeSizes()
+{
+    // 5 GB, 50 GB, and the 350 GB that an upload session may carry
+    const qint64 sizes[] = { Q_INT64_C(5) << 30, Q_INT64_C(50) << 30, Q_INT64_C(350) << 30 };
+
+    for(qint64 size : sizes)
+    {
+        // metadata reports sizes past 2 GB exactly
+        QJsonObject json;
+        json.insert(".tag", QString("file"));
+        json.insert("path_display", QString("/Backups/disk.img"));
+        json.insert("size", double(size));
+        QDropbox2EntityInfo info(json);
+        QCOMPARE(info.bytes(), quint64(size));
+        QCOMPARE(info.toEntry().bytes, quint64(size));
+        QCOMPARE(QDropbox2EntityInfo(info.toEntry()).bytes(), quint64(size));
+
+        // and so do the cursors of upload sessions, up to the last chunk
+        const qint64 last = size - QDropbox2ChunkController::maximumChunkSize();
+        QDropbox2JsonWriter writer(64, QDropbox2JsonWriter::AsciiSafe);
+        writer.beginObject()
+                .beginObject("cursor")
+                    .value("session_id", QString("AAAAAAAAAZE"))
+                    .value("offset", last)
+                .endObject()
+                .value("close", false)
+            .endObject();
+        const QJsonObject cursor = QJsonDocument::fromJson(writer.data()).object().value("cursor").toObject();
+        QCOMPARE(qint64(cursor.value("offset").toDouble()), last);
+    }
+
+    // a buffer past 2 GB, as a long upload session leaves it: the front is
+    // discarded as it is sent, and the tail is spilled to disk
+    const int block = 1024*1024;
+    const qint64 piece = 4*block;
+    const qint64 past = (Q_INT64_C(1) << 31) + 3*block;
+    QDropbox2ChunkedBuffer buffer(block);
+    const QByteArray filler(int(piece), 'x');
+    while(buffer.size() < past)
+    {
+        QCOMPARE(buffer.write(buffer.size(), filler.constData(), piece), piece);
+        buffer.discard(buffer.size() - block);
+    }
+    buffer.setMemoryBudget(2*block);
+    QByteArray tail;
+    for(int i = 0;i < 2*piece;++i)
+        tail.append(char('a' + i % 23));
+    const qint64 offset = buffer.size();
+    QCOMPARE(buffer.write(offset, tail.constData(), tail.size()), qint64(tail.size()));
+    QVERIFY(buffer.spilled() > 0);
+    QVERIFY(buffer.discarded() > Q_INT64_C(1) << 31);
+
+    // reads and ranges address the content by 64-bit offsets
+    char bytes[16];
+    QCOMPARE(buffer.read(offset + 5, bytes, 16), qint64(16));
+    QCOMPARE(QByteArray(bytes, 16), tail.mid(5, 16));
+    QCOMPARE(buffer.mid(offset + block - 3, 10), tail.mid(block - 3, 10));
+    QCOMPARE(buffer.mid(offset), tail);
+    QVERIFY(buffer.mid(buffer.discarded() - 1).isEmpty());
+
+    // the reader an upload session posts for its next chunk
+    QScopedPointer<QIODevice> reader(buffer.createReader(offset + block, piece));
+    QCOMPARE(reader->size(), piece);
+    QCOMPARE(reader->read(100), tail.mid(block, 100));
+    QVERIFY(reader->seek(piece - 50));
+    QCOMPARE(reader->readAll(), tail.mid(block + piece - 50, 50));
+
+    // and a reader can be cached without one QByteArray holding it all
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QDropbox2ContentCache cache(dir.path(), 4*piece);
+    reader.reset(buffer.createReader(offset, tail.size()));
+    QVERIFY(cache.insert("tail", reader.data()));
+    QScopedPointer<QFile> cached(cache.open("tail"));
+    QVERIFY(!cached.isNull());
+    QCOMPARE(cached->readAll(), tail);
+
+    // content too large for a cache is refused
+    QDropbox2ContentCache small(dir.path() + "/small", block);
+    reader.reset(buffer.createReader(offset, tail.size()));
+    QVERIFY(!small.insert("tail", reader.data()));
+    QVERIFY(!small.contains("tail"));
+
+    // ranges longer than a QByteArray can hold are refused, not truncated
+    const qint64 huge = (Q_INT64_C(1) << 31) + 1;
+    QDropbox2ChunkedBuffer spilled(block);
+    spilled.setMemoryBudget(2*block);
+    while(spilled.size() < huge)
+        QCOMPARE(spilled.write(spilled.size(), filler.constData(), piece), piece);
+    QVERIFY(spilled.spilled() > Q_INT64_C(1) << 31);
+    QVERIFY(spilled.mid(0).isEmpty());
+    QVERIFY(spilled.toByteArray().isEmpty());
+    QCOMPARE(spilled.mid(spilled.size() - 10), QByteArray(10, 'x'));
+    QCOMPARE(spilled.mid(spilled.discarded(), 10), QByteArray(10, 'x'));
+
+    // an upload past 2 GB, of a sparse file, to a stand-in server that only
+    // counts what it is sent: the chunks follow each other past 2^31, and
+    // the session is committed at the full size
+    const qint64 chunk = 4 * QDropbox2ChunkController::Unit;
+    const qint64 total = (Q_INT64_C(1) << 31) + 2 * chunk + 1000;
+    const QString local = dir.path() + "/large.bin";
+    QFile sparse(local);
+    QVERIFY(sparse.open(QIODevice::WriteOnly));
+    QVERIFY(sparse.resize(total));
+    sparse.close();
+
+    StubServer server(0, "{}");
+    server.discard("/2/files/upload_session/start");
+    server.discard("/2/files/upload_session/append_v2");
+    server.discard("/2/files/upload_session/finish");
+    server.answer("/2/files/upload_session/start", 200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    QDropbox2Upload upload(local, "/large.bin", &api);
+    upload.setChunkSize(chunk);
+    QVERIFY(upload.upload());
+    QCOMPARE(upload.stageStats(QDropbox2Upload::Send).bytes, total);
+
+    const QList<StubServer::Discarded> appended = server.discardedRequests("/2/files/upload_session/append_v2");
+    const QList<StubServer::Discarded> finished = server.discardedRequests("/2/files/upload_session/finish");
+    QCOMPARE(server.discardedRequests("/2/files/upload_session/start").count(), 1);
+    QCOMPARE(appended.count(), int(total / chunk) - 1);
+    QCOMPARE(finished.count(), 1);
+
+    qint64 offset = chunk;
+    foreach(const StubServer::Discarded& request, appended)
+    {
+        const QJsonObject cursor = QJsonDocument::fromJson(request.arg).object().value("cursor").toObject();
+        QCOMPARE(qint64(cursor.value("offset").toDouble()), offset);
+        QCOMPARE(request.size, chunk);
+        offset += request.size;
+    }
+    QVERIFY(offset > Q_INT64_C(1) << 31);
+
+    const QJsonObject commit = QJsonDocument::fromJson(finished.first().arg).object();
+    QCOMPARE(qint64(commit.value("cursor").toObject().value("offset").toDouble()), offset);
+    QCOMPARE(offset + finished.first().size, total);
+    QCOMPARE(commit.value("commit").toObject().value("path").toString(), QString("/large.bin"));
+}
+
+void QtDropbox2Test::zipReader()
+{
+    // deflated and stored entries, with the sizes in data descriptors
+    const int count = 300;
+    qint64 total = 0;
+    const QByteArray archive = makeZipArchive(count, total);
+
+    int entries = 0;
+    qint64 received = 0;
+    QVERIFY(readZipArchive(archive, entries, received));
+    QCOMPARE(entries, count + 1);
+    QCOMPARE(received, total);
+
+    // a corrupted entry is caught by its checksum
+    QByteArray corrupt;
+    addZipEntry(corrupt, "Folder/bad.txt", zipContent(7), true);
+    corrupt[corrupt.size() - 12] = char(corrupt[corrupt.size() - 12] ^ 0x55);
+    zipValue(corrupt, 0x06054b50, 4);
+    QDropbox2ZipReader strict;
+    QVERIFY(!strict.addData(corrupt));
+    QVERIFY(strict.hasError());
+
+    // and an archive cut short is reported at its end
+    QDropbox2ZipReader partial;
+    QVERIFY(partial.addData(archive.left(archive.size() / 2)));
+    QVERIFY(!partial.finish());
+
+    // Zip64 sizes, in the extra field of the local header and in data
+    // descriptors, for stored and deflated entries
+    const QByteArray text = zipContent(42);
+    const QByteArray zlib = qCompress(text);
+    const QByteArray deflated = zlib.mid(6, zlib.size() - 10);
+    QByteArray zip64;
+    addEncodedZipEntry(zip64, "Folder/stored.txt", text, text, 0, true, false);
+    addEncodedZipEntry(zip64, "Folder/deflated.txt", text, deflated, 8, true, false);
+    addEncodedZipEntry(zip64, "Folder/streamed.txt", text, text, 0, true, true);
+    addEncodedZipEntry(zip64, "Folder/compressed.txt", text, deflated, 8, true, true);
+    zipValue(zip64, 0x06064b50, 4);             // Zip64 end of central directory
+    zip64.append(QByteArray(52, '\0'));
+    for(int piece : { 1, 7, 1460 })
+    {
+        QStringList names;
+        QList<QByteArray> contents;
+        QVERIFY(readZipEntries(zip64, piece, names, contents));
+        QCOMPARE(names, QStringList() << "Folder/stored.txt" << "Folder/deflated.txt" << "Folder/streamed.txt" << "Folder/compressed.txt");
+        for(const QByteArray& content : contents)
+            QCOMPARE(content, text);
+    }
+
+    // a Zip64 descriptor is read as 64-bit: a size off by 4 GB is caught
+    QByteArray wide;
+    addEncodedZipEntry(wide, "Folder/wide.txt", text, deflated, 8, true, true);
+    const int size_at = wide.size() - 16;
+    wide[size_at + 4] = char(wide[size_at + 4] + 1);
+    zipValue(wide, 0x06054b50, 4);
+    QDropbox2ZipReader mismatch;
+    QVERIFY(!mismatch.addData(wide));
+    QVERIFY(mismatch.errorString().contains("Size mismatch"));
+
+    // deflate streams made of stored blocks, among them an empty one (as a
+    // flush writes) and one longer than a network read, and stored blocks
+    // followed by a compressed one
+    const QByteArray large = zipContent(49).repeated(60);
+    const QList<QByteArray> blocks = QList<QByteArray>() << "stored " << QByteArray() << large << "blocks";
+    const QByteArray joined = blocks.join();
+    const QByteArray prefixed = QByteArray("stored, then ").append(text);
+    const QByteArray mixed = storedBlocks(QList<QByteArray>() << "stored, then " << QByteArray(), false).append(deflated);
+    QByteArray stored;
+    addEncodedZipEntry(stored, "Folder/blocks.txt", joined, storedBlocks(blocks), 8, false, true);
+    addEncodedZipEntry(stored, "Folder/mixed.txt", prefixed, mixed, 8, false, false);
+    zipValue(stored, 0x06054b50, 4);
+    stored.append(QByteArray(18, '\0'));
+    for(int piece : { 1, 3, 1460 })
+    {
+        QStringList names;
+        QList<QByteArray> contents;
+        QVERIFY(readZipEntries(stored, piece, names, contents));
+        QCOMPARE(names, QStringList() << "Folder/blocks.txt" << "Folder/mixed.txt");
+        QCOMPARE(contents[0], joined);
+        QCOMPARE(contents[1], prefixed);
+    }
+
+    // a stored block whose length does not match its complement is corrupt
+    QByteArray bad_block = storedBlocks(QList<QByteArray>() << "abc");
+    bad_block[3] = char(bad_block[3] ^ 0x01);
+    QByteArray bad_stored;
+    addEncodedZipEntry(bad_stored, "Folder/bad.txt", "abc", bad_block, 8, false, true);
+    QDropbox2ZipReader invalid;
+    QVERIFY(!invalid.addData(bad_stored));
+    QVERIFY(invalid.errorString().contains("stored block length mismatch"));
+
+    // download() refuses entries that would land outside its directory,
+    // whether they climb out of it or are absolute
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString out = dir.path() + "/out";
+    const QStringList unsafe = QStringList() << "Folder/../escaped.txt"
+                                             << "Folder/Sub/../../../escaped.txt"
+                                             << "Folder/" + dir.path() + "/absolute.txt";
+    for(const QString& name : unsafe)
+    {
+        QByteArray archive;
+        addZipEntry(archive, "Folder/kept.txt", text, true);
+        addZipEntry(archive, name, text, false);
+        addZipEntry(archive, "Folder/after.txt", text, true);
+        zipValue(archive, 0x06054b50, 4);
+        archive.append(QByteArray(18, '\0'));
+
+        StubServer server(0, archive);
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+        QDropbox2 api("not-a-real-token");
+        api.setServerOverride(server.url());
+
+        QDropbox2Folder folder("/Folder", &api);
+        QVERIFY(!folder.download(out));
+        QCOMPARE(folder.error(), int(QDropbox2::APIError));
+        QVERIFY(folder.errorString().startsWith("Unsafe path in zip archive"));
+        QVERIFY(QFile::exists(out + "/kept.txt"));
+        QVERIFY(!QFile::exists(out + "/after.txt"));
+        QVERIFY(!QFile::exists(dir.path() + "/escaped.txt"));
+        QVERIFY(!QFile::exists(dir.path() + "/absolute.txt"));
+    }
+
+    // entries can be read as devices while they are decoded
+    QDropbox2ZipEntry entry("File.txt");
+    entry.appendData("abc");
+    entry.appendData("def");
+    QCOMPARE(entry.bytesAvailable(), qint64(6));
+    QCOMPARE(entry.read(4), QByteArray("abcd"));
+    QVERIFY(!entry.atEnd());
+    entry.setComplete();
+    QCOMPARE(entry.readAll(), QByteArray("ef"));
+    QVERIFY(entry.atEnd());
+}
+
+void QtDropbox2Test::thumbnails()
+{
+    const int per_batch = QDropbox2Thumbnails::BatchSize;
+
+    for(int b = 0;b < 4;++b)
+    {
+        QVector<QDropbox2Thumbnails::Result> results;
+        QVERIFY(QDropbox2Thumbnails::decodeBatch(thumbnailResponse(b), results));
+        QCOMPARE(results.count(), per_batch);
+        for(int k = 0;k < per_batch;++k)
+        {
+            QCOMPARE(results[k].image, thumbnailImage(b * per_batch + k));
+            QCOMPARE(results[k].path, QString("/Photos/IMG_%1.jpg").arg(b * per_batch + k));
+        }
+    }
+
+    // failures are reported in place, in the order of the request
+    QVector<QDropbox2Thumbnails::Result> results;
+    QVERIFY(QDropbox2Thumbnails::decodeBatch(R"({"entries": [{".tag": "failure", "failure": {".tag": "path", "path": {".tag": "not_found"}}},
+                                                           {".tag": "success", "metadata": {"id": "id:a", "rev": "1"}, "thumbnail": "AAEC"}]})",
+                                             results));
+    QCOMPARE(results.count(), 2);
+    QVERIFY(results[0].image.isEmpty());
+    QCOMPARE(results[0].error, QString("path/not_found"));
+    QCOMPARE(results[1].image, QByteArray("\x00\x01\x02", 3));
+    QVERIFY(!QDropbox2Thumbnails::decodeBatch("<html>", results));
+
+    // a batch request names every file with the size and format
+    QStringList paths;
+    for(int k = 0;k < per_batch;++k)
+        paths.append(QString("/Photos/IMG_%1.jpg").arg(k));
+    const QJsonArray request = QJsonDocument::fromJson(QDropbox2Thumbnails::batchRequest(paths, QDropbox2Thumbnails::W256H256, QDropbox2Thumbnails::Png))
+                                   .object().value("entries").toArray();
+    QCOMPARE(request.count(), per_batch);
+    QCOMPARE(request[3].toObject().value("path").toString(), paths[3]);
+    QCOMPARE(request[3].toObject().value("size").toString(), QString("w256h256"));
+    QCOMPARE(request[3].toObject().value("format").toString(), QString("png"));
+
+    // cached thumbnails are keyed by revision, size and format
+    const QString key = QDropbox2Thumbnails::cacheKey("id:a", "1", QDropbox2Thumbnails::W64H64, QDropbox2Thumbnails::Jpeg);
+    QVERIFY(key != QDropbox2Thumbnails::cacheKey("id:a", "2", QDropbox2Thumbnails::W64H64, QDropbox2Thumbnails::Jpeg));
+    QVERIFY(key != QDropbox2Thumbnails::cacheKey("id:a", "1", QDropbox2Thumbnails::W128H128, QDropbox2Thumbnails::Jpeg));
+    QVERIFY(key != QDropbox2Thumbnails::cacheKey("id:a", "1", QDropbox2Thumbnails::W64H64, QDropbox2Thumbnails::Png));
+
+    // and files requested with their metadata are answered from the cache
+    QTemporaryDir dir;
+    QDropbox2 api("not-a-real-token");
+    QDropbox2Thumbnails thumbnails(&api);
+    QVERIFY(thumbnails.enableCache(dir.path(), 4 * 1024 * 1024));
+
+    const int cached = 100;
+    QDropbox2Folder::ContentsList files;
+    for(int i = 0;i < cached;++i)
+    {
+        const QJsonObject json = thumbnailMetadata(i);
+        QVERIFY(thumbnails.cache()->insert(QDropbox2Thumbnails::cacheKey(json.value("id").toString(), json.value("rev").toString(),
+                                                                         thumbnails.size(), thumbnails.format()), thumbnailImage(i)));
+        files.append(QDropbox2EntityInfo(json));
+    }
+
+    QHash<QString, QByteArray> delivered;
+    connect(&thumbnails, &QDropbox2Thumbnails::signal_thumbnailReady, [&](const QString& path, const QByteArray& data) { delivered[path] = data; });
+
+    thumbnails.request(files);
+    QVERIFY(thumbnails.waitForFinished());
+    QCOMPARE(delivered.count(), cached);
+    QCOMPARE(delivered.value("/Photos/IMG_42.jpg"), thumbnailImage(42));
+}
+
+void QtDropbox2Test::thumbnailScheduling()
+{
+    const QByteArray batch_path = "/2/files/get_thumbnail_batch";
+
+    // every answer carries a full batch; thumbnails are delivered in the
+    // order of the request, so any answer serves any batch
+    StubServer server(50, thumbnailResponse(0));
+    server.record(batch_path);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    // requests are grouped by size and format into batches of at most 25,
+    // and no more than the set number are in flight
+    QDropbox2Thumbnails thumbnails(&api);
+    thumbnails.setMaxConcurrency(2);
+
+    QStringList requested;
+    auto request = [&](int first, int count) {
+        QStringList paths;
+        for(int i = first;i < first + count;++i)
+            paths.append(QString("/Photos/IMG_%1.jpg").arg(i));
+        thumbnails.request(paths);
+        requested += paths;
+    };
+    request(0, 30);
+    thumbnails.setSize(QDropbox2Thumbnails::W128H128);
+    request(30, 30);
+    thumbnails.setSize(QDropbox2Thumbnails::W64H64);
+    request(60, 30);                            // joins the first size
+    thumbnails.setFormat(QDropbox2Thumbnails::Png);
+    request(90, 10);
+    QCOMPARE(thumbnails.pendingCount(), 100);
+
+    QStringList delivered;
+    connect(&thumbnails, &QDropbox2Thumbnails::signal_thumbnailReady, [&](const QString& path, const QByteArray&) { delivered.append(path); });
+    QVERIFY(thumbnails.waitForFinished());
+    QCOMPARE(delivered.count(), requested.count());
+
+    QMap<QString, QList<int>> batches;          // batch sizes by size and format
+    QStringList batched;
+    foreach(const QByteArray& body, server.recordedBodies(batch_path))
+    {
+        const QJsonArray entries = QJsonDocument::fromJson(body).object().value("entries").toArray();
+        const QString kind = entries.first().toObject().value("size").toString() + "/" +
+                             entries.first().toObject().value("format").toString();
+        for(const QJsonValue& entry : entries)
+        {
+            QCOMPARE(entry.toObject().value("size").toString() + "/" + entry.toObject().value("format").toString(), kind);
+            batched.append(entry.toObject().value("path").toString());
+        }
+        batches[kind].append(entries.count());
+    }
+    for(QList<int>& sizes : batches)
+        std::sort(sizes.begin(), sizes.end());
+    QCOMPARE(batches.value("w64h64/jpeg"), QList<int>() << 10 << 25 << 25);
+    QCOMPARE(batches.value("w128h128/jpeg"), QList<int>() << 5 << 25);
+    QCOMPARE(batches.value("w64h64/png"), QList<int>() << 10);
+    QCOMPARE(batches.count(), 3);
+    std::sort(batched.begin(), batched.end());
+    std::sort(requested.begin(), requested.end());
+    QCOMPARE(batched, requested);
+    QCOMPARE(server.mostConcurrent(), 2);
+
+    // a batch that fails reports every thumbnail in it, and only those
+    StubServer failing(50, thumbnailResponse(0));
+    failing.queue(QDROPBOX_V2_ERROR, "{\"error_summary\": \"too_many_requests/..\"}");
+    QVERIFY(failing.listen(QHostAddress::LocalHost));
+    api.setServerOverride(failing.url());
+
+    QDropbox2Thumbnails single(&api);
+    single.setMaxConcurrency(1);
+    QStringList failed;
+    QStringList ready;
+    connect(&single, &QDropbox2Thumbnails::signal_thumbnailReady, [&](const QString& path, const QByteArray&) { ready.append(path); });
+    connect(&single, &QDropbox2Thumbnails::signal_thumbnailFailed, [&](const QString& path, int errorcode, const QString& errormessage) {
+        if(errorcode == QDROPBOX_V2_ERROR && errormessage == "too_many_requests/..")
+            failed.append(path);
+    });
+    QStringList paths;
+    for(int i = 0;i < 30;++i)
+        paths.append(QString("/Photos/IMG_%1.jpg").arg(i));
+    single.request(paths);
+    QVERIFY(!single.waitForFinished());
+    QCOMPARE(failed, paths.mid(0, QDropbox2Thumbnails::BatchSize));
+    QCOMPARE(ready, paths.mid(QDropbox2Thumbnails::BatchSize));
+    QCOMPARE(single.pendingCount(), 0);
+    QCOMPARE(failing.mostConcurrent(), 1);
+}
+
+void QtDropbox2Test::saveUrlJobs()
+{
+    const QByteArray progress = "{\".tag\": \"in_progress\"}";
+    const QUrl source("https://example.com/page.html");
+
+    StubServer server(0, "{}");
+    server.answer("/2/files/save_url", 200, "{\".tag\": \"async_job_id\", \"async_job_id\": \"job1\"}");
+    server.record("/2/files/save_url/check_job_status");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    // the job is polled until it completes, at intervals that double up to
+    // the last one: 50 + 5 * 100 msecs, rather than 50 + 100 + ... + 1600
+    QDropbox2File file("/Saved/page.html", &api);
+    file.setJobPolling(50, 100);
+    for(int i = 0;i < 5;++i)
+        server.queue(200, progress);
+    server.queue(200, "{\".tag\": \"complete\", \"name\": \"page.html\"}");
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(file.saveUrl(source));
+    QVERIFY(timer.elapsed() >= 550);
+    QVERIFY(timer.elapsed() < 3000);
+
+    const QJsonObject request = QJsonDocument::fromJson(server.lastBody("/2/files/save_url")).object();
+    QCOMPARE(request.value("path").toString(), QString("/Saved/page.html"));
+    QCOMPARE(request.value("url").toString(), source.toString());
+    QCOMPARE(server.requests("/2/files/save_url/check_job_status"), 6);
+    foreach(const QByteArray& body, server.recordedBodies("/2/files/save_url/check_job_status"))
+        QCOMPARE(QJsonDocument::fromJson(body).object().value("async_job_id").toString(), QString("job1"));
+
+    // a job that fails on the server
+    server.queue(200, progress);
+    server.queue(200, "{\".tag\": \"failed\", \"failed\": {\".tag\": \"download_failed\"}}");
+    QVERIFY(!file.saveUrl(source));
+    QCOMPARE(file.error(), int(QDROPBOX_V2_ERROR));
+    QVERIFY(file.errorString().endsWith("download_failed"));
+
+    // an answer the loop does not know ends it
+    server.queue(200, "{\".tag\": \"other\"}");
+    QVERIFY(!file.saveUrl(source));
+    QCOMPARE(file.error(), int(QDropbox2::APIError));
+    QCOMPARE(server.requests("/2/files/save_url/check_job_status"), 6 + 2 + 1);
+
+    // and waiting can be abandoned
+    QDropbox2File waiting("/Saved/slow.html", &api);
+    waiting.setJobPolling(10000, 10000);
+    QTimer::singleShot(200, &waiting, SLOT(slot_abort()));
+    timer.start();
+    QVERIFY(!waiting.saveUrl(source));
+    QVERIFY(timer.elapsed() < 10000);
+    QCOMPARE(waiting.error(), int(QNetworkReply::OperationCanceledError));
+    QCOMPARE(server.requests("/2/files/save_url/check_job_status"), 6 + 2 + 1);
+
+    // a copy reference, and the copy it makes
+    server.answer("/2/files/copy_reference/get", 200, "{\"metadata\": {\".tag\": \"file\", \"name\": \"page.html\"}, "
+                  "\"copy_reference\": \"z1X6ATl6aWtzOGq0c3g5Ng\", \"expires\": \"2045-05-12T15:50:38Z\"}");
+    server.answer("/2/files/copy_reference/save", 200, "{\"metadata\": {\".tag\": \"file\", \"name\": \"page.html\"}}");
+    QDateTime expires;
+    QCOMPARE(file.copyReference(&expires), QString("z1X6ATl6aWtzOGq0c3g5Ng"));
+    QCOMPARE(expires, QDateTime(QDate(2045, 5, 12), QTime(15, 50, 38), Qt::UTC));
+    QCOMPARE(QJsonDocument::fromJson(server.lastBody("/2/files/copy_reference/get")).object().value("path").toString(),
+             QString("/Saved/page.html"));
+
+    QDropbox2File copy("/Copies/page.html", &api);
+    QVERIFY(copy.saveCopyReference("z1X6ATl6aWtzOGq0c3g5Ng"));
+    const QJsonObject saved = QJsonDocument::fromJson(server.lastBody("/2/files/copy_reference/save")).object();
+    QCOMPARE(saved.value("copy_reference").toString(), QString("z1X6ATl6aWtzOGq0c3g5Ng"));
+    QCOMPARE(saved.value("path").toString(), QString("/Copies/page.html"));
+
+    // no reference in the answer is an error
+    server.answer("/2/files/copy_reference/get", 200, "{}");
+    QVERIFY(file.copyReference().isEmpty());
+    QCOMPARE(file.error(), int(QDropbox2::APIError));
+}
+
+void QtDropbox2Test::searchCursors()
+{
+    // a search_v2 page of photos 'first' onwards
+    auto page = [](int first, int count, const QString& cursor, bool more) -> QByteArray {
+        QStringList matches;
+        for(int i = first;i < first + count;++i)
+            matches.append(QString("{\"match_type\": {\".tag\": \"filename\"}, \"metadata\": {\".tag\": \"metadata\", "
+                                   "\"metadata\": {\".tag\": \"file\", \"id\": \"id:%1\", \"name\": \"photo%1.jpg\", "
+                                   "\"path_display\": \"/Photos/photo%1.jpg\", \"path_lower\": \"/photos/photo%1.jpg\", "
+                                   "\"rev\": \"r%1\", \"size\": 100}}}").arg(i));
+        return QString("{\"matches\": [%1], \"has_more\": %2, \"cursor\": \"%3\"}")
+                .arg(matches.join(", ")).arg(more ? "true" : "false").arg(cursor).toUtf8();
+    };
+
+    StubServer server(0, "{}");
+    server.answer("/2/files/search_v2", 200, page(0, 3, "cursor1", true));
+    server.queue(200, page(3, 3, "cursor2", true));
+    server.queue(200, page(6, 2, QString(), false));
+    server.record("/2/files/search/continue_v2");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    QDropbox2Folder folder("/Photos", &api);
+    QStringList paths;
+    QList<bool> more;
+    int errors = 0;
+    connect(&folder, &QDropbox2Folder::signal_searchPage, [&](const QDropbox2Folder::EntryList& entries, bool has_more) {
+        foreach(const QDropbox2Entry& entry, entries)
+            paths.append(entry.path);
+        more.append(has_more);
+    });
+    connect(&folder, &QDropbox2Folder::signal_errorOccurred, [&]() { ++errors; });
+
+    // pages arrive one by one, each cursor followed until there are no more
+    QDropbox2Folder::SearchFilter filter;
+    filter.extensions << "jpg" << "png";
+    filter.categories << "image";
+    filter.filenameOnly = true;
+    QVERIFY(folder.searchPages("photo", filter, 3));
+    QTRY_COMPARE_WITH_TIMEOUT(more.count(), 3, 10000);
+    QCOMPARE(more, QList<bool>() << true << true << false);
+    QCOMPARE(paths.count(), 8);
+    QCOMPARE(paths.first(), QString("/Photos/photo0.jpg"));
+    QCOMPARE(paths.last(), QString("/Photos/photo7.jpg"));
+    QCOMPARE(errors, 0);
+
+    const QList<QByteArray> continued = server.recordedBodies("/2/files/search/continue_v2");
+    QCOMPARE(continued.count(), 2);
+    QCOMPARE(QJsonDocument::fromJson(continued[0]).object().value("cursor").toString(), QString("cursor1"));
+    QCOMPARE(QJsonDocument::fromJson(continued[1]).object().value("cursor").toString(), QString("cursor2"));
+    QCOMPARE(server.requests(), 3);
+
+    // the search is scoped to the folder, and filtered by the server
+    const QJsonObject request = QJsonDocument::fromJson(server.lastBody("/2/files/search_v2")).object();
+    const QJsonObject options = request.value("options").toObject();
+    QCOMPARE(request.value("query").toString(), QString("photo"));
+    QCOMPARE(options.value("path").toString(), QString("/Photos"));
+    QCOMPARE(options.value("max_results").toInt(), 3);
+    QCOMPARE(options.value("file_status").toString(), QString("active"));
+    QCOMPARE(options.value("filename_only").toBool(), true);
+    QCOMPARE(options.value("file_extensions").toArray(), QJsonArray() << "jpg" << "png");
+    QCOMPARE(options.value("file_categories").toArray(), QJsonArray() << "image");
+
+    // at the root, the search is not scoped; and without a filter, none is sent
+    server.answer("/2/files/search_v2", 200, page(0, 1, QString(), false));
+    QDropbox2Folder root("/", &api);
+    int pages = 0;
+    connect(&root, &QDropbox2Folder::signal_searchPage, [&]() { ++pages; });
+    QDropbox2Folder::SearchFilter deleted;
+    deleted.deleted = true;
+    QVERIFY(root.searchPages("photo", deleted));
+    QTRY_COMPARE_WITH_TIMEOUT(pages, 1, 10000);
+    const QJsonObject unscoped = QJsonDocument::fromJson(server.lastBody("/2/files/search_v2")).object().value("options").toObject();
+    QVERIFY(!unscoped.contains("path"));
+    QVERIFY(!unscoped.contains("file_extensions"));
+    QVERIFY(!unscoped.contains("file_categories"));
+    QCOMPARE(unscoped.value("file_status").toString(), QString("deleted"));
+    QCOMPARE(unscoped.value("filename_only").toBool(), false);
+    QCOMPARE(unscoped.value("max_results").toInt(), 100);
+
+    // a refused search, and an answer that is not a page, are errors
+    server.answer("/2/files/search_v2", 409, "{\"error_summary\": \"path/not_found/\"}");
+    QVERIFY(folder.searchPages("photo"));
+    QTRY_COMPARE_WITH_TIMEOUT(errors, 1, 10000);
+    QVERIFY(folder.error() != 0);
+
+    server.answer("/2/files/search_v2", 200, "not a page");
+    QVERIFY(folder.searchPages("photo"));
+    QTRY_COMPARE_WITH_TIMEOUT(errors, 2, 10000);
+    QCOMPARE(folder.error(), int(QDropbox2::APIError));
+
+    // and one on a later page ends the search there
+    server.answer("/2/files/search_v2", 200, page(0, 3, "cursor1", true));
+    server.queue(500, "{}");
+    more.clear();
+    QVERIFY(folder.searchPages("photo"));
+    QTRY_COMPARE_WITH_TIMEOUT(errors, 3, 10000);
+    QCOMPARE(more, QList<bool>() << true);
+}
+
+#if defined(QDROPBOX2_BENCHMARKS)
+// builds a synthetic "list_folder" page roughly the size of a large listing
+static QByteArray makeListingPage(int entries)
+{
+    QByteArray page("{\"entries\": [");
+    for(int i = 0;i < entries;++i)
+    {
+        if(i)
+            page += ", ";
+        page += QString("{\".tag\": \"file\", \"name\": \"file%1.txt\", \"id\": \"id:a4ayc_80_OEAAAAAAAAA%1\", "
+                        "\"client_modified\": \"2015-05-12T15:50:38Z\", \"server_modified\": \"2015-05-12T15:50:38Z\", "
+                        "\"rev\": \"a1c10ce0dd78\", \"size\": %1, \"path_lower\": \"/homework/math/file%1.txt\", "
+                        "\"path_display\": \"/Homework/math/file%1.txt\"}").arg(i).toUtf8();
+    }
+    page += "], \"cursor\": \"ZtkX9_EHj3x7PMkVuFIhwKYXEpwpLwyxp9vMKomUhllil9q7eWiAu\", \"has_more\": false}";
+    return page;
+}
+
+void QtDropbox2Test::responseParse_benchmark()
+{
+    const QByteArray page = makeListingPage(5000);
+    QJsonParseError jsonError;
+
+    // previous path: body -> QString (UTF-16) -> QByteArray (UTF-8) -> JSON
+    quint64 before = allocation_count;
+    {
+        QString lastResponse = QString(page);
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse.toUtf8(), &jsonError);
+        QCOMPARE(jsonError.error, QJsonParseError::NoError);
+    }
+    quint64 roundtrip_allocations = allocation_count - before;
+
+    // current path: body -> JSON
+    before = allocation_count;
+    {
+        QByteArray lastResponse = page;
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
+        QCOMPARE(jsonError.error, QJsonParseError::NoError);
+    }
+    quint64 raw_allocations = allocation_count - before;
+
+    qDebug() << page.size() << "byte response:" << roundtrip_allocations << "allocations with QString round-trip,"
+             << raw_allocations << "parsing raw bytes";
+    QVERIFY(raw_allocations < roundtrip_allocations);
+
+    QBENCHMARK {
+        QByteArray lastResponse = page;
+        QJsonDocument json = QJsonDocument::fromJson(lastResponse, &jsonError);
+    }
+}
+
+void QtDropbox2Test::jsonWriter_benchmark()
+{
+    const QString path = QString::fromUtf8("/Caf\xc3\xa9 \"quoted\"\\dir\t/\xf0\x9f\x93\x81 file.txt");
+
+    quint64 before = allocation_count;
+    {
+        QString json = QString("{\"from_path\": \"%1\", \"to_path\": \"%2\", \"autorename\": %3, \"allow_shared_folder\": false}")
+                                    .arg(path)
+                                    .arg(path)
+                                    .arg("false");
+        QByteArray postdata = json.toUtf8();
+    }
+    quint64 arg_allocations = allocation_count - before;
+
+    before = allocation_count;
+    {
+        QDropbox2JsonWriter json(path.size() * 2);
+        json.beginObject()
+                .value("from_path", path)
+                .value("to_path", path)
+                .value("autorename", false)
+                .value("allow_shared_folder", false)
+            .endObject();
+        QByteArray postdata = json.data();
+    }
+    quint64 writer_allocations = allocation_count - before;
+
+    qDebug() << "move request:" << arg_allocations << "allocations with QString::arg(),"
+             << writer_allocations << "with QDropbox2JsonWriter";
+    QCOMPARE(writer_allocations, quint64(1));
+
+    QBENCHMARK {
+        QDropbox2JsonWriter json(path.size() * 2);
+        json.beginObject()
+                .value("from_path", path)
+                .value("to_path", path)
+                .value("autorename", false)
+                .value("allow_shared_folder", false)
+            .endObject();
+    }
+}
+
+void QtDropbox2Test::metadataCache_benchmark()
+{
+    QDropbox2MetadataCache cache(1000, 1024*1024);
+    cache.addRoot("/Watched");
+
+    QList<QDropbox2Entry> page;
+    for(int i = 0;i < 1000;++i)
+    {
+        QDropbox2Entry entry;
+        entry.type  = QDropbox2Entry::File;
+        entry.path  = QString("/Watched/file_%1.txt").arg(i);
+        entry.rev   = QString("a1c10ce0dd%1").arg(i);
+        page.append(entry);
+    }
+    cache.apply(page);
+
+    QDropbox2Entry entry;
+    QBENCHMARK {
+        cache.lookup("/Watched/file_900.txt", entry);
+    }
+}
+
+void QtDropbox2Test::concurrentRequests_benchmark()
+{
+    // every request takes a round trip, so throughput should grow with the
+    // number of threads as long as they do not serialize on the shared object
+    StubServer server(20, StubAccount);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    const int iterations = 25;
+    double single_rate = 0.0;
+    for(int threads = 1;threads <= 8;threads *= 2)
+    {
+        QAtomicInt failures;
+        QThreadPool pool;
+        pool.setMaxThreadCount(threads);
+
+        QElapsedTimer timer;
+        timer.start();
+        for(int i = 0;i < threads;++i)
+            pool.start(new UserInfoTask(&api, iterations, &failures));
+        waitForPool(pool);
+        double rate = double(threads) * iterations / qMax(qint64(1), timer.elapsed()) * 1000.0;
+
+        QCOMPARE(failures.load(), 0);
+        if(threads == 1)
+            single_rate = rate;
+        qDebug() << threads << "threads:" << qRound64(rate) << "requests/s"
+                 << QString("(x%1)").arg(rate / single_rate, 0, 'f', 2).toUtf8().constData();
+        if(threads == 8)
+            QVERIFY(rate > 2.0 * single_rate);
+    }
+}
+
+void QtDropbox2Test::engineSubmission_benchmark()
+{
+    QDropbox2Engine engine(2);
+
+    // many producers, no lock on the submission path
+    const int producers = qMax(2, QThread::idealThreadCount());
+    const int per_producer = 50;
+    QAtomicInt finished;
+    QObject receiver;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(producers);
+    for(int i = 0;i < producers;++i)
+        pool.start(new SubmitTask(&engine, per_producer, &receiver, &finished));
+    pool.waitForDone();
+    qDebug() << producers * per_producer << "requests submitted from" << producers << "threads in"
+             << timer.elapsed() << "ms";
+
+    QTRY_COMPARE_WITH_TIMEOUT(finished.load(), producers * per_producer, 30000);
+    qDebug() << producers * per_producer << "requests from" << producers << "threads completed in"
+             << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::requestMetrics_benchmark()
+{
+    QSharedPointer<QDropbox2Metrics> metrics = QSharedPointer<QDropbox2Metrics>::create();
+    QAtomicInt observed;
+    metrics->setObserver([&observed](const QDropbox2Metrics::Sample&) { observed.ref(); });
+
+    QDropbox2Engine engine(2);
+    engine.setMetrics(metrics);
+
+    const int requests = 100;
+    QList<QDropbox2EngineReply*> replies;
+
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0;i < requests;++i)
+        replies.append(engine.post(QNetworkRequest(QUrl("http://127.0.0.1:9/2/files/get_metadata")), QByteArray("{}")));
+
+    QTRY_COMPARE_WITH_TIMEOUT(observed.load(), requests, 30000);
+    qDebug() << requests << "tracked requests completed in" << timer.elapsed() << "ms";
+
+    QTRY_VERIFY_WITH_TIMEOUT(std::all_of(replies.begin(), replies.end(),
+                                         [](QDropbox2EngineReply* r) { return r->isFinished(); }), 10000);
+    qDeleteAll(replies);
+}
+
+void QtDropbox2Test::traceExport_benchmark()
+{
+    // cost of recording from many threads at once
+    QDropbox2Tracer tracer;
+    const int per_thread = 10000;
+    const int threads = qMax(2, QThread::idealThreadCount());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for(int i = 0;i < threads;++i)
+        pool.start(new TraceTask(&tracer, per_thread));
+    pool.waitForDone();
+    qDebug() << tracer.count() << "events recorded from" << threads << "threads in" << timer.elapsed() << "ms";
+
+    timer.restart();
+    QByteArray trace = tracer.toChromeTrace();
+    qDebug() << "exported" << trace.size() << "bytes in" << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::fileRead_benchmark()
+{
+    QDropbox2File file("/benchmark.bin", nullptr);
+    QVERIFY(file.open(QIODevice::ReadWrite | QIODevice::Truncate));
+
+    const quint32 values = 1024 * 1024;
+    {
+        QDataStream out(&file);
+        for(quint32 i = 0;i < values;++i)
+            out << i;
+    }
+
+    // QDataStream-style small reads, each a single copy out of the buffer
+    file.reset();
+    QDataStream in(&file);
+
+    allocation_count = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    quint32 value = 0;
+    for(quint32 i = 0;i < values;++i)
+        in >> value;
+
+    qDebug() << values << "4-byte reads in" << timer.elapsed() << "ms," << allocation_count << "allocations";
+}
+
+void QtDropbox2Test::chunkedWrite_benchmark()
+{
+    // many small writes, as QTextStream makes them; none of them moves
+    // previously written content
+    QDropbox2File file("/benchmark.txt", nullptr);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+
+    const int lines = 2 * 1024 * 1024;
+    QElapsedTimer timer;
+    timer.start();
+    {
+        QTextStream out(&file);
+        for(int i = 0;i < lines;++i)
+            out << "line " << i << '\n';
+    }
+    qDebug() << file.pos() << "bytes written as" << lines << "lines in" << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::spillBuffer_benchmark()
+{
+    // sustained writing against a small budget
+    QDropbox2ChunkedBuffer large;
+    large.setMemoryBudget(8 * 1024 * 1024);
+    QByteArray line(4096, 'x');
+
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0;i < 16 * 1024;++i)
+        large.write(large.size(), line.constData(), line.size());
+    qDebug() << large.size() << "bytes written," << large.spilled() << "spilled, in" << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::contentHash_benchmark()
+{
+    // the hash stage must keep up with the network; measure its throughput
+    QByteArray large(64 * 1024 * 1024, 'x');
+    QDropbox2ContentHasher hasher;
+
+    QElapsedTimer timer;
+    timer.start();
+    hasher.addData(large);
+    hasher.result();
+    qint64 elapsed = qMax(qint64(1), timer.elapsed());
+    qDebug() << "content hash:" << (large.size() / 1024 / 1024) * 1000 / elapsed << "MB/s";
+}
+
+void QtDropbox2Test::chunkController_benchmark()
+{
+    // the goodput of each link in simulated time; see chunkController()
+    const qint64 total = qint64(2) * 1024 * 1024 * 1024;
+
+    for(const Link& link : Links)
+    {
+        QDropbox2ChunkController controller;
+
+        const double largest = simulateUpload(link, total, QDropbox2ChunkController::maximumChunkSize(), nullptr);
+        const double smallest = simulateUpload(link, total, QDropbox2ChunkController::Unit, nullptr);
+        const double adaptive = simulateUpload(link, total, 0, &controller);
+
+        qDebug() << link.name << ": fixed" << (QDropbox2ChunkController::maximumChunkSize() >> 20) << "MB" << largest
+                 << "MB/s, fixed 4 MB" << smallest << "MB/s, adaptive" << adaptive << "MB/s, settled on"
+                 << (controller.chunkSize() >> 20) << "MB";
+    }
+
+    // and of real uploads through a server emulating each link; smaller, as
+    // these take real time.  An upload that gives up reports no goodput
+    QByteArray content(64 * 1024 * 1024, 'x');
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString local = dir.path() + "/upload.bin";
+    QFile file(local);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(content);
+    file.close();
+
+    for(const Link& link : Links)
+    {
+        StubServer server(int(link.rtt), "{}");
+        server.answer("/2/files/upload_session/start", 200, "{\"session_id\": \"AAAAAAAAAZE\"}");
+        server.setLink(link.bandwidth, link.lossPerMB);
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+
+        QDropbox2 api("not-a-real-token");
+        api.setServerOverride(server.url());
+
+        double goodput[3];
+        qint64 settled = 0;
+        for(int i = 0;i < 3;++i)
+        {
+            QDropbox2Upload upload(local, "/upload.bin", &api);
+            if(i == 0)
+                upload.setChunkSize(QDropbox2ChunkController::maximumChunkSize());
+            else if(i == 1)
+                upload.setChunkSize(QDropbox2ChunkController::Unit);
+            goodput[i] = upload.upload() ? content.size() / (1024.0 * 1024.0) / (upload.elapsed() / 1000.0) : 0.0;
+            settled = upload.chunkController()->chunkSize();
+        }
+
+        qDebug() << link.name << "(stand-in server) : fixed" << (QDropbox2ChunkController::maximumChunkSize() >> 20)
+                 << "MB" << goodput[0] << "MB/s, fixed 4 MB" << goodput[1] << "MB/s, adaptive" << goodput[2]
+                 << "MB/s, settled on" << (settled >> 20) << "MB";
+    }
+}
+
+void QtDropbox2Test::transferQueue_benchmark()
+{
+    QDropbox2 api("not-a-real-token");
+    QDropbox2TransferManager manager(&api);
+
+    // queueing is cheap; nothing starts until control returns to the event loop
+    const int count = 20000;
+
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0;i < count;++i)
+        manager.download(QString("/file%1").arg(i), QString("file%1").arg(i), i % 4, (i % 100) ? 1024 : 64 * 1024 * 1024);
+    qDebug() << count << "downloads queued in" << timer.elapsed() << "ms";
+
+    timer.restart();
+    manager.slot_abort();
+    qDebug() << count << "downloads cancelled in" << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::syncReconcile_benchmark()
+{
+    // a synchronized tree of 1000 folders of 100 files each; time is spent in
+    // reconciling the changes and keeping the state
+    QDropbox2Sync::RecordMap records;
+    QDropbox2Sync::LocalChanges local;
+    QDropbox2Sync::RemoteChanges remote;
+    makeSyncChanges(1000, 100, records, local, remote);
+
+    QElapsedTimer timer;
+    timer.start();
+    QList<QDropbox2Sync::Action> actions = QDropbox2Sync::reconcile(records, local, remote);
+    qDebug() << "reconciled" << local.count() << "local and" << remote.count() << "remote changes against"
+             << records.count() << "paths in" << timer.elapsed() << "ms";
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString state = dir.path() + "/" + QDropbox2Sync::stateFileName();
+
+    timer.restart();
+    QVERIFY(QDropbox2Sync::saveState(state, "/Sync", "cursor", records));
+    qDebug() << "saved" << records.count() << "records in" << timer.elapsed() << "ms," << QFileInfo(state).size() << "bytes";
+
+    QString cursor;
+    QDropbox2Sync::RecordMap loaded;
+    timer.restart();
+    QVERIFY(QDropbox2Sync::loadState(state, "/sync", cursor, loaded));
+    qDebug() << "loaded" << loaded.count() << "records in" << timer.elapsed() << "ms";
+
+    // a local tree: the first scan hashes every file, a rescan none of them
+    const QString root = dir.path() + "/tree";
+    QVERIFY(makeLocalTree(root, 2000));
+
+    QDropbox2Sync::RecordMap synced;
+    QDropbox2Sync::LocalChanges scanned;
+
+    timer.restart();
+    QDropbox2Sync::scanLocal(root, QString(), true, synced, scanned);
+    qDebug() << "scanned and hashed" << scanned.count() << "paths in" << timer.elapsed() << "ms";
+
+    actions = QDropbox2Sync::reconcile(synced, scanned, QDropbox2Sync::RemoteChanges());
+    foreach(const QDropbox2Sync::Action& action, actions)
+        synced.insert(action.key, action.record);
+
+    scanned.clear();
+    timer.restart();
+    QDropbox2Sync::scanLocal(root, QString(), true, synced, scanned);
+    qDebug() << "rescanned" << synced.count() << "paths in" << timer.elapsed() << "ms";
+
+    // whole passes over a tree of 100k files, against a stand-in server that
+    // has every other one of them already; see syncReconcile()
+    const int count = 100000;
+    const QString large = dir.path() + "/large";
+    QVERIFY(makeLocalTree(large, count));
+
+    StubServer server(0, "{}");
+    server.answer("/2/files/list_folder", 200, localTreeListing(count, 2, 0));
+    server.answer("/2/files/list_folder/continue", 200, "{\"entries\": [], \"cursor\": \"c2\", \"has_more\": false}");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QDropbox2 api("not-a-real-token");
+    api.setServerOverride(server.url());
+
+    QDropbox2Sync sync(large, "/Sync", &api);
+    timer.restart();
+    QVERIFY(sync.synchronize());
+    qDebug() << "first pass over" << count << "files, uploading" << server.requests("/2/files/upload")
+             << "of them, in" << timer.elapsed() << "ms";
+
+    timer.restart();
+    QVERIFY(sync.synchronize());
+    qDebug() << "next pass, with nothing to do, in" << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::snapshotDiff_benchmark()
+{
+    // a million files in ten thousand folders
+    const int count = 1000000;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QDropbox2Snapshot remote;
+    QDropbox2Snapshot local;
+    makeSnapshots(count, remote, local);
+    qDebug() << "built two snapshots of" << count << "entries in" << timer.elapsed() << "ms";
+
+    timer.restart();
+    remote.sort();
+    local.sort();
+    qDebug() << "sorted in" << timer.elapsed() << "ms;" << remote.memoryUsage() / count << "bytes per entry";
+
+    timer.restart();
+    QDropbox2Snapshot::Diff diff = QDropbox2Snapshot::diff(remote, local);
+    qDebug() << "diffed in" << timer.elapsed() << "ms;" << diff.added.count() + diff.modified.count() + diff.deleted.count()
+             << "differences";
+
+    // lookups are case-insensitive binary searches
+    timer.restart();
+    int found = 0;
+    for(int i = 0;i < count;i += 10)
+        found += remote.indexOf(snapshotPath(i).toUpper()) >= 0;
+    qDebug() << found << "lookups in" << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::pathTable_benchmark()
+{
+    // two million files
+    const int count = 2000000;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QDropbox2PathTable table;
+    QVector<QDropbox2PathTable::Id> ids(count);
+    qint64 plain = 0;
+    for(int i = 0;i < count;++i)
+    {
+        const QString path = archivePath(i);
+        ids[i] = table.insert(path);
+        plain += 2 * (path.size() * qint64(sizeof(QChar)) + 24);
+    }
+    const qint64 interned = table.memoryUsage() + count * qint64(sizeof(QDropbox2PathTable::Id));
+    qDebug() << "interned" << count << "paths in" << timer.elapsed() << "ms;"
+             << interned / count << "bytes per path, against" << plain / count << "as strings";
+
+    timer.restart();
+    int found = 0;
+    for(int i = 0;i < count;i += 10)
+        found += table.find(archivePath(i).toUpper()) == ids[i];
+    qDebug() << found << "lookups in" << timer.elapsed() << "ms";
+
+    timer.restart();
+    for(int i = 0;i < count;++i)
+        table.release(ids[i]);
+    qDebug() << "released in" << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::timestamp_benchmark()
+{
+    // the timestamps of a million-entry listing
+    const int count = 1000000;
+    const QVector<QString> stamps = makeTimestamps(count);
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 sum = 0;
+    for(int i = 0;i < count;++i)
+    {
+        QDateTime parsed = QLocale(QLocale::English).toDateTime(stamps[i], "yyyy-MM-ddTHH:mm:ssZ");
+        parsed.setTimeSpec(Qt::UTC);
+        sum += parsed.toMSecsSinceEpoch();
+    }
+    qDebug() << "QLocale parsed" << count << "timestamps in" << timer.elapsed() << "ms";
+
+    timer.restart();
+    qint64 fast = 0;
+    for(int i = 0;i < count;++i)
+    {
+        qint64 msecs = 0;
+        QDropbox2EntityInfo::parseTimestamp(stamps[i], msecs);
+        fast += msecs;
+    }
+    qDebug() << "parseTimestamp parsed" << count << "timestamps in" << timer.elapsed() << "ms";
+    QCOMPARE(fast, sum);
+}
+
+void QtDropbox2Test::zipReader_benchmark()
+{
+    // a download_zip response for a folder of 30k small files
+    const int count = 30000;
+    qint64 total = 0;
+    const QByteArray archive = makeZipArchive(count, total);
+
+    QElapsedTimer timer;
+    timer.start();
+    int entries = 0;
+    qint64 received = 0;
+    QVERIFY(readZipArchive(archive, entries, received));
+    qDebug() << "decoded" << entries << "entries," << archive.size() << "bytes into" << received << "in" << timer.elapsed() << "ms";
+}
+
+void QtDropbox2Test::thumbnails_benchmark()
+{
+    // 10k thumbnails of about 20 KB, in get_thumbnail_batch responses of 25
+    const int batches = 400;
+
+    QList<QByteArray> responses;
+    for(int b = 0;b < batches;++b)
+        responses.append(thumbnailResponse(b));
+
+    QElapsedTimer timer;
+    timer.start();
+    for(int b = 0;b < batches;++b)
+    {
+        QVector<QDropbox2Thumbnails::Result> results;
+        QVERIFY(QDropbox2Thumbnails::decodeBatch(responses[b], results));
+    }
+    qDebug() << "decoded" << batches * QDropbox2Thumbnails::BatchSize << "thumbnails in" << timer.elapsed() << "ms";
+}
+#endif      // QDROPBOX2_BENCHMARKS
+
 QTEST_MAIN(QtDropbox2Test)
@@ -9,6 +9,22 @@
 #include "qdropbox2.h"
 #include "qdropbox2file.h"
 #include "qdropbox2folder.h"
+#include "qdropbox2json.h"
+#include "qdropbox2contentcache.h"
+#include "qdropbox2metadatacache.h"
+#include "qdropbox2linkcache.h"
+#include "qdropbox2engine.h"
+#include "qdropbox2metrics.h"
+#include "qdropbox2tracer.h"
+#include "qdropbox2upload.h"
+#include "qdropbox2chunkcontroller.h"
+#include "qdropbox2transfermanager.h"
+#include "qdropbox2sync.h"
+#include "qdropbox2mirror.h"
+#include "qdropbox2snapshot.h"
+#include "qdropbox2pathtable.h"
+#include "qdropbox2zipreader.h"
+#include "qdropbox2thumbnails.h"
 #include "config.h"
 
 class QtDropbox2Test : public QObject
@@ -47,13 +63,68 @@ private Q_SLOTS:
     void uploadFile();
     void copyFile();
     void moveFile();
+    void serverSideCopy();
     void getRevisions();
     void getLink();
     void search();
+    void searchPages();
     void downloadFile();
+    void downloadFileCached();
     void removeFile();
 #endif
 
+    // these need no account, and always run
+    void jsonWriter();
+    void metadataCache();
+    void linkCache();
+    void threadErrors();
+    void concurrentRequests();
+    void engineSubmission();
+    void requestMetrics();
+    void traceExport();
+    void fileRead();
+    void chunkedWrite();
+    void spillBuffer();
+    void streamFailure();
+    void contentHash();
+    void uploadPipeline();
+    void chunkController();
+    void transferQueue();
+    void transferScheduling();
+    void syncReconcile();
+    void mirrorRun();
+    void snapshotDiff();
+    void pathTable();
+    void timestamp();
+    void largeSizes();
+    void zipReader();
+    void thumbnails();
+    void thumbnailScheduling();
+    void saveUrlJobs();
+    void searchCursors();
+
+#if defined(QDROPBOX2_BENCHMARKS)
+    void responseParse_benchmark();
+    void jsonWriter_benchmark();
+    void metadataCache_benchmark();
+    void concurrentRequests_benchmark();
+    void engineSubmission_benchmark();
+    void requestMetrics_benchmark();
+    void traceExport_benchmark();
+    void fileRead_benchmark();
+    void chunkedWrite_benchmark();
+    void spillBuffer_benchmark();
+    void contentHash_benchmark();
+    void chunkController_benchmark();
+    void transferQueue_benchmark();
+    void syncReconcile_benchmark();
+    void snapshotDiff_benchmark();
+    void pathTable_benchmark();
+    void timestamp_benchmark();
+    void zipReader_benchmark();
+    void thumbnails_benchmark();
+#endif
+
 private:        // data members
 #if defined(QDROPBOX2_ACCOUNT_TESTS) || defined(QDROPBOX2_FOLDER_TESTS) || defined(QDROPBOX2_FILE_TESTS)
     QDropbox2*  db2;